@@ -41,7 +41,8 @@ g._set_json_attr('dotgraph_output', '/tmp/workspace/before.dot')
 g.apply('DotGraph')
 
 print('\n\nParallelizing')
-g = g.apply('Parallelize')
+g._set_json_attr('num_partitions', 2, 'int')
+g = g.apply(['Parallelize', 'EliminateMerge'])
 
 print('\n\nAfter')
 g._set_json_attr('dotgraph_output', '/tmp/workspace/after.dot')
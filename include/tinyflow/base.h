@@ -13,6 +13,7 @@
 #include <nnvm/symbolic.h>
 #include <vector>
 #include <string>
+#include <functional>
 
 namespace tinyflow {
 
@@ -76,6 +77,50 @@ using FLuaCompute = std::string;
  */
 using FLuaCreateNNModule = std::string;
 
+/*!
+ * \brief a native C++ function to carry out computation of an op on CPU.
+ *
+ *  Signature:
+ *  function(attrs, inputs, outputs)
+ *  - attrs: attributes of the node, attrs.dict holds the kwargs.
+ *  - inputs: array of input TBlob.
+ *  - outputs: array of output TBlob, the space is already allocated.
+ *
+ *  After this function, outputs content are set to be correct value.
+ *  This function cannot change the storage of inputs and outputs.
+ * \note Register as FCompute
+ *  used by the native session, which do not go through lua.
+ */
+using FCompute = std::function<void(const nnvm::NodeAttrs& attrs,
+                                    const std::vector<TBlob>& inputs,
+                                    const std::vector<TBlob>& outputs)>;
+
+/*!
+ * \brief native backward of an op whose gradient is the generic _backward node.
+ *  Same signature as FCompute, attrs are the attributes of the forward node,
+ *  inputs/outputs are the ones of the _backward node.
+ * \note Register as FComputeBackward on the forward op.
+ */
+using FComputeBackward = FCompute;
+
+/*!
+ * \brief create the native kernel of a node once the shapes are known.
+ *  Called at executor setup, lets the op pick an algorithm for the shapes,
+ *  e.g. the convolution algorithm. Takes precedence over FCompute.
+ *
+ *  Signature:
+ *  function(attrs, ishape, oshape) -> FCompute
+ *  - ishape: shape of each input.
+ *  - oshape: shape of each output.
+ * \note Register as FCreateCompute.
+ *  FCreateComputeBackward is the counterpart of FComputeBackward, registered
+ *  on the forward op and called with the shapes of the _backward node.
+ */
+using FCreateCompute = std::function<FCompute(const nnvm::NodeAttrs& attrs,
+                                              const std::vector<TShape>& ishape,
+                                              const std::vector<TShape>& oshape)>;
+using FCreateComputeBackward = FCreateCompute;
+
 /*!
  * \brief If registered and TBackwardNumNoGrad=k
  *  The last k inputs do not have gradient.
@@ -95,6 +140,53 @@ using TBackwardNeedInputs = bool;
  */
 using TBackwardNeedOutputs = bool;
 
+/*! \brief statistics of the executor cache in a session */
+struct ExecCacheStats {
+  /*! \brief number of runs that reuse a cached executor */
+  uint64_t num_hit{0};
+  /*! \brief number of runs that create a new executor */
+  uint64_t num_miss{0};
+  /*! \brief number of executors evicted from the cache */
+  uint64_t num_evict{0};
+};
+
+/*! \brief statistics of the storage arena shared by the executors of a session */
+struct StorageStats {
+  /*! \brief number of storages allocated */
+  uint64_t num_alloc{0};
+  /*! \brief number of storages recycled from a previous setup or executor */
+  uint64_t num_reuse{0};
+  /*! \brief total bytes allocated, in use or cached */
+  uint64_t bytes_allocated{0};
+  /*! \brief bytes of the free storages kept for reuse */
+  uint64_t bytes_cached{0};
+};
+
+/*!
+ * \brief a graph with fixed fetches and feeds, bound once by Session::MakeCallable.
+ *  Runs take the feeds by position, in the order given at creation,
+ *  without looking up the graph or the placeholder names again.
+ */
+class Callable {
+ public:
+  /*!
+   * \brief Run the bound graph
+   * \param feeds The value of each feed, in the order of the feed names.
+   * \note Same as Session::Run, the results are only valid before the next run.
+   * \return The output tensors.
+   */
+  virtual const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds) = 0;
+  /*!
+   * \brief Run the bound graph, write the results into caller provided space.
+   * \param feeds The value of each feed, in the order of the feed names.
+   * \param outputs The space of each output, on CPU with the exact output shape.
+   */
+  virtual void RunInto(const std::vector<TBlob>& feeds,
+                       const std::vector<TBlob>& outputs) = 0;
+  /*! \brief virtual destructor */
+  virtual ~Callable() {}
+};
+
 /*! \brief Executor of a graph */
 class Session {
  public:
@@ -109,10 +201,67 @@ class Session {
   virtual const std::vector<TBlob>& Run(
       Symbol* g,
       const std::unordered_map<std::string, TBlob>& inputs) = 0;
+  /*!
+   * \brief Run the given graph, write the results into caller provided space.
+   * \param g the graph to run.
+   * \param inputs The input feed_dict mapping
+   * \param outputs The space of each output, on CPU with the exact output shape.
+   */
+  virtual void RunInto(
+      Symbol* g,
+      const std::unordered_map<std::string, TBlob>& inputs,
+      const std::vector<TBlob>& outputs);
+  /*!
+   * \brief Start running the given graph, return without waiting for the results.
+   *  The feeds are copied before return, the caller can reuse its buffers.
+   * \param g the graph to run.
+   * \param inputs The input feed_dict mapping
+   * \note Only supported by sessions created with the async option.
+   * \return id of the run, to be passed to Wait.
+   */
+  virtual uint64_t RunAsync(
+      Symbol* g,
+      const std::unordered_map<std::string, TBlob>& inputs);
+  /*!
+   * \brief Wait for a run started by RunAsync.
+   * \param run_id the id returned by RunAsync.
+   * \note The results are kept until the slot of the run is reused by a later RunAsync.
+   * \return The output tensors.
+   */
+  virtual const std::vector<TBlob>& Wait(uint64_t run_id);
+  /*!
+   * \brief Bind the graph and the feeds for repeated runs.
+   * \param g the graph to run.
+   * \param feed_names names of the placeholders, the order of feeds in Callable::Run.
+   * \note The callable uses the states of this session, and must be freed before it.
+   * \return a new created callable.
+   */
+  virtual Callable* MakeCallable(
+      Symbol* g,
+      const std::vector<std::string>& feed_names);
+  /*!
+   * \brief Dump the operator profile recorded since last dump.
+   * \param trace_file file to write the chrome trace-event timeline, empty to skip.
+   * \note Only supported by sessions created with the profile option.
+   * \return json list of per op statistics, sorted by total time.
+   */
+  virtual std::string DumpProfile(const std::string& trace_file);
+  /*! \return statistics of the executor cache */
+  virtual ExecCacheStats GetCacheStats() const {
+    return ExecCacheStats();
+  }
+  /*! \return statistics of the storage arena */
+  virtual StorageStats GetStorageStats() const {
+    return StorageStats();
+  }
   /*! \brief virtual destructor */
   virtual ~Session() {}
   /*!
    * \brief create a new session of given type.
+   *  The type is a list of flags and key=value options, e.g. "cpu exec_cache=4".
+   *  - exec_cache: number of executors cached by the session.
+   *  - async: run on a background thread, enables RunAsync.
+   *  - profile: record the time of each op, see DumpProfile.
    * \param type The type of the session.
    * \return a new created session.
    */
@@ -9,6 +9,7 @@
 #include <nnvm/c_api.h>
 
 typedef void* SessionHandle;
+typedef void* CallableHandle;
 
 NNVM_DLL int NNSessionCreate(SessionHandle* handle, const char* option);
 
@@ -28,4 +29,135 @@ NNVM_DLL int NNSessionRun(SessionHandle handle,
                           const nn_uint **out_shape_ndim,
                           const nn_uint ***out_shape_data);
 
+/*!
+ * \brief run the graph and write the outputs into caller provided space,
+ *  the feed arguments are the same as NNSessionRun.
+ * \param num_out number of outputs, must match the graph.
+ * \param out_dptr space of each output, contiguous float on CPU.
+ * \param out_shape_csr_ptr offset of each output shape in out_shape_data.
+ * \param out_shape_data shape of the outputs, must match the results.
+ */
+NNVM_DLL int NNSessionRunInto(SessionHandle handle,
+                              SymbolHandle graph,
+                              nn_uint num_feed,
+                              const SymbolHandle* feed_placeholders,
+                              const float** feed_dptr,
+                              const nn_uint* feed_dtype,
+                              const nn_uint* feed_shape_csr_ptr,
+                              const nn_uint* feed_shape_data,
+                              nn_uint num_out,
+                              float** out_dptr,
+                              const nn_uint* out_shape_csr_ptr,
+                              const nn_uint* out_shape_data);
+
+/*!
+ * \brief start running the graph without waiting for the results,
+ *  the feed arguments are the same as NNSessionRun and are copied before return.
+ *  Only supported by session created with the async option.
+ * \param run_id the id of the run, to be passed to NNSessionWait.
+ */
+NNVM_DLL int NNSessionRunAsync(SessionHandle handle,
+                               SymbolHandle graph,
+                               nn_uint num_feed,
+                               const SymbolHandle* feed_placeholders,
+                               const float** feed_dptr,
+                               const nn_uint* feed_dtype,
+                               const nn_uint* feed_shape_csr_ptr,
+                               const nn_uint* feed_shape_data,
+                               uint64_t* run_id);
+
+/*!
+ * \brief wait for a run started by NNSessionRunAsync,
+ *  the outputs are returned the same way as NNSessionRun.
+ */
+NNVM_DLL int NNSessionWait(SessionHandle handle,
+                           uint64_t run_id,
+                           nn_uint* num_out,
+                           const float*** out_dptr,
+                           const nn_uint** out_dtype,
+                           const nn_uint **out_shape_ndim,
+                           const nn_uint ***out_shape_data);
+
+/*!
+ * \brief dump the operator profile recorded since last dump,
+ *  only supported by session created with the profile option.
+ * \param handle the session handle.
+ * \param trace_file file to write the chrome trace-event timeline, can be NULL.
+ * \param out_summary json list of per op statistics, valid until next API call.
+ */
+NNVM_DLL int NNSessionDumpProfile(SessionHandle handle,
+                                  const char* trace_file,
+                                  const char** out_summary);
+
+/*!
+ * \brief get the statistics of the executor cache of the session.
+ * \param handle the session handle.
+ * \param num_hit number of runs that reuse a cached executor.
+ * \param num_miss number of runs that create a new executor.
+ * \param num_evict number of executors evicted from the cache.
+ */
+NNVM_DLL int NNSessionGetCacheStats(SessionHandle handle,
+                                    uint64_t* num_hit,
+                                    uint64_t* num_miss,
+                                    uint64_t* num_evict);
+
+/*!
+ * \brief get the statistics of the storage arena of the session.
+ * \param handle the session handle.
+ * \param num_alloc number of storages allocated.
+ * \param num_reuse number of storages recycled from a previous setup or executor.
+ * \param bytes_allocated total bytes allocated, in use or cached.
+ * \param bytes_cached bytes of the free storages kept for reuse.
+ */
+NNVM_DLL int NNSessionGetStorageStats(SessionHandle handle,
+                                      uint64_t* num_alloc,
+                                      uint64_t* num_reuse,
+                                      uint64_t* bytes_allocated,
+                                      uint64_t* bytes_cached);
+
+/*!
+ * \brief bind the graph and the feed placeholders for repeated runs.
+ * \param handle the session handle.
+ * \param graph the graph to run.
+ * \param num_feed number of feeds.
+ * \param feed_placeholders the placeholders, the order of feeds in NNCallableRun.
+ * \param out the created callable, freed by NNCallableFree before the session closes.
+ */
+NNVM_DLL int NNSessionMakeCallable(SessionHandle handle,
+                                   SymbolHandle graph,
+                                   nn_uint num_feed,
+                                   const SymbolHandle* feed_placeholders,
+                                   CallableHandle* out);
+
+NNVM_DLL int NNCallableFree(CallableHandle handle);
+
+/*!
+ * \brief run the callable, the feeds are given in the bound order,
+ *  the outputs are returned the same way as NNSessionRun.
+ */
+NNVM_DLL int NNCallableRun(CallableHandle handle,
+                           nn_uint num_feed,
+                           const float** feed_dptr,
+                           const nn_uint* feed_shape_csr_ptr,
+                           const nn_uint* feed_shape_data,
+                           nn_uint* num_out,
+                           const float*** out_dptr,
+                           const nn_uint** out_dtype,
+                           const nn_uint **out_shape_ndim,
+                           const nn_uint ***out_shape_data);
+
+/*!
+ * \brief run the callable and write the outputs into caller provided space,
+ *  the output arguments are the same as NNSessionRunInto.
+ */
+NNVM_DLL int NNCallableRunInto(CallableHandle handle,
+                               nn_uint num_feed,
+                               const float** feed_dptr,
+                               const nn_uint* feed_shape_csr_ptr,
+                               const nn_uint* feed_shape_data,
+                               nn_uint num_out,
+                               float** out_dptr,
+                               const nn_uint* out_shape_csr_ptr,
+                               const nn_uint* out_shape_data);
+
 #endif  // TINYFLOW_C_API_H_
@@ -10,4 +10,4 @@ from ._ops import *
 
 from ._session import Session
 
-from ._util import infer_variable_shapes
+from ._util import infer_variable_shapes, parallelize
@@ -36,6 +36,9 @@ float32 = 0
 # global list of all variable initializers
 _all_variable_inits = []
 
+# initialization expression of each variable by name, which gives its shape.
+_variable_init_exprs = {}
+
 
 def Variable(init=None, name=None):
     name = NameManager.current.get(name, 'variable')
@@ -44,6 +47,7 @@ def Variable(init=None, name=None):
         if not isinstance(init, symbol.Symbol):
             raise TypeError("Expect initialization expression to be Symbol")
         _all_variable_inits.append(symbol.assign(v, init))
+        _variable_init_exprs[v.attr("name")] = init
     return v
 
 
@@ -55,8 +59,10 @@ def initialize_all_variables():
 
 
 def placeholder(dtype, shape=None, name=None):
-    v = symbol.placeholder(name=name, dtype=dtype)
-    return v
+    if shape is None:
+        return symbol.placeholder(name=name, dtype=dtype)
+    # a leading None marks the batch, which replicas cut.
+    return symbol.placeholder(name=name, dtype=dtype, shape=list(shape))
 
 
 def group(*inputs, **kwargs):
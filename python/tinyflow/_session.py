@@ -1,10 +1,12 @@
 from __future__ import absolute_import as _abs
 import ctypes as _ctypes
+import json
 import numpy as np
 from nnvm import symbol
 from nnvm._base import c_str, check_call, _LIB, c_array, nn_uint
 
 SessionHandle = _ctypes.c_void_p
+CallableHandle = _ctypes.c_void_p
 nn_float = _ctypes.c_float
 
 def _get_numpy(cptr, dtype, shape):
@@ -19,6 +21,154 @@ def _get_numpy(cptr, dtype, shape):
     else:
         return None
 
+def _out_arrays(out):
+    """Pack the pre-allocated output arrays into C arguments."""
+    out_list = out if isinstance(out, (list, tuple)) else [out]
+    out_dptr = []
+    out_shape_csr_ptr = [0]
+    out_shape_data = []
+    for arr in out_list:
+        if (not isinstance(arr, np.ndarray) or arr.dtype != np.float32
+                or not arr.flags['C_CONTIGUOUS'] or not arr.flags['WRITEABLE']):
+            raise ValueError("out must be writeable C contiguous float32 arrays")
+        out_dptr.append(arr.ctypes.data_as(_ctypes.c_void_p))
+        out_shape_data.extend(arr.shape)
+        out_shape_csr_ptr.append(len(out_shape_data))
+    return (nn_uint(len(out_list)),
+            c_array(_ctypes.c_void_p, out_dptr),
+            c_array(nn_uint, out_shape_csr_ptr),
+            c_array(nn_uint, out_shape_data))
+
+
+def _feed_arrays(feed_dict):
+    """Pack the feed dict into C arguments.
+
+    Returns the converted arrays, which must be kept alive during the call,
+    and the arguments.
+    """
+    feed_placeholders = []
+    feed_dptr = []
+    feed_dtype = []
+    feed_shape_csr_ptr = [0]
+    feed_shape_data = []
+    src_list = []
+
+    for k, v in feed_dict.items():
+        assert isinstance(k, symbol.Symbol)
+        assert isinstance(v, np.ndarray)
+        feed_placeholders.append(k.handle)
+        # only convert to float32 for now
+        source_array = np.ascontiguousarray(v, dtype=np.float32)
+        # leep src_list alive for the period
+        src_list.append(source_array)
+        feed_dptr.append(source_array.ctypes.data_as(_ctypes.c_void_p))
+        feed_dtype.append(0)
+        feed_shape_data.extend(source_array.shape)
+        feed_shape_csr_ptr.append(len(feed_shape_data))
+    return src_list, (nn_uint(len(src_list)),
+                      c_array(_ctypes.c_void_p, feed_placeholders),
+                      c_array(_ctypes.c_void_p, feed_dptr),
+                      c_array(nn_uint, feed_dtype),
+                      c_array(nn_uint, feed_shape_csr_ptr),
+                      c_array(nn_uint, feed_shape_data))
+
+
+def _get_outputs(fcall):
+    """Call fcall with the output arguments, and convert the returned outputs."""
+    out_size = nn_uint()
+    out_dptr = _ctypes.POINTER(_ctypes.POINTER(nn_float))()
+    out_dtype = _ctypes.POINTER(nn_uint)()
+    out_shape_ndim = _ctypes.POINTER(nn_uint)()
+    out_shape_data = _ctypes.POINTER(_ctypes.POINTER(nn_uint))()
+    check_call(fcall(_ctypes.byref(out_size),
+                     _ctypes.byref(out_dptr),
+                     _ctypes.byref(out_dtype),
+                     _ctypes.byref(out_shape_ndim),
+                     _ctypes.byref(out_shape_data)))
+    ret = []
+    for i in range(out_size.value):
+        shape = tuple(out_shape_data[i][:out_shape_ndim[i]])
+        ret.append(_get_numpy(out_dptr[i], out_dtype[i], shape))
+    return ret[0] if len(ret) == 1 else ret
+
+
+class Callable(object):
+    """A graph bound with its feeds, created by Session.make_callable."""
+    def __init__(self, sess, fetch, feeds):
+        handle = CallableHandle()
+        check_call(_LIB.NNSessionMakeCallable(
+            sess.handle, fetch.handle, nn_uint(len(feeds)),
+            c_array(_ctypes.c_void_p, [x.handle for x in feeds]),
+            _ctypes.byref(handle)))
+        self.handle = handle
+        # the callable uses the session and the graph, keep them alive.
+        self._sess = sess
+        self._fetch = fetch
+        self._num_feed = len(feeds)
+
+    def __del__(self):
+        check_call(_LIB.NNCallableFree(self.handle))
+
+    def __call__(self, *args, **kwargs):
+        """Run the bound graph.
+
+        Parameters
+        ----------
+        *args : numpy.ndarray
+            The values of the feeds, in the order given to make_callable.
+        out : numpy.ndarray or list of numpy.ndarray, optional
+            Pre-allocated outputs, same as Session.run.
+
+        Returns
+        -------
+        result : numpy.ndarray or list of numpy.ndarray
+            The results, which are the arrays in out when provided.
+        """
+        if len(args) != self._num_feed:
+            raise ValueError("expect %d feeds, got %d" % (self._num_feed, len(args)))
+        feed_dptr = []
+        feed_shape_csr_ptr = [0]
+        feed_shape_data = []
+        src_list = []
+        for v in args:
+            source_array = np.ascontiguousarray(v, dtype=np.float32)
+            src_list.append(source_array)
+            feed_dptr.append(source_array.ctypes.data_as(_ctypes.c_void_p))
+            feed_shape_data.extend(source_array.shape)
+            feed_shape_csr_ptr.append(len(feed_shape_data))
+        feed_args = (nn_uint(len(src_list)),
+                     c_array(_ctypes.c_void_p, feed_dptr),
+                     c_array(nn_uint, feed_shape_csr_ptr),
+                     c_array(nn_uint, feed_shape_data))
+        out = kwargs.get('out', None)
+        if out is not None:
+            check_call(_LIB.NNCallableRunInto(
+                self.handle, *(feed_args + _out_arrays(out))))
+            return out
+
+        return _get_outputs(
+            lambda *out_args: _LIB.NNCallableRun(self.handle, *(feed_args + out_args)))
+
+
+class RunFuture(object):
+    """A run started by Session.run_async."""
+    def __init__(self, sess, run_id):
+        self._sess = sess
+        self.run_id = run_id
+
+    def wait(self):
+        """Wait for the run to finish.
+
+        Returns
+        -------
+        result : numpy.ndarray or list of numpy.ndarray
+            The results, same as Session.run.
+        """
+        return _get_outputs(
+            lambda *out_args: _LIB.NNSessionWait(
+                self._sess.handle, _ctypes.c_uint64(self.run_id), *out_args))
+
+
 class Session(object):
     def __init__(self, config='cpu'):
         handle = SessionHandle()
@@ -28,50 +178,148 @@ class Session(object):
     def __del__(self):
         check_call(_LIB.NNSessionClose(self.handle))
 
-    def run(self, fetch, feed_dict=None):
+    def cache_stats(self):
+        """Get the statistics of the executor cache.
+
+        Returns
+        -------
+        stats : dict
+            number of hit, miss and evict of the cache.
+        """
+        num_hit = _ctypes.c_uint64()
+        num_miss = _ctypes.c_uint64()
+        num_evict = _ctypes.c_uint64()
+        check_call(_LIB.NNSessionGetCacheStats(
+            self.handle, _ctypes.byref(num_hit),
+            _ctypes.byref(num_miss), _ctypes.byref(num_evict)))
+        return {'hit': num_hit.value, 'miss': num_miss.value,
+                'evict': num_evict.value}
+
+    def storage_stats(self):
+        """Get the statistics of the storage arena shared by the executors.
+
+        Returns
+        -------
+        stats : dict
+            number of storages allocated and reused, bytes allocated
+            and bytes cached for reuse.
+        """
+        num_alloc = _ctypes.c_uint64()
+        num_reuse = _ctypes.c_uint64()
+        bytes_allocated = _ctypes.c_uint64()
+        bytes_cached = _ctypes.c_uint64()
+        check_call(_LIB.NNSessionGetStorageStats(
+            self.handle, _ctypes.byref(num_alloc), _ctypes.byref(num_reuse),
+            _ctypes.byref(bytes_allocated), _ctypes.byref(bytes_cached)))
+        return {'alloc': num_alloc.value, 'reuse': num_reuse.value,
+                'bytes_allocated': bytes_allocated.value,
+                'bytes_cached': bytes_cached.value}
+
+    def dump_profile(self, trace_file=None):
+        """Dump the operator profile recorded since last dump.
+
+        Needs a session created with the profile option, e.g. Session('cpu profile').
+
+        Parameters
+        ----------
+        trace_file : str, optional
+            Write the timeline in chrome trace-event format to this file,
+            which can be opened in chrome://tracing.
+
+        Returns
+        -------
+        summary : list of dict
+            Statistics of each op type, with count, total_us, max_us,
+            bytes_read and bytes_written, sorted by total time.
+        """
+        summary = _ctypes.c_char_p()
+        check_call(_LIB.NNSessionDumpProfile(
+            self.handle, c_str(trace_file) if trace_file else None,
+            _ctypes.byref(summary)))
+        return json.loads(summary.value.decode('utf-8'))
+
+    def run(self, fetch, feed_dict=None, out=None):
+        """Run the fetch graph.
+
+        Parameters
+        ----------
+        fetch : Symbol or list of Symbol
+            The outputs to be computed.
+        feed_dict : dict of Symbol to numpy.ndarray
+            The values of placeholders.
+        out : numpy.ndarray or list of numpy.ndarray, optional
+            Pre-allocated C contiguous float32 arrays with the exact output
+            shapes, the results are written into them without extra copy.
+
+        Returns
+        -------
+        result : numpy.ndarray or list of numpy.ndarray
+            The results, which are the arrays in out when provided.
+        """
         if isinstance(fetch, list):
             fetch = symbol.Group(fetch)
         feed_dict = feed_dict if feed_dict else {}
-        feed_placeholders = []
-        feed_dptr = []
-        feed_dtype = []
-        feed_shape_csr_ptr = [0]
-        feed_shape_data = []
-        src_list = []
+        src_list, feed_args = _feed_arrays(feed_dict)
+
+        if out is not None:
+            check_call(_LIB.NNSessionRunInto(
+                self.handle, fetch.handle, *(feed_args + _out_arrays(out))))
+            return out
+
+        return _get_outputs(
+            lambda *out_args: _LIB.NNSessionRun(
+                self.handle, fetch.handle, *(feed_args + out_args)))
+
+    def run_async(self, fetch, feed_dict=None):
+        """Start running the fetch graph, return without waiting for the results.
+
+        The feeds are copied before return, so the next batch can be
+        prepared while this run computes. Needs a session created with
+        the async option, e.g. Session('cpu async').
 
-        for k, v in feed_dict.items():
+        Parameters
+        ----------
+        fetch : Symbol or list of Symbol
+            The outputs to be computed.
+        feed_dict : dict of Symbol to numpy.ndarray
+            The values of placeholders.
+
+        Returns
+        -------
+        future : RunFuture
+            Call wait() on it to get the results. Only the last two runs
+            started can be waited.
+        """
+        if isinstance(fetch, list):
+            fetch = symbol.Group(fetch)
+        feed_dict = feed_dict if feed_dict else {}
+        src_list, feed_args = _feed_arrays(feed_dict)
+        run_id = _ctypes.c_uint64()
+        check_call(_LIB.NNSessionRunAsync(
+            self.handle, fetch.handle, *(feed_args + (_ctypes.byref(run_id),))))
+        return RunFuture(self, run_id.value)
+
+    def make_callable(self, fetch, feeds=None):
+        """Bind the fetch graph and the feed placeholders for repeated runs.
+
+        The executor and the placeholder order are resolved once,
+        each call only passes the feed buffers.
+
+        Parameters
+        ----------
+        fetch : Symbol or list of Symbol
+            The outputs to be computed.
+        feeds : list of Symbol
+            The placeholders, in the order their values are passed to the callable.
+
+        Returns
+        -------
+        callable : Callable
+            Call it with the feed values, optionally with out= like run.
+        """
+        if isinstance(fetch, list):
+            fetch = symbol.Group(fetch)
+        feeds = feeds if feeds else []
+        for k in feeds:
             assert isinstance(k, symbol.Symbol)
-            assert isinstance(v, np.ndarray)
-            feed_placeholders.append(k.handle)
-            # only convert to float32 for now
-            source_array = np.ascontiguousarray(v, dtype=np.float32)
-            # leep src_list alive for the period
-            src_list.append(source_array)
-            feed_dptr.append(source_array.ctypes.data_as(_ctypes.c_void_p))
-            feed_dtype.append(0)
-            feed_shape_data.extend(source_array.shape)
-            feed_shape_csr_ptr.append(len(feed_shape_data))
-        out_size = nn_uint()
-        out_dptr = _ctypes.POINTER(_ctypes.POINTER(nn_float))()
-        out_dtype = _ctypes.POINTER(nn_uint)()
-        out_shape_ndim = _ctypes.POINTER(nn_uint)()
-        out_shape_data = _ctypes.POINTER(_ctypes.POINTER(nn_uint))()
-
-        check_call(_LIB.NNSessionRun(
-            self.handle, fetch.handle, nn_uint(len(src_list)),
-            c_array(_ctypes.c_void_p, feed_placeholders),
-            c_array(_ctypes.c_void_p, feed_dptr),
-            c_array(nn_uint, feed_dtype),
-            c_array(nn_uint, feed_shape_csr_ptr),
-            c_array(nn_uint, feed_shape_data),
-            _ctypes.byref(out_size),
-            _ctypes.byref(out_dptr),
-            _ctypes.byref(out_dtype),
-            _ctypes.byref(out_shape_ndim),
-            _ctypes.byref(out_shape_data)))
-        ret = []
-        for i in range(out_size.value):
-            shape = tuple(out_shape_data[i][:out_shape_ndim[i]])
-            ret.append(_get_numpy(out_dptr[i], out_dtype[i], shape))
-
-        return ret[0] if len(ret) == 1 else ret
+        return Callable(self, fetch, feeds)
@@ -1,6 +1,7 @@
 from __future__ import absolute_import as _abs
 import json
 from nnvm import symbol, graph
+from . import _base
 
 def infer_variable_shapes(net, feed_dict):
     """Inference shape of all variables in the net.
@@ -38,3 +39,54 @@ def infer_variable_shapes(net, feed_dict):
         if len(vshape) == 0:
             raise ValueError("not sufficient information in feed_dict")
         yield (v, vname, vshape)
+
+
+def _init_shape(init):
+    """Shape of the output of a variable initialization expression, [] if unknown."""
+    g = graph.create(init)
+    jgraph = json.loads(g.apply('SaveJSON').json_attr('json'))
+    head = jgraph["heads"][0]
+    shape = g.apply("InferShape").json_attr("shape")
+    return shape[jgraph["node_row_ptr"][head[0]] + head[1]]
+
+
+def parallelize(net, feed_dict=None, num_partitions=None):
+    """Split the ops of net worth it into parts that run in parallel.
+
+    Parameters
+    ----------
+    net : tf.Symbol
+       The symbolic network.
+
+    feed_dict : dict, optional
+       dict of placeholder to known shape, used to estimate the cost of the ops.
+       The shapes of the variables come from their initialization expression.
+       Without shapes, only the ops with attribute parallelism are split.
+
+    num_partitions : int, optional
+       Maximum number of parts of an op, the number of cores by default.
+
+    Returns
+    -------
+    The symbol of the parallelized network, computing the same outputs.
+    """
+    g = graph.create(net)
+    known = {}
+    for v in net.list_input_variables():
+        init = _base._variable_init_exprs.get(v.attr("name"))
+        if init is not None:
+            known[v.attr("name")] = _init_shape(init)
+    if feed_dict:
+        for k, v in feed_dict.items():
+            known[k.attr("name")] = v
+    if known:
+        jgraph = json.loads(g.apply('SaveJSON').json_attr('json'))
+        jnode_row_ptr = jgraph["node_row_ptr"]
+        nindex = {n['name']: i for i, n in enumerate(jgraph["nodes"])}
+        shape = [[]] * jnode_row_ptr[-1]
+        for name, v in known.items():
+            shape[jnode_row_ptr[nindex[name]]] = v
+        g._set_json_attr("shape", shape, "list_shape")
+    if num_partitions is not None:
+        g._set_json_attr("num_partitions", num_partitions, "int")
+    return g.apply(["Parallelize", "EliminateMerge"]).symbol
@@ -8,10 +8,28 @@ class GradientDescentOptimizer(object):
     def minimize(self, obj):
         variables = obj.list_input_variables()
         grads = _base.gradients(obj, variables)
-        updates = []
-        for v, g in zip(variables, grads):
-            updates.append(_sym.assign(v, v + (-self.learning_rate) * g))
-        return _base.group(*updates)
+        update = _sym.sgd_update(*(variables + grads), num_weights=len(variables),
+                                 learning_rate=self.learning_rate)
+        return _base.group(update)
+
+class MomentumOptimizer(object):
+    def __init__(self, learning_rate, momentum, name='Momentum'):
+        self.name = name
+        self.learning_rate = learning_rate
+        self.momentum = momentum
+        self.accum = []
+
+    def minimize(self, obj):
+        variables = obj.list_input_variables()
+        grads = _base.gradients(obj, variables)
+        accum = []
+        for i, v in enumerate(variables):
+            accum.append(_base.Variable(_sym.zeros_like(v), self.name + '_accum' + str(i)))
+        self.accum += accum
+        update = _sym.momentum_update(*(variables + grads + accum), num_weights=len(variables),
+                                      learning_rate=self.learning_rate,
+                                      momentum=self.momentum)
+        return _base.group(update)
 
 class AdamOptimizer(object):
     def __init__(self, learning_rate=0.001, beta1=0.9, beta2=0.999, epsilon=1e-04, name='Adam'):
@@ -27,17 +45,16 @@ class AdamOptimizer(object):
     def minimize(self, obj):
         variables = obj.list_input_variables()
         grads = _base.gradients(obj, variables)
-        updates = []
-        for i, v in enumerate(variables):
-            self.m.append(_base.Variable(_sym.zeros_like(v), self.name + '_m' + str(i)))
-            self.v.append(_base.Variable(_sym.zeros_like(v), self.name + '_v' + str(i)))
+        m, v = [], []
+        for i, var in enumerate(variables):
+            m.append(_base.Variable(_sym.zeros_like(var), self.name + '_m' + str(i)))
+            v.append(_base.Variable(_sym.zeros_like(var), self.name + '_v' + str(i)))
+        self.m += m
+        self.v += v
         update_t = _sym.assign(self.t, self.t + 1)
-        rate = _sym.sqrt(1 - self.beta2 ** update_t) / (1 -  self.beta1 ** update_t)
-        lr_t = self.learning_rate * rate
-        for var, g, m, v in zip(variables, grads, self.m, self.v):
-            update_m = _sym.assign(m, self.beta1 * m + (1 - self.beta1) * g)
-            update_v = _sym.assign(v, self.beta2 * v + (1 - self.beta2) * g * g)
-            update_var = _sym.assign(var,
-                var - lr_t * update_m / (_sym.sqrt(update_v) + self.epsilon))
-            updates.append(update_var)
-        return _base.group(*updates)
+        update = _sym.adam_update(*(variables + grads + m + v + [update_t]),
+                                  num_weights=len(variables),
+                                  learning_rate=self.learning_rate,
+                                  beta1=self.beta1, beta2=self.beta2,
+                                  epsilon=self.epsilon)
+        return _base.group(update)
@@ -0,0 +1,226 @@
+// Copyright (c) 2016 by Contributors
+// session that runs graphs on a background thread, so the caller
+// can prepare the next feed while the current run computes.
+#include <tinyflow/base.h>
+#include <dmlc/logging.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "./session_util.h"
+#include "./native/native_util.h"
+
+namespace tinyflow {
+
+class AsyncSession;
+
+// callable created by the inner session, runs on the worker thread.
+class AsyncCallable : public Callable {
+ public:
+  AsyncCallable(AsyncSession* sess, Callable* inner)
+      : sess_(sess), inner_(inner) {}
+  ~AsyncCallable();
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds) override;
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs) override;
+
+ private:
+  AsyncSession* sess_;
+  Callable* inner_;
+};
+
+/*!
+ * \brief session decorator that owns a worker thread.
+ *  The inner session is created, used and destroyed only on the worker,
+ *  which then owns the lua state the torch session depends on.
+ *  Tasks run in submission order, so the synchronous calls
+ *  see the effect of all the runs started before them.
+ */
+class AsyncSession : public Session {
+ public:
+  /*! \brief maximum number of runs in flight, each owns a copy of its feeds */
+  static const uint64_t kNumSlots = 2;
+
+  explicit AsyncSession(std::function<Session*()> fcreate)
+      : worker_([this]() { this->WorkerLoop(); }) {
+    this->Invoke([this, fcreate]() { inner_ = fcreate(); });
+  }
+  ~AsyncSession() {
+    this->Invoke([this]() { delete inner_; });
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    worker_.join();
+  }
+  const std::vector<TBlob>& Run(
+      Symbol* g,
+      const std::unordered_map<std::string, TBlob>& inputs) override {
+    const std::vector<TBlob>* ret = nullptr;
+    this->Invoke([&]() { ret = &inner_->Run(g, inputs); });
+    return *ret;
+  }
+  void RunInto(Symbol* g,
+               const std::unordered_map<std::string, TBlob>& inputs,
+               const std::vector<TBlob>& outputs) override {
+    this->Invoke([&]() { inner_->RunInto(g, inputs, outputs); });
+  }
+  Callable* MakeCallable(Symbol* g,
+                         const std::vector<std::string>& feed_names) override {
+    Callable* ret = nullptr;
+    this->Invoke([&]() { ret = inner_->MakeCallable(g, feed_names); });
+    return new AsyncCallable(this, ret);
+  }
+  std::string DumpProfile(const std::string& trace_file) override {
+    std::string ret;
+    this->Invoke([&]() { ret = inner_->DumpProfile(trace_file); });
+    return ret;
+  }
+  ExecCacheStats GetCacheStats() const override {
+    ExecCacheStats ret;
+    const_cast<AsyncSession*>(this)->Invoke([&]() { ret = inner_->GetCacheStats(); });
+    return ret;
+  }
+  StorageStats GetStorageStats() const override {
+    StorageStats ret;
+    const_cast<AsyncSession*>(this)->Invoke([&]() { ret = inner_->GetStorageStats(); });
+    return ret;
+  }
+  uint64_t RunAsync(Symbol* g,
+                    const std::unordered_map<std::string, TBlob>& inputs) override;
+  const std::vector<TBlob>& Wait(uint64_t run_id) override;
+  // run f on the worker thread and wait for it.
+  void Invoke(std::function<void()> f) {
+    this->Submit(std::move(f)).get();
+  }
+
+ private:
+  // state of a run started by RunAsync
+  struct RunSlot {
+    uint64_t run_id{std::numeric_limits<uint64_t>::max()};
+    nnvm::Symbol sym;
+    // copy of the feeds, the executor reads from here.
+    std::vector<std::vector<float> > feed_space;
+    std::unordered_map<std::string, TBlob> inputs;
+    // copy of the outputs, kept until the slot is reused.
+    std::vector<std::vector<float> > out_space;
+    std::vector<TBlob> outputs;
+    std::future<void> done;
+  };
+  // queue f to the worker thread.
+  std::future<void> Submit(std::function<void()> f) {
+    std::packaged_task<void()> task(std::move(f));
+    std::future<void> ret = task.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cond_.notify_one();
+    return ret;
+  }
+  void WorkerLoop() {
+    while (true) {
+      std::packaged_task<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+  // the wrapped session, only touched on the worker thread.
+  Session* inner_{nullptr};
+  // runs in flight, run i uses slots_[i % kNumSlots].
+  RunSlot slots_[kNumSlots];
+  uint64_t next_run_id_{0};
+  // task queue of the worker
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::packaged_task<void()> > tasks_;
+  bool stop_{false};
+  std::thread worker_;
+};
+
+uint64_t AsyncSession::RunAsync(
+    Symbol* g, const std::unordered_map<std::string, TBlob>& inputs) {
+  const uint64_t run_id = next_run_id_++;
+  RunSlot& slot = slots_[run_id % kNumSlots];
+  // the worker may still read the feeds of the run using this slot,
+  // whose error is reported here if it was never waited.
+  if (slot.done.valid()) {
+    try {
+      slot.done.get();
+    } catch (const std::exception& e) {
+      LOG(WARNING) << "run " << slot.run_id << " failed and was never waited: " << e.what();
+    }
+  }
+  slot.run_id = run_id;
+  slot.sym = *g;
+  slot.inputs.clear();
+  // copy in the feeds here, overlapped with the run in the other slot.
+  slot.feed_space.resize(inputs.size());
+  size_t i = 0;
+  for (const auto& kv : inputs) {
+    const TBlob& src = kv.second;
+    CHECK_EQ(src.dev_mask, kCPU) << "RunAsync only accept CPU feed";
+    std::vector<float>& space = slot.feed_space[i++];
+    space.resize(src.shape.Size());
+    TBlob dst = src;
+    dst.data = dmlc::BeginPtr(space);
+    CopyBlob(src, dst);
+    slot.inputs[kv.first] = dst;
+  }
+  RunSlot* s = &slot;
+  slot.done = this->Submit([this, s]() {
+      const std::vector<TBlob>& out = inner_->Run(&s->sym, s->inputs);
+      s->out_space.resize(out.size());
+      s->outputs.resize(out.size());
+      for (size_t i = 0; i < out.size(); ++i) {
+        s->out_space[i].resize(out[i].shape.Size());
+        s->outputs[i] = out[i];
+        s->outputs[i].data = dmlc::BeginPtr(s->out_space[i]);
+        CopyBlob(out[i], s->outputs[i]);
+      }
+    });
+  return run_id;
+}
+
+const std::vector<TBlob>& AsyncSession::Wait(uint64_t run_id) {
+  RunSlot& slot = slots_[run_id % kNumSlots];
+  CHECK(slot.run_id == run_id)
+      << "run " << run_id << " is not tracked, only the last "
+      << kNumSlots << " runs started can be waited";
+  // re-throw the error of the run.
+  if (slot.done.valid()) slot.done.get();
+  return slot.outputs;
+}
+
+AsyncCallable::~AsyncCallable() {
+  Callable* inner = inner_;
+  sess_->Invoke([inner]() { delete inner; });
+}
+
+const std::vector<TBlob>& AsyncCallable::Run(const std::vector<TBlob>& feeds) {
+  const std::vector<TBlob>* ret = nullptr;
+  sess_->Invoke([&]() { ret = &inner_->Run(feeds); });
+  return *ret;
+}
+
+void AsyncCallable::RunInto(const std::vector<TBlob>& feeds,
+                            const std::vector<TBlob>& outputs) {
+  sess_->Invoke([&]() { inner_->RunInto(feeds, outputs); });
+}
+
+Session* CreateAsyncSession(std::function<Session*()> fcreate) {
+  return new AsyncSession(fcreate);
+}
+
+}  // namespace tinyflow
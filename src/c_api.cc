@@ -34,6 +34,8 @@ struct TinyAPIThreadLocalEntry {
   std::vector<nn_uint> shape_ndim;
   /*! \brief result holder for returning handles */
   std::vector<const nn_uint*> shape_data;
+  /*! \brief result holder for returning string */
+  std::string ret_str;
 };
 
 using namespace tinyflow;
@@ -50,33 +52,49 @@ int NNSessionClose(SessionHandle handle) {
   API_END();
 }
 
-int NNSessionRun(SessionHandle handle,
-                 SymbolHandle graph,
-                 nn_uint num_feed,
-                 const SymbolHandle* feed_placeholders,
-                 const float** feed_dptr,
-                 const nn_uint* feed_dtype,
-                 const nn_uint* feed_shape_csr_ptr,
-                 const nn_uint* feed_shape_data,
-                 nn_uint* num_out,
-                 const float*** out_dptr,
-                 const nn_uint** out_dtype,
-                 const nn_uint** out_shape_ndim,
-                 const nn_uint*** out_shape_data) {
-  API_BEGIN();
+// name of the placeholder symbol
+inline const std::string& PlaceholderName(SymbolHandle placeholder) {
+  return static_cast<nnvm::Symbol*>(placeholder)->outputs[0].node->attrs.name;
+}
+
+// build the blobs from the arguments of C API
+inline std::vector<TBlob> MakeBlobs(
+    nn_uint num,
+    const float* const* dptr,
+    const nn_uint* shape_csr_ptr,
+    const nn_uint* shape_data) {
+  std::vector<TBlob> ret(num);
+  for (nn_uint i = 0; i < num; ++i) {
+    ret[i].data = (void*)dptr[i];  // NOLINT(*)
+    ret[i].shape = TShape(shape_data + shape_csr_ptr[i],
+                          shape_data + shape_csr_ptr[i + 1]);
+  }
+  return ret;
+}
+
+// build the feed dict from the arguments of C API
+inline std::unordered_map<std::string, TBlob> MakeFeedDict(
+    nn_uint num_feed,
+    const SymbolHandle* feed_placeholders,
+    const float** feed_dptr,
+    const nn_uint* feed_shape_csr_ptr,
+    const nn_uint* feed_shape_data) {
+  std::vector<TBlob> blobs = MakeBlobs(
+      num_feed, feed_dptr, feed_shape_csr_ptr, feed_shape_data);
   std::unordered_map<std::string, TBlob> feed;
   for (nn_uint i = 0; i < num_feed; ++i) {
-    const std::string& key =
-        static_cast<nnvm::Symbol*>(feed_placeholders[i])->outputs[0].node->attrs.name;
-    TBlob tmp;
-    tmp.data = (void*)feed_dptr[i];  // NOLINT(*)
-    tmp.shape = TShape(feed_shape_data + feed_shape_csr_ptr[i],
-                       feed_shape_data + feed_shape_csr_ptr[i + 1]);
-    feed[key] = tmp;
+    feed[PlaceholderName(feed_placeholders[i])] = blobs[i];
   }
+  return feed;
+}
 
-  const std::vector<TBlob>& out = static_cast<Session*>(handle)->Run(
-      static_cast<nnvm::Symbol*>(graph), feed);
+// hold the outputs in thread local store and return them.
+inline void ReturnOutputs(const std::vector<TBlob>& out,
+                          nn_uint* num_out,
+                          const float*** out_dptr,
+                          const nn_uint** out_dtype,
+                          const nn_uint** out_shape_ndim,
+                          const nn_uint*** out_shape_data) {
   *num_out = static_cast<nn_uint>(out.size());
   auto* ret = dmlc::ThreadLocalStore<TinyAPIThreadLocalEntry>::Get();
   ret->floatp.resize(out.size());
@@ -94,6 +112,171 @@ int NNSessionRun(SessionHandle handle,
   *out_dtype = dmlc::BeginPtr(ret->dtype);
   *out_shape_ndim = dmlc::BeginPtr(ret->shape_ndim);
   *out_shape_data = dmlc::BeginPtr(ret->shape_data);
+}
+
+int NNSessionRun(SessionHandle handle,
+                 SymbolHandle graph,
+                 nn_uint num_feed,
+                 const SymbolHandle* feed_placeholders,
+                 const float** feed_dptr,
+                 const nn_uint* feed_dtype,
+                 const nn_uint* feed_shape_csr_ptr,
+                 const nn_uint* feed_shape_data,
+                 nn_uint* num_out,
+                 const float*** out_dptr,
+                 const nn_uint** out_dtype,
+                 const nn_uint** out_shape_ndim,
+                 const nn_uint*** out_shape_data) {
+  API_BEGIN();
+  std::unordered_map<std::string, TBlob> feed = MakeFeedDict(
+      num_feed, feed_placeholders, feed_dptr, feed_shape_csr_ptr, feed_shape_data);
+
+  const std::vector<TBlob>& out = static_cast<Session*>(handle)->Run(
+      static_cast<nnvm::Symbol*>(graph), feed);
+  ReturnOutputs(out, num_out, out_dptr, out_dtype, out_shape_ndim, out_shape_data);
   API_END();
   return 0;
 }
+
+int NNSessionRunInto(SessionHandle handle,
+                     SymbolHandle graph,
+                     nn_uint num_feed,
+                     const SymbolHandle* feed_placeholders,
+                     const float** feed_dptr,
+                     const nn_uint* feed_dtype,
+                     const nn_uint* feed_shape_csr_ptr,
+                     const nn_uint* feed_shape_data,
+                     nn_uint num_out,
+                     float** out_dptr,
+                     const nn_uint* out_shape_csr_ptr,
+                     const nn_uint* out_shape_data) {
+  API_BEGIN();
+  std::unordered_map<std::string, TBlob> feed = MakeFeedDict(
+      num_feed, feed_placeholders, feed_dptr, feed_shape_csr_ptr, feed_shape_data);
+  std::vector<TBlob> out = MakeBlobs(
+      num_out, out_dptr, out_shape_csr_ptr, out_shape_data);
+  static_cast<Session*>(handle)->RunInto(
+      static_cast<nnvm::Symbol*>(graph), feed, out);
+  API_END();
+}
+
+int NNSessionRunAsync(SessionHandle handle,
+                      SymbolHandle graph,
+                      nn_uint num_feed,
+                      const SymbolHandle* feed_placeholders,
+                      const float** feed_dptr,
+                      const nn_uint* feed_dtype,
+                      const nn_uint* feed_shape_csr_ptr,
+                      const nn_uint* feed_shape_data,
+                      uint64_t* run_id) {
+  API_BEGIN();
+  std::unordered_map<std::string, TBlob> feed = MakeFeedDict(
+      num_feed, feed_placeholders, feed_dptr, feed_shape_csr_ptr, feed_shape_data);
+  *run_id = static_cast<Session*>(handle)->RunAsync(
+      static_cast<nnvm::Symbol*>(graph), feed);
+  API_END();
+}
+
+int NNSessionWait(SessionHandle handle,
+                  uint64_t run_id,
+                  nn_uint* num_out,
+                  const float*** out_dptr,
+                  const nn_uint** out_dtype,
+                  const nn_uint** out_shape_ndim,
+                  const nn_uint*** out_shape_data) {
+  API_BEGIN();
+  const std::vector<TBlob>& out = static_cast<Session*>(handle)->Wait(run_id);
+  ReturnOutputs(out, num_out, out_dptr, out_dtype, out_shape_ndim, out_shape_data);
+  API_END();
+}
+
+int NNSessionDumpProfile(SessionHandle handle,
+                         const char* trace_file,
+                         const char** out_summary) {
+  API_BEGIN();
+  auto* ret = dmlc::ThreadLocalStore<TinyAPIThreadLocalEntry>::Get();
+  ret->ret_str = static_cast<Session*>(handle)->DumpProfile(
+      trace_file != nullptr ? trace_file : "");
+  *out_summary = ret->ret_str.c_str();
+  API_END();
+}
+
+int NNSessionGetCacheStats(SessionHandle handle,
+                           uint64_t* num_hit,
+                           uint64_t* num_miss,
+                           uint64_t* num_evict) {
+  API_BEGIN();
+  ExecCacheStats stats = static_cast<Session*>(handle)->GetCacheStats();
+  *num_hit = stats.num_hit;
+  *num_miss = stats.num_miss;
+  *num_evict = stats.num_evict;
+  API_END();
+}
+
+int NNSessionGetStorageStats(SessionHandle handle,
+                             uint64_t* num_alloc,
+                             uint64_t* num_reuse,
+                             uint64_t* bytes_allocated,
+                             uint64_t* bytes_cached) {
+  API_BEGIN();
+  StorageStats stats = static_cast<Session*>(handle)->GetStorageStats();
+  *num_alloc = stats.num_alloc;
+  *num_reuse = stats.num_reuse;
+  *bytes_allocated = stats.bytes_allocated;
+  *bytes_cached = stats.bytes_cached;
+  API_END();
+}
+
+int NNSessionMakeCallable(SessionHandle handle,
+                          SymbolHandle graph,
+                          nn_uint num_feed,
+                          const SymbolHandle* feed_placeholders,
+                          CallableHandle* out) {
+  API_BEGIN();
+  std::vector<std::string> feed_names;
+  for (nn_uint i = 0; i < num_feed; ++i) {
+    feed_names.push_back(PlaceholderName(feed_placeholders[i]));
+  }
+  *out = static_cast<Session*>(handle)->MakeCallable(
+      static_cast<nnvm::Symbol*>(graph), feed_names);
+  API_END();
+}
+
+int NNCallableFree(CallableHandle handle) {
+  API_BEGIN();
+  delete static_cast<Callable*>(handle);
+  API_END();
+}
+
+int NNCallableRun(CallableHandle handle,
+                  nn_uint num_feed,
+                  const float** feed_dptr,
+                  const nn_uint* feed_shape_csr_ptr,
+                  const nn_uint* feed_shape_data,
+                  nn_uint* num_out,
+                  const float*** out_dptr,
+                  const nn_uint** out_dtype,
+                  const nn_uint** out_shape_ndim,
+                  const nn_uint*** out_shape_data) {
+  API_BEGIN();
+  const std::vector<TBlob>& out = static_cast<Callable*>(handle)->Run(
+      MakeBlobs(num_feed, feed_dptr, feed_shape_csr_ptr, feed_shape_data));
+  ReturnOutputs(out, num_out, out_dptr, out_dtype, out_shape_ndim, out_shape_data);
+  API_END();
+}
+
+int NNCallableRunInto(CallableHandle handle,
+                      nn_uint num_feed,
+                      const float** feed_dptr,
+                      const nn_uint* feed_shape_csr_ptr,
+                      const nn_uint* feed_shape_data,
+                      nn_uint num_out,
+                      float** out_dptr,
+                      const nn_uint* out_shape_csr_ptr,
+                      const nn_uint* out_shape_data) {
+  API_BEGIN();
+  static_cast<Callable*>(handle)->RunInto(
+      MakeBlobs(num_feed, feed_dptr, feed_shape_csr_ptr, feed_shape_data),
+      MakeBlobs(num_out, out_dptr, out_shape_csr_ptr, out_shape_data));
+  API_END();
+}
@@ -0,0 +1,553 @@
+// Copyright (c) 2016 by Contributors
+// 2d convolution kernels on CPU.
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "./conv.h"
+#include "./gemm.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+namespace {
+
+// number of tiles multiplied by one batch of winograd gemms,
+// small images are grouped to make the gemms wide enough.
+const size_t kWinogradTiles = 1024;
+
+// range [lo, hi) of output index o that reads input o * stride + k - pad inside [0, in).
+inline void ValidRange(size_t k, size_t pad, size_t stride, size_t in, size_t out,
+                       size_t* lo, size_t* hi) {
+  *lo = k >= pad ? 0 : (pad - k + stride - 1) / stride;
+  *hi = in + pad <= k ? 0 : (in + pad - k + stride - 1) / stride;
+  *hi = std::min(*hi, out);
+  *lo = std::min(*lo, *hi);
+}
+
+// NCHW shape of an image.
+inline TShape ImageShape(size_t n, size_t c, size_t h, size_t w) {
+  return TShape{static_cast<index_t>(n), static_cast<index_t>(c),
+                static_cast<index_t>(h), static_cast<index_t>(w)};
+}
+
+// whether the filter is 1x1 with stride 1, where the input is its own im2col.
+inline bool IsPointwise(const ConvGeometry& g) {
+  return g.kernel_h == 1 && g.kernel_w == 1 && g.stride_h == 1 && g.stride_w == 1 &&
+      g.pad_h == 0 && g.pad_w == 0;
+}
+
+// col (in_channels * kernel_h * kernel_w, out_height * out_width) of one image.
+void Im2Col(const ConvGeometry& g, const float* x, float* col) {
+  const size_t ohw = g.out_height * g.out_width;
+  for (size_t c = 0; c < g.in_channels; ++c) {
+    const float* plane = x + c * g.height * g.width;
+    for (size_t kh = 0; kh < g.kernel_h; ++kh) {
+      for (size_t kw = 0; kw < g.kernel_w; ++kw) {
+        float* row = col + ((c * g.kernel_h + kh) * g.kernel_w + kw) * ohw;
+        std::fill(row, row + ohw, 0.0f);
+        size_t hlo, hhi, wlo, whi;
+        ValidRange(kh, g.pad_h, g.stride_h, g.height, g.out_height, &hlo, &hhi);
+        ValidRange(kw, g.pad_w, g.stride_w, g.width, g.out_width, &wlo, &whi);
+        for (size_t oh = hlo; oh < hhi; ++oh) {
+          const float* xr = plane + (oh * g.stride_h + kh - g.pad_h) * g.width +
+              wlo * g.stride_w + kw - g.pad_w;
+          float* r = row + oh * g.out_width;
+          for (size_t ow = wlo; ow < whi; ++ow) {
+            r[ow] = xr[(ow - wlo) * g.stride_w];
+          }
+        }
+      }
+    }
+  }
+}
+
+// accumulate col back to the image it is taken from, x is overwritten.
+void Col2Im(const ConvGeometry& g, const float* col, float* x) {
+  const size_t ohw = g.out_height * g.out_width;
+  std::fill(x, x + g.in_channels * g.height * g.width, 0.0f);
+  for (size_t c = 0; c < g.in_channels; ++c) {
+    float* plane = x + c * g.height * g.width;
+    for (size_t kh = 0; kh < g.kernel_h; ++kh) {
+      for (size_t kw = 0; kw < g.kernel_w; ++kw) {
+        const float* row = col + ((c * g.kernel_h + kh) * g.kernel_w + kw) * ohw;
+        size_t hlo, hhi, wlo, whi;
+        ValidRange(kh, g.pad_h, g.stride_h, g.height, g.out_height, &hlo, &hhi);
+        ValidRange(kw, g.pad_w, g.stride_w, g.width, g.out_width, &wlo, &whi);
+        for (size_t oh = hlo; oh < hhi; ++oh) {
+          float* xr = plane + (oh * g.stride_h + kh - g.pad_h) * g.width +
+              wlo * g.stride_w + kw - g.pad_w;
+          const float* r = row + oh * g.out_width;
+          for (size_t ow = wlo; ow < whi; ++ow) {
+            xr[(ow - wlo) * g.stride_w] += r[ow];
+          }
+        }
+      }
+    }
+  }
+}
+
+// the relu epilogue, applied to each part of the output while it is in cache.
+inline void ReluInplace(float* y, size_t size) {
+  for (size_t i = 0; i < size; ++i) y[i] = std::max(y[i], 0.0f);
+}
+
+// fill each channel of one image with its bias.
+inline void FillBias(const ConvGeometry& g, const float* bias, float* y) {
+  const size_t ohw = g.out_height * g.out_width;
+  for (size_t o = 0; o < g.out_channels; ++o) {
+    std::fill(y + o * ohw, y + (o + 1) * ohw, bias != nullptr ? bias[o] : 0.0f);
+  }
+}
+
+// accumulate each filter tap over the rows of the output,
+// no copy of the input is made.
+void DirectForward(const ConvGeometry& g, const float* data, const float* weight,
+                   const float* bias, float* out) {
+  const size_t ohw = g.out_height * g.out_width;
+  for (size_t n = 0; n < g.batch; ++n) {
+    float* yn = out + n * g.out_channels * ohw;
+    FillBias(g, bias, yn);
+    for (size_t o = 0; o < g.out_channels; ++o) {
+      float* y = yn + o * ohw;
+      for (size_t c = 0; c < g.in_channels; ++c) {
+        const float* x = data + (n * g.in_channels + c) * g.height * g.width;
+        const float* w = weight + (o * g.in_channels + c) * g.kernel_h * g.kernel_w;
+        for (size_t kh = 0; kh < g.kernel_h; ++kh) {
+          size_t hlo, hhi;
+          ValidRange(kh, g.pad_h, g.stride_h, g.height, g.out_height, &hlo, &hhi);
+          for (size_t kw = 0; kw < g.kernel_w; ++kw) {
+            const float wv = w[kh * g.kernel_w + kw];
+            size_t wlo, whi;
+            ValidRange(kw, g.pad_w, g.stride_w, g.width, g.out_width, &wlo, &whi);
+            for (size_t oh = hlo; oh < hhi; ++oh) {
+              const float* xr = x + (oh * g.stride_h + kh - g.pad_h) * g.width +
+                  wlo * g.stride_w + kw - g.pad_w;
+              float* yr = y + oh * g.out_width + wlo;
+              const size_t len = whi - wlo;
+              if (g.stride_w == 1) {
+                for (size_t i = 0; i < len; ++i) yr[i] += wv * xr[i];
+              } else {
+                for (size_t i = 0; i < len; ++i) yr[i] += wv * xr[i * g.stride_w];
+              }
+            }
+          }
+        }
+      }
+      if (g.relu) ReluInplace(y, ohw);
+    }
+  }
+}
+
+// y = weight * im2col(x), one gemm per image.
+void GemmForward(const ConvGeometry& g, const float* data, const float* weight,
+                 const float* bias, float* out) {
+  const size_t ckk = g.in_channels * g.kernel_h * g.kernel_w;
+  const size_t ohw = g.out_height * g.out_width;
+  const bool pointwise = IsPointwise(g);
+  static thread_local std::vector<float> col;
+  if (!pointwise) col.resize(ckk * ohw);
+  for (size_t n = 0; n < g.batch; ++n) {
+    const float* x = data + n * g.in_channels * g.height * g.width;
+    float* y = out + n * g.out_channels * ohw;
+    if (!pointwise) {
+      Im2Col(g, x, col.data());
+      x = col.data();
+    }
+    float beta = 0.0f;
+    if (bias != nullptr) {
+      FillBias(g, bias, y);
+      beta = 1.0f;
+    }
+    Sgemm(false, false, g.out_channels, ohw, ckk, weight, ckk, x, ohw, beta, y, ohw);
+    if (g.relu) ReluInplace(y, g.out_channels * ohw);
+  }
+}
+
+// u = G g G^T of each 3x3 filter, stored as u[xi][o][c] for the 16 positions xi.
+void WinogradFilterTransform(const ConvGeometry& g, const float* weight, float* u) {
+  const size_t oc = g.out_channels * g.in_channels;
+  for (size_t i = 0; i < oc; ++i) {
+    const float* k = weight + i * 9;
+    float t[4][3];
+    for (size_t j = 0; j < 3; ++j) {
+      t[0][j] = k[j];
+      t[1][j] = 0.5f * (k[j] + k[3 + j] + k[6 + j]);
+      t[2][j] = 0.5f * (k[j] - k[3 + j] + k[6 + j]);
+      t[3][j] = k[6 + j];
+    }
+    for (size_t r = 0; r < 4; ++r) {
+      u[(r * 4 + 0) * oc + i] = t[r][0];
+      u[(r * 4 + 1) * oc + i] = 0.5f * (t[r][0] + t[r][1] + t[r][2]);
+      u[(r * 4 + 2) * oc + i] = 0.5f * (t[r][0] - t[r][1] + t[r][2]);
+      u[(r * 4 + 3) * oc + i] = t[r][2];
+    }
+  }
+}
+
+// Winograd F(2x2, 3x3): each 2x2 output tile is computed from a 4x4 input
+// tile with 16 multiplies instead of 36. The multiplies of all tiles are
+// batched into 16 gemms of (out, in) x (in, tiles), one per tile position.
+void WinogradForward(const ConvGeometry& g, const float* data, const float* weight,
+                     const float* bias, float* out) {
+  const size_t C = g.in_channels, O = g.out_channels;
+  const size_t th = (g.out_height + 1) / 2, tw = (g.out_width + 1) / 2;
+  const size_t tiles = th * tw;
+  const size_t group = std::max<size_t>(1, kWinogradTiles / tiles);
+  static thread_local std::vector<float> u, v, m, rows;
+  u.resize(16 * O * C);
+  WinogradFilterTransform(g, weight, u.data());
+  for (size_t n0 = 0; n0 < g.batch; n0 += group) {
+    const size_t ng = std::min(group, g.batch - n0);
+    const size_t cols = ng * tiles;
+    v.resize(16 * C * cols);
+    m.resize(16 * O * cols);
+    // v = B^T d B of each input tile, stored as v[xi][c][tile].
+    // B^T is applied to 4 zero padded input rows at once, B to each tile.
+    const size_t pw = 2 * tw + 2;
+    rows.resize(8 * pw);
+    float* d = rows.data();
+    float* t = rows.data() + 4 * pw;
+    for (size_t img = 0; img < ng; ++img) {
+      for (size_t c = 0; c < C; ++c) {
+        const float* x = data + ((n0 + img) * C + c) * g.height * g.width;
+        for (size_t ty = 0; ty < th; ++ty) {
+          std::fill(d, d + 4 * pw, 0.0f);
+          for (size_t i = 0; i < 4; ++i) {
+            const size_t iy = 2 * ty + i;
+            if (iy < g.pad_h || iy - g.pad_h >= g.height) continue;
+            const float* xr = x + (iy - g.pad_h) * g.width;
+            const size_t len = std::min(g.width, pw - g.pad_w);
+            std::copy(xr, xr + len, d + i * pw + g.pad_w);
+          }
+          for (size_t j = 0; j < pw; ++j) {
+            t[j] = d[j] - d[2 * pw + j];
+            t[pw + j] = d[pw + j] + d[2 * pw + j];
+            t[2 * pw + j] = d[2 * pw + j] - d[pw + j];
+            t[3 * pw + j] = d[pw + j] - d[3 * pw + j];
+          }
+          float* vt = v.data() + c * cols + img * tiles + ty * tw;
+          const size_t vs = C * cols;
+          for (size_t r = 0; r < 4; ++r) {
+            const float* tr = t + r * pw;
+            for (size_t tx = 0; tx < tw; ++tx) {
+              const float* q = tr + 2 * tx;
+              vt[(r * 4 + 0) * vs + tx] = q[0] - q[2];
+              vt[(r * 4 + 1) * vs + tx] = q[1] + q[2];
+              vt[(r * 4 + 2) * vs + tx] = q[2] - q[1];
+              vt[(r * 4 + 3) * vs + tx] = q[1] - q[3];
+            }
+          }
+        }
+      }
+    }
+    for (size_t xi = 0; xi < 16; ++xi) {
+      Sgemm(false, false, O, cols, C, u.data() + xi * O * C, C,
+            v.data() + xi * C * cols, cols, 0.0f, m.data() + xi * O * cols, cols);
+    }
+    // y = A^T m A of each tile, cut at the border of the output.
+    const size_t ms = O * cols;
+    for (size_t img = 0; img < ng; ++img) {
+      for (size_t o = 0; o < O; ++o) {
+        float* y = out + ((n0 + img) * O + o) * g.out_height * g.out_width;
+        const float b = bias != nullptr ? bias[o] : 0.0f;
+        for (size_t ty = 0; ty < th; ++ty) {
+          for (size_t tx = 0; tx < tw; ++tx) {
+            const float* mt = m.data() + o * cols + img * tiles + ty * tw + tx;
+            float s[2][4];
+            for (size_t j = 0; j < 4; ++j) {
+              s[0][j] = mt[j * ms] + mt[(4 + j) * ms] + mt[(8 + j) * ms];
+              s[1][j] = mt[(4 + j) * ms] - mt[(8 + j) * ms] - mt[(12 + j) * ms];
+            }
+            for (size_t i = 0; i < 2 && 2 * ty + i < g.out_height; ++i) {
+              float* yr = y + (2 * ty + i) * g.out_width + 2 * tx;
+              yr[0] = s[i][0] + s[i][1] + s[i][2] + b;
+              if (g.relu) yr[0] = std::max(yr[0], 0.0f);
+              if (2 * tx + 1 < g.out_width) {
+                yr[1] = s[i][1] - s[i][2] - s[i][3] + b;
+                if (g.relu) yr[1] = std::max(yr[1], 0.0f);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// y (ohw, out) = im2col(x) (ohw, kh * kw * in) * weight^T of each NHWC image,
+// the rows of im2col are copies of contiguous channel vectors.
+void NHWCForward(const ConvGeometry& g, const float* data, const float* weight,
+                 const float* bias, float* out) {
+  const size_t C = g.in_channels, O = g.out_channels;
+  const size_t kk = g.kernel_h * g.kernel_w;
+  const size_t kkc = kk * C;
+  const size_t ohw = g.out_height * g.out_width;
+  const bool pointwise = IsPointwise(g);
+  static thread_local std::vector<float> w, col;
+  // weight as (out, kh, kw, in), the order of the im2col rows.
+  w.resize(O * kkc);
+  for (size_t o = 0; o < O; ++o) {
+    for (size_t c = 0; c < C; ++c) {
+      for (size_t k = 0; k < kk; ++k) {
+        w[(o * kk + k) * C + c] = weight[(o * C + c) * kk + k];
+      }
+    }
+  }
+  if (!pointwise) col.resize(ohw * kkc);
+  for (size_t n = 0; n < g.batch; ++n) {
+    const float* x = data + n * g.height * g.width * C;
+    float* y = out + n * ohw * O;
+    if (!pointwise) {
+      for (size_t oh = 0; oh < g.out_height; ++oh) {
+        for (size_t ow = 0; ow < g.out_width; ++ow) {
+          float* row = col.data() + (oh * g.out_width + ow) * kkc;
+          for (size_t kh = 0; kh < g.kernel_h; ++kh) {
+            const size_t ih = oh * g.stride_h + kh;
+            for (size_t kw = 0; kw < g.kernel_w; ++kw) {
+              const size_t iw = ow * g.stride_w + kw;
+              float* dst = row + (kh * g.kernel_w + kw) * C;
+              if (ih < g.pad_h || ih - g.pad_h >= g.height ||
+                  iw < g.pad_w || iw - g.pad_w >= g.width) {
+                std::fill(dst, dst + C, 0.0f);
+              } else {
+                const float* src = x + ((ih - g.pad_h) * g.width + iw - g.pad_w) * C;
+                std::copy(src, src + C, dst);
+              }
+            }
+          }
+        }
+      }
+      x = col.data();
+    }
+    float beta = 0.0f;
+    if (bias != nullptr) {
+      for (size_t i = 0; i < ohw; ++i) std::copy(bias, bias + O, y + i * O);
+      beta = 1.0f;
+    }
+    Sgemm(false, true, ohw, O, kkc, x, kkc, w.data(), kkc, beta, y, O);
+    if (g.relu) ReluInplace(y, ohw * O);
+  }
+}
+
+// the row kernel of the widest vector that fits the block,
+// CPUs with AVX-512 also run the AVX2 kernels.
+inline SimdConvRowKernel ConvRowKernelFor(size_t block) {
+  const SimdKernels& simd = Simd();
+  const SimdKernels* avx2 = GetAVX2Kernels();
+  if (block % (simd.gemm_nr / 2) != 0 && GetSimdLevel() == SimdLevel::kAVX512 &&
+      avx2 != nullptr) {
+    return avx2->conv_row;
+  }
+  return simd.conv_row;
+}
+
+// direct convolution of NCHW[x]c data. Each image is copied with zero padding,
+// so every tap is in range, then each output row of a channel block is
+// accumulated over all taps in vector registers by the simd row kernel.
+void BlockedForward(const ConvGeometry& g, const float* data, const float* weight,
+                    const float* bias, float* out) {
+  const size_t B = g.layout.block;
+  const size_t C = g.in_channels, O = g.out_channels;
+  const size_t kk = g.kernel_h * g.kernel_w;
+  const size_t ntap = C * kk;
+  const size_t hp = g.height + 2 * g.pad_h, wp = g.width + 2 * g.pad_w;
+  static thread_local std::vector<float> w, xpad;
+  static thread_local std::vector<size_t> xoff;
+  // weight as (out / B, in, kh, kw, B), the taps of one block are contiguous.
+  w.resize(O * ntap);
+  for (size_t o = 0; o < O; ++o) {
+    for (size_t t = 0; t < ntap; ++t) {
+      w[((o / B) * ntap + t) * B + o % B] = weight[o * ntap + t];
+    }
+  }
+  // offset of each tap in the padded image, from the input of the output (0, 0).
+  xoff.resize(ntap);
+  for (size_t c = 0; c < C; ++c) {
+    for (size_t kh = 0; kh < g.kernel_h; ++kh) {
+      for (size_t kw = 0; kw < g.kernel_w; ++kw) {
+        xoff[(c * g.kernel_h + kh) * g.kernel_w + kw] =
+            (((c / B) * hp + kh) * wp + kw) * B + c % B;
+      }
+    }
+  }
+  const SimdConvRowKernel conv_row = ConvRowKernelFor(B);
+  xpad.assign(C * hp * wp, 0.0f);
+  for (size_t n = 0; n < g.batch; ++n) {
+    const float* x = data + n * C * g.height * g.width;
+    for (size_t cb = 0; cb < C / B; ++cb) {
+      for (size_t h = 0; h < g.height; ++h) {
+        const float* src = x + (cb * g.height + h) * g.width * B;
+        std::copy(src, src + g.width * B,
+                  xpad.data() + ((cb * hp + h + g.pad_h) * wp + g.pad_w) * B);
+      }
+    }
+    for (size_t ob = 0; ob < O / B; ++ob) {
+      float* y = out + (n * (O / B) + ob) * g.out_height * g.out_width * B;
+      for (size_t i = 0; i < g.out_height * g.out_width; ++i) {
+        for (size_t j = 0; j < B; ++j) {
+          y[i * B + j] = bias != nullptr ? bias[ob * B + j] : 0.0f;
+        }
+      }
+      for (size_t oh = 0; oh < g.out_height; ++oh) {
+        float* yr = y + oh * g.out_width * B;
+        conv_row(ntap, xpad.data() + oh * g.stride_h * wp * B, xoff.data(),
+                 g.stride_w * B, w.data() + ob * ntap * B, B, yr, g.out_width);
+        if (g.relu) ReluInplace(yr, g.out_width * B);
+      }
+    }
+  }
+}
+
+// gradients of NCHW data, the arguments are those of ConvBackward.
+void NCHWBackward(const ConvGeometry& g, const float* gout,
+                  const float* data, const float* weight,
+                  float* gdata, float* gweight, float* gbias) {
+  const size_t ckk = g.in_channels * g.kernel_h * g.kernel_w;
+  const size_t ohw = g.out_height * g.out_width;
+  const bool pointwise = IsPointwise(g);
+  if (gbias != nullptr) {
+    std::fill(gbias, gbias + g.out_channels, 0.0f);
+    for (size_t n = 0; n < g.batch; ++n) {
+      for (size_t o = 0; o < g.out_channels; ++o) {
+        const float* gy = gout + (n * g.out_channels + o) * ohw;
+        float sum = 0.0f;
+        for (size_t i = 0; i < ohw; ++i) sum += gy[i];
+        gbias[o] += sum;
+      }
+    }
+  }
+  static thread_local std::vector<float> col;
+  if (!pointwise) col.resize(ckk * ohw);
+  for (size_t n = 0; n < g.batch; ++n) {
+    const float* gy = gout + n * g.out_channels * ohw;
+    // gradWeight += gradOutput * im2col(x)^T
+    if (gweight != nullptr) {
+      const float* x = data + n * g.in_channels * g.height * g.width;
+      if (!pointwise) {
+        Im2Col(g, x, col.data());
+        x = col.data();
+      }
+      Sgemm(false, true, g.out_channels, ckk, ohw, gy, ohw, x, ohw,
+            n == 0 ? 0.0f : 1.0f, gweight, ckk);
+    }
+    // gradData = col2im(weight^T * gradOutput)
+    if (gdata != nullptr) {
+      float* gx = gdata + n * g.in_channels * g.height * g.width;
+      if (pointwise) {
+        Sgemm(true, false, ckk, ohw, g.out_channels, weight, ckk, gy, ohw, 0.0f, gx, ohw);
+      } else {
+        Sgemm(true, false, ckk, ohw, g.out_channels, weight, ckk, gy, ohw,
+              0.0f, col.data(), ohw);
+        Col2Im(g, col.data(), gx);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+ConvGeometry ConvGeometry::Make(const ConvPoolParam& param,
+                                const TShape& dshape, const TShape& wshape) {
+  CHECK_EQ(wshape.ndim(), 4);
+  ConvGeometry g;
+  g.layout = DataLayout::Parse(param.data_format);
+  const TShape nchw = g.layout.ToNCHW(dshape);
+  g.batch = nchw[0];
+  g.in_channels = nchw[1];
+  g.height = nchw[2];
+  g.width = nchw[3];
+  g.out_channels = wshape[0];
+  g.kernel_h = wshape[2];
+  g.kernel_w = wshape[3];
+  g.stride_h = param.strides[1];
+  g.stride_w = param.strides[2];
+  g.pad_h = param.padding == "SAME" ? (g.kernel_h - 1) / 2 : 0;
+  g.pad_w = param.padding == "SAME" ? (g.kernel_w - 1) / 2 : 0;
+  g.out_height = (g.height + 2 * g.pad_h - g.kernel_h) / g.stride_h + 1;
+  g.out_width = (g.width + 2 * g.pad_w - g.kernel_w) / g.stride_w + 1;
+  CHECK(param.activation.length() == 0 || param.activation == "relu")
+      << "unknown activation " << param.activation << " of conv2d, expect relu";
+  g.relu = param.activation == "relu";
+  return g;
+}
+
+ConvAlgo SelectConvAlgo(const ConvGeometry& g) {
+  if (g.layout.kind == DataLayout::kNHWC) return ConvAlgo::kGemm;
+  if (g.layout.kind == DataLayout::kNCHWc) return ConvAlgo::kDirect;
+  const bool winograd_ok = g.kernel_h == 3 && g.kernel_w == 3 &&
+      g.stride_h == 1 && g.stride_w == 1;
+  const char* env = std::getenv("TINYFLOW_CONV_ALGO");
+  if (env != nullptr) {
+    std::string algo(env);
+    if (algo == "direct") return ConvAlgo::kDirect;
+    if (algo == "gemm") return ConvAlgo::kGemm;
+    CHECK_EQ(algo, "winograd") << "unknown TINYFLOW_CONV_ALGO=" << algo
+                               << ", expect direct, winograd or gemm";
+    if (winograd_ok) return ConvAlgo::kWinograd;
+  }
+  // the transforms pay off once there are enough channels to share them.
+  if (winograd_ok && g.in_channels >= 8 && g.out_channels >= 8 &&
+      g.out_height >= 4 && g.out_width >= 4) {
+    return ConvAlgo::kWinograd;
+  }
+  // too thin for the gemm tiles, e.g. a single channel input.
+  if (g.out_channels < kSimdGemmMR ||
+      g.in_channels * g.kernel_h * g.kernel_w < 16) {
+    return ConvAlgo::kDirect;
+  }
+  return ConvAlgo::kGemm;
+}
+
+const char* ConvAlgoName(ConvAlgo algo) {
+  switch (algo) {
+    case ConvAlgo::kDirect: return "direct";
+    case ConvAlgo::kWinograd: return "winograd";
+    case ConvAlgo::kGemm: return "gemm";
+  }
+  return "unknown";
+}
+
+void ConvForward(ConvAlgo algo, const ConvGeometry& g,
+                 const float* data, const float* weight,
+                 const float* bias, float* out) {
+  if (g.layout.kind == DataLayout::kNHWC) {
+    NHWCForward(g, data, weight, bias, out);
+    return;
+  }
+  if (g.layout.kind == DataLayout::kNCHWc) {
+    BlockedForward(g, data, weight, bias, out);
+    return;
+  }
+  switch (algo) {
+    case ConvAlgo::kDirect: DirectForward(g, data, weight, bias, out); break;
+    case ConvAlgo::kWinograd: WinogradForward(g, data, weight, bias, out); break;
+    case ConvAlgo::kGemm: GemmForward(g, data, weight, bias, out); break;
+  }
+}
+
+void ConvBackward(const ConvGeometry& g, const float* gout,
+                  const float* data, const float* weight,
+                  float* gdata, float* gweight, float* gbias) {
+  if (g.layout.kind == DataLayout::kNCHW) {
+    NCHWBackward(g, gout, data, weight, gdata, gweight, gbias);
+    return;
+  }
+  const DataLayout nchw;
+  const TShape dshape = ImageShape(g.batch, g.in_channels, g.height, g.width);
+  const TShape oshape = ImageShape(g.batch, g.out_channels, g.out_height, g.out_width);
+  static thread_local std::vector<float> x, gy, gx;
+  x.resize(dshape.Size());
+  gy.resize(oshape.Size());
+  TransformLayout(g.layout, nchw, dshape, data, x.data());
+  TransformLayout(g.layout, nchw, oshape, gout, gy.data());
+  if (gdata != nullptr) gx.resize(dshape.Size());
+  NCHWBackward(g, gy.data(), x.data(), weight,
+               gdata != nullptr ? gx.data() : nullptr, gweight, gbias);
+  if (gdata != nullptr) {
+    TransformLayout(nchw, g.layout, dshape, gx.data(), gdata);
+  }
+}
+
+}  // namespace tinyflow
@@ -0,0 +1,71 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file conv.h
+ * \brief 2d convolution kernels on CPU, with (out, in, kh, kw) filters.
+ *
+ *  The forward of NCHW data has three algorithms, picked per shape when the
+ *  kernel is created: direct convolution for thin products, Winograd F(2x2, 3x3)
+ *  for 3x3 stride 1, and im2col + GEMM otherwise, which skips the im2col of
+ *  1x1 stride 1. Set TINYFLOW_CONV_ALGO to direct, winograd or gemm to force
+ *  the forward algorithm where it applies.
+ *  NHWC data runs on GEMM over rows of contiguous channels, and the blocked
+ *  layouts on a direct convolution vectorized over the block of output channels.
+ *  The backward runs on GEMM in NCHW, other layouts are transformed to it.
+ *  The relu of activation='relu' runs on each part of the output just computed,
+ *  e.g. a row of the blocked layouts, instead of another pass over the output.
+ */
+#ifndef TINYFLOW_NATIVE_CONV_H_
+#define TINYFLOW_NATIVE_CONV_H_
+
+#include <tinyflow/base.h>
+#include "../op_util.h"
+#include "./layout.h"
+
+namespace tinyflow {
+
+/*! \brief algorithm of the convolution forward */
+enum class ConvAlgo : int {
+  kDirect,
+  kWinograd,
+  kGemm
+};
+
+/*! \brief sizes of a 2d convolution */
+struct ConvGeometry {
+  size_t batch, in_channels, height, width;
+  size_t out_channels, kernel_h, kernel_w;
+  size_t stride_h, stride_w, pad_h, pad_w;
+  size_t out_height, out_width;
+  /*! \brief layout of the data and output */
+  DataLayout layout;
+  /*! \brief whether relu is applied to the output, in the epilogue of the kernel */
+  bool relu{false};
+  /*! \brief geometry of conv2d with the data and weight shape */
+  static ConvGeometry Make(const ConvPoolParam& param,
+                           const TShape& dshape, const TShape& wshape);
+};
+
+/*! \return the algorithm for the geometry, the only one of NHWC and blocked layouts */
+ConvAlgo SelectConvAlgo(const ConvGeometry& g);
+
+/*! \return name of the algorithm, e.g. winograd */
+const char* ConvAlgoName(ConvAlgo algo);
+
+/*!
+ * \brief out = conv(data, weight) + bias.
+ * \param bias the bias, nullptr for no bias.
+ */
+void ConvForward(ConvAlgo algo, const ConvGeometry& g,
+                 const float* data, const float* weight,
+                 const float* bias, float* out);
+
+/*!
+ * \brief gradients of the convolution, each of them is skipped when nullptr.
+ */
+void ConvBackward(const ConvGeometry& g, const float* gout,
+                  const float* data, const float* weight,
+                  float* gdata, float* gweight, float* gbias);
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_CONV_H_
@@ -0,0 +1,95 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file ewise_program.h
+ * \brief kernel of fused elementwise ops on CPU.
+ *
+ *  A chain of elementwise ops is compiled into a small register program,
+ *  which is run over cache sized tiles of the output. Each instruction
+ *  is a simd kernel over one tile, so the whole chain makes a single
+ *  pass over the memory of its inputs and output.
+ */
+#ifndef TINYFLOW_NATIVE_EWISE_PROGRAM_H_
+#define TINYFLOW_NATIVE_EWISE_PROGRAM_H_
+
+#include <tinyflow/base.h>
+#include <dmlc/logging.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace tinyflow {
+
+/*! \brief instruction code of the elementwise program */
+enum class EwiseOpcode : int {
+  kAdd,
+  kSub,
+  kMul,
+  kDiv,
+  kPow,
+  kAddScalar,
+  kSubScalar,
+  kRSubScalar,
+  kMulScalar,
+  kDivScalar,
+  kRPowScalar,
+  kExp,
+  kLog,
+  kSqrt
+};
+
+/*! \brief one instruction, out = code(lhs, rhs, scalar) */
+struct EwiseInstr {
+  EwiseOpcode code;
+  /*! \brief register of the operands, rhs is -1 for unary and scalar ops */
+  int lhs, rhs;
+  /*! \brief the scalar argument of scalar ops */
+  float scalar;
+};
+
+/*!
+ * \brief program of a fused elementwise kernel.
+ *  Register i < num_inputs is input i, each instruction writes
+ *  a new register, num_inputs + its index. The last one is the output.
+ *  Inputs of shape (1,) broadcast as scalars, like the ops they replace.
+ */
+class EwiseProgram {
+ public:
+  /*! \brief number of elements per tile, the registers of a tile stay in L1 */
+  static const size_t kTileSize = 256;
+  /*! \brief number of inputs */
+  int num_inputs{0};
+  /*! \brief the instructions, in execution order */
+  std::vector<EwiseInstr> instrs;
+  /*!
+   * \brief append an instruction.
+   * \return the register of the result.
+   */
+  inline int Emit(EwiseOpcode code, int lhs, int rhs = -1, float scalar = 0.0f) {
+    instrs.push_back(EwiseInstr{code, lhs, rhs, scalar});
+    return num_inputs + static_cast<int>(instrs.size()) - 1;
+  }
+  /*!
+   * \brief run the program.
+   *  The output can share the space of any input of the same size.
+   */
+  void Run(const std::vector<TBlob>& inputs, const TBlob& output) const;
+  /*! \return readable form of the program, e.g. mul(%0, add(%1, 2)) */
+  std::string ToString() const;
+};
+
+/*!
+ * \brief emit the instructions of an elementwise op into the program.
+ *  The CPU counterpart of FCodeGen, used by the FuseElemwise pass.
+ * \param attrs attributes of the node.
+ * \param inputs register of each input.
+ * \param prog the program to append to.
+ * \return register of the output.
+ */
+using FEwiseCodeGen = std::function<
+  int(const nnvm::NodeAttrs& attrs,
+      const std::vector<int>& inputs,
+      EwiseProgram* prog)>;
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_EWISE_PROGRAM_H_
@@ -0,0 +1,279 @@
+// Copyright (c) 2016 by Contributors
+// cache blocked sgemm, in the loop order of GotoBLAS:
+// the columns of c are cut into kNC chunks, k into kKC slices, whose
+// panel of op(b) is packed to stay in L3, and the rows into kMC blocks,
+// whose panel of op(a) is packed to stay in L2. The micro kernel then
+// runs over the packed panels one register tile at a time.
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "./gemm.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+namespace {
+
+const size_t kMC = 120;
+const size_t kKC = 256;
+const size_t kNC = 1024;
+// widest tile of the micro kernels, the one of AVX-512.
+const size_t kMaxNR = 32;
+// products of fewer multiply-adds run on the calling thread.
+const size_t kParallelWork = 1 << 18;
+
+/*!
+ * \brief thread pool to run the tasks of one gemm.
+ *  Gemm can be called from the workers of the op scheduler at the same time,
+ *  only one call uses the pool, the others run on their own thread.
+ */
+class GemmThreadPool {
+ public:
+  static GemmThreadPool* Get() {
+    static GemmThreadPool inst;
+    return &inst;
+  }
+  ~GemmThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+  /*! \return number of threads, including the calling thread */
+  inline size_t num_threads() const {
+    return threads_.size() + 1;
+  }
+  /*! \brief run f(i) for i in [0, ntask), the calling thread also takes tasks */
+  void Run(size_t ntask, const std::function<void(size_t)>& f) {
+    std::unique_lock<std::mutex> run_lock(run_mutex_, std::try_to_lock);
+    if (!run_lock.owns_lock()) {
+      for (size_t i = 0; i < ntask; ++i) f(i);
+      return;
+    }
+    {
+      // workers that woke up late from the last run hold its state,
+      // wait until they leave before it is reset.
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cond_.wait(lock, [this]() { return num_active_ == 0; });
+      task_ = &f;
+      num_tasks_ = ntask;
+      next_task_ = 0;
+      error_ = nullptr;
+      ++generation_;
+    }
+    cond_.notify_all();
+    Work();
+    std::exception_ptr error;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cond_.wait(lock, [this]() { return num_active_ == 0; });
+      error = error_;
+    }
+    if (error) std::rethrow_exception(error);
+  }
+
+ private:
+  GemmThreadPool() {
+    int nthread = static_cast<int>(std::thread::hardware_concurrency());
+    const char* env = std::getenv("TINYFLOW_GEMM_THREADS");
+    if (env != nullptr) nthread = std::atoi(env);
+    for (int i = 1; i < nthread; ++i) {
+      threads_.emplace_back([this]() { this->WorkerLoop(); });
+    }
+  }
+  void WorkerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cond_.wait(lock, [this, seen]() { return stop_ || generation_ != seen; });
+      if (stop_) return;
+      seen = generation_;
+      ++num_active_;
+      lock.unlock();
+      Work();
+      lock.lock();
+      if (--num_active_ == 0) done_cond_.notify_all();
+    }
+  }
+  // take tasks until all of them are taken, the first error is kept.
+  void Work() {
+    size_t i;
+    while ((i = next_task_.fetch_add(1)) < num_tasks_) {
+      try {
+        (*task_)(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = std::current_exception();
+      }
+    }
+  }
+  std::vector<std::thread> threads_;
+  // held by the call that owns the pool
+  std::mutex run_mutex_;
+  // guards the state below, signaled on a new run and when workers leave
+  std::mutex mutex_;
+  std::condition_variable cond_, done_cond_;
+  bool stop_{false};
+  uint64_t generation_{0};
+  size_t num_active_{0};
+  // ----------------------------
+  // state of current run
+  const std::function<void(size_t)>* task_{nullptr};
+  size_t num_tasks_{0};
+  std::atomic<size_t> next_task_{0};
+  std::exception_ptr error_;
+};
+
+// address of element (row, col) of op(x)
+inline const float* OpPtr(bool trans, const float* x, size_t ld, size_t row, size_t col) {
+  return trans ? x + col * ld + row : x + row * ld + col;
+}
+
+// pack op(a) of (mc, kc) into panels of kSimdGemmMR rows, padded by zero.
+void PackA(bool trans, const float* a, size_t lda, size_t mc, size_t kc, float* pack) {
+  for (size_t ir = 0; ir < mc; ir += kSimdGemmMR) {
+    const size_t mr = std::min(kSimdGemmMR, mc - ir);
+    for (size_t p = 0; p < kc; ++p) {
+      for (size_t i = 0; i < mr; ++i) {
+        pack[i] = *OpPtr(trans, a, lda, ir + i, p);
+      }
+      std::fill(pack + mr, pack + kSimdGemmMR, 0.0f);
+      pack += kSimdGemmMR;
+    }
+  }
+}
+
+// pack op(b) of (kc, nc) into panels of nr columns, padded by zero.
+void PackB(bool trans, const float* b, size_t ldb, size_t kc, size_t nc,
+           size_t nr, float* pack) {
+  for (size_t jr = 0; jr < nc; jr += nr) {
+    const size_t nv = std::min(nr, nc - jr);
+    for (size_t p = 0; p < kc; ++p) {
+      for (size_t j = 0; j < nv; ++j) {
+        pack[j] = *OpPtr(trans, b, ldb, p, jr + j);
+      }
+      std::fill(pack + nv, pack + nr, 0.0f);
+      pack += nr;
+    }
+  }
+}
+
+// single threaded gemm, the arguments are those of Sgemm.
+void SgemmBlocked(bool trans_a, bool trans_b,
+                  size_t m, size_t n, size_t k,
+                  const float* a, size_t lda,
+                  const float* b, size_t ldb,
+                  float beta, float* c, size_t ldc) {
+  const SimdKernels& simd = Simd();
+  const size_t nr = simd.gemm_nr;
+  CHECK_LE(nr, kMaxNR);
+  if (beta != 0.0f && beta != 1.0f) {
+    for (size_t i = 0; i < m; ++i) {
+      simd.mul_scalar(c + i * ldc, beta, c + i * ldc, n);
+    }
+    beta = 1.0f;
+  }
+  if (k == 0) {
+    if (beta == 0.0f) {
+      for (size_t i = 0; i < m; ++i) std::fill(c + i * ldc, c + i * ldc + n, 0.0f);
+    }
+    return;
+  }
+  static thread_local std::vector<float> pack_a, pack_b;
+  pack_a.resize(kMC * kKC);
+  pack_b.resize(kKC * kNC);
+  float tile[kSimdGemmMR * kMaxNR];
+  for (size_t jc = 0; jc < n; jc += kNC) {
+    const size_t nc = std::min(kNC, n - jc);
+    for (size_t pc = 0; pc < k; pc += kKC) {
+      const size_t kc = std::min(kKC, k - pc);
+      // the first slice of k overwrites c when beta is 0.
+      const bool accumulate = pc != 0 || beta != 0.0f;
+      PackB(trans_b, OpPtr(trans_b, b, ldb, pc, jc), ldb, kc, nc, nr, pack_b.data());
+      for (size_t ic = 0; ic < m; ic += kMC) {
+        const size_t mc = std::min(kMC, m - ic);
+        PackA(trans_a, OpPtr(trans_a, a, lda, ic, pc), lda, mc, kc, pack_a.data());
+        for (size_t jr = 0; jr < nc; jr += nr) {
+          const size_t nv = std::min(nr, nc - jr);
+          const float* pb = pack_b.data() + jr * kc;
+          for (size_t ir = 0; ir < mc; ir += kSimdGemmMR) {
+            const size_t mv = std::min(kSimdGemmMR, mc - ir);
+            const float* pa = pack_a.data() + ir * kc;
+            float* ct = c + (ic + ir) * ldc + jc + jr;
+            if (mv == kSimdGemmMR && nv == nr) {
+              simd.gemm(kc, pa, pb, ct, ldc, accumulate);
+              continue;
+            }
+            // partial tile at the border, go through a full size tile.
+            simd.gemm(kc, pa, pb, tile, nr, false);
+            for (size_t i = 0; i < mv; ++i) {
+              for (size_t j = 0; j < nv; ++j) {
+                const float v = tile[i * nr + j];
+                ct[i * ldc + j] = accumulate ? ct[i * ldc + j] + v : v;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+void Sgemm(bool trans_a, bool trans_b,
+           size_t m, size_t n, size_t k,
+           const float* a, size_t lda,
+           const float* b, size_t ldb,
+           float beta, float* c, size_t ldc) {
+  if (m == 0 || n == 0) return;
+  size_t ntask = 1;
+  if (m * n * k >= kParallelWork) {
+    ntask = GemmThreadPool::Get()->num_threads();
+  }
+  // split the longer side of c into one panel per thread,
+  // aligned to the tile of the micro kernel.
+  const bool split_rows = m >= n;
+  const size_t align = split_rows ? kSimdGemmMR : Simd().gemm_nr;
+  const size_t len = split_rows ? m : n;
+  size_t step = (len + ntask - 1) / ntask;
+  step = (step + align - 1) / align * align;
+  ntask = (len + step - 1) / step;
+  if (ntask <= 1) {
+    SgemmBlocked(trans_a, trans_b, m, n, k, a, lda, b, ldb, beta, c, ldc);
+    return;
+  }
+  GemmThreadPool::Get()->Run(ntask, [&](size_t t) {
+      const size_t begin = t * step;
+      const size_t size = std::min(step, len - begin);
+      if (split_rows) {
+        SgemmBlocked(trans_a, trans_b, size, n, k,
+                     OpPtr(trans_a, a, lda, begin, 0), lda, b, ldb,
+                     beta, c + begin * ldc, ldc);
+      } else {
+        SgemmBlocked(trans_a, trans_b, m, size, k,
+                     a, lda, OpPtr(trans_b, b, ldb, 0, begin), ldb,
+                     beta, c + begin, ldc);
+      }
+    });
+}
+
+void ParallelFor(size_t ntask, const std::function<void(size_t)>& f) {
+  if (ntask <= 1) {
+    if (ntask == 1) f(0);
+    return;
+  }
+  GemmThreadPool::Get()->Run(ntask, f);
+}
+
+}  // namespace tinyflow
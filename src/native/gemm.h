@@ -0,0 +1,42 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file gemm.h
+ * \brief cache blocked single precision matrix multiplication on CPU.
+ *
+ *  The operands are packed into panels that stay in cache, and multiplied
+ *  by the register tiled micro kernel of the simd table. Large products are
+ *  split over the rows or columns of c and run on a thread pool, whose size
+ *  is set by the environment variable TINYFLOW_GEMM_THREADS.
+ */
+#ifndef TINYFLOW_NATIVE_GEMM_H_
+#define TINYFLOW_NATIVE_GEMM_H_
+
+#include <cstddef>
+#include <functional>
+
+namespace tinyflow {
+
+/*!
+ * \brief c = op(a) * op(b) + beta * c, all matrices are row major.
+ *  op(a) is (m, k) and op(b) is (k, n), the transposes are read in place.
+ *  c is not read when beta is 0.
+ * \param trans_a whether a is stored as (k, m).
+ * \param trans_b whether b is stored as (n, k).
+ * \param lda row stride of a, likewise ldb and ldc.
+ */
+void Sgemm(bool trans_a, bool trans_b,
+           size_t m, size_t n, size_t k,
+           const float* a, size_t lda,
+           const float* b, size_t ldb,
+           float beta, float* c, size_t ldc);
+
+/*!
+ * \brief run f(i) for i in [0, ntask) on the thread pool of gemm, the calling
+ *  thread also takes tasks. When another call holds the pool, the tasks run on
+ *  the calling thread.
+ */
+void ParallelFor(size_t ntask, const std::function<void(size_t)>& f);
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_GEMM_H_
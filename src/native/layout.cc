@@ -0,0 +1,32 @@
+// Copyright (c) 2016 by Contributors
+// layout transform of 4d images on CPU.
+#include <dmlc/logging.h>
+#include <algorithm>
+#include "./layout.h"
+
+namespace tinyflow {
+
+void TransformLayout(const DataLayout& src, const DataLayout& dst,
+                     const TShape& nchw, const float* in, float* out) {
+  if (src == dst) {
+    std::copy(in, in + nchw.Size(), out);
+    return;
+  }
+  const ImageView sv(src, nchw), dv(dst, nchw);
+  // write the destination in order, gather from the source.
+  for (size_t n = 0; n < dv.batch; ++n) {
+    for (size_t co = 0; co < dv.outer; ++co) {
+      for (size_t h = 0; h < dv.height; ++h) {
+        for (size_t w = 0; w < dv.width; ++w) {
+          const size_t c0 = co * dv.inner;
+          float* y = out + dv.offset(n, c0, h, w);
+          for (size_t ci = 0; ci < dv.inner; ++ci) {
+            y[ci] = in[sv.offset(n, c0 + ci, h, w)];
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace tinyflow
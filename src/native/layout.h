@@ -0,0 +1,50 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file layout.h
+ * \brief access to 4d images in any DataLayout on CPU.
+ */
+#ifndef TINYFLOW_NATIVE_LAYOUT_H_
+#define TINYFLOW_NATIVE_LAYOUT_H_
+
+#include <tinyflow/base.h>
+#include "../op_util.h"
+
+namespace tinyflow {
+
+/*!
+ * \brief the (batch, outer, height, width, inner) view of an image,
+ *  logical channel c is at (c / inner, c % inner).
+ *  Kernels that loop over the inner channels last run on every layout,
+ *  with a contiguous inner loop on NHWC and the blocked layouts.
+ */
+struct ImageView {
+  size_t batch, outer, height, width, inner;
+  /*! \brief view of an image with the NCHW shape nchw stored in layout */
+  ImageView(const DataLayout& layout, const TShape& nchw) {
+    CHECK_EQ(nchw.ndim(), 4);
+    batch = nchw[0];
+    inner = layout.inner(nchw[1]);
+    outer = inner == 0 ? 0 : nchw[1] / inner;
+    height = nchw[2];
+    width = nchw[3];
+  }
+  /*! \return number of channels */
+  inline size_t channels() const {
+    return outer * inner;
+  }
+  /*! \return offset of the element at (n, c, h, w) */
+  inline size_t offset(size_t n, size_t c, size_t h, size_t w) const {
+    return (((n * outer + c / inner) * height + h) * width + w) * inner + c % inner;
+  }
+};
+
+/*!
+ * \brief copy the image from layout src to layout dst.
+ * \param nchw the NCHW shape of the image.
+ */
+void TransformLayout(const DataLayout& src, const DataLayout& dst,
+                     const TShape& nchw, const float* in, float* out);
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_LAYOUT_H_
@@ -0,0 +1,125 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file native_util.h
+ * \brief common util for the native CPU backend.
+ */
+#ifndef TINYFLOW_NATIVE_UTIL_H_
+#define TINYFLOW_NATIVE_UTIL_H_
+
+#include <tinyflow/base.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tinyflow {
+
+/*! \brief alignment of native storage, large enough for any SIMD load */
+constexpr size_t kNativeAlign = 64;
+
+// create a new aligned float storage with given size
+inline std::shared_ptr<float> NewNativeStorage(size_t size) {
+  void* ptr = nullptr;
+  size_t nbytes = std::max(size, static_cast<size_t>(1)) * sizeof(float);
+  CHECK_EQ(posix_memalign(&ptr, kNativeAlign, nbytes), 0)
+      << "failed to allocate " << nbytes << " bytes";
+  return std::shared_ptr<float>(static_cast<float*>(ptr), std::free);
+}
+
+// get the float data pointer of a blob
+inline float* BlobPtr(const TBlob& blob) {
+  CHECK_EQ(blob.dtype, kFloat32) << "only float is supported so far";
+  return static_cast<float*>(blob.data);
+}
+
+// copy the content of src to dst, skip when they share the space.
+inline void CopyBlob(const TBlob& src, const TBlob& dst) {
+  CHECK_EQ(src.shape.Size(), dst.shape.Size());
+  if (src.data == dst.data) return;
+  std::memcpy(dst.data, src.data, src.shape.Size() * sizeof(float));
+}
+
+// get the scalar argument of scalar ops
+inline float GetScalar(const nnvm::NodeAttrs& attrs) {
+  auto it = attrs.dict.find("scalar");
+  CHECK(it != attrs.dict.end())
+      << "scalar argument is required by op " << attrs.op->name;
+  return std::stof(it->second);
+}
+
+// apply unary function f elementwise
+template<typename F>
+inline void UnaryMap(const TBlob& in, const TBlob& out, F f) {
+  const float* x = BlobPtr(in);
+  float* y = BlobPtr(out);
+  size_t n = out.shape.Size();
+  CHECK_EQ(in.shape.Size(), n);
+  for (size_t i = 0; i < n; ++i) {
+    y[i] = f(x[i]);
+  }
+}
+
+// apply binary function f elementwise,
+// either side can be a tensor of shape (1,) that broadcast as a scalar.
+template<typename F>
+inline void BinaryMap(const TBlob& lhs, const TBlob& rhs, const TBlob& out, F f) {
+  const float* a = BlobPtr(lhs);
+  const float* b = BlobPtr(rhs);
+  float* y = BlobPtr(out);
+  size_t n = out.shape.Size();
+  if (lhs.shape.Size() == 1 && n != 1) {
+    const float s = a[0];
+    for (size_t i = 0; i < n; ++i) y[i] = f(s, b[i]);
+  } else if (rhs.shape.Size() == 1 && n != 1) {
+    const float s = b[0];
+    for (size_t i = 0; i < n; ++i) y[i] = f(a[i], s);
+  } else {
+    CHECK_EQ(lhs.shape.Size(), n);
+    CHECK_EQ(rhs.shape.Size(), n);
+    for (size_t i = 0; i < n; ++i) y[i] = f(a[i], b[i]);
+  }
+}
+
+// make FCompute of binary elementwise op
+template<typename F>
+inline FCompute MakeBinaryCompute(F f) {
+  return [f](const nnvm::NodeAttrs& attrs,
+             const std::vector<TBlob>& inputs,
+             const std::vector<TBlob>& outputs) {
+    BinaryMap(inputs[0], inputs[1], outputs[0], f);
+  };
+}
+
+// make FCompute of unary elementwise op
+template<typename F>
+inline FCompute MakeUnaryCompute(F f) {
+  return [f](const nnvm::NodeAttrs& attrs,
+             const std::vector<TBlob>& inputs,
+             const std::vector<TBlob>& outputs) {
+    UnaryMap(inputs[0], outputs[0], f);
+  };
+}
+
+// make FCompute of op between tensor and scalar, f(x, scalar)
+template<typename F>
+inline FCompute MakeScalarCompute(F f) {
+  return [f](const nnvm::NodeAttrs& attrs,
+             const std::vector<TBlob>& inputs,
+             const std::vector<TBlob>& outputs) {
+    const float scalar = GetScalar(attrs);
+    UnaryMap(inputs[0], outputs[0], [f, scalar](float x) {
+        return f(x, scalar);
+      });
+  };
+}
+
+// create a session that runs FCompute kernels from the parsed config, defined in session_native.cc
+Session* CreateNativeSession(const std::unordered_map<std::string, std::string>& config);
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_UTIL_H_
@@ -0,0 +1,193 @@
+// Copyright (c) 2016 by Contributors
+// fused elementwise kernel on CPU, and the FEwiseCodeGen
+// of the elementwise ops it can be made of.
+#include <tinyflow/base.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include "../op_util.h"
+#include "./ewise_program.h"
+#include "./native_util.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+namespace {
+
+// run one instruction over a tile of n elements.
+inline void RunInstr(const EwiseInstr& ins, const float* a, const float* b,
+                     float* y, size_t n) {
+  const SimdKernels& k = Simd();
+  const float s = ins.scalar;
+  switch (ins.code) {
+    case EwiseOpcode::kAdd: k.add(a, b, y, n); break;
+    case EwiseOpcode::kSub: k.sub(a, b, y, n); break;
+    case EwiseOpcode::kMul: k.mul(a, b, y, n); break;
+    case EwiseOpcode::kDiv: k.div(a, b, y, n); break;
+    case EwiseOpcode::kPow:
+      for (size_t i = 0; i < n; ++i) y[i] = std::pow(a[i], b[i]);
+      break;
+    case EwiseOpcode::kAddScalar: k.add_scalar(a, s, y, n); break;
+    case EwiseOpcode::kSubScalar: k.sub_scalar(a, s, y, n); break;
+    case EwiseOpcode::kRSubScalar: k.rsub_scalar(a, s, y, n); break;
+    case EwiseOpcode::kMulScalar: k.mul_scalar(a, s, y, n); break;
+    case EwiseOpcode::kDivScalar: k.div_scalar(a, s, y, n); break;
+    case EwiseOpcode::kRPowScalar: SimdRPowScalar(a, s, y, n); break;
+    case EwiseOpcode::kExp: k.exp(a, y, n); break;
+    case EwiseOpcode::kLog: k.log(a, y, n); break;
+    case EwiseOpcode::kSqrt: k.sqrt(a, y, n); break;
+  }
+}
+
+// name of the instruction in the readable form.
+inline const char* OpcodeName(EwiseOpcode code) {
+  switch (code) {
+    case EwiseOpcode::kAdd: case EwiseOpcode::kAddScalar: return "add";
+    case EwiseOpcode::kSub: case EwiseOpcode::kSubScalar: return "sub";
+    case EwiseOpcode::kRSubScalar: return "rsub";
+    case EwiseOpcode::kMul: case EwiseOpcode::kMulScalar: return "mul";
+    case EwiseOpcode::kDiv: case EwiseOpcode::kDivScalar: return "div";
+    case EwiseOpcode::kPow: return "pow";
+    case EwiseOpcode::kRPowScalar: return "rpow";
+    case EwiseOpcode::kExp: return "exp";
+    case EwiseOpcode::kLog: return "log";
+    case EwiseOpcode::kSqrt: return "sqrt";
+  }
+  return "unknown";
+}
+
+// codegen of an op that maps to a single instruction,
+// scalar ops take the scalar from the attributes.
+inline FEwiseCodeGen MakeEwiseCodeGen(EwiseOpcode code, bool has_scalar = false) {
+  return [code, has_scalar](const NodeAttrs& attrs,
+                            const std::vector<int>& inputs,
+                            EwiseProgram* prog) {
+    if (has_scalar) {
+      return prog->Emit(code, inputs[0], -1, GetScalar(attrs));
+    }
+    return prog->Emit(code, inputs[0], inputs.size() > 1 ? inputs[1] : -1);
+  };
+}
+
+}  // namespace
+
+void EwiseProgram::Run(const std::vector<TBlob>& inputs, const TBlob& output) const {
+  CHECK_EQ(inputs.size(), static_cast<size_t>(num_inputs));
+  CHECK_NE(instrs.size(), 0U);
+  const size_t n = output.shape.Size();
+  const size_t num_regs = num_inputs + instrs.size();
+  // one tile per register, broadcast inputs are filled once.
+  std::vector<float> space(num_regs * kTileSize);
+  std::vector<const float*> src(num_inputs);
+  std::vector<bool> bcast(num_inputs, false);
+  for (int i = 0; i < num_inputs; ++i) {
+    const float* ptr = BlobPtr(inputs[i]);
+    if (inputs[i].shape.Size() == n) {
+      src[i] = ptr;
+    } else {
+      CHECK_EQ(inputs[i].shape.Size(), 1U)
+          << "input " << i << " of fused kernel is neither full size nor a scalar";
+      float* tile = dmlc::BeginPtr(space) + i * kTileSize;
+      std::fill(tile, tile + kTileSize, ptr[0]);
+      src[i] = tile;
+      bcast[i] = true;
+    }
+  }
+  std::vector<const float*> reg(num_regs);
+  float* out = BlobPtr(output);
+  for (size_t begin = 0; begin < n; begin += kTileSize) {
+    const size_t len = std::min(kTileSize, n - begin);
+    for (int i = 0; i < num_inputs; ++i) {
+      reg[i] = bcast[i] ? src[i] : src[i] + begin;
+    }
+    // only the last instruction writes the output,
+    // after all the reads of this tile, so it can share an input.
+    for (size_t k = 0; k < instrs.size(); ++k) {
+      const EwiseInstr& ins = instrs[k];
+      float* y = (k + 1 == instrs.size()) ?
+          out + begin : dmlc::BeginPtr(space) + (num_inputs + k) * kTileSize;
+      RunInstr(ins, reg[ins.lhs], ins.rhs < 0 ? nullptr : reg[ins.rhs], y, len);
+      reg[num_inputs + k] = y;
+    }
+  }
+}
+
+std::string EwiseProgram::ToString() const {
+  std::vector<std::string> reg;
+  for (int i = 0; i < num_inputs; ++i) {
+    reg.push_back("%" + std::to_string(i));
+  }
+  for (const EwiseInstr& ins : instrs) {
+    std::ostringstream os;
+    os << OpcodeName(ins.code) << '(' << reg[ins.lhs];
+    if (ins.rhs >= 0) {
+      os << ", " << reg[ins.rhs];
+    } else if (ins.code >= EwiseOpcode::kAddScalar &&
+               ins.code <= EwiseOpcode::kRPowScalar) {
+      os << ", " << ins.scalar;
+    }
+    os << ')';
+    reg.push_back(os.str());
+  }
+  return reg.back();
+}
+
+
+NNVM_REGISTER_OP(_fused_elemwise)
+.describe("chain of elementwise ops fused into one kernel by FuseElemwise")
+.set_num_inputs([](const NodeAttrs& attrs) {
+    return static_cast<uint32_t>(dmlc::get<EwiseProgram>(attrs.parsed).num_inputs);
+  })
+.set_attr<FInferShape>("FInferShape", SameShape)
+.set_attr<FInplaceOption>("FInplaceOption", InplaceIn0Out0)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    dmlc::get<EwiseProgram>(attrs.parsed).Run(inputs, outputs[0]);
+  });
+
+
+NNVM_REGISTER_OP(__add_symbol__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kAdd));
+
+NNVM_REGISTER_OP(__add_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kAddScalar, true));
+
+NNVM_REGISTER_OP(__sub_symbol__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kSub));
+
+NNVM_REGISTER_OP(__sub_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kSubScalar, true));
+
+NNVM_REGISTER_OP(__rsub_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kRSubScalar, true));
+
+NNVM_REGISTER_OP(mul)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kMul));
+
+NNVM_REGISTER_OP(__mul_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kMulScalar, true));
+
+NNVM_REGISTER_OP(__div_symbol__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kDiv));
+
+NNVM_REGISTER_OP(__div_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kDivScalar, true));
+
+NNVM_REGISTER_OP(exp)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kExp));
+
+NNVM_REGISTER_OP(log)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kLog));
+
+NNVM_REGISTER_OP(sqrt)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kSqrt));
+
+NNVM_REGISTER_OP(__pow_symbol__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kPow));
+
+NNVM_REGISTER_OP(__rpow_scalar__)
+.set_attr<FEwiseCodeGen>("FEwiseCodeGen", MakeEwiseCodeGen(EwiseOpcode::kRPowScalar, true));
+
+}  // namespace tinyflow
@@ -0,0 +1,631 @@
+// Copyright (c) 2016 by Contributors
+// native implementation of common nn operators
+#include <tinyflow/base.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "../op_util.h"
+#include "./conv.h"
+#include "./gemm.h"
+#include "./layout.h"
+#include "./native_util.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+// split the shape into (outer, len, inner) around the softmax channel,
+// follows the dimension convention of nn.SoftMax
+inline void SoftmaxDims(const TShape& shape,
+                        size_t* outer, size_t* len, size_t* inner) {
+  switch (shape.ndim()) {
+    case 1: *outer = 1; *len = shape[0]; *inner = 1; break;
+    case 2: *outer = shape[0]; *len = shape[1]; *inner = 1; break;
+    case 3: *outer = 1; *len = shape[0]; *inner = shape[1] * shape[2]; break;
+    case 4: *outer = shape[0]; *len = shape[1]; *inner = shape[2] * shape[3]; break;
+    default: LOG(FATAL) << "softmax only support 1-4 dimensional input";
+  }
+}
+
+
+NNVM_REGISTER_OP(relu)
+.set_attr<FCompute>(
+  "FCompute", MakeUnaryCompute([](float x) { return x > 0.0f ? x : 0.0f; }))
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    BinaryMap(inputs[0], inputs[2], outputs[0], [](float g, float y) {
+        return y > 0.0f ? g : 0.0f;
+      });
+  });
+
+
+NNVM_REGISTER_OP(tanh)
+.set_attr<FCompute>(
+  "FCompute", MakeUnaryCompute([](float x) { return std::tanh(x); }))
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    BinaryMap(inputs[0], inputs[2], outputs[0], [](float g, float y) {
+        return g * (1.0f - y * y);
+      });
+  });
+
+
+NNVM_REGISTER_OP(softmax)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    size_t outer, len, inner;
+    SoftmaxDims(inputs[0].shape, &outer, &len, &inner);
+    const float* x = BlobPtr(inputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < outer; ++i) {
+      for (size_t j = 0; j < inner; ++j) {
+        const size_t base = i * len * inner + j;
+        float mx = x[base];
+        for (size_t k = 1; k < len; ++k) {
+          mx = std::max(mx, x[base + k * inner]);
+        }
+        float sum = 0.0f;
+        for (size_t k = 0; k < len; ++k) {
+          y[base + k * inner] = std::exp(x[base + k * inner] - mx);
+          sum += y[base + k * inner];
+        }
+        for (size_t k = 0; k < len; ++k) {
+          y[base + k * inner] /= sum;
+        }
+      }
+    }
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    size_t outer, len, inner;
+    SoftmaxDims(inputs[2].shape, &outer, &len, &inner);
+    const float* g = BlobPtr(inputs[0]);
+    const float* y = BlobPtr(inputs[2]);
+    float* gx = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < outer; ++i) {
+      for (size_t j = 0; j < inner; ++j) {
+        const size_t base = i * len * inner + j;
+        float dot = 0.0f;
+        for (size_t k = 0; k < len; ++k) {
+          dot += g[base + k * inner] * y[base + k * inner];
+        }
+        for (size_t k = 0; k < len; ++k) {
+          gx[base + k * inner] = y[base + k * inner] * (g[base + k * inner] - dot);
+        }
+      }
+    }
+  });
+
+
+NNVM_REGISTER_OP(linear)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // y = x * W^T + b, x: (batch, in), W: (hidden, in)
+    float* y = BlobPtr(outputs[0]);
+    const size_t batch = inputs[0].shape[0];
+    const size_t nin = inputs[1].shape[1];
+    const size_t nout = inputs[1].shape[0];
+    float beta = 0.0f;
+    if (inputs.size() > 2) {
+      const float* b = BlobPtr(inputs[2]);
+      for (size_t i = 0; i < batch; ++i) {
+        std::copy(b, b + nout, y + i * nout);
+      }
+      beta = 1.0f;
+    }
+    Sgemm(false, true, batch, nout, nin, BlobPtr(inputs[0]), nin,
+          BlobPtr(inputs[1]), nin, beta, y, nout);
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, weight, [bias], output
+    // outputs: gradData, gradWeight, [gradBias]
+    const float* g = BlobPtr(inputs[0]);
+    const size_t batch = inputs[1].shape[0];
+    const size_t nin = inputs[2].shape[1];
+    const size_t nout = inputs[2].shape[0];
+    // gradData = gradOutput * W, skipped for the input layer.
+    if (outputs[0].data != nullptr) {
+      Sgemm(false, false, batch, nin, nout, g, nout, BlobPtr(inputs[2]), nin,
+            0.0f, BlobPtr(outputs[0]), nin);
+    }
+    // gradWeight = gradOutput^T * x
+    if (outputs[1].data != nullptr) {
+      Sgemm(true, false, nout, nin, batch, g, nout, BlobPtr(inputs[1]), nin,
+            0.0f, BlobPtr(outputs[1]), nin);
+    }
+    if (outputs.size() > 2 && outputs[2].data != nullptr) {
+      float* gb = BlobPtr(outputs[2]);
+      std::fill(gb, gb + nout, 0.0f);
+      for (size_t i = 0; i < batch; ++i) {
+        Simd().add(gb, g + i * nout, gb, nout);
+      }
+    }
+  });
+
+
+// the algorithm is picked once for the shapes of the node.
+NNVM_REGISTER_OP(conv2d)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCreateCompute>(
+  "FCreateCompute", [](const NodeAttrs& attrs,
+                       const std::vector<TShape>& ishape,
+                       const std::vector<TShape>& oshape) {
+    const ConvGeometry g = ConvGeometry::Make(
+        dmlc::get<ConvPoolParam>(attrs.parsed), ishape[0], ishape[1]);
+    const ConvAlgo algo = SelectConvAlgo(g);
+    return FCompute([g, algo](const NodeAttrs& attrs,
+                              const std::vector<TBlob>& inputs,
+                              const std::vector<TBlob>& outputs) {
+        const float* bias = inputs.size() > 2 ? BlobPtr(inputs[2]) : nullptr;
+        ConvForward(algo, g, BlobPtr(inputs[0]), BlobPtr(inputs[1]), bias,
+                    BlobPtr(outputs[0]));
+      });
+  })
+.set_attr<FCreateComputeBackward>(
+  "FCreateComputeBackward", [](const NodeAttrs& attrs,
+                               const std::vector<TShape>& ishape,
+                               const std::vector<TShape>& oshape) {
+    // inputs: gradOutput, data, weight, [bias]
+    // outputs: gradData, gradWeight, [gradBias]
+    const ConvGeometry g = ConvGeometry::Make(
+        dmlc::get<ConvPoolParam>(attrs.parsed), ishape[1], ishape[2]);
+    CHECK(!g.relu) << "conv2d with activation has no gradient, it is meant for inference";
+    return FCompute([g](const NodeAttrs& attrs,
+                        const std::vector<TBlob>& inputs,
+                        const std::vector<TBlob>& outputs) {
+        float* gbias = outputs.size() > 2 ? BlobPtr(outputs[2]) : nullptr;
+        ConvBackward(g, BlobPtr(inputs[0]), BlobPtr(inputs[1]), BlobPtr(inputs[2]),
+                     BlobPtr(outputs[0]), BlobPtr(outputs[1]), gbias);
+      });
+  });
+
+
+// window of max_pool and avg_pool over images in the layout of the op,
+// follows nn.SpatialMaxPooling and nn.SpatialAveragePooling.
+struct PoolGeometry {
+  ImageView in, out;
+  size_t kernel_h, kernel_w, stride_h, stride_w, pad_h, pad_w;
+  PoolGeometry(const NodeAttrs& attrs, const TShape& dshape, const TShape& oshape)
+      : in(Layout(attrs), Layout(attrs).ToNCHW(dshape)),
+        out(Layout(attrs), Layout(attrs).ToNCHW(oshape)) {
+    const auto& param = dmlc::get<ConvPoolParam>(attrs.parsed);
+    kernel_h = param.ksize[1];
+    kernel_w = param.ksize[2];
+    stride_h = param.strides[1];
+    stride_w = param.strides[2];
+    pad_h = param.padding == "SAME" ? (kernel_h - 1) / 2 : 0;
+    pad_w = param.padding == "SAME" ? (kernel_w - 1) / 2 : 0;
+  }
+  static DataLayout Layout(const NodeAttrs& attrs) {
+    return DataLayout::Parse(dmlc::get<ConvPoolParam>(attrs.parsed).data_format);
+  }
+  // visit f(x, y, len) for each input x of the window of each output y,
+  // x and y point to the len channels that are contiguous.
+  template<typename F>
+  inline void ForEach(F f) const {
+    const size_t len = in.inner;
+    for (size_t n = 0; n < out.batch; ++n) {
+      for (size_t c = 0; c < out.channels(); c += len) {
+        for (size_t oh = 0; oh < out.height; ++oh) {
+          for (size_t ow = 0; ow < out.width; ++ow) {
+            const size_t y = out.offset(n, c, oh, ow);
+            for (size_t kh = 0; kh < kernel_h; ++kh) {
+              const size_t ih = oh * stride_h + kh;
+              if (ih < pad_h || ih - pad_h >= in.height) continue;
+              for (size_t kw = 0; kw < kernel_w; ++kw) {
+                const size_t iw = ow * stride_w + kw;
+                if (iw < pad_w || iw - pad_w >= in.width) continue;
+                f(in.offset(n, c, ih - pad_h, iw - pad_w), y, len);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+
+NNVM_REGISTER_OP(max_pool)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const PoolGeometry g(attrs, inputs[0].shape, outputs[0].shape);
+    const float* x = BlobPtr(inputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    std::fill(y, y + outputs[0].shape.Size(), -std::numeric_limits<float>::infinity());
+    g.ForEach([x, y](size_t i, size_t o, size_t len) {
+        for (size_t j = 0; j < len; ++j) y[o + j] = std::max(y[o + j], x[i + j]);
+      });
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    // the gradient goes to the first input that equals the max of the window.
+    const PoolGeometry g(attrs, inputs[1].shape, inputs[2].shape);
+    const float* gy = BlobPtr(inputs[0]);
+    const float* x = BlobPtr(inputs[1]);
+    const float* y = BlobPtr(inputs[2]);
+    float* gx = BlobPtr(outputs[0]);
+    std::fill(gx, gx + outputs[0].shape.Size(), 0.0f);
+    std::vector<bool> taken(inputs[2].shape.Size(), false);
+    g.ForEach([&](size_t i, size_t o, size_t len) {
+        for (size_t j = 0; j < len; ++j) {
+          if (!taken[o + j] && x[i + j] == y[o + j]) {
+            gx[i + j] += gy[o + j];
+            taken[o + j] = true;
+          }
+        }
+      });
+  });
+
+
+NNVM_REGISTER_OP(avg_pool)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // the padding counts in the size of the window.
+    const PoolGeometry g(attrs, inputs[0].shape, outputs[0].shape);
+    const float* x = BlobPtr(inputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    const size_t size = outputs[0].shape.Size();
+    std::fill(y, y + size, 0.0f);
+    g.ForEach([x, y](size_t i, size_t o, size_t len) {
+        for (size_t j = 0; j < len; ++j) y[o + j] += x[i + j];
+      });
+    Simd().mul_scalar(y, 1.0f / (g.kernel_h * g.kernel_w), y, size);
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    const PoolGeometry g(attrs, inputs[1].shape, inputs[2].shape);
+    const float* gy = BlobPtr(inputs[0]);
+    float* gx = BlobPtr(outputs[0]);
+    const float scale = 1.0f / (g.kernel_h * g.kernel_w);
+    std::fill(gx, gx + outputs[0].shape.Size(), 0.0f);
+    g.ForEach([gy, gx, scale](size_t i, size_t o, size_t len) {
+        for (size_t j = 0; j < len; ++j) gx[i + j] += gy[o + j] * scale;
+      });
+  });
+
+
+// epsilon of nn.SpatialBatchNormalization
+const float kBatchNormEps = 1e-5f;
+
+// visit f(offset, c, len) for each run of len contiguous channels c, c + 1, ...
+template<typename F>
+inline void ForEachChannelRun(const ImageView& v, F f) {
+  for (size_t n = 0; n < v.batch; ++n) {
+    for (size_t c = 0; c < v.channels(); c += v.inner) {
+      for (size_t h = 0; h < v.height; ++h) {
+        for (size_t w = 0; w < v.width; ++w) {
+          f(v.offset(n, c, h, w), c, v.inner);
+        }
+      }
+    }
+  }
+}
+
+// mean and 1 / std of each channel over the batch, as in training.
+inline void BatchNormStats(const ImageView& v, const float* x,
+                           std::vector<float>* mean, std::vector<float>* istd) {
+  const size_t nchannel = v.channels();
+  std::vector<double> sum(nchannel, 0.0), sqsum(nchannel, 0.0);
+  ForEachChannelRun(v, [&](size_t i, size_t c, size_t len) {
+      for (size_t j = 0; j < len; ++j) {
+        sum[c + j] += x[i + j];
+        sqsum[c + j] += static_cast<double>(x[i + j]) * x[i + j];
+      }
+    });
+  const double count = static_cast<double>(v.batch * v.height * v.width);
+  mean->resize(nchannel);
+  istd->resize(nchannel);
+  for (size_t c = 0; c < nchannel; ++c) {
+    const double m = sum[c] / count;
+    const double var = std::max(sqsum[c] / count - m * m, 0.0);
+    (*mean)[c] = static_cast<float>(m);
+    (*istd)[c] = static_cast<float>(1.0 / std::sqrt(var + kBatchNormEps));
+  }
+}
+
+// mean and 1 / std of each channel from the moving statistics.
+inline void BatchNormGlobalStats(const float* moving_mean, const float* moving_var,
+                                 size_t nchannel,
+                                 std::vector<float>* mean, std::vector<float>* istd) {
+  mean->assign(moving_mean, moving_mean + nchannel);
+  istd->resize(nchannel);
+  for (size_t c = 0; c < nchannel; ++c) {
+    (*istd)[c] = 1.0f / std::sqrt(moving_var[c] + kBatchNormEps);
+  }
+}
+
+inline ImageView BatchNormView(const NodeAttrs& attrs, const TShape& shape) {
+  const auto& param = dmlc::get<BatchNormalizationParam>(attrs.parsed);
+  const DataLayout layout = DataLayout::Parse(param.data_format);
+  return ImageView(layout, layout.ToNCHW(shape));
+}
+
+
+NNVM_REGISTER_OP(batch_normalization)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // inputs: data, gamma, beta, [moving_mean, moving_var]
+    // normalized by the statistics of the batch, or the moving ones if given.
+    const ImageView v = BatchNormView(attrs, inputs[0].shape);
+    const float* x = BlobPtr(inputs[0]);
+    const float* gamma = BlobPtr(inputs[1]);
+    const float* beta = BlobPtr(inputs[2]);
+    float* y = BlobPtr(outputs[0]);
+    std::vector<float> mean, scale;
+    if (inputs.size() > 3) {
+      BatchNormGlobalStats(BlobPtr(inputs[3]), BlobPtr(inputs[4]), v.channels(),
+                           &mean, &scale);
+    } else {
+      BatchNormStats(v, x, &mean, &scale);
+    }
+    // y = x * scale + shift
+    std::vector<float> shift(v.channels());
+    for (size_t c = 0; c < v.channels(); ++c) {
+      scale[c] *= gamma[c];
+      shift[c] = beta[c] - mean[c] * scale[c];
+    }
+    ForEachChannelRun(v, [&](size_t i, size_t c, size_t len) {
+        for (size_t j = 0; j < len; ++j) {
+          y[i + j] = x[i + j] * scale[c + j] + shift[c + j];
+        }
+      });
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, gamma, beta, [moving_mean, moving_var], output
+    // outputs: gradData, gradGamma, gradBeta, [gradMean, gradVar]
+    const ImageView v = BatchNormView(attrs, inputs[1].shape);
+    const size_t nchannel = v.channels();
+    const bool global_stats = outputs.size() > 3;
+    const float* gy = BlobPtr(inputs[0]);
+    const float* x = BlobPtr(inputs[1]);
+    const float* gamma = BlobPtr(inputs[2]);
+    std::vector<float> mean, istd;
+    if (global_stats) {
+      BatchNormGlobalStats(BlobPtr(inputs[4]), BlobPtr(inputs[5]), nchannel, &mean, &istd);
+    } else {
+      BatchNormStats(v, x, &mean, &istd);
+    }
+    // sum of gy and gy * xhat per channel, xhat = (x - mean) * istd
+    std::vector<double> gsum(nchannel, 0.0), gdot(nchannel, 0.0);
+    ForEachChannelRun(v, [&](size_t i, size_t c, size_t len) {
+        for (size_t j = 0; j < len; ++j) {
+          gsum[c + j] += gy[i + j];
+          gdot[c + j] += gy[i + j] * (x[i + j] - mean[c + j]) * istd[c + j];
+        }
+      });
+    if (outputs[1].data != nullptr) {
+      float* ggamma = BlobPtr(outputs[1]);
+      for (size_t c = 0; c < nchannel; ++c) ggamma[c] = static_cast<float>(gdot[c]);
+    }
+    if (outputs[2].data != nullptr) {
+      float* gbeta = BlobPtr(outputs[2]);
+      for (size_t c = 0; c < nchannel; ++c) gbeta[c] = static_cast<float>(gsum[c]);
+    }
+    if (global_stats) {
+      // the statistics are constants of y = gamma * (x - mean) * istd + beta.
+      if (outputs[3].data != nullptr) {
+        float* gmean = BlobPtr(outputs[3]);
+        for (size_t c = 0; c < nchannel; ++c) {
+          gmean[c] = static_cast<float>(-gamma[c] * istd[c] * gsum[c]);
+        }
+      }
+      if (outputs[4].data != nullptr) {
+        float* gvar = BlobPtr(outputs[4]);
+        for (size_t c = 0; c < nchannel; ++c) {
+          gvar[c] = static_cast<float>(-0.5 * gamma[c] * istd[c] * istd[c] * gdot[c]);
+        }
+      }
+      if (outputs[0].data == nullptr) return;
+      float* gx = BlobPtr(outputs[0]);
+      ForEachChannelRun(v, [&](size_t i, size_t c, size_t len) {
+          for (size_t j = 0; j < len; ++j) {
+            gx[i + j] = gamma[c + j] * istd[c + j] * gy[i + j];
+          }
+        });
+      return;
+    }
+    if (outputs[0].data == nullptr) return;
+    // gx = gamma * istd * (gy - mean(gy) - xhat * mean(gy * xhat))
+    float* gx = BlobPtr(outputs[0]);
+    const double count = static_cast<double>(v.batch * v.height * v.width);
+    std::vector<float> gmean(nchannel), dmean(nchannel), scale(nchannel);
+    for (size_t c = 0; c < nchannel; ++c) {
+      gmean[c] = static_cast<float>(gsum[c] / count);
+      dmean[c] = static_cast<float>(gdot[c] / count);
+      scale[c] = gamma[c] * istd[c];
+    }
+    ForEachChannelRun(v, [&](size_t i, size_t c, size_t len) {
+        for (size_t j = 0; j < len; ++j) {
+          const float xhat = (x[i + j] - mean[c + j]) * istd[c + j];
+          gx[i + j] = scale[c + j] * (gy[i + j] - gmean[c + j] - xhat * dmean[c + j]);
+        }
+      });
+  });
+
+
+NNVM_REGISTER_OP(_batch_norm_fold)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // inputs: weight, [bias], gamma, beta, moving_mean, moving_var
+    // outputs: weight * scale, (bias - moving_mean) * scale + beta
+    // with scale = gamma / sqrt(moving_var + eps) of each output channel.
+    const bool no_bias = dmlc::get<BatchNormFoldParam>(attrs.parsed).no_bias;
+    const size_t nchannel = inputs[0].shape[0];
+    const size_t ckk = inputs[0].shape.Size() / nchannel;
+    const size_t k = no_bias ? 1 : 2;
+    const float* w = BlobPtr(inputs[0]);
+    const float* bias = no_bias ? nullptr : BlobPtr(inputs[1]);
+    const float* gamma = BlobPtr(inputs[k]);
+    const float* beta = BlobPtr(inputs[k + 1]);
+    std::vector<float> mean, scale;
+    BatchNormGlobalStats(BlobPtr(inputs[k + 2]), BlobPtr(inputs[k + 3]), nchannel,
+                         &mean, &scale);
+    float* wout = BlobPtr(outputs[0]);
+    float* bout = BlobPtr(outputs[1]);
+    for (size_t o = 0; o < nchannel; ++o) {
+      scale[o] *= gamma[o];
+      Simd().mul_scalar(w + o * ckk, scale[o], wout + o * ckk, ckk);
+      bout[o] = ((bias != nullptr ? bias[o] : 0.0f) - mean[o]) * scale[o] + beta[o];
+    }
+  });
+
+
+NNVM_REGISTER_OP(_layout_transform)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const auto& param = dmlc::get<LayoutTransformParam>(attrs.parsed);
+    const DataLayout src = DataLayout::Parse(param.src_layout);
+    TransformLayout(src, DataLayout::Parse(param.dst_layout),
+                    src.ToNCHW(inputs[0].shape), BlobPtr(inputs[0]),
+                    BlobPtr(outputs[0]));
+  });
+
+
+NNVM_REGISTER_OP(pad)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // negative pad pads in front of the dimension, as nn.Padding
+    const auto& param = dmlc::get<PadParam>(attrs.parsed);
+    const TShape& ishape = inputs[0].shape;
+    const size_t outer = ishape.ProdShape(0, param.dim);
+    const size_t ichunk = ishape.ProdShape(param.dim, ishape.ndim());
+    const size_t ochunk = outputs[0].shape.ProdShape(param.dim, ishape.ndim());
+    const size_t offset = param.pad < 0 ? ochunk - ichunk : 0;
+    const float* x = BlobPtr(inputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    std::fill(y, y + outputs[0].shape.Size(), 0.0f);
+    for (size_t i = 0; i < outer; ++i) {
+      std::copy(x + i * ichunk, x + (i + 1) * ichunk, y + i * ochunk + offset);
+    }
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, data, output
+    const auto& param = dmlc::get<PadParam>(attrs.parsed);
+    const TShape& ishape = outputs[0].shape;
+    const size_t outer = ishape.ProdShape(0, param.dim);
+    const size_t ichunk = ishape.ProdShape(param.dim, ishape.ndim());
+    const size_t ochunk = inputs[0].shape.ProdShape(param.dim, ishape.ndim());
+    const size_t offset = param.pad < 0 ? ochunk - ichunk : 0;
+    const float* g = BlobPtr(inputs[0]);
+    float* gx = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < outer; ++i) {
+      std::copy(g + i * ochunk + offset, g + i * ochunk + offset + ichunk,
+                gx + i * ichunk);
+    }
+  });
+
+
+NNVM_REGISTER_OP(mean_sparse_softmax_cross_entropy_with_logits)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // inputs: logits (batch, nclass), zero indexed label (batch,)
+    const TShape& shape = inputs[0].shape;
+    CHECK_EQ(shape.ndim(), 2);
+    const size_t batch = shape[0], nclass = shape[1];
+    const float* x = BlobPtr(inputs[0]);
+    const float* label = BlobPtr(inputs[1]);
+    double loss = 0.0;
+    for (size_t i = 0; i < batch; ++i) {
+      const float* row = x + i * nclass;
+      const float mx = *std::max_element(row, row + nclass);
+      double sum = 0.0;
+      for (size_t k = 0; k < nclass; ++k) sum += std::exp(row[k] - mx);
+      const size_t target = static_cast<size_t>(label[i]);
+      CHECK_LT(target, nclass) << "label out of range";
+      loss += std::log(sum) + mx - row[target];
+    }
+    BlobPtr(outputs[0])[0] = static_cast<float>(loss / batch);
+  })
+.set_attr<FComputeBackward>(
+  "FComputeBackward", [](const NodeAttrs& attrs,
+                         const std::vector<TBlob>& inputs,
+                         const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput, logits, label
+    const TShape& shape = inputs[1].shape;
+    const size_t batch = shape[0], nclass = shape[1];
+    const float scale = BlobPtr(inputs[0])[0] / batch;
+    const float* x = BlobPtr(inputs[1]);
+    const float* label = BlobPtr(inputs[2]);
+    float* gx = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < batch; ++i) {
+      const float* row = x + i * nclass;
+      float* grow = gx + i * nclass;
+      const float mx = *std::max_element(row, row + nclass);
+      float sum = 0.0f;
+      for (size_t k = 0; k < nclass; ++k) {
+        grow[k] = std::exp(row[k] - mx);
+        sum += grow[k];
+      }
+      for (size_t k = 0; k < nclass; ++k) {
+        grow[k] = grow[k] / sum * scale;
+      }
+      grow[static_cast<size_t>(label[i])] -= scale;
+    }
+  });
+
+
+const FCompute kNativeReshape = [](const NodeAttrs& attrs,
+                                   const std::vector<TBlob>& inputs,
+                                   const std::vector<TBlob>& outputs) {
+  CopyBlob(inputs[0], outputs[0]);
+};
+
+
+NNVM_REGISTER_OP(flatten_layer)
+.set_attr<FCompute>("FCompute", kNativeReshape);
+
+
+NNVM_REGISTER_OP(_flatten_backward)
+.set_attr<FCompute>("FCompute", kNativeReshape);
+
+}  // namespace tinyflow
@@ -0,0 +1,28 @@
+// Copyright (c) 2016 by Contributors
+// native implementation of special operators
+#include <tinyflow/base.h>
+#include "./native_util.h"
+
+namespace tinyflow {
+
+const FCompute kNativeNOP = [](const nnvm::NodeAttrs& attrs,
+                               const std::vector<TBlob>& inputs,
+                               const std::vector<TBlob>& outputs) {};
+
+NNVM_REGISTER_OP(placeholder)
+.set_attr<FCompute>("FCompute", kNativeNOP);
+
+NNVM_REGISTER_OP(_nop)
+.set_attr<FCompute>("FCompute", kNativeNOP);
+
+NNVM_REGISTER_OP(assign)
+.set_attr<FCompute>(
+  "FCompute", [](const nnvm::NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    CopyBlob(inputs[1], inputs[0]);
+    // normally inplace optimization makes this a no-op
+    CopyBlob(inputs[1], outputs[0]);
+  });
+
+}  // namespace tinyflow
@@ -0,0 +1,592 @@
+// Copyright (c) 2016 by Contributors
+// native implementation of common tensor operators
+#include <tinyflow/base.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include "../op_util.h"
+#include "./gemm.h"
+#include "./native_util.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+// fill the output with a constant
+inline FCompute MakeFillCompute(float value) {
+  return [value](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    float* y = BlobPtr(outputs[0]);
+    std::fill(y, y + outputs[0].shape.Size(), value);
+  };
+}
+
+// FCompute of binary op on the simd kernels, fbinary(a, b),
+// flhs(b, s) and frhs(a, s) when either side is (1,) that broadcast as a scalar.
+inline FCompute MakeSimdBinaryCompute(SimdBinaryKernel SimdKernels::*fbinary,
+                                      SimdScalarKernel SimdKernels::*flhs,
+                                      SimdScalarKernel SimdKernels::*frhs) {
+  return [fbinary, flhs, frhs](const NodeAttrs& attrs,
+                               const std::vector<TBlob>& inputs,
+                               const std::vector<TBlob>& outputs) {
+    const float* a = BlobPtr(inputs[0]);
+    const float* b = BlobPtr(inputs[1]);
+    float* y = BlobPtr(outputs[0]);
+    size_t n = outputs[0].shape.Size();
+    if (inputs[0].shape.Size() == 1 && n != 1) {
+      (Simd().*flhs)(b, a[0], y, n);
+    } else if (inputs[1].shape.Size() == 1 && n != 1) {
+      (Simd().*frhs)(a, b[0], y, n);
+    } else {
+      CHECK_EQ(inputs[0].shape.Size(), n);
+      CHECK_EQ(inputs[1].shape.Size(), n);
+      (Simd().*fbinary)(a, b, y, n);
+    }
+  };
+}
+
+// FCompute of op between tensor and scalar argument on the simd kernels
+inline FCompute MakeSimdScalarCompute(SimdScalarKernel SimdKernels::*fscalar) {
+  return [fscalar](const NodeAttrs& attrs,
+                   const std::vector<TBlob>& inputs,
+                   const std::vector<TBlob>& outputs) {
+    CHECK_EQ(inputs[0].shape.Size(), outputs[0].shape.Size());
+    (Simd().*fscalar)(BlobPtr(inputs[0]), GetScalar(attrs),
+                      BlobPtr(outputs[0]), outputs[0].shape.Size());
+  };
+}
+
+// FCompute of unary op on the simd kernels
+inline FCompute MakeSimdUnaryCompute(SimdUnaryKernel SimdKernels::*funary) {
+  return [funary](const NodeAttrs& attrs,
+                  const std::vector<TBlob>& inputs,
+                  const std::vector<TBlob>& outputs) {
+    CHECK_EQ(inputs[0].shape.Size(), outputs[0].shape.Size());
+    (Simd().*funary)(BlobPtr(inputs[0]), BlobPtr(outputs[0]), outputs[0].shape.Size());
+  };
+}
+
+// get the reduction axis, the backward ops only carry the kwargs.
+inline Tuple<int> GetReduceAxis(const NodeAttrs& attrs) {
+  if (!attrs.parsed.empty()) {
+    return dmlc::get<ReduceParam>(attrs.parsed).reduction_indices;
+  }
+  ReduceParam param;
+  param.Init(attrs.dict);
+  return param.reduction_indices;
+}
+
+// visit each element of a tensor of ishape together with its
+// index in the reduced tensor, axis empty means reduce all.
+template<typename F>
+inline void ReduceVisit(const TShape& ishape, const Tuple<int>& axis, F f) {
+  const size_t ndim = ishape.ndim();
+  std::vector<size_t> ostride(ndim, 0);
+  size_t stride = 1;
+  for (size_t i = ndim; i != 0; --i) {
+    const size_t k = i - 1;
+    bool reduced = (axis.ndim() == 0);
+    for (int a : axis) {
+      if (static_cast<size_t>(a) == k) reduced = true;
+    }
+    if (!reduced) {
+      ostride[k] = stride;
+      stride *= ishape[k];
+    }
+  }
+  std::vector<size_t> coord(ndim, 0);
+  size_t oindex = 0;
+  const size_t size = ishape.Size();
+  for (size_t i = 0; i < size; ++i) {
+    f(i, oindex);
+    for (size_t d = ndim; d != 0; --d) {
+      const size_t k = d - 1;
+      oindex += ostride[k];
+      if (++coord[k] < ishape[k]) break;
+      oindex -= ostride[k] * ishape[k];
+      coord[k] = 0;
+    }
+  }
+}
+
+// reduce sum of input into output, scaled by scale
+inline void ReduceSumCompute(const NodeAttrs& attrs,
+                             const std::vector<TBlob>& inputs,
+                             const std::vector<TBlob>& outputs,
+                             bool mean) {
+  const float* x = BlobPtr(inputs[0]);
+  float* y = BlobPtr(outputs[0]);
+  const size_t osize = outputs[0].shape.Size();
+  std::fill(y, y + osize, 0.0f);
+  ReduceVisit(inputs[0].shape, GetReduceAxis(attrs),
+              [x, y](size_t i, size_t o) { y[o] += x[i]; });
+  if (mean) {
+    const float scale = static_cast<float>(osize) / inputs[0].shape.Size();
+    for (size_t i = 0; i < osize; ++i) y[i] *= scale;
+  }
+}
+
+// broadcast reduced input back to output shape, scaled by scale
+inline void ReduceBackwardCompute(const NodeAttrs& attrs,
+                                  const std::vector<TBlob>& inputs,
+                                  const std::vector<TBlob>& outputs,
+                                  bool mean) {
+  const float* x = BlobPtr(inputs[0]);
+  float* y = BlobPtr(outputs[0]);
+  const float scale = mean ?
+      static_cast<float>(inputs[0].shape.Size()) / outputs[0].shape.Size() : 1.0f;
+  ReduceVisit(outputs[0].shape, GetReduceAxis(attrs),
+              [x, y, scale](size_t i, size_t o) { y[i] = x[o] * scale; });
+}
+
+NNVM_REGISTER_OP(zeros)
+.set_attr<FCompute>("FCompute", MakeFillCompute(0.0f));
+
+
+NNVM_REGISTER_OP(zeros_like)
+.set_attr<FCompute>("FCompute", MakeFillCompute(0.0f));
+
+
+NNVM_REGISTER_OP(ones)
+.set_attr<FCompute>("FCompute", MakeFillCompute(1.0f));
+
+
+NNVM_REGISTER_OP(ones_like)
+.set_attr<FCompute>("FCompute", MakeFillCompute(1.0f));
+
+
+NNVM_REGISTER_OP(normal)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    static thread_local std::mt19937 engine{std::random_device{}()};
+    float scale = 1.0f;
+    auto it = attrs.dict.find("stdev");
+    if (it != attrs.dict.end()) scale = std::stof(it->second);
+    std::normal_distribution<float> dist(0.0f, scale);
+    float* y = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < outputs[0].shape.Size(); ++i) {
+      y[i] = dist(engine);
+    }
+  });
+
+
+NNVM_REGISTER_OP(equal)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdBinaryCompute(
+      &SimdKernels::equal, &SimdKernels::equal_scalar, &SimdKernels::equal_scalar));
+
+
+NNVM_REGISTER_OP(__ewise_sum__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // inplace option allows output to share space with the first input.
+    CopyBlob(inputs[0], outputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    size_t n = outputs[0].shape.Size();
+    for (size_t i = 1; i < inputs.size(); ++i) {
+      if (inputs[i].shape.Size() == 1 && n != 1) {
+        Simd().add_scalar(y, BlobPtr(inputs[i])[0], y, n);
+      } else {
+        CHECK_EQ(inputs[i].shape.Size(), n);
+        Simd().add(y, BlobPtr(inputs[i]), y, n);
+      }
+    }
+  });
+
+
+NNVM_REGISTER_OP(__add_symbol__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdBinaryCompute(
+      &SimdKernels::add, &SimdKernels::add_scalar, &SimdKernels::add_scalar));
+
+
+NNVM_REGISTER_OP(__add_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdScalarCompute(&SimdKernels::add_scalar));
+
+
+NNVM_REGISTER_OP(__sub_symbol__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdBinaryCompute(
+      &SimdKernels::sub, &SimdKernels::rsub_scalar, &SimdKernels::sub_scalar));
+
+
+NNVM_REGISTER_OP(__sub_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdScalarCompute(&SimdKernels::sub_scalar));
+
+
+NNVM_REGISTER_OP(__rsub_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdScalarCompute(&SimdKernels::rsub_scalar));
+
+
+NNVM_REGISTER_OP(mul)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdBinaryCompute(
+      &SimdKernels::mul, &SimdKernels::mul_scalar, &SimdKernels::mul_scalar));
+
+
+NNVM_REGISTER_OP(__mul_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdScalarCompute(&SimdKernels::mul_scalar));
+
+
+NNVM_REGISTER_OP(__div_symbol__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdBinaryCompute(
+      &SimdKernels::div, &SimdKernels::rdiv_scalar, &SimdKernels::div_scalar));
+
+
+NNVM_REGISTER_OP(__div_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdScalarCompute(&SimdKernels::div_scalar));
+
+
+NNVM_REGISTER_OP(exp)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdUnaryCompute(&SimdKernels::exp));
+
+
+NNVM_REGISTER_OP(log)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdUnaryCompute(&SimdKernels::log));
+
+
+NNVM_REGISTER_OP(sqrt)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeSimdUnaryCompute(&SimdKernels::sqrt));
+
+
+// negative base need the exact integer power, kept on std::pow.
+NNVM_REGISTER_OP(__pow_symbol__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", MakeBinaryCompute([](float a, float b) { return std::pow(a, b); }));
+
+
+NNVM_REGISTER_OP(__rpow_scalar__)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    CHECK_EQ(inputs[0].shape.Size(), outputs[0].shape.Size());
+    SimdRPowScalar(BlobPtr(inputs[0]), GetScalar(attrs),
+                   BlobPtr(outputs[0]), outputs[0].shape.Size());
+  });
+
+
+NNVM_REGISTER_OP(matmul)
+.set_attr<bool>("PreferNative", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const size_t m = inputs[0].shape[0];
+    const size_t k = inputs[0].shape[1];
+    const size_t n = inputs[1].shape[1];
+    Sgemm(false, false, m, n, k, BlobPtr(inputs[0]), k,
+          BlobPtr(inputs[1]), n, 0.0f, BlobPtr(outputs[0]), n);
+  });
+
+
+NNVM_REGISTER_OP(_matmul_backward)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    // inputs: gradOutput (m, n), lhs (m, k), rhs (k, n)
+    const float* gout = BlobPtr(inputs[0]);
+    const size_t m = inputs[1].shape[0];
+    const size_t k = inputs[1].shape[1];
+    const size_t n = inputs[2].shape[1];
+    // gradLhs = gradOutput * rhs^T
+    if (outputs[0].data != nullptr) {
+      Sgemm(false, true, m, k, n, gout, n, BlobPtr(inputs[2]), n,
+            0.0f, BlobPtr(outputs[0]), k);
+    }
+    // gradRhs = lhs^T * gradOutput
+    if (outputs[1].data != nullptr) {
+      Sgemm(true, false, k, n, m, BlobPtr(inputs[1]), k, gout, n,
+            0.0f, BlobPtr(outputs[1]), n);
+    }
+  });
+
+
+NNVM_REGISTER_OP(reduce_sum)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    ReduceSumCompute(attrs, inputs, outputs, false);
+  });
+
+
+NNVM_REGISTER_OP(reduce_mean)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    ReduceSumCompute(attrs, inputs, outputs, true);
+  });
+
+
+NNVM_REGISTER_OP(_reduce_sum_backward)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    ReduceBackwardCompute(attrs, inputs, outputs, false);
+  });
+
+
+NNVM_REGISTER_OP(_reduce_mean_backward)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    ReduceBackwardCompute(attrs, inputs, outputs, true);
+  });
+
+
+NNVM_REGISTER_OP(_argmax)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const Tuple<int>& axis = GetReduceAxis(attrs);
+    CHECK_EQ(axis.ndim(), 1) << "argmax only support one axis";
+    const TShape& ishape = inputs[0].shape;
+    const size_t k = static_cast<size_t>(axis[0]);
+    const size_t len = ishape[k];
+    const size_t outer = ishape.ProdShape(0, k);
+    const size_t inner = ishape.ProdShape(k + 1, ishape.ndim());
+    const float* x = BlobPtr(inputs[0]);
+    float* y = BlobPtr(outputs[0]);
+    for (size_t i = 0; i < outer; ++i) {
+      for (size_t j = 0; j < inner; ++j) {
+        const float* px = x + i * len * inner + j;
+        size_t best = 0;
+        for (size_t p = 1; p < len; ++p) {
+          if (px[p * inner] > px[best * inner]) best = p;
+        }
+        y[i * inner + j] = static_cast<float>(best);
+      }
+    }
+  });
+
+
+NNVM_REGISTER_OP(concat)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const uint32_t axis = dmlc::get<ConcatParam>(attrs.parsed).axis;
+    const TShape& oshape = outputs[0].shape;
+    const size_t outer = oshape.ProdShape(0, axis);
+    const size_t ostride = oshape.ProdShape(axis, oshape.ndim());
+    float* y = BlobPtr(outputs[0]);
+    size_t offset = 0;
+    for (const TBlob& in : inputs) {
+      const size_t chunk = in.shape.ProdShape(axis, in.shape.ndim());
+      const float* x = BlobPtr(in);
+      for (size_t i = 0; i < outer; ++i) {
+        std::copy(x + i * chunk, x + (i + 1) * chunk, y + i * ostride + offset);
+      }
+      offset += chunk;
+    }
+  });
+
+
+NNVM_REGISTER_OP(split)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    const uint32_t axis = dmlc::get<SplitParam>(attrs.parsed).axis;
+    const TShape& ishape = inputs[0].shape;
+    const size_t outer = ishape.ProdShape(0, axis);
+    const size_t istride = ishape.ProdShape(axis, ishape.ndim());
+    const float* x = BlobPtr(inputs[0]);
+    size_t offset = istride;
+    // the inplace option lets outputs[0] share space with input,
+    // so fill the outputs backward and compact the first one last.
+    for (size_t k = outputs.size(); k != 0; --k) {
+      const TBlob& out = outputs[k - 1];
+      const size_t chunk = out.shape.ProdShape(axis, out.shape.ndim());
+      float* y = BlobPtr(out);
+      offset -= chunk;
+      for (size_t i = 0; i < outer; ++i) {
+        std::memmove(y + i * chunk, x + i * istride + offset,
+                     chunk * sizeof(float));
+      }
+    }
+  });
+
+
+NNVM_REGISTER_OP(reshape)
+.set_attr<FCompute>(
+  "FCompute", [](const NodeAttrs& attrs,
+                 const std::vector<TBlob>& inputs,
+                 const std::vector<TBlob>& outputs) {
+    CopyBlob(inputs[0], outputs[0]);
+  });
+
+
+// the weights of an optimizer update node are cut into chunks of at most
+// kUpdateChunk floats, and consecutive chunks are packed into tasks of about
+// that many floats, so one task covers many small weights, e.g. the biases,
+// and a large weight is split over the threads of the gemm pool.
+const size_t kUpdateChunk = 1 << 14;
+// updates of fewer floats run on the calling thread.
+const size_t kParallelUpdate = 1 << 16;
+
+class UpdateWorkList {
+ public:
+  UpdateWorkList(const std::vector<TShape>& ishape, uint32_t num_weights) {
+    size_t task_size = 0;
+    task_begin_.push_back(0);
+    for (uint32_t i = 0; i < num_weights; ++i) {
+      const size_t size = ishape[i].Size();
+      total_ += size;
+      for (size_t begin = 0; begin < size; begin += kUpdateChunk) {
+        chunks_.push_back(Chunk{i, begin, std::min(kUpdateChunk, size - begin)});
+        task_size += chunks_.back().size;
+        if (task_size >= kUpdateChunk) {
+          task_begin_.push_back(chunks_.size());
+          task_size = 0;
+        }
+      }
+    }
+    if (task_size != 0) task_begin_.push_back(chunks_.size());
+  }
+  // run f(i, begin, size) on each chunk of weight i.
+  template<typename F>
+  void Run(F f) const {
+    auto task = [this, &f](size_t t) {
+      for (size_t c = task_begin_[t]; c < task_begin_[t + 1]; ++c) {
+        f(chunks_[c].index, chunks_[c].begin, chunks_[c].size);
+      }
+    };
+    const size_t ntask = task_begin_.size() - 1;
+    if (total_ < kParallelUpdate) {
+      for (size_t t = 0; t < ntask; ++t) task(t);
+    } else {
+      ParallelFor(ntask, task);
+    }
+  }
+
+ private:
+  struct Chunk {
+    uint32_t index;
+    size_t begin, size;
+  };
+  std::vector<Chunk> chunks_;
+  // the chunks of task t are [task_begin_[t], task_begin_[t + 1])
+  std::vector<size_t> task_begin_;
+  size_t total_{0};
+};
+
+// output i is a copy of the updated weight i, skipped when no one reads it.
+inline void CopyUpdatedWeights(const std::vector<TBlob>& inputs,
+                               const std::vector<TBlob>& outputs) {
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (outputs[i].data != nullptr) CopyBlob(inputs[i], outputs[i]);
+  }
+}
+
+NNVM_REGISTER_OP(sgd_update)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCreateCompute>(
+  "FCreateCompute", [](const NodeAttrs& attrs,
+                       const std::vector<TShape>& ishape,
+                       const std::vector<TShape>& oshape) {
+    const UpdateWorkList work(ishape, dmlc::get<OptimizerParam>(attrs.parsed).num_weights);
+    return FCompute([work](const NodeAttrs& attrs,
+                           const std::vector<TBlob>& inputs,
+                           const std::vector<TBlob>& outputs) {
+        // inputs: weights, grads
+        const auto& param = dmlc::get<OptimizerParam>(attrs.parsed);
+        const uint32_t n = param.num_weights;
+        work.Run([&](uint32_t i, size_t begin, size_t size) {
+            Simd().sgd_update(BlobPtr(inputs[i]) + begin, BlobPtr(inputs[n + i]) + begin,
+                              param.learning_rate, size);
+          });
+        CopyUpdatedWeights(inputs, outputs);
+      });
+  });
+
+NNVM_REGISTER_OP(momentum_update)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCreateCompute>(
+  "FCreateCompute", [](const NodeAttrs& attrs,
+                       const std::vector<TShape>& ishape,
+                       const std::vector<TShape>& oshape) {
+    const UpdateWorkList work(ishape, dmlc::get<OptimizerParam>(attrs.parsed).num_weights);
+    return FCompute([work](const NodeAttrs& attrs,
+                           const std::vector<TBlob>& inputs,
+                           const std::vector<TBlob>& outputs) {
+        // inputs: weights, grads, moms
+        const auto& param = dmlc::get<OptimizerParam>(attrs.parsed);
+        const uint32_t n = param.num_weights;
+        work.Run([&](uint32_t i, size_t begin, size_t size) {
+            Simd().momentum_update(BlobPtr(inputs[i]) + begin, BlobPtr(inputs[n + i]) + begin,
+                                   BlobPtr(inputs[2 * n + i]) + begin,
+                                   param.learning_rate, param.momentum, size);
+          });
+        CopyUpdatedWeights(inputs, outputs);
+      });
+  });
+
+NNVM_REGISTER_OP(adam_update)
+.set_attr<bool>("PreferNative", true)
+.set_attr<bool>("SkipUnusedOutputs", true)
+.set_attr<FCreateCompute>(
+  "FCreateCompute", [](const NodeAttrs& attrs,
+                       const std::vector<TShape>& ishape,
+                       const std::vector<TShape>& oshape) {
+    const UpdateWorkList work(ishape, dmlc::get<OptimizerParam>(attrs.parsed).num_weights);
+    return FCompute([work](const NodeAttrs& attrs,
+                           const std::vector<TBlob>& inputs,
+                           const std::vector<TBlob>& outputs) {
+        // inputs: weights, grads, ms, vs, t
+        const auto& param = dmlc::get<OptimizerParam>(attrs.parsed);
+        const uint32_t n = param.num_weights;
+        // the bias corrections of the moments are folded into the learning rate.
+        const float t = BlobPtr(inputs[4 * n])[0];
+        const float lr = param.learning_rate *
+            std::sqrt(1.0f - std::pow(param.beta2, t)) / (1.0f - std::pow(param.beta1, t));
+        work.Run([&](uint32_t i, size_t begin, size_t size) {
+            Simd().adam_update(BlobPtr(inputs[i]) + begin, BlobPtr(inputs[n + i]) + begin,
+                               BlobPtr(inputs[2 * n + i]) + begin,
+                               BlobPtr(inputs[3 * n + i]) + begin,
+                               lr, param.beta1, param.beta2, param.epsilon, size);
+          });
+        CopyUpdatedWeights(inputs, outputs);
+      });
+  });
+
+}  // namespace tinyflow
@@ -0,0 +1,837 @@
+// Copyright (c) 2016 by Contributors
+// native CPU session, runs FCompute kernels directly on TBlob
+// without going through the lua bridge.
+#include <tinyflow/base.h>
+#include <nnvm/pass_functions.h>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include "../op_util.h"
+#include "../profiler.h"
+#include "../scheduler.h"
+#include "../session_util.h"
+#include "../storage_arena.h"
+#include "./native_util.h"
+#include "./simd.h"
+
+namespace tinyflow {
+
+using dmlc::any;
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::ShapeVector;
+using nnvm::DTypeVector;
+using nnvm::StorageVector;
+
+class NativeExecutor;
+class DataParallelExecutor;
+
+/*! \brief shared variable living in host memory */
+struct NativeVarState {
+  /*! \brief The internal storage */
+  std::shared_ptr<float> storage;
+  /*! \brief The corresponding tblob */
+  TBlob blob;
+
+  /*! \return Whether the tensor is initialized already */
+  inline bool initialized() const {
+    return storage != nullptr;
+  }
+  // reset the space.
+  inline void ResetSpace(TShape shape, int dtype = 0) {
+    CHECK_EQ(dtype, kFloat32) << "only float is supported so far";
+    if (storage == nullptr || shape.Size() != blob.shape.Size()) {
+      storage = NewNativeStorage(shape.Size());
+    }
+    blob.data = storage.get();
+    blob.shape = shape;
+    blob.dev_mask = kCPU;
+    blob.dtype = dtype;
+  }
+};
+
+// shared variable map structure
+using NativeVarStateMap =
+    std::unordered_map<std::string, std::shared_ptr<NativeVarState> >;
+// arena of the host storages
+using NativeArena = StorageArena<std::shared_ptr<float> >;
+
+// native session, CPU only.
+class NativeSession : public Session {
+ public:
+  explicit NativeSession(const std::unordered_map<std::string, std::string>& config)
+      : cached_execs_(GetSessionOption(config, "exec_cache",
+                                       ExecutorCache<NativeExecutor>::kDefaultCapacity)),
+        cached_replicated_(GetSessionOption(
+            config, "exec_cache", ExecutorCache<DataParallelExecutor>::kDefaultCapacity)) {
+    // the native session is CPU only.
+    CheckSessionOptions(config, {"cpu-native", "async", "exec_cache", "num_threads",
+                                 "plan_concurrency", "replicas", "profile", "fusion",
+                                 "layout"}, "native");
+    int num_threads = GetSessionOption(config, "num_threads", 1);
+    if (num_threads != 1) {
+      scheduler_ = std::make_shared<OpScheduler>(num_threads);
+      plan_concurrency_ = GetSessionOption(
+          config, "plan_concurrency", scheduler_->num_workers());
+    }
+    // data parallel replicas of the graph, each runs on a thread of its own.
+    int num_replicas = GetSessionOption(config, "replicas", 1);
+    if (num_replicas != 1) {
+      replica_scheduler_ = std::make_shared<OpScheduler>(num_replicas);
+    }
+    if (config.count("profile") != 0) {
+      profiler_ = std::make_shared<OpProfiler>();
+    }
+    enable_fusion_ = config.count("fusion") != 0;
+    auto it = config.find("layout");
+    if (it != config.end()) layout_ = it->second;
+    arena_ = std::make_shared<NativeArena>(NewNativeStorage);
+  }
+  const std::vector<TBlob>&
+  Run(nnvm::Symbol* sym,
+      const std::unordered_map<std::string, TBlob>& inputs) override;
+  Callable* MakeCallable(nnvm::Symbol* sym,
+                         const std::vector<std::string>& feed_names) override;
+  std::string DumpProfile(const std::string& trace_file) override {
+    CHECK(profiler_ != nullptr) << "session is not created with profile option";
+    return profiler_->Dump(trace_file);
+  }
+  ExecCacheStats GetCacheStats() const override {
+    if (replica_scheduler_ != nullptr) return cached_replicated_.stats();
+    return cached_execs_.stats();
+  }
+  StorageStats GetStorageStats() const override {
+    return arena_->stats();
+  }
+
+ private:
+  // get the executor of the symbol from the cache.
+  std::shared_ptr<NativeExecutor> GetExecutor(nnvm::Symbol* sym);
+  // get the data parallel executor of the symbol from the cache.
+  std::shared_ptr<DataParallelExecutor> GetReplicatedExecutor(nnvm::Symbol* sym);
+  // local cached variable states.
+  NativeVarStateMap states_;
+  // storages shared by the executors.
+  std::shared_ptr<NativeArena> arena_;
+  // parallel scheduler, nullptr when ops run sequentially.
+  std::shared_ptr<OpScheduler> scheduler_;
+  // number of concurrent groups assumed by the memory planner.
+  int plan_concurrency_{1};
+  // threads of the data parallel replicas, nullptr when the graphs run whole.
+  std::shared_ptr<OpScheduler> replica_scheduler_;
+  // op profiler, nullptr when not profiling.
+  std::shared_ptr<OpProfiler> profiler_;
+  // whether to fuse elementwise ops.
+  bool enable_fusion_{false};
+  // layout to run the conv stacks in, empty to keep the graph's.
+  std::string layout_;
+  // cached executor
+  ExecutorCache<NativeExecutor> cached_execs_;
+  // cached data parallel executor, used when there are replicas.
+  ExecutorCache<DataParallelExecutor> cached_replicated_;
+};
+
+
+class NativeExecutor {
+ public:
+  // initialize the executor
+  // possibly update the states.
+  void Init(nnvm::Symbol symbol, NativeVarStateMap* states,
+            std::shared_ptr<NativeArena> arena,
+            std::shared_ptr<OpScheduler> scheduler = nullptr, int plan_concurrency = 1,
+            std::shared_ptr<OpProfiler> profiler = nullptr,
+            bool enable_fusion = false,
+            const std::string& layout = "");
+  /// run the executor, return the outputs.
+  const std::vector<TBlob>& Run(const std::unordered_map<std::string, TBlob>& inputs) {
+    return Run(ArrangeFeeds(graph_.indexed_graph(), placeholder_nids_, inputs));
+  }
+  /// run the executor with positional feeds in the order of feed_names().
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds);
+  /// run the executor with positional feeds, copy the outputs into the given space.
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs);
+  // names of the placeholders, in the order of positional feeds
+  inline std::vector<std::string> feed_names() const {
+    return PlaceholderNames(graph_.indexed_graph(), placeholder_nids_);
+  }
+
+ private:
+  // setup the executor space.
+  void SetupAuxiliaryMembers();
+  void Setup(const std::vector<TBlob>& feeds);
+  void SetupShapeDType(const std::vector<TBlob>& feeds, bool* need_redo_infer,
+                       bool* batch_only);
+  void SetupStorage(bool batch_only);
+  void PlanStorage();
+  void SetupVarSpace();
+  void SetupOpExecs();
+  // internal graph
+  nnvm::Graph graph_;
+  // variable states map.
+  NativeVarStateMap* var_states_;
+  // shape vector in graph attribute
+  const ShapeVector* node_shape_{nullptr};
+  // type vector in graph attribute
+  const DTypeVector* node_dtype_{nullptr};
+  // shapes inferred for the batch sizes seen.
+  BatchShapeCache shape_cache_;
+  // ----------------------------
+  // node auxiliary data structures
+  // node id of place holder ops, also the order of positional feeds.
+  std::vector<uint32_t> placeholder_nids_;
+  // size of number of node, placeholder_tblobs_[nid].data != nullptr
+  // if nid is a placeholder and the content is the corresponding TBlob to be copied in.
+  std::vector<TBlob> placeholder_tblobs_;
+  // whether the placeholder entry aliases the fed buffer instead of a copy.
+  std::vector<bool> placeholder_alias_;
+  // node id of variable that is assigned in this executor
+  std::vector<uint32_t> assign_var_nids_;
+  // node id of variable that is readed by this executor
+  // can overlap with assign_var_nids_
+  std::vector<uint32_t> read_var_nids_;
+  // vector maps nid->state, nullptr for non variables.
+  std::vector<NativeVarState*> node_states_;
+  // ----------------------------
+  // execution information
+  // data of each outputs
+  std::vector<TBlob> data_entry_;
+  // whether data entry is variable.
+  std::vector<bool> data_entry_is_var_;
+  // arena of the storages.
+  std::shared_ptr<NativeArena> arena_;
+  // internal storage space, and the number of floats planned for each.
+  std::vector<NativeArena::Block> storage_pool_;
+  std::vector<size_t> pool_capacity_;
+  // space of the outputs of constant nodes, by entry.
+  std::vector<NativeArena::Block> constant_storage_;
+  // operator executor closures
+  std::vector<FOpExec> op_execs_;
+  // parallel scheduler and dependency between the nodes.
+  std::shared_ptr<OpScheduler> scheduler_;
+  int plan_concurrency_{1};
+  OpDepGraph op_deps_;
+  std::vector<bool> op_on_driver_;
+  // op profiler, nullptr when not profiling.
+  std::shared_ptr<OpProfiler> profiler_;
+  // the output blobs, point to the internal space.
+  std::vector<TBlob> output_blobs_;
+};
+
+/*!
+ * \brief executor of data parallel training over replicas of the graph.
+ *  The feeds are cut on the batch axis and the replicas run the forward and
+ *  backward on their shard at the same time, each on a thread of the replica
+ *  scheduler, reading the same variable states. The gradients are combined
+ *  by a tree of pairwise sums, each of which runs as soon as both halves are
+ *  ready, then the update graph applies them once on the calling thread.
+ *  The graphs SplitDataParallel does not cut, e.g. the initialization or
+ *  the inference, run whole.
+ */
+class DataParallelExecutor {
+ public:
+  void Init(nnvm::Symbol symbol, NativeVarStateMap* states,
+            std::shared_ptr<NativeArena> arena,
+            std::shared_ptr<OpScheduler> replica_scheduler,
+            std::shared_ptr<OpScheduler> scheduler, int plan_concurrency,
+            std::shared_ptr<OpProfiler> profiler,
+            bool enable_fusion, const std::string& layout);
+  /// run the executor, return the outputs.
+  const std::vector<TBlob>& Run(const std::unordered_map<std::string, TBlob>& inputs) {
+    std::vector<TBlob> feeds(feed_names_.size());
+    for (size_t i = 0; i < feed_names_.size(); ++i) {
+      auto it = inputs.find(feed_names_[i]);
+      CHECK(it != inputs.end())
+          << "Not enought placeholder argument to feed_dict";
+      feeds[i] = it->second;
+    }
+    return Run(feeds);
+  }
+  /// run the executor with positional feeds in the order of feed_names().
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds);
+  /// run the executor with positional feeds, copy the outputs into the given space.
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs) {
+    const std::vector<TBlob>& ret = this->Run(feeds);
+    CHECK_EQ(ret.size(), outputs.size()) << "number of outputs mismatch";
+    for (size_t i = 0; i < ret.size(); ++i) {
+      CHECK_EQ(ret[i].shape, outputs[i].shape) << "shape of output " << i << " mismatch";
+      CopyBlob(ret[i], outputs[i]);
+    }
+  }
+  // names of the placeholders, in the order of positional feeds
+  inline const std::vector<std::string>& feed_names() const {
+    return feed_names_;
+  }
+
+ private:
+  // run replica r on its shard, and scale its outputs that are averaged.
+  void RunReplica(size_t r, float weight);
+  // add the outputs of replica src that are combined to those of dst.
+  void AddPartial(size_t dst, size_t src);
+  // check that the outputs to concatenate keep the batch axis.
+  void CheckConcat(const std::vector<size_t>& begin) const;
+  // the value of output k of the replicas combined, not for kConcat.
+  TBlob Combined(size_t k) const;
+  // output k of the replicas, concatenated on the batch axis.
+  TBlob Concat(size_t k, const std::vector<size_t>& begin, std::vector<float>* space) const;
+  // the graph cut in replicas and updates.
+  DataParallelGraph graph_;
+  // executor of the whole graph, for the runs without batch.
+  std::shared_ptr<NativeExecutor> whole_;
+  // executors of the replicas.
+  std::vector<std::shared_ptr<NativeExecutor> > replicas_;
+  // executor of the updates, nullptr if there are none.
+  std::shared_ptr<NativeExecutor> update_;
+  // names of the placeholders of the whole graph, in the order of positional feeds.
+  std::vector<std::string> feed_names_;
+  // whether each feed is cut on the batch axis.
+  std::vector<bool> batch_feed_;
+  // feed of each placeholder of the replicas.
+  std::vector<size_t> replica_slot_;
+  // feed of each placeholder of the updates, feeds.size() + k for output k of the replicas.
+  std::vector<size_t> update_slot_;
+  // threads of the replicas, the calling thread included.
+  std::shared_ptr<OpScheduler> replica_scheduler_;
+  // ----------------------------
+  // state of the current run
+  // feeds of each replica, a shard of the batch.
+  std::vector<std::vector<TBlob> > replica_feeds_;
+  // outputs of each replica, those averaged or summed hold the partial sums.
+  std::vector<const std::vector<TBlob>*> replica_out_;
+  std::vector<TBlob> update_feeds_;
+  // space of the concatenated outputs.
+  std::vector<std::vector<float> > out_space_;
+  std::vector<TBlob> output_blobs_;
+};
+
+Session* CreateNativeSession(const std::unordered_map<std::string, std::string>& config) {
+  return new NativeSession(config);
+}
+
+std::shared_ptr<NativeExecutor> NativeSession::GetExecutor(nnvm::Symbol* new_sym) {
+  return cached_execs_.Get(
+      *new_sym, [this](const nnvm::Symbol& sym) {
+        auto exec = std::make_shared<NativeExecutor>();
+        exec->Init(sym, &states_, arena_, scheduler_, plan_concurrency_, profiler_,
+                   enable_fusion_, layout_);
+        return exec;
+      });
+}
+
+std::shared_ptr<DataParallelExecutor> NativeSession::GetReplicatedExecutor(
+    nnvm::Symbol* new_sym) {
+  return cached_replicated_.Get(
+      *new_sym, [this](const nnvm::Symbol& sym) {
+        auto exec = std::make_shared<DataParallelExecutor>();
+        exec->Init(sym, &states_, arena_, replica_scheduler_, scheduler_, plan_concurrency_,
+                   profiler_, enable_fusion_, layout_);
+        return exec;
+      });
+}
+
+const std::vector<TBlob>& NativeSession::Run(
+    nnvm::Symbol* new_sym,
+    const std::unordered_map<std::string, TBlob>& inputs) {
+  if (replica_scheduler_ != nullptr) {
+    return GetReplicatedExecutor(new_sym)->Run(inputs);
+  }
+  return GetExecutor(new_sym)->Run(inputs);
+}
+
+Callable* NativeSession::MakeCallable(
+    nnvm::Symbol* new_sym,
+    const std::vector<std::string>& feed_names) {
+  if (replica_scheduler_ != nullptr) {
+    return new ExecutorCallable<DataParallelExecutor>(
+        GetReplicatedExecutor(new_sym), feed_names);
+  }
+  return new ExecutorCallable<NativeExecutor>(GetExecutor(new_sym), feed_names);
+}
+
+void NativeExecutor::Init(nnvm::Symbol symbol, NativeVarStateMap* states,
+                          std::shared_ptr<NativeArena> arena,
+                          std::shared_ptr<OpScheduler> scheduler,
+                          int plan_concurrency,
+                          std::shared_ptr<OpProfiler> profiler,
+                          bool enable_fusion,
+                          const std::string& layout) {
+  graph_.outputs = symbol.outputs;
+  var_states_ = states;
+  arena_ = arena;
+  scheduler_ = scheduler;
+  plan_concurrency_ = plan_concurrency;
+  profiler_ = profiler;
+  graph_ = OptimizeGraph(std::move(graph_), true, layout, enable_fusion);
+  SetupAuxiliaryMembers();
+}
+
+void NativeExecutor::SetupAuxiliaryMembers() {
+  // initialize all node auxiliary data structures.
+  const Op* assign_op = Op::Get("assign");
+  const Op* placeholder_op = Op::Get("placeholder");
+  const auto& idx = graph_.indexed_graph();
+  node_states_.resize(idx.num_nodes(), nullptr);
+
+  std::vector<int> read_count(idx.num_nodes(), 0);
+  std::vector<int> assign_count(idx.num_nodes(), 0);
+  placeholder_tblobs_.resize(idx.num_nodes());
+
+  for (uint32_t i = idx.num_nodes(); i != 0; --i) {
+    uint32_t nid = i - 1;
+    auto& inode = idx[nid];
+    if (inode.source->is_variable()) {
+      const std::string& key = inode.source->attrs.name;
+      if (var_states_->count(key) == 0) {
+        (*var_states_)[key] = std::make_shared<NativeVarState>();
+      }
+      node_states_[nid] = var_states_->at(key).get();
+      if (read_count[nid] != 0 || assign_count[nid] == 0) {
+        read_var_nids_.push_back(nid);
+      }
+      if (assign_count[nid] != 0) {
+        assign_var_nids_.push_back(nid);
+      }
+    } else {
+      if (inode.source->op() == placeholder_op) {
+        placeholder_nids_.push_back(nid);
+      } else if (inode.source->op() == assign_op) {
+        CHECK_EQ(inode.inputs.size(), 2);
+        ++read_count[inode.inputs[1].node_id];
+        ++assign_count[inode.inputs[0].node_id];
+      } else {
+        for (auto e : inode.inputs) {
+          ++read_count[e.node_id];
+        }
+      }
+    }
+  }
+}
+
+const std::vector<TBlob>&
+NativeExecutor::Run(const std::vector<TBlob>& feeds) {
+  Setup(feeds);
+  const auto& idx = graph_.indexed_graph();
+  if (scheduler_ != nullptr) {
+    try {
+      scheduler_->Run(op_deps_, op_execs_, op_on_driver_);
+    } catch (dmlc::Error& e) {
+      LOG(INFO) << "error catched in op "
+                << idx[scheduler_->error_node()].source->op()->name;
+      throw;
+    }
+  } else {
+    for (size_t i = 0; i < op_execs_.size(); ++i) {
+      try {
+        if (op_execs_[i]) {
+          op_execs_[i]();
+        }
+      } catch (dmlc::Error& e) {
+        LOG(INFO) << "error catched in op " << idx[i].source->op()->name;
+        throw;
+      }
+    }
+  }
+  // the outputs point directly into the executor space,
+  // they stay valid until the next run.
+  output_blobs_.clear();
+  for (size_t i = 0; i < idx.outputs().size(); ++i) {
+    output_blobs_.push_back(data_entry_[idx.entry_id(idx.outputs()[i])]);
+  }
+  return output_blobs_;
+}
+
+void NativeExecutor::RunInto(const std::vector<TBlob>& feeds,
+                             const std::vector<TBlob>& outputs) {
+  const std::vector<TBlob>& ret = this->Run(feeds);
+  CHECK_EQ(ret.size(), outputs.size()) << "number of outputs mismatch";
+  for (size_t i = 0; i < ret.size(); ++i) {
+    CHECK_EQ(ret[i].shape, outputs[i].shape) << "shape of output " << i << " mismatch";
+    CopyBlob(ret[i], outputs[i]);
+  }
+}
+
+void NativeExecutor::Setup(const std::vector<TBlob>& feeds) {
+  CHECK_EQ(feeds.size(), placeholder_nids_.size())
+      << "Not enought placeholder argument to feed_dict";
+  bool need_redo_infer, batch_only;
+  SetupShapeDType(feeds, &need_redo_infer, &batch_only);
+  if (need_redo_infer) SetupStorage(batch_only);
+  // variable space can be reallocated by other executors in the session.
+  SetupVarSpace();
+  if (need_redo_infer) SetupOpExecs();
+  {
+    // copy inputs
+    const auto& idx = graph_.indexed_graph();
+    for (size_t i = 0; i < placeholder_nids_.size(); ++i) {
+      uint32_t nid = placeholder_nids_[i];
+      const TBlob& value = feeds[i];
+      CHECK_EQ(value.dev_mask, kCPU)
+          << "native session only accept CPU feed";
+      placeholder_tblobs_[nid] = value;
+      // bind the entry to the fed buffer instead of copying.
+      if (placeholder_alias_[nid]) data_entry_[idx.entry_id(nid, 0)] = value;
+    }
+  }
+}
+
+void NativeExecutor::SetupShapeDType(
+    const std::vector<TBlob>& feeds,
+    bool* p_need_redo_infer,
+    bool* p_batch_only) {
+  auto var_blob = [this](uint32_t nid) -> const TBlob* {
+    const NativeVarState* state = node_states_[nid];
+    CHECK(state != nullptr);
+    return state->initialized() ? &(state->blob) : nullptr;
+  };
+  *p_need_redo_infer = InferGraphShape(
+      &graph_, read_var_nids_, assign_var_nids_, var_blob, placeholder_nids_,
+      feeds, &shape_cache_, &node_shape_, &node_dtype_, p_batch_only);
+  if (!*p_need_redo_infer) return;
+  const auto& idx = graph_.indexed_graph();
+  // setup out Variable space.
+  for (uint32_t nid : assign_var_nids_) {
+    node_states_[nid]->ResetSpace(
+        node_shape_->at(idx.entry_id(nid, 0)),
+        node_dtype_->at(idx.entry_id(nid, 0)));
+  }
+}
+
+void NativeExecutor::SetupStorage(bool batch_only) {
+  // a new batch size keeps the plan as long as the planned space holds it,
+  // the entries are bound to the same space with the new shapes.
+  if (!batch_only ||
+      !FitsStoragePlan(graph_.indexed_graph(), graph_.GetAttr<StorageVector>("storage_id"),
+                       pool_capacity_, *node_shape_)) {
+    PlanStorage();
+  }
+  const auto& idx = graph_.indexed_graph();
+  const auto& vstorage = graph_.GetAttr<StorageVector>("storage_id");
+  const auto& vshape = graph_.GetAttr<ShapeVector>("shape");
+  const auto& vdtype = graph_.GetAttr<DTypeVector>("dtype");
+  // assign pooled data to entry
+  for (size_t i = 0; i < data_entry_.size(); ++i) {
+    if (data_entry_is_var_[i] || vstorage[i] == kExternalStorageID) continue;
+    TBlob& blob = data_entry_[i];
+    blob.data = storage_pool_.at(vstorage[i])->get();
+    blob.shape = vshape[i];
+    blob.dev_mask = kCPU;
+    blob.dtype = vdtype[i];
+  }
+  // the constants are computed again for the new shapes.
+  const auto& constant_node = graph_.GetAttr<std::vector<int> >("constant_node");
+  constant_storage_.clear();
+  constant_storage_.resize(idx.num_node_entries());
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (constant_node[nid] == kNotConstant) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      constant_storage_[eid] = arena_->Alloc(vshape[eid].Size());
+      TBlob& blob = data_entry_[eid];
+      blob.data = constant_storage_[eid]->get();
+      blob.shape = vshape[eid];
+      blob.dev_mask = kCPU;
+      blob.dtype = vdtype[eid];
+    }
+  }
+}
+
+void NativeExecutor::PlanStorage() {
+  // read-only placeholders alias the fed buffer.
+  placeholder_alias_ = FindReadOnlyPlaceholders(graph_.indexed_graph(), placeholder_nids_);
+  PlanGraphStorage(&graph_, placeholder_nids_, placeholder_alias_, plan_concurrency_);
+  const auto& idx = graph_.indexed_graph();
+  const auto& vstorage = graph_.GetAttr<StorageVector>("storage_id");
+
+  if (data_entry_.size() == 0) {
+    data_entry_.resize(idx.num_node_entries());
+    data_entry_is_var_.resize(idx.num_node_entries(), false);
+    for (uint32_t nid : idx.input_nodes()) {
+      CHECK(node_states_[nid] != nullptr);
+      data_entry_is_var_[idx.entry_id(nid, 0)] = true;
+    }
+  }
+
+  std::vector<size_t> pool_entry_size = StoragePoolSize(graph_, data_entry_is_var_);
+  // the old space goes back to the arena first, so it can be taken again.
+  storage_pool_.clear();
+  for (size_t i = 0; i < pool_entry_size.size(); ++i) {
+    storage_pool_.push_back(arena_->Alloc(pool_entry_size[i]));
+  }
+  pool_capacity_ = pool_entry_size;
+  if (scheduler_ != nullptr) {
+    op_deps_ = BuildOpDepGraph(idx, vstorage);
+    op_on_driver_.assign(idx.num_nodes(), false);
+  }
+}
+
+void NativeExecutor::SetupVarSpace() {
+  // bind the variable entries to the space of the states.
+  const auto& idx = graph_.indexed_graph();
+  for (uint32_t nid : idx.input_nodes()) {
+    data_entry_[idx.entry_id(nid, 0)] = node_states_[nid]->blob;
+  }
+}
+
+void NativeExecutor::SetupOpExecs() {
+  const Op* backward_op = Op::Get("_backward");
+  const Op* placeholder_op = Op::Get("placeholder");
+  const auto& idx = graph_.indexed_graph();
+  // passed for the outputs no one reads, which the kernel skips.
+  static const TBlob skipped_blob;
+  const std::vector<bool> skipped = FindSkippedOutputs(idx);
+  op_execs_.clear();
+  op_execs_.resize(idx.num_nodes());
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    if (inode.source->is_variable()) continue;
+    if (inode.source->op() == placeholder_op) {
+      // copy in place holder as demanded.
+      // aliased placeholders point to the source, the copy is skipped.
+      const TBlob* src = &placeholder_tblobs_[nid];
+      const TBlob* dst = &data_entry_[idx.entry_id(nid, 0)];
+      op_execs_[nid] = [src, dst]() { CopyBlob(*src, *dst); };
+      continue;
+    }
+    // the entries are read at call time, variables and aliased
+    // placeholders are rebound on each run.
+    std::vector<const TBlob*> in_src, out_src;
+    for (const auto& e : inode.inputs) {
+      in_src.push_back(&data_entry_[idx.entry_id(e)]);
+    }
+    for (uint32_t index = 0; index < inode.source->num_outputs(); ++index) {
+      const uint32_t eid = idx.entry_id(nid, index);
+      out_src.push_back(skipped[eid] ? &skipped_blob : &data_entry_[eid]);
+    }
+    FCompute fcomp = GetNativeCompute(idx, nid, *node_shape_);
+    const NodeAttrs* attrs = &(inode.source->attrs);
+    if (inode.source->op() == backward_op) {
+      // nn module backward, dispatch to the forward op.
+      const Node* fwd = idx[inode.control_deps[0]].source;
+      CHECK(fcomp != nullptr)
+          << "Function FComputeBackward is not registered on "
+          << fwd->op()->name;
+      attrs = &(fwd->attrs);
+    } else {
+      CHECK(fcomp != nullptr)
+          << "Function FCompute is not registered on "
+          << inode.source->op()->name;
+    }
+    op_execs_[nid] = [fcomp, attrs, in_src, out_src]() {
+      std::vector<TBlob> in_array, out_array;
+      for (const TBlob* b : in_src) in_array.push_back(*b);
+      for (const TBlob* b : out_src) out_array.push_back(*b);
+      fcomp(*attrs, in_array, out_array);
+    };
+  }
+  // the constants are computed here once, only the space of those
+  // read by the other nodes is kept.
+  const auto& constant_node = graph_.GetAttr<std::vector<int> >("constant_node");
+  RunConstantOps(constant_node, &op_execs_);
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (constant_node[nid] != kDeadConstant) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      constant_storage_[eid].reset();
+      data_entry_[eid].data = nullptr;
+    }
+  }
+  if (profiler_ != nullptr) {
+    ProfileOpExecs(profiler_.get(), idx, *node_shape_, &op_execs_);
+  }
+}
+
+void DataParallelExecutor::Init(nnvm::Symbol symbol, NativeVarStateMap* states,
+                                std::shared_ptr<NativeArena> arena,
+                                std::shared_ptr<OpScheduler> replica_scheduler,
+                                std::shared_ptr<OpScheduler> scheduler,
+                                int plan_concurrency,
+                                std::shared_ptr<OpProfiler> profiler,
+                                bool enable_fusion,
+                                const std::string& layout) {
+  replica_scheduler_ = replica_scheduler;
+  graph_ = SplitDataParallel(symbol);
+  whole_ = std::make_shared<NativeExecutor>();
+  whole_->Init(symbol, states, arena, scheduler, plan_concurrency, profiler,
+               enable_fusion, layout);
+  feed_names_ = whole_->feed_names();
+  if (!graph_.replicated) return;
+  for (const std::string& name : feed_names_) {
+    batch_feed_.push_back(std::count(graph_.batch_feeds.begin(), graph_.batch_feeds.end(),
+                                     name) != 0);
+  }
+  auto slot = [this](const std::string& name) {
+    auto it = std::find(feed_names_.begin(), feed_names_.end(), name);
+    CHECK(it != feed_names_.end());
+    return static_cast<size_t>(it - feed_names_.begin());
+  };
+  // the replicas run sequentially, they are the parallelism.
+  for (int r = 0; r < replica_scheduler_->num_workers(); ++r) {
+    auto exec = std::make_shared<NativeExecutor>();
+    exec->Init(graph_.replica, states, arena, nullptr, 1, profiler, enable_fusion, layout);
+    replicas_.push_back(exec);
+  }
+  for (const std::string& name : replicas_[0]->feed_names()) {
+    replica_slot_.push_back(slot(name));
+  }
+  if (graph_.update.outputs.size() != 0) {
+    update_ = std::make_shared<NativeExecutor>();
+    update_->Init(graph_.update, states, arena, scheduler, plan_concurrency, profiler,
+                  enable_fusion, layout);
+    for (const std::string& name : update_->feed_names()) {
+      auto it = std::find(graph_.update_feed.begin(), graph_.update_feed.end(), name);
+      if (it != graph_.update_feed.end()) {
+        update_slot_.push_back(feed_names_.size() + (it - graph_.update_feed.begin()));
+      } else {
+        update_slot_.push_back(slot(name));
+      }
+    }
+  }
+}
+
+const std::vector<TBlob>&
+DataParallelExecutor::Run(const std::vector<TBlob>& feeds) {
+  CHECK_EQ(feeds.size(), feed_names_.size())
+      << "Not enought placeholder argument to feed_dict";
+  if (!graph_.replicated) return whole_->Run(feeds);
+  // the batch is the leading dimension of the batch feeds, the other
+  // feeds, e.g. a learning rate, go to all the replicas.
+  size_t batch = 0;
+  for (size_t i = 0; i < feeds.size(); ++i) {
+    if (!batch_feed_[i]) continue;
+    CHECK_NE(feeds[i].shape.ndim(), 0U) << feed_names_[i] << " has no batch axis";
+    CHECK(batch == 0 || feeds[i].shape[0] == batch)
+        << "the batch feeds disagree on the batch size, " << feed_names_[i]
+        << " has " << feeds[i].shape[0] << " instead of " << batch;
+    batch = feeds[i].shape[0];
+  }
+  const size_t nrep = std::min(replicas_.size(), batch);
+  if (nrep < 2) return whole_->Run(feeds);
+  std::vector<size_t> begin(nrep + 1);
+  for (size_t r = 0; r <= nrep; ++r) begin[r] = batch * r / nrep;
+  replica_feeds_.resize(nrep);
+  for (size_t r = 0; r < nrep; ++r) {
+    std::vector<TBlob>& shard = replica_feeds_[r];
+    shard.resize(replica_slot_.size());
+    for (size_t j = 0; j < replica_slot_.size(); ++j) {
+      TBlob b = feeds[replica_slot_[j]];
+      if (batch_feed_[replica_slot_[j]]) {
+        CHECK_EQ(b.dev_mask, kCPU) << "native session only accept CPU feed";
+        b.data = BlobPtr(b) + begin[r] * b.shape.ProdShape(1, b.shape.ndim());
+        b.shape[0] = begin[r + 1] - begin[r];
+      }
+      shard[j] = b;
+    }
+  }
+  // the replicas, then the sums of pairs of partial sums, each waits for
+  // the last sums of its two halves.
+  OpDepGraph step;
+  std::vector<FOpExec> execs;
+  auto add = [&step, &execs](FOpExec f, const std::vector<uint32_t>& deps) {
+    const uint32_t id = static_cast<uint32_t>(execs.size());
+    execs.push_back(f);
+    step.num_deps.push_back(static_cast<uint32_t>(deps.size()));
+    step.successors.emplace_back();
+    for (uint32_t d : deps) step.successors[d].push_back(id);
+    return id;
+  };
+  replica_out_.assign(nrep, nullptr);
+  std::vector<uint32_t> last(nrep);
+  for (size_t r = 0; r < nrep; ++r) {
+    const float weight = static_cast<float>(begin[r + 1] - begin[r]) / batch;
+    last[r] = add([this, r, weight]() { this->RunReplica(r, weight); }, {});
+  }
+  for (size_t s = 1; s < nrep; s *= 2) {
+    for (size_t r = 0; r + s < nrep; r += 2 * s) {
+      last[r] = add([this, r, s]() { this->AddPartial(r, r + s); }, {last[r], last[r + s]});
+    }
+  }
+  replica_scheduler_->Run(step, execs, std::vector<bool>(execs.size(), false));
+  // the variables are not updated unless the outputs can be given.
+  CheckConcat(begin);
+
+  const std::vector<TBlob>* update_out = nullptr;
+  if (update_ != nullptr) {
+    update_feeds_.resize(update_slot_.size());
+    for (size_t j = 0; j < update_slot_.size(); ++j) {
+      const size_t slot = update_slot_[j];
+      update_feeds_[j] = slot < feeds.size() ? feeds[slot] : Combined(slot - feeds.size());
+    }
+    update_out = &update_->Run(update_feeds_);
+  }
+  output_blobs_.resize(graph_.outputs.size());
+  out_space_.resize(graph_.outputs.size());
+  for (size_t i = 0; i < graph_.outputs.size(); ++i) {
+    const size_t k = graph_.outputs[i].second;
+    if (graph_.outputs[i].first) {
+      output_blobs_[i] = update_out->at(k);
+    } else if (graph_.aggregate[k] == DataParallelGraph::kConcat) {
+      output_blobs_[i] = Concat(k, begin, &out_space_[i]);
+    } else {
+      output_blobs_[i] = Combined(k);
+    }
+  }
+  return output_blobs_;
+}
+
+void DataParallelExecutor::RunReplica(size_t r, float weight) {
+  const std::vector<TBlob>& out = replicas_[r]->Run(replica_feeds_[r]);
+  replica_out_[r] = &out;
+  // the outputs are in the space of the replica until its next run.
+  for (size_t k = 0; k < out.size(); ++k) {
+    if (graph_.aggregate[k] != DataParallelGraph::kAverage) continue;
+    float* x = BlobPtr(out[k]);
+    Simd().mul_scalar(x, weight, x, out[k].shape.Size());
+  }
+}
+
+void DataParallelExecutor::AddPartial(size_t dst, size_t src) {
+  const std::vector<TBlob>& y = *replica_out_[dst];
+  const std::vector<TBlob>& x = *replica_out_[src];
+  for (size_t k = 0; k < y.size(); ++k) {
+    const int aggregate = graph_.aggregate[k];
+    if (aggregate != DataParallelGraph::kAverage && aggregate != DataParallelGraph::kSum) {
+      continue;
+    }
+    CHECK_EQ(x[k].shape, y[k].shape) << "replicas disagree on the shape of a gradient";
+    Simd().add(BlobPtr(y[k]), BlobPtr(x[k]), BlobPtr(y[k]), y[k].shape.Size());
+  }
+}
+
+void DataParallelExecutor::CheckConcat(const std::vector<size_t>& begin) const {
+  const size_t nrep = begin.size() - 1;
+  for (size_t k = 0; k < graph_.aggregate.size(); ++k) {
+    if (graph_.aggregate[k] != DataParallelGraph::kConcat) continue;
+    const TShape& shape = replica_out_[0]->at(k).shape;
+    for (size_t r = 0; r < nrep; ++r) {
+      const TShape& s = replica_out_[r]->at(k).shape;
+      CHECK(s.ndim() == shape.ndim() && s.ndim() != 0 && s[0] == begin[r + 1] - begin[r] &&
+            s.ProdShape(1, s.ndim()) == shape.ProdShape(1, shape.ndim()))
+          << "replicas: output " << k << " of shape " << s
+          << " does not keep the batch axis, fetch it without the updates";
+    }
+  }
+}
+
+TBlob DataParallelExecutor::Combined(size_t k) const {
+  return replica_out_[0]->at(k);
+}
+
+TBlob DataParallelExecutor::Concat(size_t k, const std::vector<size_t>& begin,
+                                   std::vector<float>* space) const {
+  const size_t nrep = begin.size() - 1;
+  TShape shape = replica_out_[0]->at(k).shape;
+  shape[0] = begin[nrep];
+  space->resize(shape.Size());
+  const size_t stride = shape.ProdShape(1, shape.ndim());
+  for (size_t r = 0; r < nrep; ++r) {
+    const float* x = BlobPtr(replica_out_[r]->at(k));
+    std::copy(x, x + (begin[r + 1] - begin[r]) * stride, space->begin() + begin[r] * stride);
+  }
+  TBlob ret = replica_out_[0]->at(k);
+  ret.data = dmlc::BeginPtr(*space);
+  ret.shape = shape;
+  return ret;
+}
+
+}  // namespace tinyflow
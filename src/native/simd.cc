@@ -0,0 +1,213 @@
+// Copyright (c) 2016 by Contributors
+// scalar kernels and the runtime selection of the instruction set.
+#include <dmlc/logging.h>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include "./simd.h"
+
+namespace tinyflow {
+
+namespace {
+
+void Add(const float* a, const float* b, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] + b[i];
+}
+
+void Sub(const float* a, const float* b, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] - b[i];
+}
+
+void Mul(const float* a, const float* b, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] * b[i];
+}
+
+void Div(const float* a, const float* b, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] / b[i];
+}
+
+void Equal(const float* a, const float* b, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] == b[i] ? 1.0f : 0.0f;
+}
+
+void AddScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] + s;
+}
+
+void SubScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] - s;
+}
+
+void RSubScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = s - a[i];
+}
+
+void MulScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] * s;
+}
+
+void DivScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] / s;
+}
+
+void RDivScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = s / a[i];
+}
+
+void EqualScalar(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = a[i] == s ? 1.0f : 0.0f;
+}
+
+void ExpScale(const float* a, float s, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::exp(a[i] * s);
+}
+
+void ExpKernel(const float* a, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::exp(a[i]);
+}
+
+void LogKernel(const float* a, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::log(a[i]);
+}
+
+void SqrtKernel(const float* a, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) y[i] = std::sqrt(a[i]);
+}
+
+const size_t kScalarGemmNR = 8;
+
+void GemmKernel(size_t kc, const float* a, const float* b,
+                float* c, size_t ldc, bool accumulate) {
+  float acc[kSimdGemmMR][kScalarGemmNR] = {{0}};
+  for (size_t p = 0; p < kc; ++p) {
+    for (size_t i = 0; i < kSimdGemmMR; ++i) {
+      for (size_t j = 0; j < kScalarGemmNR; ++j) {
+        acc[i][j] += a[i] * b[j];
+      }
+    }
+    a += kSimdGemmMR;
+    b += kScalarGemmNR;
+  }
+  for (size_t i = 0; i < kSimdGemmMR; ++i) {
+    float* ci = c + i * ldc;
+    for (size_t j = 0; j < kScalarGemmNR; ++j) {
+      ci[j] = accumulate ? ci[j] + acc[i][j] : acc[i][j];
+    }
+  }
+}
+
+void ConvRowKernel(size_t ntap, const float* x, const size_t* xoff, size_t xs,
+                   const float* w, size_t block, float* y, size_t rows) {
+  for (size_t r = 0; r < rows; ++r) {
+    const float* xr = x + r * xs;
+    float* yr = y + r * block;
+    for (size_t t = 0; t < ntap; ++t) {
+      const float xv = xr[xoff[t]];
+      const float* wt = w + t * block;
+      for (size_t j = 0; j < block; ++j) yr[j] += xv * wt[j];
+    }
+  }
+}
+
+void SgdUpdate(float* w, const float* g, float lr, size_t n) {
+  for (size_t i = 0; i < n; ++i) w[i] -= lr * g[i];
+}
+
+void MomentumUpdate(float* w, const float* g, float* mom,
+                    float lr, float momentum, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    mom[i] = mom[i] * momentum + g[i];
+    w[i] -= lr * mom[i];
+  }
+}
+
+void AdamUpdate(float* w, const float* g, float* m, float* v,
+                float lr, float beta1, float beta2, float epsilon, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    m[i] = beta1 * m[i] + (1.0f - beta1) * g[i];
+    v[i] = beta2 * v[i] + (1.0f - beta2) * g[i] * g[i];
+    w[i] -= lr * m[i] / (std::sqrt(v[i]) + epsilon);
+  }
+}
+
+const SimdKernels kScalarKernels = {
+  Add, Sub, Mul, Div, Equal,
+  AddScalar, SubScalar, RSubScalar,
+  MulScalar, DivScalar, RDivScalar, EqualScalar,
+  ExpScale,
+  ExpKernel, LogKernel, SqrtKernel,
+  kScalarGemmNR, GemmKernel,
+  ConvRowKernel,
+  SgdUpdate, MomentumUpdate, AdamUpdate
+};
+
+// best instruction set of the CPU, capped by TINYFLOW_SIMD.
+SimdLevel DetectSimdLevel() {
+  SimdLevel level = SimdLevel::kScalar;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (GetAVX512Kernels() != nullptr && __builtin_cpu_supports("avx512f")) {
+    level = SimdLevel::kAVX512;
+  } else if (GetAVX2Kernels() != nullptr &&
+             __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    level = SimdLevel::kAVX2;
+  }
+#endif
+  const char* env = std::getenv("TINYFLOW_SIMD");
+  if (env != nullptr) {
+    std::string cap(env);
+    SimdLevel max_level = SimdLevel::kAVX512;
+    if (cap == "scalar") {
+      max_level = SimdLevel::kScalar;
+    } else if (cap == "avx2") {
+      max_level = SimdLevel::kAVX2;
+    } else {
+      CHECK(cap == "avx512") << "unknown TINYFLOW_SIMD=" << cap
+                             << ", expect scalar, avx2 or avx512";
+    }
+    if (static_cast<int>(max_level) < static_cast<int>(level)) level = max_level;
+  }
+  return level;
+}
+
+}  // namespace
+
+const SimdKernels* GetScalarKernels() {
+  return &kScalarKernels;
+}
+
+SimdLevel GetSimdLevel() {
+  static SimdLevel level = DetectSimdLevel();
+  return level;
+}
+
+const char* SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar: return "scalar";
+    case SimdLevel::kAVX2: return "avx2";
+    case SimdLevel::kAVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+const SimdKernels& Simd() {
+  static const SimdKernels* kernels = []() {
+    switch (GetSimdLevel()) {
+      case SimdLevel::kAVX512: return GetAVX512Kernels();
+      case SimdLevel::kAVX2: return GetAVX2Kernels();
+      default: return GetScalarKernels();
+    }
+  }();
+  return *kernels;
+}
+
+void SimdRPowScalar(const float* a, float s, float* y, size_t n) {
+  if (s > 0.0f) {
+    // s^a = exp(a * ln(s))
+    Simd().exp_scale(a, std::log(s), y, n);
+  } else {
+    for (size_t i = 0; i < n; ++i) y[i] = std::pow(s, a[i]);
+  }
+}
+
+}  // namespace tinyflow
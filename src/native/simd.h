@@ -0,0 +1,103 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file simd.h
+ * \brief vectorized kernels of the native backend.
+ *
+ *  Each kernel has a scalar version and AVX2/AVX-512 versions, the best one
+ *  supported by the running CPU is picked once at runtime. Set the environment
+ *  variable TINYFLOW_SIMD to scalar or avx2 to cap the instruction set.
+ */
+#ifndef TINYFLOW_NATIVE_SIMD_H_
+#define TINYFLOW_NATIVE_SIMD_H_
+
+#include <cstddef>
+
+namespace tinyflow {
+
+/*! \brief instruction set of the kernels */
+enum class SimdLevel : int {
+  kScalar = 0,
+  kAVX2 = 1,
+  kAVX512 = 2
+};
+
+/*! \brief y = f(a, b), all of size n */
+typedef void (*SimdBinaryKernel)(const float* a, const float* b, float* y, size_t n);
+/*! \brief y = f(a, s), a and y of size n */
+typedef void (*SimdScalarKernel)(const float* a, float s, float* y, size_t n);
+/*! \brief y = f(a) */
+typedef void (*SimdUnaryKernel)(const float* a, float* y, size_t n);
+/*!
+ * \brief c = a * b, or c += a * b when accumulate, on a tile of kSimdGemmMR x gemm_nr.
+ *  a is packed as kc columns of kSimdGemmMR rows, b as kc rows of gemm_nr,
+ *  c is row major with stride ldc.
+ */
+typedef void (*SimdGemmKernel)(size_t kc, const float* a, const float* b,
+                               float* c, size_t ldc, bool accumulate);
+/*!
+ * \brief direct convolution of a row of outputs in a blocked layout,
+ *  y[r][j] += x[r * xs + xoff[t]] * w[t][j] summed over the ntap taps,
+ *  for the rows r < rows and the channels j < block of the output block.
+ *  w holds block weights per tap, y block channels per row.
+ */
+typedef void (*SimdConvRowKernel)(size_t ntap, const float* x, const size_t* xoff,
+                                  size_t xs, const float* w, size_t block,
+                                  float* y, size_t rows);
+/*! \brief w -= lr * g, all of size n */
+typedef void (*SimdSgdKernel)(float* w, const float* g, float lr, size_t n);
+/*! \brief mom = mom * momentum + g, w -= lr * mom, all of size n */
+typedef void (*SimdMomentumKernel)(float* w, const float* g, float* mom,
+                                   float lr, float momentum, size_t n);
+/*!
+ * \brief m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g * g,
+ *  w -= lr * m / (sqrt(v) + epsilon), all of size n
+ */
+typedef void (*SimdAdamKernel)(float* w, const float* g, float* m, float* v,
+                               float lr, float beta1, float beta2, float epsilon,
+                               size_t n);
+
+/*! \brief number of rows of the gemm micro kernel tile */
+const size_t kSimdGemmMR = 6;
+
+/*!
+ * \brief table of the kernels of one instruction set.
+ *  y can be the same array as an input.
+ */
+struct SimdKernels {
+  SimdBinaryKernel add, sub, mul, div, equal;
+  // a + s, a - s, s - a, a * s, a / s, s / a, a == s
+  SimdScalarKernel add_scalar, sub_scalar, rsub_scalar;
+  SimdScalarKernel mul_scalar, div_scalar, rdiv_scalar, equal_scalar;
+  // exp(a * s)
+  SimdScalarKernel exp_scale;
+  SimdUnaryKernel exp, log, sqrt;
+  // gemm micro kernel and the number of columns of its tile
+  size_t gemm_nr;
+  SimdGemmKernel gemm;
+  SimdConvRowKernel conv_row;
+  // optimizer updates, in place in one pass over the weight and its states
+  SimdSgdKernel sgd_update;
+  SimdMomentumKernel momentum_update;
+  SimdAdamKernel adam_update;
+};
+
+/*! \return the instruction set in use */
+SimdLevel GetSimdLevel();
+
+/*! \return name of the instruction set, e.g. avx2 */
+const char* SimdLevelName(SimdLevel level);
+
+/*! \return the kernels of the instruction set in use */
+const SimdKernels& Simd();
+
+/*! \brief y = pow(s, a), vectorized when s is positive */
+void SimdRPowScalar(const float* a, float s, float* y, size_t n);
+
+// tables of each instruction set, nullptr when not compiled in.
+const SimdKernels* GetScalarKernels();
+const SimdKernels* GetAVX2Kernels();
+const SimdKernels* GetAVX512Kernels();
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_NATIVE_SIMD_H_
@@ -0,0 +1,78 @@
+// Copyright (c) 2016 by Contributors
+// AVX2 kernels, compiled for the instruction set and only
+// called after the CPU is checked to support it.
+#include "./simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+#include <immintrin.h>
+
+namespace tinyflow {
+namespace {
+
+struct Vec {
+  static const size_t kWidth = 8;
+  __m256 v;
+  static Vec Load(const float* p) { return Vec{_mm256_loadu_ps(p)}; }
+  static Vec Set1(float s) { return Vec{_mm256_set1_ps(s)}; }
+  void Store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline Vec operator+(Vec a, Vec b) { return Vec{_mm256_add_ps(a.v, b.v)}; }
+inline Vec operator-(Vec a, Vec b) { return Vec{_mm256_sub_ps(a.v, b.v)}; }
+inline Vec operator*(Vec a, Vec b) { return Vec{_mm256_mul_ps(a.v, b.v)}; }
+inline Vec operator/(Vec a, Vec b) { return Vec{_mm256_div_ps(a.v, b.v)}; }
+inline Vec FMA(Vec a, Vec b, Vec c) { return Vec{_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+inline Vec Sqrt(Vec a) { return Vec{_mm256_sqrt_ps(a.v)}; }
+inline Vec Min(Vec a, Vec b) { return Vec{_mm256_min_ps(a.v, b.v)}; }
+inline Vec Max(Vec a, Vec b) { return Vec{_mm256_max_ps(a.v, b.v)}; }
+inline Vec Floor(Vec a) { return Vec{_mm256_floor_ps(a.v)}; }
+inline Vec SelectLT(Vec a, Vec b, Vec x, Vec y) {
+  return Vec{_mm256_blendv_ps(y.v, x.v, _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ))};
+}
+inline Vec SelectEQ(Vec a, Vec b, Vec x, Vec y) {
+  return Vec{_mm256_blendv_ps(y.v, x.v, _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ))};
+}
+inline Vec Pow2i(Vec n) {
+  __m256i e = _mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127));
+  return Vec{_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))};
+}
+inline Vec Frexp(Vec x, Vec* e) {
+  __m256i bits = _mm256_castps_si256(x.v);
+  __m256i exp = _mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff));
+  e->v = _mm256_cvtepi32_ps(_mm256_sub_epi32(exp, _mm256_set1_epi32(126)));
+  bits = _mm256_and_si256(bits, _mm256_set1_epi32(static_cast<int>(0x807fffff)));
+  bits = _mm256_or_si256(bits, _mm256_set1_epi32(0x3f000000));
+  return Vec{_mm256_castsi256_ps(bits)};
+}
+
+#include "./simd_impl.h"
+
+}  // namespace
+
+const SimdKernels* GetAVX2Kernels() {
+  return &kKernels;
+}
+
+}  // namespace tinyflow
+
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#else
+
+namespace tinyflow {
+const SimdKernels* GetAVX2Kernels() {
+  return nullptr;
+}
+}  // namespace tinyflow
+
+#endif
@@ -0,0 +1,80 @@
+// Copyright (c) 2016 by Contributors
+// AVX-512 kernels, compiled for the instruction set and only
+// called after the CPU is checked to support it.
+#include "./simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+#include <immintrin.h>
+
+namespace tinyflow {
+namespace {
+
+struct Vec {
+  static const size_t kWidth = 16;
+  __m512 v;
+  static Vec Load(const float* p) { return Vec{_mm512_loadu_ps(p)}; }
+  static Vec Set1(float s) { return Vec{_mm512_set1_ps(s)}; }
+  void Store(float* p) const { _mm512_storeu_ps(p, v); }
+};
+
+inline Vec operator+(Vec a, Vec b) { return Vec{_mm512_add_ps(a.v, b.v)}; }
+inline Vec operator-(Vec a, Vec b) { return Vec{_mm512_sub_ps(a.v, b.v)}; }
+inline Vec operator*(Vec a, Vec b) { return Vec{_mm512_mul_ps(a.v, b.v)}; }
+inline Vec operator/(Vec a, Vec b) { return Vec{_mm512_div_ps(a.v, b.v)}; }
+inline Vec FMA(Vec a, Vec b, Vec c) { return Vec{_mm512_fmadd_ps(a.v, b.v, c.v)}; }
+inline Vec Sqrt(Vec a) { return Vec{_mm512_sqrt_ps(a.v)}; }
+inline Vec Min(Vec a, Vec b) { return Vec{_mm512_min_ps(a.v, b.v)}; }
+inline Vec Max(Vec a, Vec b) { return Vec{_mm512_max_ps(a.v, b.v)}; }
+inline Vec Floor(Vec a) {
+  return Vec{_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)};
+}
+inline Vec SelectLT(Vec a, Vec b, Vec x, Vec y) {
+  return Vec{_mm512_mask_blend_ps(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ), y.v, x.v)};
+}
+inline Vec SelectEQ(Vec a, Vec b, Vec x, Vec y) {
+  return Vec{_mm512_mask_blend_ps(_mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ), y.v, x.v)};
+}
+inline Vec Pow2i(Vec n) {
+  __m512i e = _mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127));
+  return Vec{_mm512_castsi512_ps(_mm512_slli_epi32(e, 23))};
+}
+inline Vec Frexp(Vec x, Vec* e) {
+  __m512i bits = _mm512_castps_si512(x.v);
+  __m512i exp = _mm512_and_si512(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(0xff));
+  e->v = _mm512_cvtepi32_ps(_mm512_sub_epi32(exp, _mm512_set1_epi32(126)));
+  bits = _mm512_and_si512(bits, _mm512_set1_epi32(static_cast<int>(0x807fffff)));
+  bits = _mm512_or_si512(bits, _mm512_set1_epi32(0x3f000000));
+  return Vec{_mm512_castsi512_ps(bits)};
+}
+
+#include "./simd_impl.h"
+
+}  // namespace
+
+const SimdKernels* GetAVX512Kernels() {
+  return &kKernels;
+}
+
+}  // namespace tinyflow
+
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#else
+
+namespace tinyflow {
+const SimdKernels* GetAVX512Kernels() {
+  return nullptr;
+}
+}  // namespace tinyflow
+
+#endif
@@ -0,0 +1,327 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file simd_impl.h
+ * \brief generic kernels over a vector type, included by each instruction set.
+ *
+ *  The including file compiles for the instruction set and defines, in an
+ *  anonymous namespace, Vec with kWidth, Load, Store and Set1, the arithmetic
+ *  operators, and FMA(a, b, c) = a * b + c, Sqrt, Min, Max, Floor,
+ *  SelectLT(a, b, x, y) = a < b ? x : y, SelectEQ, Pow2i(n) = 2^n for
+ *  integral n in [-126, 127], and Frexp(x, &e) = mantissa in [0.5, 1).
+ *  Nothing from the standard library is used here, so no inline function
+ *  compiled for the instruction set can leak into the rest of the program.
+ */
+#ifndef TINYFLOW_NATIVE_SIMD_IMPL_H_
+#define TINYFLOW_NATIVE_SIMD_IMPL_H_
+
+// y = fv(a) over full vectors, the tail is run on a padded copy.
+template<typename FV>
+inline void MapUnaryVec(const float* a, float* y, size_t n, FV fv) {
+  size_t i = 0;
+  for (; i + Vec::kWidth <= n; i += Vec::kWidth) {
+    fv(Vec::Load(a + i)).Store(y + i);
+  }
+  if (i == n) return;
+  float pa[Vec::kWidth] = {0};
+  for (size_t j = i; j < n; ++j) pa[j - i] = a[j];
+  fv(Vec::Load(pa)).Store(pa);
+  for (size_t j = i; j < n; ++j) y[j] = pa[j - i];
+}
+
+// y = fv(a, b) over full vectors, the tail is run on a padded copy.
+template<typename FV>
+inline void MapBinaryVec(const float* a, const float* b, float* y, size_t n, FV fv) {
+  size_t i = 0;
+  for (; i + Vec::kWidth <= n; i += Vec::kWidth) {
+    fv(Vec::Load(a + i), Vec::Load(b + i)).Store(y + i);
+  }
+  if (i == n) return;
+  float pa[Vec::kWidth] = {0}, pb[Vec::kWidth] = {0};
+  for (size_t j = i; j < n; ++j) {
+    pa[j - i] = a[j]; pb[j - i] = b[j];
+  }
+  fv(Vec::Load(pa), Vec::Load(pb)).Store(pa);
+  for (size_t j = i; j < n; ++j) y[j] = pa[j - i];
+}
+
+// exp of the cephes single precision polynomial, within 2 ulp of expf.
+inline Vec Exp(Vec x) {
+  Vec v = Min(Max(x, Vec::Set1(-104.0f)), Vec::Set1(88.7228391f));
+  // x = n * ln2 + r, |r| <= ln2 / 2
+  Vec fx = Floor(FMA(v, Vec::Set1(1.44269504088896341f), Vec::Set1(0.5f)));
+  v = v - fx * Vec::Set1(0.693359375f);
+  v = v - fx * Vec::Set1(-2.12194440e-4f);
+  Vec z = v * v;
+  Vec y = Vec::Set1(1.9875691500e-4f);
+  y = FMA(y, v, Vec::Set1(1.3981999507e-3f));
+  y = FMA(y, v, Vec::Set1(8.3334519073e-3f));
+  y = FMA(y, v, Vec::Set1(4.1665795894e-2f));
+  y = FMA(y, v, Vec::Set1(1.6666665459e-1f));
+  y = FMA(y, v, Vec::Set1(5.0000001201e-1f));
+  y = FMA(y, z, v + Vec::Set1(1.0f));
+  // n is in [-150, 128], scale in two steps to stay in the exponent range.
+  Vec n1 = Floor(fx * Vec::Set1(0.5f));
+  y = y * Pow2i(n1) * Pow2i(fx - n1);
+  y = SelectLT(Vec::Set1(88.7228391f), x, Vec::Set1(__builtin_inff()), y);
+  return SelectEQ(x, x, y, x);
+}
+
+// log of the cephes single precision polynomial, within 2 ulp of logf.
+inline Vec Log(Vec x) {
+  const Vec zero = Vec::Set1(0.0f), one = Vec::Set1(1.0f);
+  // denormals are scaled up, their exponent is off by 23.
+  const Vec min_normal = Vec::Set1(1.17549435e-38f);
+  Vec v = x * SelectLT(x, min_normal, Vec::Set1(8388608.0f), one);
+  Vec e;
+  Vec m = Frexp(v, &e);
+  e = e + SelectLT(x, min_normal, Vec::Set1(-23.0f), zero);
+  // keep m in [sqrt(0.5), sqrt(2)) for the polynomial.
+  Vec lt = SelectLT(m, Vec::Set1(0.707106781186547524f), one, zero);
+  e = e - lt;
+  m = FMA(m, lt, m) - one;
+  Vec z = m * m;
+  Vec y = Vec::Set1(7.0376836292e-2f);
+  y = FMA(y, m, Vec::Set1(-1.1514610310e-1f));
+  y = FMA(y, m, Vec::Set1(1.1676998740e-1f));
+  y = FMA(y, m, Vec::Set1(-1.2420140846e-1f));
+  y = FMA(y, m, Vec::Set1(1.4249322787e-1f));
+  y = FMA(y, m, Vec::Set1(-1.6668057665e-1f));
+  y = FMA(y, m, Vec::Set1(2.0000714765e-1f));
+  y = FMA(y, m, Vec::Set1(-2.4999993993e-1f));
+  y = FMA(y, m, Vec::Set1(3.3333331174e-1f));
+  y = y * m * z;
+  y = FMA(e, Vec::Set1(-2.12194440e-4f), y);
+  y = FMA(z, Vec::Set1(-0.5f), y);
+  Vec r = FMA(e, Vec::Set1(0.693359375f), m + y);
+  r = SelectEQ(x, zero, Vec::Set1(-__builtin_inff()), r);
+  r = SelectLT(x, zero, Vec::Set1(__builtin_nanf("")), r);
+  r = SelectEQ(x, Vec::Set1(__builtin_inff()), x, r);
+  return SelectEQ(x, x, r, x);
+}
+
+void Add(const float* a, const float* b, float* y, size_t n) {
+  MapBinaryVec(a, b, y, n, [](Vec p, Vec q) { return p + q; });
+}
+
+void Sub(const float* a, const float* b, float* y, size_t n) {
+  MapBinaryVec(a, b, y, n, [](Vec p, Vec q) { return p - q; });
+}
+
+void Mul(const float* a, const float* b, float* y, size_t n) {
+  MapBinaryVec(a, b, y, n, [](Vec p, Vec q) { return p * q; });
+}
+
+void Div(const float* a, const float* b, float* y, size_t n) {
+  MapBinaryVec(a, b, y, n, [](Vec p, Vec q) { return p / q; });
+}
+
+void Equal(const float* a, const float* b, float* y, size_t n) {
+  const Vec zero = Vec::Set1(0.0f), one = Vec::Set1(1.0f);
+  MapBinaryVec(a, b, y, n, [zero, one](Vec p, Vec q) {
+      return SelectEQ(p, q, one, zero);
+    });
+}
+
+void AddScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return p + vs; });
+}
+
+void SubScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return p - vs; });
+}
+
+void RSubScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return vs - p; });
+}
+
+void MulScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return p * vs; });
+}
+
+void DivScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return p / vs; });
+}
+
+void RDivScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return vs / p; });
+}
+
+void EqualScalar(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s), zero = Vec::Set1(0.0f), one = Vec::Set1(1.0f);
+  MapUnaryVec(a, y, n, [vs, zero, one](Vec p) { return SelectEQ(p, vs, one, zero); });
+}
+
+void ExpScale(const float* a, float s, float* y, size_t n) {
+  const Vec vs = Vec::Set1(s);
+  MapUnaryVec(a, y, n, [vs](Vec p) { return Exp(p * vs); });
+}
+
+void ExpKernel(const float* a, float* y, size_t n) {
+  MapUnaryVec(a, y, n, [](Vec p) { return Exp(p); });
+}
+
+void LogKernel(const float* a, float* y, size_t n) {
+  MapUnaryVec(a, y, n, [](Vec p) { return Log(p); });
+}
+
+void SqrtKernel(const float* a, float* y, size_t n) {
+  MapUnaryVec(a, y, n, [](Vec p) { return Sqrt(p); });
+}
+
+// the c tile is kept in 2 * kSimdGemmMR registers over the whole kc loop.
+void GemmKernel(size_t kc, const float* a, const float* b,
+                float* c, size_t ldc, bool accumulate) {
+  Vec c0[kSimdGemmMR], c1[kSimdGemmMR];
+  for (size_t i = 0; i < kSimdGemmMR; ++i) {
+    c0[i] = Vec::Set1(0.0f);
+    c1[i] = Vec::Set1(0.0f);
+  }
+  for (size_t p = 0; p < kc; ++p) {
+    const Vec b0 = Vec::Load(b), b1 = Vec::Load(b + Vec::kWidth);
+    for (size_t i = 0; i < kSimdGemmMR; ++i) {
+      const Vec ai = Vec::Set1(a[i]);
+      c0[i] = FMA(ai, b0, c0[i]);
+      c1[i] = FMA(ai, b1, c1[i]);
+    }
+    a += kSimdGemmMR;
+    b += 2 * Vec::kWidth;
+  }
+  for (size_t i = 0; i < kSimdGemmMR; ++i) {
+    float* ci = c + i * ldc;
+    if (accumulate) {
+      c0[i] = c0[i] + Vec::Load(ci);
+      c1[i] = c1[i] + Vec::Load(ci + Vec::kWidth);
+    }
+    c0[i].Store(ci);
+    c1[i].Store(ci + Vec::kWidth);
+  }
+}
+
+// R rows of NV vectors of the output block, kept in registers over all taps.
+template<size_t NV, size_t R>
+inline void ConvTile(size_t ntap, const float* x, const size_t* xoff, size_t xs,
+                     const float* w, float* y) {
+  Vec acc[R][NV];
+  for (size_t r = 0; r < R; ++r) {
+    for (size_t v = 0; v < NV; ++v) acc[r][v] = Vec::Load(y + (r * NV + v) * Vec::kWidth);
+  }
+  for (size_t t = 0; t < ntap; ++t) {
+    Vec wv[NV];
+    for (size_t v = 0; v < NV; ++v) wv[v] = Vec::Load(w + v * Vec::kWidth);
+    const float* xt = x + xoff[t];
+    for (size_t r = 0; r < R; ++r) {
+      const Vec xv = Vec::Set1(xt[r * xs]);
+      for (size_t v = 0; v < NV; ++v) acc[r][v] = FMA(xv, wv[v], acc[r][v]);
+    }
+    w += NV * Vec::kWidth;
+  }
+  for (size_t r = 0; r < R; ++r) {
+    for (size_t v = 0; v < NV; ++v) acc[r][v].Store(y + (r * NV + v) * Vec::kWidth);
+  }
+}
+
+// tiles of 8 vectors of accumulators, the rest one row at a time.
+template<size_t NV>
+inline void ConvRowVec(size_t ntap, const float* x, const size_t* xoff, size_t xs,
+                       const float* w, float* y, size_t rows) {
+  const size_t kRows = 8 / NV;
+  size_t r = 0;
+  for (; r + kRows <= rows; r += kRows) {
+    ConvTile<NV, kRows>(ntap, x + r * xs, xoff, xs, w, y + r * NV * Vec::kWidth);
+  }
+  for (; r < rows; ++r) {
+    ConvTile<NV, 1>(ntap, x + r * xs, xoff, xs, w, y + r * NV * Vec::kWidth);
+  }
+}
+
+// blocks of one or two vectors run on registers, other blocks on scalars.
+void ConvRowKernel(size_t ntap, const float* x, const size_t* xoff, size_t xs,
+                   const float* w, size_t block, float* y, size_t rows) {
+  if (block == Vec::kWidth) {
+    ConvRowVec<1>(ntap, x, xoff, xs, w, y, rows);
+  } else if (block == 2 * Vec::kWidth) {
+    ConvRowVec<2>(ntap, x, xoff, xs, w, y, rows);
+  } else {
+    for (size_t r = 0; r < rows; ++r) {
+      const float* xr = x + r * xs;
+      float* yr = y + r * block;
+      for (size_t t = 0; t < ntap; ++t) {
+        const float xv = xr[xoff[t]];
+        const float* wt = w + t * block;
+        for (size_t j = 0; j < block; ++j) yr[j] += xv * wt[j];
+      }
+    }
+  }
+}
+
+// s[k] = fv(g, s[k]...) in place over full vectors, the tail is run on padded copies.
+template<size_t N, typename FV>
+inline void UpdateVec(const float* g, float* const (&s)[N], size_t n, FV fv) {
+  Vec v[N];
+  size_t i = 0;
+  for (; i + Vec::kWidth <= n; i += Vec::kWidth) {
+    for (size_t k = 0; k < N; ++k) v[k] = Vec::Load(s[k] + i);
+    fv(Vec::Load(g + i), v);
+    for (size_t k = 0; k < N; ++k) v[k].Store(s[k] + i);
+  }
+  if (i == n) return;
+  float pg[Vec::kWidth] = {0}, ps[N][Vec::kWidth] = {{0}};
+  for (size_t j = i; j < n; ++j) {
+    pg[j - i] = g[j];
+    for (size_t k = 0; k < N; ++k) ps[k][j - i] = s[k][j];
+  }
+  for (size_t k = 0; k < N; ++k) v[k] = Vec::Load(ps[k]);
+  fv(Vec::Load(pg), v);
+  for (size_t k = 0; k < N; ++k) v[k].Store(ps[k]);
+  for (size_t j = i; j < n; ++j) {
+    for (size_t k = 0; k < N; ++k) s[k][j] = ps[k][j - i];
+  }
+}
+
+void SgdUpdate(float* w, const float* g, float lr, size_t n) {
+  const Vec vlr = Vec::Set1(-lr);
+  float* const s[1] = {w};
+  UpdateVec(g, s, n, [vlr](Vec q, Vec* v) { v[0] = FMA(vlr, q, v[0]); });
+}
+
+void MomentumUpdate(float* w, const float* g, float* mom,
+                    float lr, float momentum, size_t n) {
+  const Vec vlr = Vec::Set1(-lr), vmom = Vec::Set1(momentum);
+  float* const s[2] = {w, mom};
+  UpdateVec(g, s, n, [vlr, vmom](Vec q, Vec* v) {
+      v[1] = FMA(v[1], vmom, q);
+      v[0] = FMA(vlr, v[1], v[0]);
+    });
+}
+
+void AdamUpdate(float* w, const float* g, float* m, float* v,
+                float lr, float beta1, float beta2, float epsilon, size_t n) {
+  const Vec vlr = Vec::Set1(-lr), veps = Vec::Set1(epsilon);
+  const Vec vb1 = Vec::Set1(beta1), vc1 = Vec::Set1(1.0f - beta1);
+  const Vec vb2 = Vec::Set1(beta2), vc2 = Vec::Set1(1.0f - beta2);
+  float* const s[3] = {w, m, v};
+  UpdateVec(g, s, n, [=](Vec q, Vec* p) {
+      p[1] = FMA(vb1, p[1], vc1 * q);
+      p[2] = FMA(vb2, p[2], vc2 * q * q);
+      p[0] = FMA(vlr, p[1] / (Sqrt(p[2]) + veps), p[0]);
+    });
+}
+
+const SimdKernels kKernels = {
+  Add, Sub, Mul, Div, Equal,
+  AddScalar, SubScalar, RSubScalar,
+  MulScalar, DivScalar, RDivScalar, EqualScalar,
+  ExpScale,
+  ExpKernel, LogKernel, SqrtKernel,
+  2 * Vec::kWidth, GemmKernel,
+  ConvRowKernel,
+  SgdUpdate, MomentumUpdate, AdamUpdate
+};
+
+#endif  // TINYFLOW_NATIVE_SIMD_IMPL_H_
@@ -106,6 +106,7 @@ NNVM_REGISTER_OP(relu)
 .describe("Relu operation")
 .set_num_inputs(1)
 .include("nn_module")
+.set_attr<bool>("IsElementWise", true)
 .set_attr<FInferShape>("FInferShape", SameShape)
 .set_attr<bool>("TBackwardNeedOutputs", true);
 
@@ -114,6 +115,7 @@ NNVM_REGISTER_OP(tanh)
 .describe("Tanh operation")
 .set_num_inputs(1)
 .include("nn_module")
+.set_attr<bool>("IsElementWise", true)
 .set_attr<FInferShape>("FInferShape", SameShape);
 
 
@@ -168,15 +170,6 @@ NNVM_REGISTER_OP(linear)
 .set_attr<FInferShape>("FInferShape", LinearShape);
 
 
-struct PadParam : public dmlc::Parameter<PadParam> {
-  uint32_t dim;
-  int pad;
-
-  DMLC_DECLARE_PARAMETER(PadParam) {
-    DMLC_DECLARE_FIELD(dim).set_default(0);
-    DMLC_DECLARE_FIELD(pad).set_default(0);
-  }
-};
 DMLC_REGISTER_PARAMETER(PadParam);
 
 inline bool PadShape(const NodeAttrs& attrs,
@@ -200,31 +193,16 @@ NNVM_REGISTER_OP(pad)
 .set_attr<FInferShape>("FInferShape", PadShape);
 
 
-struct ConvPoolParam : public dmlc::Parameter<ConvPoolParam> {
-  TShape ksize;
-  TShape strides;
-  std::string padding;
-  std::string data_format;
-  bool no_bias;
-  uint32_t num_filter;
-
-  DMLC_DECLARE_PARAMETER(ConvPoolParam) {
-    DMLC_DECLARE_FIELD(ksize).set_default(TShape{1, 1, 1, 1});
-    DMLC_DECLARE_FIELD(strides).set_default(TShape{1, 1, 1, 1});
-    DMLC_DECLARE_FIELD(padding).set_default("SAME");
-    DMLC_DECLARE_FIELD(data_format).set_default("NCHW");
-    DMLC_DECLARE_FIELD(no_bias).set_default(true);
-    DMLC_DECLARE_FIELD(num_filter).set_default(0);
-  }
-};
 DMLC_REGISTER_PARAMETER(ConvPoolParam);
 
+// the filter is (out, in, kh, kw) and the bias (out,) in every layout.
 inline bool ConvPoolShape(const NodeAttrs& attrs,
                           std::vector<TShape> *ishape,
                           std::vector<TShape> *oshape) {
   const auto& param = dmlc::get<ConvPoolParam>(attrs.parsed);
   if (ishape->at(0).ndim() == 0) return false;
-  const TShape& in = ishape->at(0);
+  const DataLayout layout = DataLayout::Parse(param.data_format);
+  const TShape in = layout.ToNCHW(ishape->at(0));
   TShape filter;
   if (ishape->size() == 1) {
     // pooling
@@ -253,9 +231,10 @@ inline bool ConvPoolShape(const NodeAttrs& attrs,
   CHECK_EQ(in[1], filter[1])
       << "in=" << in << ", filter=" << filter;
   // batch, out, height, width
-  oshape->at(0) = TShape{in[0], filter[0],
-                         (in[2] + 2 * padH - filter[2]) / dH + 1,
-                         (in[3] + 2 * padW - filter[3]) / dW + 1};
+  TShape out{in[0], filter[0],
+             (in[2] + 2 * padH - filter[2]) / dH + 1,
+             (in[3] + 2 * padW - filter[3]) / dW + 1};
+  oshape->at(0) = layout.FromNCHW(out);
   return true;
 }
 
@@ -293,38 +272,108 @@ NNVM_REGISTER_OP(avg_pool)
 .set_attr<FInferShape>("FInferShape", ConvPoolShape);
 
 
-struct BatchNormalizationParam : public dmlc::Parameter<BatchNormalizationParam> {
-  std::string name;
-  DMLC_DECLARE_PARAMETER(BatchNormalizationParam) {
-    DMLC_DECLARE_FIELD(name).set_default("batch_normalization");
-  }
-};
 DMLC_REGISTER_PARAMETER(BatchNormalizationParam);
 
 inline bool BatchNormalizationShape(const NodeAttrs& attrs,
                                     std::vector<TShape> *ishape,
                                     std::vector<TShape> *oshape) {
+  const auto& param = dmlc::get<BatchNormalizationParam>(attrs.parsed);
   if (ishape->at(0).ndim() == 0) return false;
   const TShape& in = ishape->at(0);
-  CHECK_EQ(in.ndim(), 4);
-  TShape mean = TShape{in[1]};
-  SHAPE_ASSIGN(ishape->at(1), mean);
-  SHAPE_ASSIGN(ishape->at(2), mean);
+  const TShape nchw = DataLayout::Parse(param.data_format).ToNCHW(in);
+  TShape mean = TShape{nchw[1]};
+  for (size_t i = 1; i < ishape->size(); ++i) {
+    SHAPE_ASSIGN(ishape->at(i), mean);
+  }
   oshape->at(0) = in;
   return true;
 }
 
 NNVM_REGISTER_OP(batch_normalization)
 .describe("batch normalization")
-.set_num_inputs(3)
+.set_num_inputs([](const NodeAttrs& attrs) {
+    return (dmlc::get<BatchNormalizationParam>(attrs.parsed).use_global_stats ? 5 : 3);
+  })
 .set_attr<FListInputNames>("FListInputNames", [](const NodeAttrs& attrs) {
-    return std::vector<std::string>{"data", "gamma", "beta"};
+    if (dmlc::get<BatchNormalizationParam>(attrs.parsed).use_global_stats) {
+      return std::vector<std::string>{"data", "gamma", "beta", "moving_mean", "moving_var"};
+    } else {
+      return std::vector<std::string>{"data", "gamma", "beta"};
+    }
 })
 .set_attr_parser(ParamParser<BatchNormalizationParam>)
 .include("nn_module")
 .set_attr<FInferShape>("FInferShape", BatchNormalizationShape);
 
 
+DMLC_REGISTER_PARAMETER(BatchNormFoldParam);
+
+inline bool BatchNormFoldShape(const NodeAttrs& attrs,
+                               std::vector<TShape> *ishape,
+                               std::vector<TShape> *oshape) {
+  if (ishape->at(0).ndim() == 0) return false;
+  const TShape& wshape = ishape->at(0);
+  TShape channels = TShape{wshape[0]};
+  for (size_t i = 1; i < ishape->size(); ++i) {
+    SHAPE_ASSIGN(ishape->at(i), channels);
+  }
+  SHAPE_ASSIGN(oshape->at(0), wshape);
+  SHAPE_ASSIGN(oshape->at(1), channels);
+  return true;
+}
+
+NNVM_REGISTER_OP(_batch_norm_fold)
+.describe("Weight and bias of a conv2d followed by batch_normalization with global stats")
+.set_num_inputs([](const NodeAttrs& attrs) {
+    return (dmlc::get<BatchNormFoldParam>(attrs.parsed).no_bias ? 5 : 6);
+  })
+.set_num_outputs(2)
+.set_attr<FListInputNames>("FListInputNames", [](const NodeAttrs& attrs) {
+    if (dmlc::get<BatchNormFoldParam>(attrs.parsed).no_bias) {
+      return std::vector<std::string>{"weight", "gamma", "beta", "moving_mean", "moving_var"};
+    } else {
+      return std::vector<std::string>{
+        "weight", "bias", "gamma", "beta", "moving_mean", "moving_var"};
+    }
+  })
+.set_attr_parser(ParamParser<BatchNormFoldParam>)
+.set_attr<FInferShape>("FInferShape", BatchNormFoldShape);
+
+
+DMLC_REGISTER_PARAMETER(LayoutTransformParam);
+
+inline bool LayoutTransformShape(const NodeAttrs& attrs,
+                                 std::vector<TShape> *ishape,
+                                 std::vector<TShape> *oshape) {
+  const auto& param = dmlc::get<LayoutTransformParam>(attrs.parsed);
+  const DataLayout src = DataLayout::Parse(param.src_layout);
+  const DataLayout dst = DataLayout::Parse(param.dst_layout);
+  if (ishape->at(0).ndim() != 0) {
+    SHAPE_ASSIGN(oshape->at(0), dst.FromNCHW(src.ToNCHW(ishape->at(0))));
+  } else if (oshape->at(0).ndim() != 0) {
+    SHAPE_ASSIGN(ishape->at(0), src.FromNCHW(dst.ToNCHW(oshape->at(0))));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+NNVM_REGISTER_OP(_layout_transform)
+.describe("Copy a 4d image from src_layout to dst_layout")
+.set_num_inputs(1)
+.set_attr_parser(ParamParser<LayoutTransformParam>)
+.set_attr<FInferShape>("FInferShape", LayoutTransformShape)
+.set_attr<FGradient>(
+    "FGradient", [](const NodePtr& n,
+                    const std::vector<NodeEntry>& ograds) {
+      const auto& param = dmlc::get<LayoutTransformParam>(n->attrs.parsed);
+      return std::vector<NodeEntry>{
+        MakeNode("_layout_transform", n->attrs.name + "_backward", {ograds[0]},
+                 {{"src_layout", param.dst_layout}, {"dst_layout", param.src_layout}})
+      };
+    });
+
+
 NNVM_REGISTER_OP(mean_sparse_softmax_cross_entropy_with_logits)
 .describe("Softmax cross entropy given logit and label")
 .set_num_inputs(2)
@@ -49,9 +49,12 @@ NNVM_REGISTER_OP_GROUP(ElementwiseOpAttr)
 .set_attr<FInferShape>("FInferShape", SameShape);
 
 
+// the fill ops are marked IsConstant, their output only depends on
+// the attributes and the shape, so FoldConstant computes them once.
 NNVM_REGISTER_OP(zeros)
 .describe("zeros")
 .set_num_inputs(0)
+.set_attr<bool>("IsConstant", true)
 .set_attr_parser(ParamParser<ZeroParam>)
 .set_attr<FInferShape>("FInferShape", ZeroShape)
 .set_attr<FInferType>("FInferType", ZeroType);
@@ -59,11 +62,13 @@ NNVM_REGISTER_OP(zeros)
 NNVM_REGISTER_OP(zeros_like)
 .describe("zeros_like")
 .set_num_inputs(1)
+.set_attr<bool>("IsConstant", true)
 .set_attr<FInferShape>("FInferShape", SameShape);
 
 NNVM_REGISTER_OP(ones)
 .describe("ones")
 .set_num_inputs(0)
+.set_attr<bool>("IsConstant", true)
 .set_attr_parser(ParamParser<ZeroParam>)
 .set_attr<FInferShape>("FInferShape", ZeroShape)
 .set_attr<FInferType>("FInferType", ZeroType);
@@ -72,6 +77,7 @@ NNVM_REGISTER_OP(ones)
 NNVM_REGISTER_OP(ones_like)
 .describe("ones_like")
 .set_num_inputs(1)
+.set_attr<bool>("IsConstant", true)
 .set_attr<FInferShape>("FInferShape", SameShape);
 
 
@@ -367,12 +373,6 @@ NNVM_REGISTER_OP(_matmul_backward)
 .set_num_outputs(2)
 .set_attr<nnvm::TIsBackward>("TIsBackward", true);
 
-struct ReduceParam : public dmlc::Parameter<ReduceParam> {
-  Tuple<int> reduction_indices;
-  DMLC_DECLARE_PARAMETER(ReduceParam) {
-    DMLC_DECLARE_FIELD(reduction_indices).set_default(Tuple<int>());
-  }
-};
 DMLC_REGISTER_PARAMETER(ReduceParam);
 
 
@@ -448,12 +448,6 @@ NNVM_REGISTER_OP(_argmax)
 .set_attr<FInferShape>("FInferShape", ReduceShape);
 
 
-struct ConcatParam : public dmlc::Parameter<ConcatParam> {
-  uint32_t axis;
-  DMLC_DECLARE_PARAMETER(ConcatParam) {
-    DMLC_DECLARE_FIELD(axis).set_default(0);
-  }
-};
 DMLC_REGISTER_PARAMETER(ConcatParam);
 
 NNVM_REGISTER_OP(concat)
@@ -516,14 +510,6 @@ NNVM_REGISTER_OP(concat)
     return res;
 });
 
-struct SplitParam : public dmlc::Parameter<SplitParam> {
-  uint32_t axis;
-  uint32_t num_outputs;
-  DMLC_DECLARE_PARAMETER(SplitParam) {
-    DMLC_DECLARE_FIELD(axis).set_default(0);
-    DMLC_DECLARE_FIELD(num_outputs).set_default(2);
-  }
-};
 DMLC_REGISTER_PARAMETER(SplitParam);
 
 NNVM_REGISTER_OP(split)
@@ -632,4 +618,91 @@ NNVM_REGISTER_OP(reshape)
     return std::vector<NodeEntry>{ {bpnode, 0, 0} };
 });
 
+DMLC_REGISTER_PARAMETER(OptimizerParam);
+
+// the updates of the optimizers run in one pass over the weights, mutating them
+// and their states in place. One node updates num_weights weights, its inputs
+// are grouped by kind: the weights, the gradients, then each kind of state, and
+// adam_update's step count t last. Output i is the updated weight i, which the
+// kernels skip when no one reads it, e.g. when the updates are grouped.
+template<uint32_t kTensors, uint32_t kExtra>
+inline uint32_t UpdateNumInputs(const NodeAttrs& attrs) {
+  return dmlc::get<OptimizerParam>(attrs.parsed).num_weights * kTensors + kExtra;
+}
+
+inline uint32_t UpdateNumOutputs(const NodeAttrs& attrs) {
+  return dmlc::get<OptimizerParam>(attrs.parsed).num_weights;
+}
+
+// the tensors of weight i share its shape, the extra inputs are (1,).
+template<uint32_t kTensors>
+inline bool UpdateShape(const NodeAttrs& attrs,
+                        std::vector<TShape> *ishape,
+                        std::vector<TShape> *oshape) {
+  const uint32_t n = dmlc::get<OptimizerParam>(attrs.parsed).num_weights;
+  for (uint32_t i = kTensors * n; i < ishape->size(); ++i) {
+    SHAPE_ASSIGN((*ishape)[i], TShape{1});
+  }
+  bool known = true;
+  for (uint32_t i = 0; i < n; ++i) {
+    TShape def_v = (*oshape)[i];
+    for (uint32_t k = 0; k < kTensors && def_v.ndim() == 0; ++k) {
+      def_v = (*ishape)[k * n + i];
+    }
+    if (def_v.ndim() == 0) {
+      known = false;
+      continue;
+    }
+    SHAPE_ASSIGN((*oshape)[i], def_v);
+    for (uint32_t k = 0; k < kTensors; ++k) {
+      SHAPE_ASSIGN((*ishape)[k * n + i], def_v);
+    }
+  }
+  return known;
+}
+
+// the inputs of the given kinds are mutated.
+inline std::vector<uint32_t> UpdateMutateInputs(const NodeAttrs& attrs,
+                                                std::vector<uint32_t> kinds) {
+  const uint32_t n = dmlc::get<OptimizerParam>(attrs.parsed).num_weights;
+  std::vector<uint32_t> ret;
+  for (uint32_t k : kinds) {
+    for (uint32_t i = 0; i < n; ++i) ret.push_back(k * n + i);
+  }
+  return ret;
+}
+
+NNVM_REGISTER_OP(sgd_update)
+.describe("weight -= learning_rate * grad, inputs: weights, grads")
+.set_num_inputs(UpdateNumInputs<2, 0>)
+.set_num_outputs(UpdateNumOutputs)
+.set_attr_parser(ParamParser<OptimizerParam>)
+.set_attr<FInferShape>("FInferShape", UpdateShape<2>)
+.set_attr<FMutateInputs>("FMutateInputs", [](const NodeAttrs& attrs) {
+    return UpdateMutateInputs(attrs, {0});
+  });
+
+NNVM_REGISTER_OP(momentum_update)
+.describe("mom = mom * momentum + grad, weight -= learning_rate * mom, "
+          "inputs: weights, grads, moms")
+.set_num_inputs(UpdateNumInputs<3, 0>)
+.set_num_outputs(UpdateNumOutputs)
+.set_attr_parser(ParamParser<OptimizerParam>)
+.set_attr<FInferShape>("FInferShape", UpdateShape<3>)
+.set_attr<FMutateInputs>("FMutateInputs", [](const NodeAttrs& attrs) {
+    return UpdateMutateInputs(attrs, {0, 2});
+  });
+
+// t is the step count, already increased for this step.
+NNVM_REGISTER_OP(adam_update)
+.describe("adam update of the weights and their moments m and v, "
+          "inputs: weights, grads, ms, vs, t")
+.set_num_inputs(UpdateNumInputs<4, 1>)
+.set_num_outputs(UpdateNumOutputs)
+.set_attr_parser(ParamParser<OptimizerParam>)
+.set_attr<FInferShape>("FInferShape", UpdateShape<4>)
+.set_attr<FMutateInputs>("FMutateInputs", [](const NodeAttrs& attrs) {
+    return UpdateMutateInputs(attrs, {0, 2, 3});
+  });
+
 }  // namespace tinyflow
@@ -9,6 +9,8 @@
 #include <tinyflow/base.h>
 #include <nnvm/op_attr_types.h>
 #include <nnvm/graph_attr_types.h>
+#include <dmlc/parameter.h>
+#include <cstdlib>
 #include <vector>
 #include <string>
 #include <utility>
@@ -140,6 +142,200 @@ struct NNBackwardParam {
   bool need_outputs{true};
 };
 
+// parameter of reduction ops
+struct ReduceParam : public dmlc::Parameter<ReduceParam> {
+  Tuple<int> reduction_indices;
+  DMLC_DECLARE_PARAMETER(ReduceParam) {
+    DMLC_DECLARE_FIELD(reduction_indices).set_default(Tuple<int>());
+  }
+};
+
+// parameter of concat
+struct ConcatParam : public dmlc::Parameter<ConcatParam> {
+  uint32_t axis;
+  DMLC_DECLARE_PARAMETER(ConcatParam) {
+    DMLC_DECLARE_FIELD(axis).set_default(0);
+  }
+};
+
+// parameter of split
+struct SplitParam : public dmlc::Parameter<SplitParam> {
+  uint32_t axis;
+  uint32_t num_outputs;
+  DMLC_DECLARE_PARAMETER(SplitParam) {
+    DMLC_DECLARE_FIELD(axis).set_default(0);
+    DMLC_DECLARE_FIELD(num_outputs).set_default(2);
+  }
+};
+
+// parameter of pad
+struct PadParam : public dmlc::Parameter<PadParam> {
+  uint32_t dim;
+  int pad;
+
+  DMLC_DECLARE_PARAMETER(PadParam) {
+    DMLC_DECLARE_FIELD(dim).set_default(0);
+    DMLC_DECLARE_FIELD(pad).set_default(0);
+  }
+};
+
+// parameter of convolution and pooling
+struct ConvPoolParam : public dmlc::Parameter<ConvPoolParam> {
+  TShape ksize;
+  TShape strides;
+  std::string padding;
+  std::string data_format;
+  bool no_bias;
+  uint32_t num_filter;
+  // relu applied to the output of conv2d, empty for none
+  std::string activation;
+
+  DMLC_DECLARE_PARAMETER(ConvPoolParam) {
+    DMLC_DECLARE_FIELD(ksize).set_default(TShape{1, 1, 1, 1});
+    DMLC_DECLARE_FIELD(strides).set_default(TShape{1, 1, 1, 1});
+    DMLC_DECLARE_FIELD(padding).set_default("SAME");
+    DMLC_DECLARE_FIELD(data_format).set_default("NCHW");
+    DMLC_DECLARE_FIELD(no_bias).set_default(true);
+    DMLC_DECLARE_FIELD(num_filter).set_default(0);
+    DMLC_DECLARE_FIELD(activation).set_default("");
+  }
+};
+
+// parameter of batch normalization
+struct BatchNormalizationParam : public dmlc::Parameter<BatchNormalizationParam> {
+  std::string name;
+  std::string data_format;
+  // normalize by the inputs moving_mean and moving_var instead of the batch
+  bool use_global_stats;
+  DMLC_DECLARE_PARAMETER(BatchNormalizationParam) {
+    DMLC_DECLARE_FIELD(name).set_default("batch_normalization");
+    DMLC_DECLARE_FIELD(data_format).set_default("NCHW");
+    DMLC_DECLARE_FIELD(use_global_stats).set_default(false);
+  }
+};
+
+// parameter of _batch_norm_fold
+struct BatchNormFoldParam : public dmlc::Parameter<BatchNormFoldParam> {
+  bool no_bias;
+  DMLC_DECLARE_PARAMETER(BatchNormFoldParam) {
+    DMLC_DECLARE_FIELD(no_bias).set_default(true);
+  }
+};
+
+// parameter of layout transform
+struct LayoutTransformParam : public dmlc::Parameter<LayoutTransformParam> {
+  std::string src_layout;
+  std::string dst_layout;
+  DMLC_DECLARE_PARAMETER(LayoutTransformParam) {
+    DMLC_DECLARE_FIELD(src_layout).set_default("NCHW");
+    DMLC_DECLARE_FIELD(dst_layout).set_default("NCHW");
+  }
+};
+
+// parameter of the optimizer updates, sgd_update, momentum_update and adam_update
+struct OptimizerParam : public dmlc::Parameter<OptimizerParam> {
+  // number of weights updated by the node
+  uint32_t num_weights;
+  float learning_rate;
+  float momentum;
+  float beta1;
+  float beta2;
+  float epsilon;
+  DMLC_DECLARE_PARAMETER(OptimizerParam) {
+    DMLC_DECLARE_FIELD(num_weights).set_default(1);
+    DMLC_DECLARE_FIELD(learning_rate).set_default(0.01f);
+    DMLC_DECLARE_FIELD(momentum).set_default(0.9f);
+    DMLC_DECLARE_FIELD(beta1).set_default(0.9f);
+    DMLC_DECLARE_FIELD(beta2).set_default(0.999f);
+    DMLC_DECLARE_FIELD(epsilon).set_default(1e-4f);
+  }
+};
+
+/*!
+ * \brief layout of 4d images, the data_format of conv and pooling.
+ *  Every layout is a view (N, C / inner, H, W, inner) of the logical NCHW image:
+ *  inner is 1 for NCHW, C for NHWC, and the block size for the blocked
+ *  layouts, e.g. 16 for NCHW16c whose shape is (N, C / 16, H, W, 16).
+ */
+struct DataLayout {
+  enum Kind {kNCHW, kNHWC, kNCHWc};
+  Kind kind{kNCHW};
+  /*! \brief channel block of kNCHWc */
+  uint32_t block{1};
+  /*! \brief parse the name of a layout, e.g. NCHW8c */
+  static DataLayout Parse(const std::string& name) {
+    DataLayout ret;
+    if (name == "NCHW") return ret;
+    if (name == "NHWC") {
+      ret.kind = kNHWC;
+      return ret;
+    }
+    int block = 0;
+    if (name.length() > 5 && name.compare(0, 4, "NCHW") == 0 &&
+        name[name.length() - 1] == 'c') {
+      block = std::atoi(name.substr(4, name.length() - 5).c_str());
+    }
+    CHECK_GT(block, 0) << "unknown data_format " << name
+                       << ", expect NCHW, NHWC or NCHW[x]c";
+    ret.kind = kNCHWc;
+    ret.block = static_cast<uint32_t>(block);
+    return ret;
+  }
+  /*! \return name of the layout */
+  inline std::string name() const {
+    switch (kind) {
+      case kNCHW: return "NCHW";
+      case kNHWC: return "NHWC";
+      default: return "NCHW" + std::to_string(block) + "c";
+    }
+  }
+  inline bool operator==(const DataLayout& other) const {
+    return kind == other.kind && (kind != kNCHWc || block == other.block);
+  }
+  inline bool operator!=(const DataLayout& other) const {
+    return !(*this == other);
+  }
+  /*! \return the channels that are contiguous in memory */
+  inline uint32_t inner(uint32_t channels) const {
+    switch (kind) {
+      case kNCHW: return 1;
+      case kNHWC: return channels;
+      default: return block;
+    }
+  }
+  /*! \return shape of the data in this layout, from its NCHW shape */
+  inline TShape FromNCHW(const TShape& s) const {
+    CHECK_EQ(s.ndim(), 4) << "expect 4d NCHW image, given " << s;
+    switch (kind) {
+      case kNCHW: return s;
+      case kNHWC: return TShape{s[0], s[2], s[3], s[1]};
+      default: {
+        CHECK_EQ(s[1] % block, 0)
+            << "channels " << s[1] << " is not divisible by the block of " << name();
+        return TShape{s[0], s[1] / block, s[2], s[3], block};
+      }
+    }
+  }
+  /*! \return NCHW shape of the data from its shape in this layout */
+  inline TShape ToNCHW(const TShape& s) const {
+    switch (kind) {
+      case kNCHW: {
+        CHECK_EQ(s.ndim(), 4) << "expect NCHW image, given " << s;
+        return s;
+      }
+      case kNHWC: {
+        CHECK_EQ(s.ndim(), 4) << "expect NHWC image, given " << s;
+        return TShape{s[0], s[3], s[1], s[2]};
+      }
+      default: {
+        CHECK(s.ndim() == 5 && s[4] == block)
+            << "expect " << name() << " image, given " << s;
+        return TShape{s[0], s[1] * block, s[2], s[3]};
+      }
+    }
+  }
+};
+
 }  // namespace tinyflow
 
 #endif  // TINYFLOW_OP_UTIL_H_
@@ -0,0 +1,166 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file convert_layout.cc
+ * \brief Run conv stacks in another data layout, e.g. NCHW16c.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <dmlc/logging.h>
+#include <string>
+#include <vector>
+#include "../op_util.h"
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+using nnvm::Op;
+
+/*!
+ * \brief run conv2d, max_pool, avg_pool and batch_normalization of NCHW data
+ *  in the layout of graph attribute "target_layout".
+ *  Each entry keeps one version per layout, the missing one is made on demand
+ *  by a _layout_transform node. An op reading the converted output of another
+ *  converted op reads it directly, so the transforms of a stack cancel and
+ *  only remain where the graph enters or leaves it. Elementwise ops whose
+ *  inputs are all converted outputs run in the new layout as well.
+ *  The blocked layouts need the channels divisible by the block; they are
+ *  tracked from num_filter of conv2d, since the shapes are not known yet.
+ *  Nodes that others depend on by control dependency, e.g. the forward node
+ *  of an nn module gradient, are kept as they are.
+ */
+Graph ConvertLayout(Graph src) {
+    static auto& fewise = Op::GetAttr<bool>("IsElementWise");
+    static const Op* conv_op = Op::Get("conv2d");
+    static const Op* max_pool_op = Op::Get("max_pool");
+    static const Op* avg_pool_op = Op::Get("avg_pool");
+    static const Op* bn_op = Op::Get("batch_normalization");
+    const std::string target_name = src.GetAttr<std::string>("target_layout");
+    const DataLayout target = DataLayout::Parse(target_name);
+    const DataLayout nchw;
+    if (target == nchw) return src;
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        for (uint32_t dep : idx[nid].control_deps) {
+            pinned[dep] = true;
+        }
+    }
+    // number of channels of each entry, 0 when unknown.
+    std::vector<uint32_t> channels(idx.num_node_entries(), 0);
+    // the entries in the new graph, in NCHW and in the target layout.
+    std::vector<NodeEntry> nchw_entry(idx.num_node_entries());
+    std::vector<NodeEntry> target_entry(idx.num_node_entries());
+    // whether the entry is computed in the target layout.
+    std::vector<bool> converted(idx.num_node_entries(), false);
+    std::vector<NodePtr> new_node(idx.num_nodes());
+
+    auto transform = [](const NodeEntry& e, const DataLayout& from, const DataLayout& to) {
+        return MakeNode("_layout_transform", e.node->attrs.name + "_to_" + to.name(), {e},
+                        {{"src_layout", from.name()}, {"dst_layout", to.name()}});
+    };
+    auto get_nchw = [&](const NodeEntry& e) {
+        const uint32_t eid = idx.entry_id(e);
+        if (nchw_entry[eid].node == nullptr) {
+            nchw_entry[eid] = transform(target_entry[eid], target, nchw);
+        }
+        return nchw_entry[eid];
+    };
+    auto get_target = [&](const NodeEntry& e) {
+        const uint32_t eid = idx.entry_id(e);
+        if (target_entry[eid].node == nullptr) {
+            target_entry[eid] = transform(nchw_entry[eid], nchw, target);
+        }
+        return target_entry[eid];
+    };
+    auto fits = [&](uint32_t c) {
+        return target.kind != DataLayout::kNCHWc || (c != 0 && c % target.block == 0);
+    };
+
+    nnvm::DFSVisit(src.outputs, [&](const NodePtr& n) {
+        const uint32_t nid = idx.node_id(n.get());
+        if (n->is_variable()) {
+            new_node[nid] = n;
+            nchw_entry[idx.entry_id(nid, 0)] = NodeEntry{n, 0, 0};
+            return;
+        }
+        const Op* op = n->op();
+        const bool is_image_op = op == conv_op || op == max_pool_op ||
+            op == avg_pool_op || op == bn_op;
+        uint32_t in_channels = n->inputs.size() != 0 ? channels[idx.entry_id(n->inputs[0])] : 0;
+        uint32_t out_channels = in_channels;
+        bool convert = false;
+        if (is_image_op) {
+            if (op == conv_op) {
+                out_channels = dmlc::get<ConvPoolParam>(n->attrs.parsed).num_filter;
+            }
+            auto it = n->attrs.dict.find("data_format");
+            const bool is_nchw = it == n->attrs.dict.end() ||
+                DataLayout::Parse(it->second) == nchw;
+            convert = is_nchw && !pinned[nid] && fits(in_channels) && fits(out_channels);
+        } else if (fewise.get(op, false) && n->num_outputs() == 1 && !pinned[nid] &&
+                   n->inputs.size() != 0) {
+            convert = true;
+            for (const auto& e : n->inputs) {
+                convert = convert && converted[idx.entry_id(e)];
+            }
+        } else {
+            out_channels = 0;
+        }
+        NodePtr p = Node::Create();
+        p->attrs = n->attrs;
+        for (const auto& dep : n->control_deps) {
+            p->control_deps.push_back(new_node[idx.node_id(dep.get())]);
+        }
+        new_node[nid] = p;
+        if (!convert) {
+            for (const auto& e : n->inputs) {
+                p->inputs.push_back(get_nchw(e));
+            }
+            for (uint32_t i = 0; i < n->num_outputs(); ++i) {
+                nchw_entry[idx.entry_id(nid, i)] = NodeEntry{p, i, 0};
+            }
+            if (n->num_outputs() == 1) channels[idx.entry_id(nid, 0)] = out_channels;
+            return;
+        }
+        if (is_image_op) {
+            // only the data is in the layout, the filter, bias, gamma and beta are not.
+            p->attrs.dict["data_format"] = target.name();
+            op->attr_parser(&(p->attrs));
+            p->inputs.push_back(get_target(n->inputs[0]));
+            for (size_t i = 1; i < n->inputs.size(); ++i) {
+                p->inputs.push_back(get_nchw(n->inputs[i]));
+            }
+        } else {
+            for (const auto& e : n->inputs) {
+                p->inputs.push_back(get_target(e));
+            }
+        }
+        const uint32_t eid = idx.entry_id(nid, 0);
+        target_entry[eid] = NodeEntry{p, 0, 0};
+        converted[eid] = true;
+        channels[eid] = out_channels;
+    });
+
+    Graph ret;
+    for (const auto& e : src.outputs) {
+        ret.outputs.push_back(get_nchw(e));
+    }
+    return ret;
+}
+
+NNVM_REGISTER_PASS(ConvertLayout)
+.describe("Run conv, pooling and batch normalization in the layout of target_layout")
+.set_body(ConvertLayout)
+.set_change_graph(true)
+.depend_graph_attr("target_layout");
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
@@ -0,0 +1,123 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file eliminate_common_expr.cc
+ * \brief Merge the nodes that compute the same value.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+using nnvm::Op;
+
+/*! \brief what a pure node computes: op, attributes and input entries of the new graph */
+using ExprKey = std::tuple<const Op*,
+                           std::vector<std::pair<std::string, std::string> >,
+                           std::vector<std::tuple<const Node*, uint32_t, uint32_t> > >;
+
+/*!
+ * \brief merge the nodes with the same op, attributes and inputs, e.g. the
+ *  scalar ops repeated in gradient graphs. The inputs are compared after merging, so
+ *  the duplicated chains are merged from their first node on.
+ *  Only pure nodes are merged. Ops without inputs, e.g. placeholder and
+ *  normal, are not, unless they are marked IsConstant. Neither are ops that
+ *  mutate their inputs, e.g. assign, nodes reading an entry that some op
+ *  mutates, whose value depends on where they run, and nodes tied to others
+ *  by control dependency, e.g. nn modules and their gradients.
+ */
+Graph EliminateCommonExpr(Graph src) {
+    static auto& fconstant = Op::GetAttr<bool>("IsConstant");
+    static auto& fmutate_inputs = Op::GetAttr<nnvm::FMutateInputs>("FMutateInputs");
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    std::vector<bool> mutated(idx.num_node_entries(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        const auto& inode = idx[nid];
+        for (uint32_t dep : inode.control_deps) {
+            pinned[dep] = true;
+        }
+        if (inode.source->is_variable()) continue;
+        const Op* op = inode.source->op();
+        if (fmutate_inputs.count(op)) {
+            pinned[nid] = true;
+            for (uint32_t i : fmutate_inputs[op](inode.source->attrs)) {
+                mutated[idx.entry_id(inode.inputs[i])] = true;
+            }
+        }
+    }
+
+    std::vector<NodePtr> new_node(idx.num_nodes());
+    // the entry of the new graph that computes each entry.
+    std::vector<NodeEntry> new_entry(idx.num_node_entries());
+    std::map<ExprKey, NodePtr> exprs;
+    nnvm::DFSVisit(src.outputs, [&](const NodePtr& n) {
+        const uint32_t nid = idx.node_id(n.get());
+        if (n->is_variable()) {
+            new_node[nid] = n;
+            new_entry[idx.entry_id(nid, 0)] = NodeEntry{n, 0, 0};
+            return;
+        }
+        NodePtr p = Node::Create();
+        p->attrs = n->attrs;
+        for (const auto& e : n->inputs) {
+            p->inputs.push_back(new_entry[idx.entry_id(e)]);
+        }
+        for (const auto& dep : n->control_deps) {
+            p->control_deps.push_back(new_node[idx.node_id(dep.get())]);
+        }
+        bool pure = !pinned[nid] && n->control_deps.size() == 0 &&
+            (n->inputs.size() != 0 || fconstant.get(n->op(), false));
+        for (const auto& e : n->inputs) {
+            pure = pure && !mutated[idx.entry_id(e)];
+        }
+        if (pure) {
+            ExprKey key;
+            std::get<0>(key) = n->op();
+            auto& attrs = std::get<1>(key);
+            attrs.assign(n->attrs.dict.begin(), n->attrs.dict.end());
+            std::sort(attrs.begin(), attrs.end());
+            for (const auto& e : p->inputs) {
+                std::get<2>(key).emplace_back(e.node.get(), e.index, e.version);
+            }
+            auto it = exprs.find(key);
+            if (it != exprs.end()) {
+                p = it->second;
+            } else {
+                exprs.emplace(std::move(key), p);
+            }
+        }
+        new_node[nid] = p;
+        for (uint32_t i = 0; i < n->num_outputs(); ++i) {
+            new_entry[idx.entry_id(nid, i)] = NodeEntry{p, i, 0};
+        }
+    });
+
+    Graph ret;
+    for (const auto& e : src.outputs) {
+        ret.outputs.push_back(new_entry[idx.entry_id(e)]);
+    }
+    return ret;
+}
+
+NNVM_REGISTER_PASS(EliminateCommonExpr)
+.describe("Merge the pure nodes with the same op, attributes and inputs")
+.set_body(EliminateCommonExpr)
+.set_change_graph(true);
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
@@ -0,0 +1,145 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file eliminate_merge.cc
+ * \brief Pass the parts of a partitioned node to the next one without merging them.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <vector>
+
+#include "../op_util.h"
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+using nnvm::Op;
+
+// whether the entries are the outputs of one split, which have the same shape.
+bool FromOneSplit(const std::vector<NodeEntry>& entries) {
+    static const Op* split_op = Op::Get("split");
+    for (const auto& e : entries) {
+        if (e.node != entries[0].node) return false;
+    }
+    return !entries[0].node->is_variable() && entries[0].node->op() == split_op;
+}
+
+/*!
+ * \brief whether the entries have the same shape for sure, without shapes:
+ *  outputs of one split, or the same output of nodes of one op and attributes
+ *  whose inputs are either the same or the outputs of one split, e.g. the
+ *  parts Parallelize makes of a node.
+ */
+bool SameShape(const std::vector<NodeEntry>& entries) {
+    if (FromOneSplit(entries)) return true;
+    const Node* first = entries[0].node.get();
+    if (first->is_variable()) return false;
+    for (const auto& e : entries) {
+        const Node* n = e.node.get();
+        if (n->is_variable() || n->op() != first->op() || e.index != entries[0].index ||
+            n->attrs.dict != first->attrs.dict || n->inputs.size() != first->inputs.size()) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < first->inputs.size(); ++i) {
+        std::vector<NodeEntry> inputs;
+        bool same = true;
+        for (const auto& e : entries) {
+            const NodeEntry& in = e.node->inputs[i];
+            same = same && in.node == first->inputs[i].node && in.index == first->inputs[i].index;
+            inputs.push_back(in);
+        }
+        if (!same && !FromOneSplit(inputs)) return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief cancel the concat followed by a split of the same axis and count,
+ *  e.g. the merge of a node Parallelize cut in parts and the split of the
+ *  next node cut the same way, so the parts flow from one node to the other.
+ *  The readers of the split read the inputs of the concat instead, and the
+ *  concat goes when no one else reads it. The inputs of the concat need to
+ *  have the same shape, which is checked on the structure of the graph as
+ *  the shapes are not known yet.
+ *  Nodes tied to others by control dependency are kept.
+ */
+Graph EliminateMerge(Graph src) {
+    static const Op* concat_op = Op::Get("concat");
+    static const Op* split_op = Op::Get("split");
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        for (uint32_t dep : idx[nid].control_deps) {
+            pinned[dep] = true;
+        }
+    }
+    // whether the split nid cancels the concat it reads.
+    auto cancels = [&](uint32_t nid) {
+        const auto& inode = idx[nid];
+        if (inode.source->op() != split_op || pinned[nid] || inode.control_deps.size() != 0) {
+            return false;
+        }
+        const uint32_t cid = inode.inputs[0].node_id;
+        const Node* concat = idx[cid].source;
+        if (concat->is_variable() || concat->op() != concat_op || pinned[cid] ||
+            concat->control_deps.size() != 0) {
+            return false;
+        }
+        const auto& split = dmlc::get<SplitParam>(inode.source->attrs.parsed);
+        return dmlc::get<ConcatParam>(concat->attrs.parsed).axis == split.axis &&
+            concat->inputs.size() == split.num_outputs && SameShape(concat->inputs);
+    };
+
+    std::vector<NodePtr> new_node(idx.num_nodes());
+    // the entry of the new graph that computes each entry.
+    std::vector<NodeEntry> new_entry(idx.num_node_entries());
+    nnvm::DFSVisit(src.outputs, [&](const NodePtr& n) {
+        const uint32_t nid = idx.node_id(n.get());
+        if (n->is_variable()) {
+            new_node[nid] = n;
+            new_entry[idx.entry_id(nid, 0)] = NodeEntry{n, 0, 0};
+            return;
+        }
+        if (cancels(nid)) {
+            const auto& concat = idx[idx[nid].inputs[0].node_id].source;
+            for (uint32_t i = 0; i < n->num_outputs(); ++i) {
+                new_entry[idx.entry_id(nid, i)] = new_entry[idx.entry_id(concat->inputs[i])];
+            }
+            return;
+        }
+        NodePtr p = Node::Create();
+        p->attrs = n->attrs;
+        for (const auto& e : n->inputs) {
+            p->inputs.push_back(new_entry[idx.entry_id(e)]);
+        }
+        for (const auto& dep : n->control_deps) {
+            p->control_deps.push_back(new_node[idx.node_id(dep.get())]);
+        }
+        new_node[nid] = p;
+        for (uint32_t i = 0; i < n->num_outputs(); ++i) {
+            new_entry[idx.entry_id(nid, i)] = NodeEntry{p, i, 0};
+        }
+    });
+
+    Graph ret;
+    for (const auto& e : src.outputs) {
+        ret.outputs.push_back(new_entry[idx.entry_id(e)]);
+    }
+    return ret;
+}
+
+NNVM_REGISTER_PASS(EliminateMerge)
+.describe("Cancel the concat followed by a split of the same axis and count")
+.set_body(EliminateMerge)
+.set_change_graph(true);
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
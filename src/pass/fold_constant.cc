@@ -0,0 +1,96 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fold_constant.cc
+ * \brief Find the subgraphs that compute the same value on every run.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <nnvm/graph_attr_types.h>
+#include <memory>
+#include <vector>
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Op;
+
+// the states of graph attribute constant_node, same as ConstantState of session_util.h
+const int kNotConstant = 0;
+const int kDeadConstant = 1;
+const int kFrozenConstant = 2;
+
+/*!
+ * \brief mark the nodes whose outputs do not depend on placeholders or variables.
+ *  A node is constant when its op is marked IsConstant, whose output only
+ *  depends on the attributes and the input shapes, e.g. zeros and ones_like,
+ *  or when all its inputs are constant. Shapes are fixed until the executor
+ *  sets up its space again, when the constants are evaluated again.
+ *  Ops without inputs that are not marked, e.g. placeholder and normal, are
+ *  not constant, nor are nodes tied to others by control dependency and nodes
+ *  whose output is mutated, e.g. by assign.
+ *  The result is graph attribute "constant_node" of each node:
+ *  kFrozenConstant for the constants read by the rest of the graph, whose
+ *  outputs are kept, and kDeadConstant for those only read by other constants,
+ *  which are not needed once the constants are evaluated.
+ */
+Graph FoldConstant(Graph src) {
+    static auto& fconstant = Op::GetAttr<bool>("IsConstant");
+    static auto& fmutate_inputs = Op::GetAttr<nnvm::FMutateInputs>("FMutateInputs");
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        const auto& inode = idx[nid];
+        for (uint32_t dep : inode.control_deps) {
+            pinned[dep] = true;
+        }
+        if (inode.source->is_variable()) continue;
+        const Op* op = inode.source->op();
+        if (fmutate_inputs.count(op)) {
+            for (uint32_t i : fmutate_inputs[op](inode.source->attrs)) {
+                pinned[inode.inputs[i].node_id] = true;
+            }
+        }
+    }
+    std::vector<int> constant(idx.num_nodes(), kNotConstant);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        const auto& inode = idx[nid];
+        if (inode.source->is_variable() || pinned[nid] || inode.control_deps.size() != 0) {
+            continue;
+        }
+        bool is_constant = fconstant.get(inode.source->op(), false);
+        if (!is_constant && inode.inputs.size() != 0) {
+            is_constant = true;
+            for (const auto& e : inode.inputs) {
+                is_constant = is_constant && constant[e.node_id] != kNotConstant;
+            }
+        }
+        if (is_constant) constant[nid] = kDeadConstant;
+    }
+    // constants read by the others and the outputs of the graph are kept.
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        if (constant[nid] != kNotConstant) continue;
+        for (const auto& e : idx[nid].inputs) {
+            if (constant[e.node_id] != kNotConstant) constant[e.node_id] = kFrozenConstant;
+        }
+    }
+    for (const auto& e : idx.outputs()) {
+        if (constant[e.node_id] != kNotConstant) constant[e.node_id] = kFrozenConstant;
+    }
+    src.attrs["constant_node"] = std::make_shared<nnvm::any>(std::move(constant));
+    return src;
+}
+
+NNVM_REGISTER_PASS(FoldConstant)
+.describe("Mark the nodes that do not depend on placeholders or variables, "
+          "so the executor evaluates them once")
+.set_body(FoldConstant)
+.set_change_graph(false)
+.provide_graph_attr("constant_node");
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
@@ -0,0 +1,132 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fold_conv_bn.cc
+ * \brief Fold conv2d -> batch_normalization -> relu of inference into one conv2d.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <dmlc/logging.h>
+#include <vector>
+#include "../op_util.h"
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+using nnvm::Op;
+
+/*!
+ * \brief fold the chains conv2d -> batch_normalization -> relu into one conv2d.
+ *  A batch_normalization with use_global_stats is an affine map of each channel,
+ *  folded into the weight and bias of the conv2d before it by a _batch_norm_fold
+ *  node, whose cost is that of reading the weight once. A relu after either of
+ *  them becomes the activation of the conv2d, run in the epilogue of its kernel.
+ *  An op is folded only when it is the single reader of the output before it,
+ *  and nodes that others depend on by control dependency, e.g. the forward node
+ *  of an nn module gradient, are kept, so training graphs stay as they are.
+ */
+Graph FoldConvBatchNorm(Graph src) {
+    static const Op* conv_op = Op::Get("conv2d");
+    static const Op* bn_op = Op::Get("batch_normalization");
+    static const Op* relu_op = Op::Get("relu");
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<uint32_t> ref_count(idx.num_node_entries(), 0);
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        for (const auto& e : idx[nid].inputs) {
+            ++ref_count[idx.entry_id(e)];
+        }
+        for (uint32_t dep : idx[nid].control_deps) {
+            pinned[dep] = true;
+        }
+    }
+    for (const auto& e : idx.outputs()) {
+        ++ref_count[idx.entry_id(e)];
+    }
+    // whether n can be computed by the node of its first input.
+    auto foldable = [&](const NodePtr& n) {
+        const NodeEntry& in = n->inputs[0];
+        return !pinned[idx.node_id(n.get())] && n->control_deps.size() == 0 &&
+            !pinned[idx.node_id(in.node.get())] && ref_count[idx.entry_id(in)] == 1;
+    };
+
+    std::vector<NodePtr> new_node(idx.num_nodes());
+    // the entry of the new graph that computes each entry.
+    std::vector<NodeEntry> new_entry(idx.num_node_entries());
+    // whether the new entry is the output of a conv2d without activation.
+    std::vector<bool> conv_out(idx.num_node_entries(), false);
+    nnvm::DFSVisit(src.outputs, [&](const NodePtr& n) {
+        const uint32_t nid = idx.node_id(n.get());
+        if (n->is_variable()) {
+            new_node[nid] = n;
+            new_entry[idx.entry_id(nid, 0)] = NodeEntry{n, 0, 0};
+            return;
+        }
+        const Op* op = n->op();
+        NodePtr p = Node::Create();
+        p->attrs = n->attrs;
+        for (const auto& e : n->inputs) {
+            p->inputs.push_back(new_entry[idx.entry_id(e)]);
+        }
+        for (const auto& dep : n->control_deps) {
+            p->control_deps.push_back(new_node[idx.node_id(dep.get())]);
+        }
+        new_node[nid] = p;
+        const uint32_t eid = idx.entry_id(nid, 0);
+        const uint32_t in_eid = n->inputs.size() != 0 ? idx.entry_id(n->inputs[0]) : 0;
+        if (op == bn_op && conv_out[in_eid] && foldable(n)) {
+            const auto& param = dmlc::get<BatchNormalizationParam>(n->attrs.parsed);
+            NodePtr conv = new_entry[in_eid].node;
+            const ConvPoolParam conv_param = dmlc::get<ConvPoolParam>(conv->attrs.parsed);
+            if (param.use_global_stats && DataLayout::Parse(param.data_format) ==
+                DataLayout::Parse(conv_param.data_format)) {
+                // inputs: weight, [bias], gamma, beta, moving_mean, moving_var
+                std::vector<NodeEntry> inputs(conv->inputs.begin() + 1, conv->inputs.end());
+                inputs.insert(inputs.end(), p->inputs.begin() + 1, p->inputs.end());
+                NodePtr fold = MakeNode(
+                    "_batch_norm_fold", n->attrs.name + "_fold", inputs,
+                    {{"no_bias", conv_param.no_bias ? "True" : "False"}}).node;
+                conv->inputs = {conv->inputs[0], NodeEntry{fold, 0, 0}, NodeEntry{fold, 1, 0}};
+                conv->attrs.dict["no_bias"] = "False";
+                conv_op->attr_parser(&(conv->attrs));
+                new_entry[eid] = new_entry[in_eid];
+                conv_out[eid] = true;
+                return;
+            }
+        }
+        if (op == relu_op && conv_out[in_eid] && foldable(n)) {
+            NodePtr conv = new_entry[in_eid].node;
+            conv->attrs.dict["activation"] = "relu";
+            conv_op->attr_parser(&(conv->attrs));
+            new_entry[eid] = new_entry[in_eid];
+            return;
+        }
+        for (uint32_t i = 0; i < n->num_outputs(); ++i) {
+            new_entry[idx.entry_id(nid, i)] = NodeEntry{p, i, 0};
+        }
+        if (op == conv_op) {
+            conv_out[eid] = dmlc::get<ConvPoolParam>(p->attrs.parsed).activation.length() == 0;
+        }
+    });
+
+    Graph ret;
+    for (const auto& e : src.outputs) {
+        ret.outputs.push_back(new_entry[idx.entry_id(e)]);
+    }
+    return ret;
+}
+
+NNVM_REGISTER_PASS(FoldConvBatchNorm)
+.describe("Fold batch_normalization of global statistics and relu into the conv2d before them")
+.set_body(FoldConvBatchNorm)
+.set_change_graph(true);
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
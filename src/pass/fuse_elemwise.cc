@@ -0,0 +1,152 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fuse_elemwise.cc
+ * \brief Fuse chains of elementwise ops into one CPU kernel.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/op_attr_types.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "../native/ewise_program.h"
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+using nnvm::Op;
+
+/*!
+ * \brief replace each tree of elementwise ops by a _fused_elemwise node.
+ *  A node is folded into its consumer when both have FEwiseCodeGen,
+ *  and its output is used only by that consumer. Outputs of the graph,
+ *  and nodes other ops depend on by control dependency, stay materialized.
+ *  The shapes are not needed, inputs of shape (1,) broadcast at runtime.
+ */
+Graph FuseElemwise(Graph src) {
+    static auto& fewise = Op::GetAttr<bool>("IsElementWise");
+    static auto& fcodegen = Op::GetAttr<FEwiseCodeGen>("FEwiseCodeGen");
+    static const Op* fused_op = Op::Get("_fused_elemwise");
+    const IndexedGraph& idx = src.indexed_graph();
+
+    std::vector<bool> fusible(idx.num_nodes(), false);
+    std::vector<bool> pinned(idx.num_nodes(), false);
+    std::vector<uint32_t> ref_count(idx.num_node_entries(), 0);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        const auto& inode = idx[nid];
+        if (inode.source->is_variable()) continue;
+        const Op* op = inode.source->op();
+        fusible[nid] = fewise.get(op, false) && fcodegen.count(op) &&
+            inode.source->num_outputs() == 1 && inode.control_deps.size() == 0;
+        for (const auto& e : inode.inputs) {
+            ++ref_count[idx.entry_id(e)];
+        }
+        for (uint32_t dep : inode.control_deps) {
+            pinned[dep] = true;
+        }
+    }
+    for (const auto& e : idx.outputs()) {
+        pinned[e.node_id] = true;
+    }
+    // whether the node is computed inside the kernel of its consumer.
+    std::vector<bool> folded(idx.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        if (!fusible[nid]) continue;
+        for (const auto& e : idx[nid].inputs) {
+            if (fusible[e.node_id] && !pinned[e.node_id] &&
+                ref_count[idx.entry_id(e)] == 1) {
+                folded[e.node_id] = true;
+            }
+        }
+    }
+
+    std::vector<NodePtr> new_node(idx.num_nodes());
+    auto new_entry = [&](const NodeEntry& e) {
+        return NodeEntry{new_node[idx.node_id(e.node.get())], e.index, e.version};
+    };
+    nnvm::DFSVisit(src.outputs, [&](const NodePtr& n) {
+        const uint32_t nid = idx.node_id(n.get());
+        if (n->is_variable()) {
+            new_node[nid] = n;
+            return;
+        }
+        if (folded[nid]) return;
+        bool has_folded_input = false;
+        for (const auto& e : n->inputs) {
+            if (folded[idx.node_id(e.node.get())]) has_folded_input = true;
+        }
+        NodePtr p = Node::Create();
+        if (!fusible[nid] || !has_folded_input) {
+            p->attrs = n->attrs;
+            for (const auto& e : n->inputs) {
+                p->inputs.push_back(new_entry(e));
+            }
+            for (const auto& dep : n->control_deps) {
+                p->control_deps.push_back(new_node[idx.node_id(dep.get())]);
+            }
+            new_node[nid] = p;
+            return;
+        }
+        // inputs of the kernel are the distinct entries read from outside the tree.
+        std::vector<NodeEntry> inputs;
+        std::vector<uint32_t> input_eids;
+        std::function<void(const NodePtr&)> collect = [&](const NodePtr& m) {
+            for (const auto& e : m->inputs) {
+                if (folded[idx.node_id(e.node.get())]) {
+                    collect(e.node); continue;
+                }
+                uint32_t eid = idx.entry_id(e);
+                if (std::find(input_eids.begin(), input_eids.end(), eid) == input_eids.end()) {
+                    input_eids.push_back(eid);
+                    inputs.push_back(e);
+                }
+            }
+        };
+        collect(n);
+        EwiseProgram prog;
+        prog.num_inputs = static_cast<int>(inputs.size());
+        std::function<int(const NodePtr&)> codegen = [&](const NodePtr& m) {
+            std::vector<int> regs;
+            for (const auto& e : m->inputs) {
+                if (folded[idx.node_id(e.node.get())]) {
+                    regs.push_back(codegen(e.node)); continue;
+                }
+                uint32_t eid = idx.entry_id(e);
+                regs.push_back(static_cast<int>(
+                    std::find(input_eids.begin(), input_eids.end(), eid) - input_eids.begin()));
+            }
+            return fcodegen[m->op()](m->attrs, regs, &prog);
+        };
+        codegen(n);
+        p->attrs.op = fused_op;
+        p->attrs.name = n->attrs.name;
+        p->attrs.dict["expr"] = prog.ToString();
+        p->attrs.parsed = std::move(prog);
+        for (const auto& e : inputs) {
+            p->inputs.push_back(new_entry(e));
+        }
+        new_node[nid] = p;
+    });
+
+    Graph ret;
+    for (const auto& e : src.outputs) {
+        ret.outputs.push_back(new_entry(e));
+    }
+    return ret;
+}
+
+NNVM_REGISTER_PASS(FuseElemwise)
+.describe("Fuse trees of elementwise ops into _fused_elemwise nodes run by one CPU kernel")
+.set_body(FuseElemwise)
+.set_change_graph(true);
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
@@ -1,11 +1,15 @@
 /*!
  *  Copyright (c) 2016 by Aetf
  * \file parallelize.cpp
- * \brief Apply model/data parallel to marked nodes.
+ * \brief Apply model/data parallel to the nodes worth splitting.
  */
 #include <nnvm/pass.h>
 #include <nnvm/pass_functions.h>
+#include <nnvm/graph_attr_types.h>
 #include <algorithm>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "../op_util.h"
@@ -69,111 +73,344 @@ void replaceUsage(const IndexedGraph &idxg, const UseSite &use, const NodeEntry
     userNode->inputs[use.user_input_idx] = replacement;
 }
 
-// Substitute node with corresponding parallelized version
+// Rough rates of one core for the cost model, only their ratios matter.
+// multiply-adds count as two flops.
+const double kFlopRate = 1e10;
+// bytes per second streamed by a kernel
+const double kMemRate = 1e10;
+// bytes per second copied by split and concat, which run on one core
+const double kCopyRate = 5e9;
+// seconds to dispatch one node
+const double kNodeCost = 5e-6;
+
+/*! \brief how to cut a node into parts */
+struct PartitionPlan {
+    // "data" or "model"
+    std::string kind;
+    uint32_t parts{0};
+    // axis each input is split on, -1 for inputs shared by the parts
+    vector<int> split_axis;
+    // axis the outputs of the parts are concatenated on
+    uint32_t merge_axis{0};
+    // attributes changed in the parts, e.g. num_filter of conv2d
+    std::unordered_map<std::string, std::string> part_attrs;
+    // estimated seconds, split and merge included
+    double time{0};
+};
+
+/*! \brief the merge of a partitioned node read by an input, parts 0 for none */
+struct InputMerge {
+    int axis{-1};
+    uint32_t parts{0};
+};
+
+// time of a kernel of flops and bytes touched.
+inline double KernelTime(double flops, double bytes) {
+    return std::max(flops / kFlopRate, bytes / kMemRate) + kNodeCost;
+}
+
+inline double Bytes(const TShape &s) {
+    return static_cast<double>(s.Size()) * sizeof(float);
+}
+
+/*!
+ * \brief the ops that can be partitioned and their cost.
+ *  Data parallelism splits the batch, axis 0 of the data, and shares the weights.
+ *  Model parallelism splits the output features of linear, matmul and conv2d,
+ *  and shares the data.
+ */
+class PartitionModel {
+ public:
+    /*!
+     * \param unknown_parts number of parts of a marked node whose split axis
+     *  has an unknown size.
+     */
+    PartitionModel(const IndexedGraph &idxg, const nnvm::ShapeVector &shapes,
+                   uint32_t unknown_parts)
+        : idxg_(idxg), shapes_(shapes), unknown_parts_(unknown_parts) {}
+
+    // whether the node is of an op that can be partitioned.
+    bool Supported(const Node *n) const {
+        static auto &fewise = Op::GetAttr<bool>("IsElementWise");
+        const std::string &name = n->op()->name;
+        return name == "matmul" || name == "linear" || name == "conv2d" ||
+            name == "max_pool" || name == "avg_pool" ||
+            (fewise.get(n->op(), false) && n->num_outputs() == 1);
+    }
+
+    /*!
+     * \brief the plans of kind to cut node nid in at most max_parts parts,
+     *  one per number of parts that divides the split axis.
+     *  With unknown shapes, the only plan is of unknown cost, in unknown_parts
+     *  parts, or in the largest number of parts up to it that divides the size
+     *  attribute, e.g. num_hidden, when there is one.
+     *  An input split the way it is merged costs no copy, since EliminateMerge
+     *  passes the parts through, and elementwise ops follow the merge they read.
+     * \param merges the merge read by each input.
+     * \param serial_time the estimated seconds of the node as it is, 0 when unknown.
+     */
+    vector<PartitionPlan> Plans(uint32_t nid, const std::string &kind, uint32_t max_parts,
+                                const vector<InputMerge> &merges, double *serial_time) const {
+        const auto &inode = idxg_[nid];
+        const Node *n = inode.source;
+        const std::string &name = n->op()->name;
+        vector<TShape> ishape;
+        bool known = true;
+        for (const auto &e : inode.inputs) {
+            ishape.push_back(shapes_[idxg_.entry_id(e)]);
+            known = known && ishape.back().ndim() != 0;
+        }
+        const TShape &oshape = shapes_[idxg_.entry_id(nid, 0)];
+        known = known && oshape.ndim() != 0;
+        *serial_time = 0;
+
+        PartitionPlan plan;
+        plan.kind = kind;
+        plan.split_axis.assign(ishape.size(), -1);
+        // size of the split axis
+        uint32_t dim = 0;
+        // the parts need a multiple of align of the split axis
+        uint32_t align = 1;
+        // attribute holding the size of the split axis, e.g. num_filter
+        std::string size_attr;
+        // number of parts of the merge followed, 0 for any
+        uint32_t follow = 0;
+        if (kind == "data") {
+            plan.merge_axis = 0;
+            if (name == "matmul" || name == "linear" || name == "conv2d" ||
+                name == "max_pool" || name == "avg_pool") {
+                plan.split_axis[0] = 0;
+            } else {
+                // elementwise, inputs of shape (1,) are broadcast, the others are split,
+                // on the axis of the first merge read if any. Without all the shapes,
+                // the inputs not known to be of shape (1,) are split.
+                vector<uint32_t> split;
+                for (uint32_t i = 0; i < ishape.size(); ++i) {
+                    const bool broadcast = ishape[i].ndim() != 0 && ishape[i].Size() == 1;
+                    if (known ? ishape[i] == oshape : !broadcast) {
+                        split.push_back(i);
+                        if (follow == 0 && merges[i].parts != 0 &&
+                            (!known || static_cast<uint32_t>(merges[i].axis) < oshape.ndim())) {
+                            plan.merge_axis = merges[i].axis;
+                            follow = merges[i].parts;
+                        }
+                    } else if (ishape[i].Size() != 1) {
+                        return {};
+                    }
+                }
+                if (split.size() == 0) return {};
+                for (uint32_t i : split) plan.split_axis[i] = plan.merge_axis;
+            }
+            if (known) dim = oshape[plan.merge_axis];
+        } else if (kind == "model") {
+            if (name == "matmul") {
+                // (m, k) x (k, n), split n
+                plan.split_axis[1] = 1;
+                plan.merge_axis = 1;
+                if (known) dim = ishape[1][1];
+            } else if (name == "linear") {
+                // the weight is (num_hidden, in), split num_hidden
+                for (uint32_t i = 1; i < ishape.size(); ++i) plan.split_axis[i] = 0;
+                plan.merge_axis = 1;
+                size_attr = "num_hidden";
+                if (known) dim = ishape[1][0];
+            } else if (name == "conv2d") {
+                // the filter is (out, in, kh, kw), split out
+                const DataLayout layout = DataLayout::Parse(
+                    dmlc::get<ConvPoolParam>(n->attrs.parsed).data_format);
+                for (uint32_t i = 1; i < ishape.size(); ++i) plan.split_axis[i] = 0;
+                plan.merge_axis = layout.kind == DataLayout::kNHWC ? 3 : 1;
+                align = layout.kind == DataLayout::kNCHWc ? layout.block : 1;
+                size_attr = "num_filter";
+                if (known) dim = ishape[1][0];
+            } else {
+                return {};
+            }
+        } else {
+            return {};
+        }
+
+        vector<PartitionPlan> ret;
+        if (!known) {
+            // the sizes not known here are checked by the shape inference of split.
+            plan.parts = follow != 0 ? follow : unknown_parts_;
+            if (size_attr.length() != 0) {
+                auto it = n->attrs.dict.find(size_attr);
+                const uint32_t size = it == n->attrs.dict.end() ? 0 : std::stoi(it->second);
+                if (size != 0) {
+                    plan.parts = 0;
+                    for (uint32_t parts = 2; parts <= std::min(unknown_parts_, size); ++parts) {
+                        if (size % parts == 0 && (size / parts) % align == 0) plan.parts = parts;
+                    }
+                    if (plan.parts == 0) return ret;
+                    plan.part_attrs[size_attr] = std::to_string(size / plan.parts);
+                }
+            }
+            ret.push_back(plan);
+            return ret;
+        }
+        // cost of the kernel and of the copies made by split and concat.
+        // the shared inputs are read by each part.
+        double flops = 0, copy_bytes = Bytes(oshape), shared_bytes = 0;
+        for (uint32_t i = 0; i < ishape.size(); ++i) {
+            if (plan.split_axis[i] >= 0) {
+                copy_bytes += Bytes(ishape[i]);
+            } else {
+                shared_bytes += Bytes(ishape[i]);
+            }
+        }
+        if (name == "matmul" || name == "linear") {
+            const double hidden = name == "matmul" ? ishape[1][1] : ishape[1][0];
+            flops = 2.0 * ishape[0].Size() * hidden;
+        } else if (name == "conv2d") {
+            flops = 2.0 * oshape.Size() * ishape[1].ProdShape(1, 4);
+        } else if (name == "max_pool" || name == "avg_pool") {
+            const auto &ksize = dmlc::get<ConvPoolParam>(n->attrs.parsed).ksize;
+            flops = static_cast<double>(oshape.Size()) * ksize[1] * ksize[2];
+        } else {
+            flops = static_cast<double>(oshape.Size()) * ishape.size();
+        }
+        *serial_time = KernelTime(flops, copy_bytes + shared_bytes);
+        int num_split = 0;
+        for (int axis : plan.split_axis) num_split += axis >= 0;
+        for (uint32_t parts = 2; parts <= std::min(max_parts, dim); ++parts) {
+            if (dim % parts != 0 || (dim / parts) % align != 0) continue;
+            if (follow != 0 && parts != follow) continue;
+            PartitionPlan p = plan;
+            p.parts = parts;
+            if (size_attr.length() != 0) p.part_attrs[size_attr] = std::to_string(dim / parts);
+            // the inputs already cut this way are passed through, which saves
+            // their split and the merge of the node before when no one else reads it.
+            double copied = copy_bytes;
+            int num_copied = num_split;
+            for (uint32_t i = 0; i < ishape.size(); ++i) {
+                if (plan.split_axis[i] >= 0 && merges[i].parts == parts &&
+                    merges[i].axis == plan.split_axis[i]) {
+                    copied -= 2 * Bytes(ishape[i]);
+                    num_copied -= 2;
+                }
+            }
+            copied = std::max(copied, 0.0);
+            // the parts run at the same time, each of them is dispatched.
+            p.time = KernelTime(flops / parts, copy_bytes / parts + shared_bytes) +
+                copied / kCopyRate + (static_cast<int>(parts) + num_copied + 1) * kNodeCost;
+            ret.push_back(p);
+        }
+        return ret;
+    }
+
+ private:
+    const IndexedGraph &idxg_;
+    const nnvm::ShapeVector &shapes_;
+    uint32_t unknown_parts_;
+};
+
+// Substitute the nodes with their partitioned version
 Graph Parallelize(Graph src) {
+    uint32_t max_parts = std::thread::hardware_concurrency();
+    // an axis of unknown size is cut in 2 unless the number is given,
+    // so the graph does not depend on the machine.
+    uint32_t unknown_parts = 2;
+    if (src.attrs.count("num_partitions") != 0) {
+        max_parts = static_cast<uint32_t>(src.GetAttr<int>("num_partitions"));
+        unknown_parts = max_parts;
+    }
+    if (max_parts < 2) return src;
+    src = ApplyPass(std::move(src), "InferShape");
     Graph ret;
     ret.outputs = src.outputs;
 
     auto useSites = BuildUseSites(src);
     auto &idxg = src.indexed_graph();
+    const auto &shapes = src.GetAttr<nnvm::ShapeVector>("shape");
+    // nodes whose gradient is in the graph, e.g. nn modules, are kept.
+    vector<bool> pinned(idxg.num_nodes(), false);
+    for (uint32_t nid = 0; nid < idxg.num_nodes(); ++nid) {
+        for (uint32_t dep : idxg[nid].control_deps) {
+            pinned[dep] = true;
+        }
+    }
+    PartitionModel model(idxg, shapes, unknown_parts);
+    // the merges created so far
+    std::unordered_map<const Node*, InputMerge> merges;
 
     DFSVisit(src.outputs, [&](const NodePtr &n) {
-        if (n->is_variable()
-            || (n->op()->name != "matmul" && n->op()->name != "conv2d")) {
-            // only support matmul and conv2d for now
+        if (n->is_variable() || !model.Supported(n.get())) {
             return;
         }
+        const uint32_t nid = idxg.node_id(n.get());
+        std::string parallelism;
         auto it = n->attrs.dict.find("parallelism");
-        if (it != n->attrs.dict.end()) {
-            if (it->second == "model") {
-                // model
-                if (n->op()->name == "matmul") {
-                    // only support model for matmul
-                    // get two inputs
-                    auto netinput = n->inputs[0];
-                    auto weight = n->inputs[1];
-                    // split weight and netinput
-                    auto nd_splited_weight = MakeNode("split", n->attrs.name + "/split0",
-                                                      {weight}, {{"axis", "1"}, {"num_outputs", "2"}}).node;
-                    auto nd_splited_netinput = MakeNode("split", n->attrs.name + "/split1",
-                                                        {netinput},
-                                                        {{"axis", "1"}, {"num_outputs", "2"}}).node;
-                    // actual compute
-                    auto new_attrs(n->attrs.dict);
-                    new_attrs.erase("parallelism");
-                    auto part0 = MakeNode("matmul", n->attrs.name + "/part0",
-                                          {{nd_splited_netinput, 0, 0}, {nd_splited_weight, 0, 0}},
-                                          new_attrs).node;
-                    auto part1 = MakeNode("matmul", n->attrs.name + "/part1",
-                                          {{nd_splited_netinput, 1, 0}, {nd_splited_weight, 1, 0}},
-                                          new_attrs).node;
-                    // preserve control deps
-                    part0->control_deps = n->control_deps;
-                    part1->control_deps = n->control_deps;
-                    // merge output back, one merge operation per use site
-                    const auto &sites = useSites[idxg.node_id(n.get())];
-                    for (auto site : sites) {
-                        if (!site.as_control_dep) {
-                            auto merged_out = MakeNode("concat", n->attrs.name + "/merge0",
-                            {{part0, 0, 0}, {part1, 0, 0}},
-                            {{"axis", "1"}}).node;
-                            if (!site.is_graph_output) {
-                                replaceUsage(idxg, site, {merged_out, 0, 0});
-                            } else {
-                                ret.outputs[site.user_input_idx] = {merged_out, 0, 0};
-                            }
-                        }
-                    }
-                }
-            } else if (it->second == "data"){
-                // data
-                if (n->op()->name == "conv2d") {
-                    // only support data for conv2d
-                    // get inputs
-                    auto netinput = n->inputs[0];
-                    auto new_inputs = n->inputs;
-                    // mark other inputs, which are shared among all replicas, as avg in grad_agg
-                    // TODO: not taking into account those inputs are possibly shared by nodes other
-                    // than replica we created here.
-                    for (uint32_t i = 1; i < new_inputs.size(); ++i) {
-                        const auto &e = new_inputs[i];
-                        e.node->attrs.dict["grad_aggregate_fun"] = "avg";
-                    }
-                    // split data
-                    auto nd_splited_netinput = MakeNode("split", n->attrs.name + "/split0",
-                                                        {netinput},
-                                                        {{"axis", "0"}, {"num_outputs", "2"}}).node;
-                    // actual compute
-                    auto new_attrs(n->attrs.dict);
-                    new_attrs.erase("parallelism");
-                    new_inputs[0] = {nd_splited_netinput, 0, 0};
-                    auto part0 = MakeNode("conv2d", n->attrs.name + "/part0",
-                                          new_inputs,
-                                          new_attrs).node;
-                    new_inputs[0] = {nd_splited_netinput, 1, 0};
-                    auto part1 = MakeNode("conv2d", n->attrs.name + "/part1",
-                                          new_inputs,
-                                          new_attrs).node;
-                    // preserve control deps
-                    part0->control_deps = n->control_deps;
-                    part1->control_deps = n->control_deps;
-                    // merge output back, one merge operation per use site
-                    const auto &sites = useSites[idxg.node_id(n.get())];
-                    for (auto site : sites) {
-                        if (!site.as_control_dep) {
-                            auto merged_out = MakeNode("concat", n->attrs.name + "/merge0",
-                            {{part0, 0, 0}, {part1, 0, 0}},
-                            {{"axis", "0"}}).node;
-                            if (!site.is_graph_output) {
-                                replaceUsage(idxg, site, {merged_out, 0, 0});
-                            } else {
-                                ret.outputs[site.user_input_idx] = {merged_out, 0, 0};
-                            }
-                        }
-                    }
-                }
-            } else if (!it->second.empty()) {
-                throw dmlc::Error("Unknown attribute value for parallelism");
+        if (it != n->attrs.dict.end()) parallelism = it->second;
+        if (parallelism != "" && parallelism != "data" &&
+            parallelism != "model" && parallelism != "none") {
+            throw dmlc::Error("Unknown attribute value for parallelism");
+        }
+        if (parallelism == "none" || pinned[nid]) return;
+        // the cheapest plan of the given kinds, or of both when not set.
+        vector<PartitionPlan> plans;
+        vector<InputMerge> input_merges(n->inputs.size());
+        for (uint32_t i = 0; i < n->inputs.size(); ++i) {
+            auto mit = merges.find(n->inputs[i].node.get());
+            if (mit != merges.end()) input_merges[i] = mit->second;
+        }
+        double serial_time = 0;
+        for (const char *kind : {"data", "model"}) {
+            if (parallelism.length() != 0 && parallelism != kind) continue;
+            double time;
+            auto p = model.Plans(nid, kind, max_parts, input_merges, &time);
+            plans.insert(plans.end(), p.begin(), p.end());
+            serial_time = std::max(serial_time, time);
+        }
+        if (plans.size() == 0) return;
+        auto best = std::min_element(
+            plans.begin(), plans.end(),
+            [](const PartitionPlan &a, const PartitionPlan &b) { return a.time < b.time; });
+        // without shapes only the marked nodes are split.
+        if (parallelism.length() == 0 && (serial_time == 0 || best->time >= serial_time)) {
+            return;
+        }
+        const PartitionPlan &plan = *best;
+
+        // split the inputs
+        vector<NodePtr> splits(n->inputs.size());
+        for (uint32_t i = 0; i < n->inputs.size(); ++i) {
+            if (plan.split_axis[i] < 0) continue;
+            splits[i] = MakeNode("split", n->attrs.name + "/split" + std::to_string(i),
+                                 {n->inputs[i]},
+                                 {{"axis", std::to_string(plan.split_axis[i])},
+                                  {"num_outputs", std::to_string(plan.parts)}}).node;
+        }
+        // actual compute
+        auto new_attrs(n->attrs.dict);
+        new_attrs.erase("parallelism");
+        for (const auto &kv : plan.part_attrs) {
+            new_attrs[kv.first] = kv.second;
+        }
+        vector<NodeEntry> parts;
+        for (uint32_t p = 0; p < plan.parts; ++p) {
+            vector<NodeEntry> inputs = n->inputs;
+            for (uint32_t i = 0; i < inputs.size(); ++i) {
+                if (splits[i] != nullptr) inputs[i] = NodeEntry{splits[i], p, 0};
+            }
+            auto part = MakeNode(n->op()->name.c_str(), n->attrs.name + "/part" + std::to_string(p),
+                                 inputs, new_attrs).node;
+            // preserve control deps
+            part->control_deps = n->control_deps;
+            parts.push_back(NodeEntry{part, 0, 0});
+        }
+        // merge output back, one merge operation shared by the use sites
+        auto merged_out = MakeNode("concat", n->attrs.name + "/merge", parts,
+                                   {{"axis", std::to_string(plan.merge_axis)}}).node;
+        InputMerge &merge = merges[merged_out.get()];
+        merge.axis = plan.merge_axis;
+        merge.parts = plan.parts;
+        for (const auto &site : useSites[nid]) {
+            if (site.as_control_dep) continue;
+            if (!site.is_graph_output) {
+                replaceUsage(idxg, site, {merged_out, 0, 0});
+            } else {
+                ret.outputs[site.user_input_idx] = {merged_out, 0, 0};
             }
         }
     });
@@ -182,10 +419,10 @@ Graph Parallelize(Graph src) {
 
 // register pass
 NNVM_REGISTER_PASS(Parallelize)
-.describe("Substitute suitable node with corresponding parallelized version")
+.describe("Split the nodes worth it into parts that run in parallel, by data or model")
 .set_body(Parallelize)
 .set_change_graph(true);
 
 }  // namespace
 }  // namespace pass
-}  // namespace nnvm
+}  // namespace tinyflow
@@ -0,0 +1,283 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file plan_memory.cc
+ * \brief Memory planning aware of concurrent execution.
+ */
+#include <nnvm/pass.h>
+#include <nnvm/graph_attr_types.h>
+#include <nnvm/op_attr_types.h>
+#include <dmlc/logging.h>
+#include <dmlc/parameter.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace tinyflow {
+namespace pass {
+namespace {
+
+using nnvm::Graph;
+using nnvm::IndexedGraph;
+using nnvm::ShapeVector;
+using nnvm::DTypeVector;
+using nnvm::StorageVector;
+using nnvm::FInplaceOption;
+
+// storage id that is not planned.
+const int kBadStorageID = -1;
+// storage id of entries whose space is provided from outside.
+const int kExternalStorageID = -2;
+// reuse a free block only when its size is within this ratio.
+const size_t kMatchRange = 16;
+// skip counting the false dependencies on graphs larger than this,
+// the reachability matrix grows quadratically.
+const uint32_t kMaxCountNodes = 16384;
+
+/*!
+ * \brief color the nodes into groups that are likely to run concurrently.
+ *  Repeatedly take the longest path over the uncolored nodes as a new group,
+ *  nodes left after num_colors - 1 paths form the last group.
+ *  Nodes in one path are dependent, so sharing space within a path adds no
+ *  false dependency.
+ */
+std::vector<uint32_t> ColorNodeGroup(const IndexedGraph& idx, uint32_t num_colors) {
+    std::vector<uint32_t> color(idx.num_nodes(), num_colors - 1);
+    std::vector<uint32_t> importance(idx.num_nodes(), 0);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        if (!idx[nid].source->is_variable()) importance[nid] = 1;
+    }
+    std::vector<uint32_t> reward(idx.num_nodes());
+    std::vector<int64_t> prev(idx.num_nodes());
+    for (uint32_t c = 0; c + 1 < num_colors; ++c) {
+        // longest path by dynamic programming over the topological order.
+        int64_t best = -1;
+        for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+            reward[nid] = 0;
+            prev[nid] = -1;
+            for (const auto& e : idx[nid].inputs) {
+                if (reward[e.node_id] > reward[nid]) {
+                    reward[nid] = reward[e.node_id];
+                    prev[nid] = e.node_id;
+                }
+            }
+            for (uint32_t cid : idx[nid].control_deps) {
+                if (reward[cid] > reward[nid]) {
+                    reward[nid] = reward[cid];
+                    prev[nid] = cid;
+                }
+            }
+            reward[nid] += importance[nid];
+            if (best < 0 || reward[nid] > reward[best]) best = nid;
+        }
+        if (best < 0 || reward[best] == 0) break;
+        for (int64_t nid = best; nid >= 0; nid = prev[nid]) {
+            if (importance[nid] == 0) continue;
+            color[nid] = c;
+            importance[nid] = 0;
+        }
+    }
+    return color;
+}
+
+// storage blocks, free blocks are kept per color
+class StoragePool {
+ public:
+    // get a block for size bytes with color, allocate one if nothing fits.
+    int Request(size_t size, uint32_t color) {
+        auto& free = free_[color];
+        auto begin = free.lower_bound(size / kMatchRange);
+        auto mid = free.lower_bound(size);
+        auto end = free.upper_bound(size * kMatchRange);
+        // first try the smallest block that is large enough,
+        // then the largest block that is smaller.
+        if (mid != end) return Take(&free, mid, size);
+        if (mid != begin) return Take(&free, std::prev(mid), size);
+        int sid = static_cast<int>(block_size_.size());
+        block_size_.push_back(size);
+        block_color_.push_back(color);
+        return sid;
+    }
+    // return the block to the pool of its color
+    void Release(int sid) {
+        free_[block_color_[sid]].insert({block_size_[sid], sid});
+    }
+    // total bytes of all blocks
+    size_t TotalBytes() const {
+        size_t total = 0;
+        for (size_t s : block_size_) total += s;
+        return total;
+    }
+
+ private:
+    int Take(std::multimap<size_t, int>* free,
+             std::multimap<size_t, int>::iterator it, size_t size) {
+        int sid = it->second;
+        free->erase(it);
+        block_size_[sid] = std::max(block_size_[sid], size);
+        return sid;
+    }
+    std::map<uint32_t, std::multimap<size_t, int> > free_;
+    std::vector<size_t> block_size_;
+    std::vector<uint32_t> block_color_;
+};
+
+/*!
+ * \brief count the storage reuses that order two nodes with no path between them.
+ *  Each reuse of a block makes its next writer wait for the last users of
+ *  the previous content; the edge is false when the scheduler would otherwise
+ *  be free to run the two nodes concurrently.
+ */
+size_t CountFalseDeps(const IndexedGraph& idx, const StorageVector& storage) {
+    const uint32_t n = idx.num_nodes();
+    const size_t words = (n + 63) / 64;
+    // ancestor bitset of each node
+    std::vector<uint64_t> anc(static_cast<size_t>(n) * words, 0);
+    auto is_anc = [&](uint32_t a, uint32_t b) {
+        return (anc[b * words + a / 64] >> (a % 64)) & 1;
+    };
+    for (uint32_t nid = 0; nid < n; ++nid) {
+        uint64_t* row = &anc[nid * words];
+        auto merge = [&](uint32_t p) {
+            const uint64_t* prow = &anc[p * words];
+            for (size_t w = 0; w < words; ++w) row[w] |= prow[w];
+            row[p / 64] |= 1ULL << (p % 64);
+        };
+        for (const auto& e : idx[nid].inputs) merge(e.node_id);
+        for (uint32_t cid : idx[nid].control_deps) merge(cid);
+    }
+    // users of the current content of each block
+    std::map<int, std::vector<uint32_t> > users;
+    size_t count = 0;
+    for (uint32_t nid = 0; nid < n; ++nid) {
+        const auto& inode = idx[nid];
+        if (inode.source->is_variable()) continue;
+        for (const auto& e : inode.inputs) {
+            int sid = storage[idx.entry_id(e)];
+            if (sid >= 0) users[sid].push_back(nid);
+        }
+        for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+            int sid = storage[idx.entry_id(nid, i)];
+            if (sid < 0) continue;
+            std::vector<uint32_t>& prev = users[sid];
+            for (uint32_t p : prev) {
+                if (p != nid && !is_anc(p, nid)) ++count;
+            }
+            prev.assign(1, nid);
+        }
+    }
+    return count;
+}
+
+/*!
+ * \brief plan the memory with a target concurrency.
+ *
+ *  Same contract as PlanMemory: requires "shape" and "dtype", and keeps the
+ *  entries already marked external in an existing "storage_id".
+ *  Attribute "mem_plan_concurrency" (int, default 1) sets the number of node
+ *  groups; blocks are only reused within a group, so independent branches do
+ *  not get serialized by sharing space. With 1 it reduces to a sequential plan.
+ *
+ *  Provides "storage_id", "storage_allocated_bytes" (size_t), and when
+ *  TINYFLOW_PLAN_MEMORY_VERBOSE is set "storage_num_false_deps" (size_t),
+ *  the number of ordering constraints added between otherwise independent
+ *  nodes by reusing space.
+ */
+Graph PlanMemoryParallel(Graph ret) {
+    static auto& finplace_option = nnvm::Op::GetAttr<FInplaceOption>("FInplaceOption");
+    const IndexedGraph& idx = ret.indexed_graph();
+    const ShapeVector& shape_vec = ret.GetAttr<ShapeVector>("shape");
+    const DTypeVector& dtype_vec = ret.GetAttr<DTypeVector>("dtype");
+    uint32_t num_colors = 1;
+    if (ret.attrs.count("mem_plan_concurrency") != 0) {
+        num_colors = static_cast<uint32_t>(
+            std::max(ret.GetAttr<int>("mem_plan_concurrency"), 1));
+    }
+    StorageVector storage(idx.num_node_entries(), kBadStorageID);
+    if (ret.attrs.count("storage_id") != 0) {
+        const StorageVector& prev = ret.GetAttr<StorageVector>("storage_id");
+        CHECK_EQ(prev.size(), storage.size());
+        for (size_t i = 0; i < prev.size(); ++i) {
+            if (prev[i] == kExternalStorageID) storage[i] = kExternalStorageID;
+        }
+    }
+    // reference counter of each entry, outputs are never released.
+    std::vector<uint32_t> ref_count(idx.num_node_entries(), 0);
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        for (const auto& e : idx[nid].inputs) ++ref_count[idx.entry_id(e)];
+    }
+    for (const auto& e : idx.outputs()) ++ref_count[idx.entry_id(e)];
+
+    std::vector<uint32_t> color = ColorNodeGroup(idx, num_colors);
+    StoragePool pool;
+    for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        const auto& inode = idx[nid];
+        if (inode.source->is_variable()) continue;
+        // take over the space of inputs that die here.
+        if (finplace_option.count(inode.source->op())) {
+            auto inplace_pairs = finplace_option[inode.source->op()](inode.source->attrs);
+            for (const auto& kv : inplace_pairs) {
+                uint32_t eid_out = idx.entry_id(nid, kv.second);
+                uint32_t eid_in = idx.entry_id(inode.inputs[kv.first]);
+                int sid_in = storage[eid_in];
+                if (sid_in >= 0 && storage[eid_out] == kBadStorageID &&
+                    ref_count[eid_in] == 1 && ref_count[eid_out] != 0 &&
+                    shape_vec[eid_out].Size() == shape_vec[eid_in].Size() &&
+                    dtype_vec[eid_out] == dtype_vec[eid_in]) {
+                    storage[eid_out] = sid_in;
+                    // hold the space until the output dies.
+                    ++ref_count[eid_in];
+                }
+            }
+        }
+        for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+            uint32_t eid = idx.entry_id(nid, i);
+            if (storage[eid] != kBadStorageID) continue;
+            // only float is supported in the executors.
+            size_t bytes = shape_vec[eid].Size() * sizeof(float);
+            storage[eid] = pool.Request(bytes, color[nid]);
+        }
+        // release the inputs that are no longer needed.
+        for (const auto& e : inode.inputs) {
+            uint32_t eid = idx.entry_id(e);
+            if (--ref_count[eid] == 0 && storage[eid] >= 0) {
+                pool.Release(storage[eid]);
+            }
+        }
+        // outputs nobody reads
+        for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+            uint32_t eid = idx.entry_id(nid, i);
+            if (ref_count[eid] == 0 && storage[eid] >= 0) {
+                pool.Release(storage[eid]);
+            }
+        }
+    }
+    // the count walks the ancestors of every node, only pay for it when asked.
+    if (dmlc::GetEnv("TINYFLOW_PLAN_MEMORY_VERBOSE", 0) != 0) {
+        size_t num_false_deps = 0;
+        if (idx.num_nodes() <= kMaxCountNodes) {
+            num_false_deps = CountFalseDeps(idx, storage);
+        }
+        LOG(INFO) << "PlanMemoryParallel: concurrency=" << num_colors
+                  << ", allocated " << pool.TotalBytes() << " bytes"
+                  << ", " << num_false_deps << " false dependencies";
+        ret.attrs["storage_num_false_deps"] = std::make_shared<dmlc::any>(num_false_deps);
+    }
+    ret.attrs["storage_allocated_bytes"] = std::make_shared<dmlc::any>(pool.TotalBytes());
+    ret.attrs["storage_id"] = std::make_shared<dmlc::any>(std::move(storage));
+    return ret;
+}
+
+NNVM_REGISTER_PASS(PlanMemoryParallel)
+.describe("Plan the memory allocation of each node entry, "
+          "only share space among nodes of the same concurrency group")
+.set_body(PlanMemoryParallel)
+.set_change_graph(false)
+.depend_graph_attr("shape")
+.depend_graph_attr("dtype")
+.provide_graph_attr("storage_id");
+
+}  // namespace
+}  // namespace pass
+}  // namespace tinyflow
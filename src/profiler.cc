@@ -0,0 +1,163 @@
+// Copyright (c) 2016 by Contributors
+// per operator profiler, exports chrome trace-event timeline.
+#include <dmlc/json.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include "./profiler.h"
+
+namespace tinyflow {
+
+using nnvm::IndexedGraph;
+
+namespace {
+
+// small id of the calling thread, for the tid of the timeline.
+int ThreadIndex() {
+  static std::atomic<int> counter{0};
+  static thread_local int index = counter++;
+  return index;
+}
+
+// complete event of chrome trace-event format.
+struct TraceEvent {
+  std::string name;
+  std::string node;
+  int64_t ts;
+  int64_t dur;
+  int tid;
+
+  void Save(dmlc::JSONWriter* writer) const {
+    std::map<std::string, std::string> args;
+    args["node"] = node;
+    writer->BeginObject(false);
+    writer->WriteObjectKeyValue("name", name);
+    writer->WriteObjectKeyValue("cat", std::string("op"));
+    writer->WriteObjectKeyValue("ph", std::string("X"));
+    writer->WriteObjectKeyValue("ts", ts);
+    writer->WriteObjectKeyValue("dur", dur);
+    writer->WriteObjectKeyValue("pid", 0);
+    writer->WriteObjectKeyValue("tid", tid);
+    writer->WriteObjectKeyValue("args", args);
+    writer->EndObject();
+  }
+};
+
+// statistics of one op type in the summary.
+struct OpSummary {
+  std::string op;
+  OpProfiler::OpStat stat;
+
+  void Save(dmlc::JSONWriter* writer) const {
+    writer->BeginObject(false);
+    writer->WriteObjectKeyValue("op", op);
+    writer->WriteObjectKeyValue("count", stat.count);
+    writer->WriteObjectKeyValue("total_us", stat.total_us);
+    writer->WriteObjectKeyValue("max_us", stat.max_us);
+    writer->WriteObjectKeyValue("bytes_read", stat.bytes_read);
+    writer->WriteObjectKeyValue("bytes_written", stat.bytes_written);
+    writer->EndObject();
+  }
+};
+
+}  // namespace
+
+const std::string* OpProfiler::Intern(const std::string& str) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return &(*strings_.insert(str).first);
+}
+
+void OpProfiler::Record(const std::string* op_key, const std::string* node_name,
+                        int64_t start_us, int64_t dur_us,
+                        size_t bytes_read, size_t bytes_written) {
+  const int tid = ThreadIndex();
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpStat& s = stats_[op_key];
+  s.count += 1;
+  s.total_us += dur_us;
+  s.max_us = std::max(s.max_us, static_cast<uint64_t>(dur_us));
+  s.bytes_read += bytes_read;
+  s.bytes_written += bytes_written;
+  if (events_.size() < kMaxEvents) {
+    events_.push_back(Event{op_key, node_name, start_us, dur_us, tid});
+  }
+}
+
+std::string OpProfiler::Dump(const std::string& trace_file) {
+  std::vector<Event> events;
+  std::vector<OpSummary> summary;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events.swap(events_);
+    for (const auto& kv : stats_) {
+      summary.push_back(OpSummary{*kv.first, kv.second});
+    }
+    stats_.clear();
+  }
+  std::sort(summary.begin(), summary.end(),
+            [](const OpSummary& a, const OpSummary& b) {
+              return a.stat.total_us > b.stat.total_us;
+            });
+  if (trace_file.length() != 0) {
+    std::vector<TraceEvent> trace;
+    for (const Event& e : events) {
+      trace.push_back(TraceEvent{*e.op_key, *e.node_name, e.start_us, e.dur_us, e.tid});
+    }
+    std::ofstream os(trace_file);
+    CHECK(os.good()) << "cannot open " << trace_file;
+    dmlc::JSONWriter writer(&os);
+    writer.BeginObject();
+    writer.WriteObjectKeyValue("traceEvents", trace);
+    writer.WriteObjectKeyValue("displayTimeUnit", std::string("ms"));
+    writer.EndObject();
+  }
+  std::ostringstream os;
+  dmlc::JSONWriter writer(&os);
+  writer.Write(summary);
+  return os.str();
+}
+
+int64_t OpProfiler::NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ProfileOpExecs(OpProfiler* prof,
+                    const IndexedGraph& idx,
+                    const nnvm::ShapeVector& shape,
+                    std::vector<FOpExec>* p_execs) {
+  static const Op* backward_op = Op::Get("_backward");
+  std::vector<FOpExec>& execs = *p_execs;
+  CHECK_EQ(execs.size(), idx.num_nodes());
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (!execs[nid]) continue;
+    const auto& inode = idx[nid];
+    std::string key = inode.source->op()->name;
+    if (inode.source->op() == backward_op && inode.control_deps.size() != 0) {
+      key += "[" + idx[inode.control_deps[0]].source->op()->name + "]";
+    }
+    // only float is supported in the executors.
+    size_t bytes_read = 0, bytes_written = 0;
+    for (const auto& e : inode.inputs) {
+      bytes_read += shape[idx.entry_id(e)].Size() * sizeof(float);
+    }
+    for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+      bytes_written += shape[idx.entry_id(nid, i)].Size() * sizeof(float);
+    }
+    const std::string* op_key = prof->Intern(key);
+    const std::string* node_name = prof->Intern(inode.source->attrs.name);
+    FOpExec fexec = std::move(execs[nid]);
+    execs[nid] = [prof, fexec, op_key, node_name, bytes_read, bytes_written]() {
+      int64_t start = OpProfiler::NowMicros();
+      fexec();
+      prof->Record(op_key, node_name, start, OpProfiler::NowMicros() - start,
+                   bytes_read, bytes_written);
+    };
+  }
+}
+
+}  // namespace tinyflow
@@ -0,0 +1,94 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file profiler.h
+ * \brief per operator profiler of the executors.
+ */
+#ifndef TINYFLOW_PROFILER_H_
+#define TINYFLOW_PROFILER_H_
+
+#include <tinyflow/base.h>
+#include <nnvm/graph.h>
+#include <nnvm/graph_attr_types.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "./scheduler.h"
+
+namespace tinyflow {
+
+/*!
+ * \brief records the execution of operators.
+ *  Each execution keeps the wall time, the bytes of its inputs and outputs,
+ *  and is aggregated by the op type. Thread safe, so the closures
+ *  can be recorded from the workers of the scheduler.
+ * \note On GPU the time covers launching the kernel, not its completion.
+ */
+class OpProfiler {
+ public:
+  /*! \brief maximum number of events kept for the timeline */
+  static const size_t kMaxEvents = 1 << 20;
+  /*! \brief aggregated statistics of an op type */
+  struct OpStat {
+    uint64_t count{0};
+    uint64_t total_us{0};
+    uint64_t max_us{0};
+    uint64_t bytes_read{0};
+    uint64_t bytes_written{0};
+  };
+  /*! \return unique pointer to the string, stays valid with the profiler */
+  const std::string* Intern(const std::string& str);
+  /*!
+   * \brief record one execution.
+   * \param op_key the op type, interned.
+   * \param node_name the node name, interned.
+   * \param start_us start time, in micro seconds from NowMicros.
+   * \param dur_us the wall time.
+   * \param bytes_read total bytes of the inputs.
+   * \param bytes_written total bytes of the outputs.
+   */
+  void Record(const std::string* op_key, const std::string* node_name,
+              int64_t start_us, int64_t dur_us,
+              size_t bytes_read, size_t bytes_written);
+  /*!
+   * \brief dump the records and clear them.
+   * \param trace_file path to write the chrome trace-event json, empty to skip.
+   * \return the per op statistics in json, sorted by total time.
+   */
+  std::string Dump(const std::string& trace_file);
+  /*! \return micro seconds from a steady clock */
+  static int64_t NowMicros();
+
+ private:
+  // one execution in the timeline
+  struct Event {
+    const std::string* op_key;
+    const std::string* node_name;
+    int64_t start_us;
+    int64_t dur_us;
+    int tid;
+  };
+  std::mutex mutex_;
+  std::unordered_set<std::string> strings_;
+  std::map<const std::string*, OpStat> stats_;
+  std::vector<Event> events_;
+};
+
+/*!
+ * \brief wrap the op closures to record them in the profiler.
+ *  Ops are keyed by their type, the generic _backward of nn modules
+ *  is keyed by the forward op, e.g. _backward[conv2d].
+ * \param prof the profiler.
+ * \param idx the indexed graph.
+ * \param shape shape of each entry, used to count the bytes.
+ * \param execs closure of each node, empty ones are kept.
+ */
+void ProfileOpExecs(OpProfiler* prof,
+                    const nnvm::IndexedGraph& idx,
+                    const nnvm::ShapeVector& shape,
+                    std::vector<FOpExec>* execs);
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_PROFILER_H_
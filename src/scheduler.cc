@@ -0,0 +1,262 @@
+// Copyright (c) 2016 by Contributors
+// dependency driven parallel scheduler with work stealing.
+#include <nnvm/op_attr_types.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include "./scheduler.h"
+
+namespace tinyflow {
+
+using nnvm::IndexedGraph;
+using nnvm::FMutateInputs;
+
+OpDepGraph BuildOpDepGraph(const IndexedGraph& idx,
+                           const nnvm::StorageVector& storage_id) {
+  static auto& fmutate_inputs = Op::GetAttr<FMutateInputs>("FMutateInputs");
+  CHECK_EQ(storage_id.size(), idx.num_node_entries());
+  // every pooled storage and every non-pooled entry is a resource.
+  int max_sid = -1;
+  std::vector<bool> pooled(idx.num_node_entries(), false);
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (idx[nid].source->is_variable()) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      uint32_t eid = idx.entry_id(nid, i);
+      pooled[eid] = storage_id[eid] >= 0;
+      max_sid = std::max(max_sid, storage_id[eid]);
+    }
+  }
+  const size_t num_pooled = static_cast<size_t>(max_sid + 1);
+  auto resource = [&](uint32_t eid) -> size_t {
+    if (!pooled[eid]) return num_pooled + eid;
+    return static_cast<size_t>(storage_id[eid]);
+  };
+  const size_t num_resource = num_pooled + idx.num_node_entries();
+  // last node that writes the resource, and the nodes reading it since then.
+  std::vector<int64_t> last_writer(num_resource, -1);
+  std::vector<std::vector<uint32_t> > readers(num_resource);
+
+  OpDepGraph ret;
+  ret.num_deps.resize(idx.num_nodes(), 0);
+  ret.successors.resize(idx.num_nodes());
+  std::vector<uint32_t> preds;
+  std::vector<size_t> reads, writes;
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    preds.clear(); reads.clear(); writes.clear();
+    for (const auto& e : inode.inputs) {
+      preds.push_back(e.node_id);
+      reads.push_back(resource(idx.entry_id(e)));
+    }
+    for (uint32_t cid : inode.control_deps) {
+      preds.push_back(cid);
+    }
+    for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+      writes.push_back(resource(idx.entry_id(nid, i)));
+    }
+    if (!inode.source->is_variable() &&
+        fmutate_inputs.count(inode.source->op())) {
+      for (uint32_t i : fmutate_inputs[inode.source->op()](inode.source->attrs)) {
+        writes.push_back(resource(idx.entry_id(inode.inputs[i])));
+      }
+    }
+    // read after write
+    for (size_t r : reads) {
+      if (last_writer[r] >= 0) preds.push_back(static_cast<uint32_t>(last_writer[r]));
+    }
+    // write after write, write after read
+    for (size_t r : writes) {
+      if (last_writer[r] >= 0) preds.push_back(static_cast<uint32_t>(last_writer[r]));
+      preds.insert(preds.end(), readers[r].begin(), readers[r].end());
+    }
+    for (size_t r : reads) {
+      readers[r].push_back(nid);
+    }
+    for (size_t r : writes) {
+      last_writer[r] = nid;
+      readers[r].clear();
+    }
+    std::sort(preds.begin(), preds.end());
+    preds.erase(std::unique(preds.begin(), preds.end()), preds.end());
+    for (uint32_t p : preds) {
+      if (p == nid) continue;
+      ret.successors[p].push_back(nid);
+      ++ret.num_deps[nid];
+    }
+  }
+  return ret;
+}
+
+OpScheduler::OpScheduler(int num_workers) {
+  if (num_workers <= 0) {
+    num_workers = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    queues_.emplace_back(new ReadyQueue());
+  }
+  for (int i = 1; i < num_workers; ++i) {
+    threads_.emplace_back([this, i]() { this->WorkerLoop(i); });
+  }
+}
+
+OpScheduler::~OpScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stop_ = true;
+  }
+  idle_cond_.notify_all();
+  for (std::thread& t : threads_) {
+    t.join();
+  }
+}
+
+void OpScheduler::Run(const OpDepGraph& graph,
+                      const std::vector<FOpExec>& execs,
+                      const std::vector<bool>& on_driver) {
+  const size_t num_nodes = graph.num_deps.size();
+  CHECK_EQ(execs.size(), num_nodes);
+  CHECK_EQ(on_driver.size(), num_nodes);
+  if (num_nodes == 0) return;
+  graph_ = &graph;
+  execs_ = &execs;
+  on_driver_ = &on_driver;
+  pending_.reset(new std::atomic<uint32_t>[num_nodes]);
+  for (size_t i = 0; i < num_nodes; ++i) {
+    pending_[i] = graph.num_deps[i];
+  }
+  num_remain_ = num_nodes;
+  aborted_ = false;
+  error_ = nullptr;
+  // spread the initial ready nodes over the workers.
+  int wid = 0;
+  for (uint32_t nid = 0; nid < num_nodes; ++nid) {
+    if (graph.num_deps[nid] == 0) {
+      this->Push(wid, nid);
+      wid = (wid + 1) % num_workers();
+    }
+  }
+  // the calling thread works until all nodes finish.
+  while (num_remain_ != 0) {
+    uint32_t nid;
+    if (this->Pop(0, &nid)) {
+      this->Execute(0, nid);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cond_.wait(lock, [this]() {
+        return num_remain_ == 0 || num_driver_ != 0 || num_stealable_ != 0;
+      });
+  }
+  graph_ = nullptr;
+  execs_ = nullptr;
+  on_driver_ = nullptr;
+  if (error_ != nullptr) {
+    std::exception_ptr err = error_;
+    error_ = nullptr;
+    std::rethrow_exception(err);
+  }
+}
+
+void OpScheduler::WorkerLoop(int wid) {
+  while (true) {
+    uint32_t nid;
+    if (this->Pop(wid, &nid)) {
+      this->Execute(wid, nid);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cond_.wait(lock, [this]() {
+        return stop_ || num_stealable_ != 0;
+      });
+    if (stop_) return;
+  }
+}
+
+void OpScheduler::Push(int wid, uint32_t nid) {
+  if ((*on_driver_)[nid]) {
+    {
+      std::lock_guard<std::mutex> lock(driver_queue_.mutex);
+      driver_queue_.nodes.push_back(nid);
+    }
+    ++num_driver_;
+  } else {
+    ReadyQueue* q = queues_[wid].get();
+    {
+      std::lock_guard<std::mutex> lock(q->mutex);
+      q->nodes.push_back(nid);
+    }
+    ++num_stealable_;
+  }
+  this->Notify();
+}
+
+bool OpScheduler::Pop(int wid, uint32_t* nid) {
+  if (wid == 0 && num_driver_ != 0) {
+    std::lock_guard<std::mutex> lock(driver_queue_.mutex);
+    if (!driver_queue_.nodes.empty()) {
+      *nid = driver_queue_.nodes.front();
+      driver_queue_.nodes.pop_front();
+      --num_driver_;
+      return true;
+    }
+  }
+  if (num_stealable_ == 0) return false;
+  {
+    // own queue, last in first out for locality.
+    ReadyQueue* q = queues_[wid].get();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (!q->nodes.empty()) {
+      *nid = q->nodes.back();
+      q->nodes.pop_back();
+      --num_stealable_;
+      return true;
+    }
+  }
+  // steal the oldest node of other workers.
+  const int n = num_workers();
+  for (int i = 1; i < n; ++i) {
+    ReadyQueue* q = queues_[(wid + i) % n].get();
+    std::lock_guard<std::mutex> lock(q->mutex);
+    if (!q->nodes.empty()) {
+      *nid = q->nodes.front();
+      q->nodes.pop_front();
+      --num_stealable_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void OpScheduler::Execute(int wid, uint32_t nid) {
+  const FOpExec& fexec = (*execs_)[nid];
+  if (fexec && !aborted_) {
+    try {
+      fexec();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      if (!aborted_) {
+        error_ = std::current_exception();
+        error_nid_ = nid;
+        aborted_ = true;
+      }
+    }
+  }
+  for (uint32_t succ : graph_->successors[nid]) {
+    if (--pending_[succ] == 0) {
+      this->Push(wid, succ);
+    }
+  }
+  if (--num_remain_ == 0) {
+    this->Notify();
+  }
+}
+
+void OpScheduler::Notify() {
+  {
+    // take the lock so that a thread checking the condition
+    // cannot miss the notification.
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+  }
+  idle_cond_.notify_all();
+}
+
+}  // namespace tinyflow
@@ -0,0 +1,131 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file scheduler.h
+ * \brief dependency driven parallel scheduler of operator closures.
+ */
+#ifndef TINYFLOW_SCHEDULER_H_
+#define TINYFLOW_SCHEDULER_H_
+
+#include <tinyflow/base.h>
+#include <nnvm/graph.h>
+#include <nnvm/graph_attr_types.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tinyflow {
+
+// operator executor closures
+using FOpExec = std::function<void()>;
+
+/*! \brief dependency structure of the nodes in an IndexedGraph */
+struct OpDepGraph {
+  /*! \brief number of nodes each node waits for */
+  std::vector<uint32_t> num_deps;
+  /*! \brief nodes to be notified when a node finishes */
+  std::vector<std::vector<uint32_t> > successors;
+};
+
+/*!
+ * \brief build the dependency of nodes for parallel execution.
+ *
+ *  Besides data and control dependencies, the node order of idx is treated
+ *  as the reference sequential order, and hazards on shared space are turned
+ *  into edges: entries that share a storage_id (as planned by PlanMemory),
+ *  and variables mutated through FMutateInputs. Any schedule that honors
+ *  the result computes the same values as running the nodes in order.
+ *
+ * \param idx the indexed graph.
+ * \param storage_id storage id of each entry, negative for entries
+ *   not in the pool (e.g. variables), which are tracked by entry.
+ */
+OpDepGraph BuildOpDepGraph(const nnvm::IndexedGraph& idx,
+                           const nnvm::StorageVector& storage_id);
+
+/*!
+ * \brief thread pool that executes an OpDepGraph.
+ *
+ *  Each worker owns a deque of ready nodes: it pushes newly ready successors
+ *  to its own deque and pops from the back, an idle worker steals from the
+ *  front of the others. The calling thread acts as worker 0 and is the only
+ *  thread that runs the nodes marked on_driver, e.g. lua closures which
+ *  can only run on the thread owning the LuaState.
+ */
+class OpScheduler {
+ public:
+  /*!
+   * \param num_workers total number of workers including the calling thread,
+   *   0 means the number of hardware threads.
+   */
+  explicit OpScheduler(int num_workers);
+  ~OpScheduler();
+  /*! \return total number of workers, including the calling thread */
+  inline int num_workers() const {
+    return static_cast<int>(queues_.size());
+  }
+  /*!
+   * \brief run all nodes in the graph, return when all of them finish.
+   *  The first error raised by a closure is re-thrown after the remaining
+   *  nodes are drained without being executed.
+   * \param graph the dependency graph.
+   * \param execs closure of each node, can be empty.
+   * \param on_driver whether the node must run on the calling thread.
+   */
+  void Run(const OpDepGraph& graph,
+           const std::vector<FOpExec>& execs,
+           const std::vector<bool>& on_driver);
+  /*! \return the node that raised the error in last Run */
+  inline uint32_t error_node() const {
+    return error_nid_;
+  }
+
+ private:
+  // ready queue of a worker
+  struct ReadyQueue {
+    std::mutex mutex;
+    std::deque<uint32_t> nodes;
+  };
+  // main loop of background worker
+  void WorkerLoop(int wid);
+  // push a ready node from worker wid
+  void Push(int wid, uint32_t nid);
+  // pop a node for worker wid, steal from others when own queue is empty
+  bool Pop(int wid, uint32_t* nid);
+  // execute the node and release its successors
+  void Execute(int wid, uint32_t nid);
+  // wake up all the sleeping threads
+  void Notify();
+  // ready queues, queues_[0] belongs to the calling thread
+  std::vector<std::unique_ptr<ReadyQueue> > queues_;
+  // nodes only the calling thread can execute
+  ReadyQueue driver_queue_;
+  // background threads
+  std::vector<std::thread> threads_;
+  // number of nodes in the stealable queues and the driver queue
+  std::atomic<int> num_stealable_{0};
+  std::atomic<int> num_driver_{0};
+  // lock and condition for idle threads
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cond_;
+  bool stop_{false};
+  // ----------------------------
+  // state of current run
+  const OpDepGraph* graph_{nullptr};
+  const std::vector<FOpExec>* execs_{nullptr};
+  const std::vector<bool>* on_driver_{nullptr};
+  std::unique_ptr<std::atomic<uint32_t>[]> pending_;
+  std::atomic<size_t> num_remain_{0};
+  std::atomic<bool> aborted_{false};
+  std::exception_ptr error_;
+  uint32_t error_nid_{0};
+};
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_SCHEDULER_H_
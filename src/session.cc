@@ -8,7 +8,12 @@
 #include <memory>
 #include <functional>
 #include "./op_util.h"
+#include "./profiler.h"
+#include "./scheduler.h"
+#include "./session_util.h"
+#include "./storage_arena.h"
 #include "./torch/torch_util.h"
+#include "./native/native_util.h"
 
 namespace tinyflow {
 
@@ -56,38 +61,84 @@ struct VarState {
 
 // shared variable map structure
 using VarStateMap = std::unordered_map<std::string, std::shared_ptr<VarState> >;
-// operator executor closures
-using FOpExec = std::function<void()>;
+// arena of the torch storages on the device of the session
+using TorchArena = StorageArena<LuaRef>;
 
 // torch session.
 class TorchSession : public Session {
  public:
   // simple session that binds to one device.
-  explicit TorchSession(const std::string& config) {
-    if (config.find("gpu") != std::string::npos) {
+  explicit TorchSession(const std::unordered_map<std::string, std::string>& config)
+      : cached_execs_(GetSessionOption(config, "exec_cache",
+                                       ExecutorCache<TorchExecutor>::kDefaultCapacity)) {
+    // the variables live in the lua state of the calling thread, replicas would
+    // each need a lua state of their own, which is left for later.
+    CHECK_EQ(config.count("replicas"), 0U)
+        << "replicas is not supported by the torch session yet, use cpu-native";
+    // the lua ops keep the NCHW layout.
+    CheckSessionOptions(config, {"cpu", "gpu", "async", "exec_cache", "num_threads",
+                                 "plan_concurrency", "profile", "fusion"}, "torch");
+    // rtc kernels on GPU, the FuseElemwise pass on CPU.
+    enable_fusion_ = config.count("fusion") != 0;
+    if (config.count("gpu") != 0) {
+      CHECK(config.count("cpu") == 0) << "session config selects both cpu and gpu";
+      CHECK(config.count("num_threads") == 0 && config.count("plan_concurrency") == 0)
+          << "num_threads is only supported on CPU";
       default_dev_mask_ = kGPU;
-      if (config.find("fusion") != std::string::npos) {
-        enable_fusion_ = true;
+    } else {
+      // ops with native kernels run on the worker pool,
+      // lua ops stay on the calling thread.
+      int num_threads = GetSessionOption(config, "num_threads", 1);
+      if (num_threads != 1) {
+        scheduler_ = std::make_shared<OpScheduler>(num_threads);
+        plan_concurrency_ = GetSessionOption(
+            config, "plan_concurrency", scheduler_->num_workers());
       }
     }
+    if (config.count("profile") != 0) {
+      profiler_ = std::make_shared<OpProfiler>();
+    }
+    int dev_mask = default_dev_mask_;
+    arena_ = std::make_shared<TorchArena>([dev_mask](size_t size) {
+        return TorchState::ThreadLocalState()->NewStorage(size, dev_mask);
+      });
   }
   const std::vector<TBlob>&
   Run(nnvm::Symbol* sym,
       const std::unordered_map<std::string, TBlob>& inputs) override;
+  void RunInto(nnvm::Symbol* sym,
+               const std::unordered_map<std::string, TBlob>& inputs,
+               const std::vector<TBlob>& outputs) override;
+  Callable* MakeCallable(nnvm::Symbol* sym,
+                         const std::vector<std::string>& feed_names) override;
+  std::string DumpProfile(const std::string& trace_file) override {
+    CHECK(profiler_ != nullptr) << "session is not created with profile option";
+    return profiler_->Dump(trace_file);
+  }
+  ExecCacheStats GetCacheStats() const override {
+    return cached_execs_.stats();
+  }
+  StorageStats GetStorageStats() const override {
+    return arena_->stats();
+  }
 
  private:
-  // entry to store cached executor
-  struct ExecEntry {
-    nnvm::Symbol cached_symbol;
-    std::shared_ptr<TorchExecutor> exec;
-    size_t use_count{0};
-  };
   int default_dev_mask_{kCPU};
   bool enable_fusion_{false};
+  // get the executor of the symbol from the cache.
+  std::shared_ptr<TorchExecutor> GetExecutor(nnvm::Symbol* sym);
   // local cached variable states.
   VarStateMap states_;
+  // storages shared by the executors.
+  std::shared_ptr<TorchArena> arena_;
+  // parallel scheduler, nullptr when ops run sequentially.
+  std::shared_ptr<OpScheduler> scheduler_;
+  // number of concurrent groups assumed by the memory planner.
+  int plan_concurrency_{1};
+  // op profiler, nullptr when not profiling.
+  std::shared_ptr<OpProfiler> profiler_;
   // cached executor
-  std::unordered_map<uint64_t, ExecEntry> cached_execs_;
+  ExecutorCache<TorchExecutor> cached_execs_;
 };
 
 
@@ -95,9 +146,28 @@ class TorchExecutor {
  public:
   // initialize the executor
   // possibly update the states.
-  void Init(nnvm::Symbol symbol, VarStateMap* states, int default_dev_mask, bool enable_fusion);
+  void Init(nnvm::Symbol symbol, VarStateMap* states, int default_dev_mask, bool enable_fusion,
+            std::shared_ptr<TorchArena> arena,
+            std::shared_ptr<OpScheduler> scheduler = nullptr, int plan_concurrency = 1,
+            std::shared_ptr<OpProfiler> profiler = nullptr);
   /// run the executor, return the outputs.
-  const std::vector<TBlob>& Run(const std::unordered_map<std::string, TBlob>& inputs);
+  const std::vector<TBlob>& Run(const std::unordered_map<std::string, TBlob>& inputs) {
+    return Run(ArrangeFeeds(graph_.indexed_graph(), placeholder_nids_, inputs));
+  }
+  /// run the executor with positional feeds in the order of feed_names().
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds);
+  /// run the executor, copy the outputs into the given space.
+  void RunInto(const std::unordered_map<std::string, TBlob>& inputs,
+               const std::vector<TBlob>& outputs) {
+    RunInto(ArrangeFeeds(graph_.indexed_graph(), placeholder_nids_, inputs), outputs);
+  }
+  /// run the executor with positional feeds, copy the outputs into the given space.
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs);
+  // names of the placeholders, in the order of positional feeds
+  inline std::vector<std::string> feed_names() const {
+    return PlaceholderNames(graph_.indexed_graph(), placeholder_nids_);
+  }
   // return corresponding internal symbol
   inline const nnvm::Symbol& symbol() const {
     return symbol_;
@@ -107,10 +177,15 @@ class TorchExecutor {
   // setup the executor space.
   void SetupAuxiliaryMembers();
   void ClearAuxiliaryMembers();
-  void Setup(const std::unordered_map<std::string, TBlob>& inputs);
-  void SetupShapeDType(const std::unordered_map<std::string, TBlob>& inputs, bool* need_redo_infer);
-  void SetupStorage();
+  void Setup(const std::vector<TBlob>& feeds);
+  void SetupShapeDType(const std::vector<TBlob>& feeds, bool* need_redo_infer,
+                       bool* batch_only);
+  void SetupStorage(bool batch_only);
   void SetupOpExecs();
+  void SetupNativeOpExecs(std::vector<bool>* native);
+  // whether node nid runs a native kernel instead of lua.
+  bool RunsNative(uint32_t nid) const;
+  void Execute();
 #if TINYFLOW_USE_FUSION == 1
   FOpExec GenerateRTCClosure(RTC& rtc,
           const std::vector<LuaRef>& input_luaref, std::vector<LuaRef>& output_luaref);
@@ -124,6 +199,8 @@ class TorchExecutor {
   const ShapeVector* node_shape_{nullptr};
   // type vector in graph attribute
   const DTypeVector* node_dtype_{nullptr};
+  // shapes inferred for the batch sizes seen.
+  BatchShapeCache shape_cache_;
 #if TINYFLOW_USE_FUSION == 1
   // map nid->rtc
   RTCMap* node_rtc_{nullptr};
@@ -134,11 +211,15 @@ class TorchExecutor {
   int dev_mask_{kGPU};
   // whether to enable fusion
   bool enable_fusion_;
-  // node id of place holder ops
+  // node id of place holder ops, also the order of positional feeds.
   std::vector<uint32_t> placeholder_nids_;
   // size of number of node, placeholder_tblobs_[nid].data != nullptr
   // if nid is a placeholder and the content is the corresponding TBlob to be copied in.
   std::vector<TBlob> placeholder_tblobs_;
+  // whether the placeholder entry aliases the fed buffer instead of a copy.
+  std::vector<bool> placeholder_alias_;
+  // the fed buffer an aliased placeholder entry currently points to.
+  std::vector<TBlob> placeholder_bound_;
   // node id of variable that is assigned in this executor
   std::vector<uint32_t> assign_var_nids_;
   // node id of variable that is readed by this executor
@@ -152,71 +233,165 @@ class TorchExecutor {
   std::vector<LuaRef> data_entry_;
   // whether data entry is variable.
   std::vector<bool> data_entry_is_var_;
-  // internal storage space.
-  std::vector<LuaRef> storage_pool_;
+  // arena of the storages.
+  std::shared_ptr<TorchArena> arena_;
+  // internal storage space, and the number of floats planned for each.
+  std::vector<TorchArena::Block> storage_pool_;
+  std::vector<size_t> pool_capacity_;
+  // space of the outputs of constant nodes, by entry.
+  std::vector<TorchArena::Block> constant_storage_;
   // operator executor closures
   std::vector<FOpExec> op_execs_;
+  // ----------------------------
+  // parallel execution, only used on CPU with a scheduler.
+  std::shared_ptr<OpScheduler> scheduler_;
+  // number of concurrent groups assumed by the memory planner.
+  int plan_concurrency_{1};
+  // dependency between the nodes
+  OpDepGraph op_deps_;
+  // whether the op has to run on the thread owning the lua state.
+  std::vector<bool> op_on_driver_;
+  // blob of each data entry, variables are read from the states.
+  std::vector<TBlob> entry_blobs_;
+  // op profiler, nullptr when not profiling.
+  std::shared_ptr<OpProfiler> profiler_;
   // lua module states of each operator.
   std::vector<LuaRef> op_exec_modules_;
   // The storage space to hold outputs.
   std::vector<LuaRef> outputs_;
   std::vector<TBlob> output_blobs_;
+  // tensors sharing the space of caller provided outputs, and the bound space.
+  std::vector<LuaRef> caller_outputs_;
+  std::vector<TBlob> caller_outputs_bound_;
+};
+
+void Session::RunInto(Symbol* g,
+                      const std::unordered_map<std::string, TBlob>& inputs,
+                      const std::vector<TBlob>& outputs) {
+  const std::vector<TBlob>& ret = this->Run(g, inputs);
+  CHECK_EQ(ret.size(), outputs.size()) << "number of outputs mismatch";
+  for (size_t i = 0; i < ret.size(); ++i) {
+    CHECK_EQ(ret[i].shape, outputs[i].shape) << "shape of output " << i << " mismatch";
+    CopyBlob(ret[i], outputs[i]);
+  }
+}
+
+// callable that goes through Session::Run, used by sessions without executors.
+class SessionCallable : public Callable {
+ public:
+  SessionCallable(Session* sess, nnvm::Symbol sym,
+                  const std::vector<std::string>& feed_names)
+      : sess_(sess), sym_(sym), feed_names_(feed_names) {}
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds) override {
+    return sess_->Run(&sym_, this->FeedDict(feeds));
+  }
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs) override {
+    sess_->RunInto(&sym_, this->FeedDict(feeds), outputs);
+  }
+
+ private:
+  std::unordered_map<std::string, TBlob> FeedDict(const std::vector<TBlob>& feeds) {
+    CHECK_EQ(feeds.size(), feed_names_.size()) << "number of feeds mismatch";
+    std::unordered_map<std::string, TBlob> inputs;
+    for (size_t i = 0; i < feeds.size(); ++i) {
+      inputs[feed_names_[i]] = feeds[i];
+    }
+    return inputs;
+  }
+  Session* sess_;
+  nnvm::Symbol sym_;
+  std::vector<std::string> feed_names_;
 };
 
+Callable* Session::MakeCallable(Symbol* g,
+                                const std::vector<std::string>& feed_names) {
+  return new SessionCallable(this, *g, feed_names);
+}
+
+uint64_t Session::RunAsync(Symbol* g,
+                           const std::unordered_map<std::string, TBlob>& inputs) {
+  LOG(FATAL) << "RunAsync is only supported by session created with async option";
+  return 0;
+}
+
+std::string Session::DumpProfile(const std::string& trace_file) {
+  LOG(FATAL) << "DumpProfile is only supported by session created with profile option";
+  return std::string();
+}
+
+const std::vector<TBlob>& Session::Wait(uint64_t run_id) {
+  LOG(FATAL) << "Wait is only supported by session created with async option";
+  static std::vector<TBlob> empty;
+  return empty;
+}
+
+// create the session that runs on the calling thread.
+inline Session* CreateLocalSession(const std::unordered_map<std::string, std::string>& config) {
+  if (config.count("cpu-native") != 0) {
+    return CreateNativeSession(config);
+  }
+  return new TorchSession(config);
+}
+
 Session* Session::Create(const std::string& option) {
-  return new TorchSession(option);
+  const auto config = ParseSessionConfig(option);
+  if (config.count("async") != 0) {
+    return CreateAsyncSession([config]() { return CreateLocalSession(config); });
+  }
+  return CreateLocalSession(config);
+}
+
+std::shared_ptr<TorchExecutor> TorchSession::GetExecutor(nnvm::Symbol* new_sym) {
+  return cached_execs_.Get(
+      *new_sym, [this](const nnvm::Symbol& sym) {
+        auto exec = std::make_shared<TorchExecutor>();
+        exec->Init(sym, &states_, default_dev_mask_, enable_fusion_, arena_,
+                   scheduler_, plan_concurrency_, profiler_);
+        return exec;
+      });
 }
 
 const std::vector<TBlob>& TorchSession::Run(
     nnvm::Symbol* new_sym,
     const std::unordered_map<std::string, TBlob>& inputs) {
-  // compute the hash value
-  uint64_t hash_value = new_sym->outputs.size();
-  for (NodeEntry& e : new_sym->outputs) {
-    uint64_t value = reinterpret_cast<uint64_t>(e.node.get());
-    hash_value ^= value + 0x9e3779b9 + (hash_value << 6) + (hash_value >> 2);
-  }
-  if (cached_execs_.count(hash_value) != 0) {
-    auto& entry = cached_execs_.at(hash_value);
-    const nnvm::Symbol& old_sym = entry.cached_symbol;
-    bool stale_exec = (old_sym.outputs.size() != new_sym->outputs.size());
-    if (!stale_exec) {
-      for (size_t i = 0; i < old_sym.outputs.size(); ++i) {
-        if (old_sym.outputs[i].node.get() != new_sym->outputs[i].node.get() ||
-            old_sym.outputs[i].index != new_sym->outputs[i].index ||
-            old_sym.outputs[i].version != new_sym->outputs[i].version) {
-          stale_exec = true; break;
-        }
-      }
-    }
-    if (!stale_exec) {
-      ++entry.use_count;
-      return entry.exec->Run(inputs);
-    } else {
-      cached_execs_.erase(hash_value);
-    }
-  }
-  // dump technique, remove all previous executors
-  // better strategy, LRU?
-  cached_execs_.clear();
-  ExecEntry e;
-  e.cached_symbol = *new_sym;
-  e.exec = std::make_shared<TorchExecutor>();
-  e.exec->Init(*new_sym, &states_, default_dev_mask_, enable_fusion_);
-  cached_execs_[hash_value] = e;
-  return e.exec->Run(inputs);
+  return GetExecutor(new_sym)->Run(inputs);
+}
+
+void TorchSession::RunInto(
+    nnvm::Symbol* new_sym,
+    const std::unordered_map<std::string, TBlob>& inputs,
+    const std::vector<TBlob>& outputs) {
+  GetExecutor(new_sym)->RunInto(inputs, outputs);
+}
+
+Callable* TorchSession::MakeCallable(
+    nnvm::Symbol* new_sym,
+    const std::vector<std::string>& feed_names) {
+  return new ExecutorCallable<TorchExecutor>(GetExecutor(new_sym), feed_names);
 }
 
 void TorchExecutor::Init(nnvm::Symbol symbol,
                          VarStateMap* states,
                          int default_dev_mask,
-                         bool enable_fusion) {
+                         bool enable_fusion,
+                         std::shared_ptr<TorchArena> arena,
+                         std::shared_ptr<OpScheduler> scheduler,
+                         int plan_concurrency,
+                         std::shared_ptr<OpProfiler> profiler) {
   dev_mask_ = default_dev_mask;
   if (dev_mask_ == kGPU) TorchState::ThreadLocalState()->InitGPU();
   enable_fusion_ = enable_fusion;
+  arena_ = arena;
+  if (dev_mask_ == kCPU) scheduler_ = scheduler;
+  plan_concurrency_ = plan_concurrency;
+  profiler_ = profiler;
   graph_.outputs = symbol.outputs;
   symbol_.outputs = graph_.outputs;
   var_states_ = states;
+  // the folded conv2d runs on the native kernel, fusion on GPU uses rtc kernels.
+  graph_ = OptimizeGraph(std::move(graph_), dev_mask_ == kCPU, "",
+                         enable_fusion_ && dev_mask_ == kCPU);
   SetupAuxiliaryMembers();
 }
 
@@ -271,15 +446,67 @@ void TorchExecutor::ClearAuxiliaryMembers() {
 }
 
 const std::vector<TBlob>&
-TorchExecutor::Run(const std::unordered_map<std::string, TBlob>& inputs) {
-  Setup(inputs);
+TorchExecutor::Run(const std::vector<TBlob>& feeds) {
+  Setup(feeds);
+  Execute();
   {
+    // copy outputs
+    output_blobs_.clear();
+    auto* th = TorchState::ThreadLocalState();
+    const auto& idx = graph_.indexed_graph();
+    for (size_t i = 0; i < outputs_.size(); ++i) {
+      uint32_t eid = idx.entry_id(idx.outputs()[i]);
+      th->CopyFromTo(data_entry_[eid], outputs_[i]);
+      output_blobs_.push_back(th->GetTBlob(outputs_[i]));
+    }
+  }
+  return output_blobs_;
+}
+
+void TorchExecutor::RunInto(const std::vector<TBlob>& feeds,
+                            const std::vector<TBlob>& outputs) {
+  Setup(feeds);
+  Execute();
+  // copy outputs straight into the caller space.
+  auto* th = TorchState::ThreadLocalState();
+  const auto& idx = graph_.indexed_graph();
+  CHECK_EQ(outputs.size(), idx.outputs().size()) << "number of outputs mismatch";
+  caller_outputs_.resize(outputs.size());
+  caller_outputs_bound_.resize(outputs.size());
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    uint32_t eid = idx.entry_id(idx.outputs()[i]);
+    CHECK_EQ(outputs[i].shape, node_shape_->at(eid))
+        << "shape of output " << i << " mismatch";
+    TBlob& bound = caller_outputs_bound_[i];
+    if (caller_outputs_[i].is_nil()) {
+      caller_outputs_[i] = th->NewTensorEmpty(kCPU);
+    }
+    if (bound.data != outputs[i].data || bound.shape != outputs[i].shape) {
+      th->SetTensorShared(caller_outputs_[i], outputs[i]);
+      bound = outputs[i];
+    }
+    th->CopyFromTo(data_entry_[eid], caller_outputs_[i]);
+  }
+}
+
+void TorchExecutor::Execute() {
+  if (scheduler_ != nullptr) {
+    // parallel execution, placeholders are copied in by their own closures.
+    try {
+      scheduler_->Run(op_deps_, op_execs_, op_on_driver_);
+    } catch (dmlc::Error& e) {
+      const auto& idx = graph_.indexed_graph();
+      LOG(INFO) << "error catched in op "
+                << idx[scheduler_->error_node()].source->op()->name;
+      throw;
+    }
+  } else {
     // execution
     const auto& idx = graph_.indexed_graph();
     auto* th = TorchState::ThreadLocalState();
     for (size_t i = 0; i < op_execs_.size(); ++i) {
       // copy in place holder as demanded.
-      if (placeholder_tblobs_[i].data != nullptr) {
+      if (placeholder_tblobs_[i].data != nullptr && !placeholder_alias_[i]) {
         th->CopyFromTo(th->NewTensorShared(placeholder_tblobs_[i]),
                        data_entry_[idx.entry_id(i, 0)]);
       }
@@ -294,123 +521,78 @@ TorchExecutor::Run(const std::unordered_map<std::string, TBlob>& inputs) {
       }
     }
   }
-  {
-    // copy outputs
-    output_blobs_.clear();
-    auto* th = TorchState::ThreadLocalState();
-    const auto& idx = graph_.indexed_graph();
-    for (size_t i = 0; i < outputs_.size(); ++i) {
-      uint32_t eid = idx.entry_id(idx.outputs()[i]);
-      th->CopyFromTo(data_entry_[eid], outputs_[i]);
-      output_blobs_.push_back(th->GetTBlob(outputs_[i]));
-    }
-  }
-  return output_blobs_;
 }
 
-void TorchExecutor::Setup(const std::unordered_map<std::string, TBlob>& inputs) {
-  bool need_redo_infer;
-  SetupShapeDType(inputs, &need_redo_infer);
+void TorchExecutor::Setup(const std::vector<TBlob>& feeds) {
+  CHECK_EQ(feeds.size(), placeholder_nids_.size())
+      << "Not enought placeholder argument to feed_dict";
+  bool need_redo_infer, batch_only;
+  SetupShapeDType(feeds, &need_redo_infer, &batch_only);
 #if TINYFLOW_USE_FUSION == 1
-  if (enable_fusion_ && need_redo_infer) {
+  if (enable_fusion_ && dev_mask_ == kGPU && need_redo_infer) {
+    std::vector<std::string> names = feed_names();
     graph_ = ApplyPasses(std::move(graph_), {"Fusion", "CodeGen", "RTCGen"});
     node_rtc_ = const_cast<RTCMap*>(&(graph_.GetAttr<RTCMap>("rtc")));
     ClearAuxiliaryMembers();
     SetupAuxiliaryMembers();
+    // keep the order of positional feeds over the rewritten graph.
+    const auto& idx = graph_.indexed_graph();
+    std::vector<uint32_t> nids(names.size());
+    for (uint32_t nid : placeholder_nids_) {
+      auto it = std::find(names.begin(), names.end(), idx[nid].source->attrs.name);
+      CHECK(it != names.end());
+      nids[it - names.begin()] = nid;
+    }
+    placeholder_nids_ = nids;
 
     node_shape_ = nullptr;
     node_dtype_ = nullptr;
-    SetupShapeDType(inputs, &need_redo_infer);
+    SetupShapeDType(feeds, &need_redo_infer, &batch_only);
   }
 #endif
-  if (need_redo_infer) SetupStorage();
+  if (need_redo_infer) SetupStorage(batch_only);
   if (need_redo_infer) {
     op_execs_.clear();
-    op_exec_modules_.clear();
+    // the nn modules are created from the channels and the weight shapes,
+    // they are kept over batch sizes.
+    if (!batch_only) op_exec_modules_.clear();
     SetupOpExecs();
   }
   {
     // copy inputs
     const auto& idx = graph_.indexed_graph();
-    for (uint32_t nid : placeholder_nids_) {
-      const std::string& key = idx[nid].source->attrs.name;
-      const TBlob& value = inputs.at(key);
+    auto* th = TorchState::ThreadLocalState();
+    for (size_t i = 0; i < placeholder_nids_.size(); ++i) {
+      uint32_t nid = placeholder_nids_[i];
+      const TBlob& value = feeds[i];
       placeholder_tblobs_[nid] = value;
+      if (!placeholder_alias_[nid]) continue;
+      // bind the entry to the fed buffer instead of copying.
+      uint32_t eid = idx.entry_id(nid, 0);
+      TBlob& bound = placeholder_bound_[nid];
+      if (bound.data != value.data || bound.shape != value.shape) {
+        th->SetTensorShared(data_entry_[eid], value);
+        bound = value;
+      }
+      if (dev_mask_ == kCPU) entry_blobs_[eid] = value;
     }
   }
 }
 
 void TorchExecutor::SetupShapeDType(
-    const std::unordered_map<std::string, TBlob>& inputs,
-    bool* p_need_redo_infer) {
+    const std::vector<TBlob>& feeds,
+    bool* p_need_redo_infer,
+    bool* p_batch_only) {
+  auto var_blob = [this](uint32_t nid) -> const TBlob* {
+    const VarState* state = node_states_[nid];
+    CHECK(state != nullptr);
+    return state->initialized() ? &(state->blob) : nullptr;
+  };
+  *p_need_redo_infer = InferGraphShape(
+      &graph_, read_var_nids_, assign_var_nids_, var_blob, placeholder_nids_,
+      feeds, &shape_cache_, &node_shape_, &node_dtype_, p_batch_only);
+  if (!*p_need_redo_infer) return;
   const auto& idx = graph_.indexed_graph();
-  bool& need_redo_infer = *p_need_redo_infer;
-  need_redo_infer = (node_shape_ == nullptr);
-
-  // check the variable states
-  if (!need_redo_infer) {
-    CHECK(node_dtype_ != nullptr);
-    for (uint32_t nid : read_var_nids_) {
-      VarState* state = node_states_[nid];
-      CHECK(state != nullptr);
-      CHECK(state->initialized())
-          << "Attempt to execute a graph un-initialized Variable";
-      if (node_shape_->at(idx.entry_id(nid, 0)) != state->blob.shape) {
-        need_redo_infer = true; break;
-      }
-      if (node_dtype_->at(idx.entry_id(nid, 0)) != state->blob.dtype) {
-        need_redo_infer = true; break;
-      }
-    }
-  }
-  // check placeholder shapes.
-  if (!need_redo_infer) {
-    for (uint32_t nid : placeholder_nids_) {
-      const std::string& key = idx[nid].source->attrs.name;
-      CHECK(inputs.count(key))
-          << "Not enought placeholder argument to feed_dict";
-      const TBlob& value = inputs.at(key);
-      if (node_shape_->at(idx.entry_id(nid, 0)) != value.shape) {
-        need_redo_infer = true; break;
-      }
-      if (node_dtype_->at(idx.entry_id(nid, 0)) != value.dtype) {
-        need_redo_infer = true; break;
-      }
-    }
-  }
-
-  if (!need_redo_infer) return;
-  // run shape inference.
-  ShapeVector new_shape(idx.num_node_entries(), TShape());
-  DTypeVector new_dtype(idx.num_node_entries(), -1);
-
-  for (uint32_t nid : read_var_nids_) {
-    VarState* state = node_states_[nid];
-    // TODO more strict rule
-    if (state->initialized()) {
-      new_shape[idx.entry_id(nid, 0)] = state->blob.shape;
-      new_dtype[idx.entry_id(nid, 0)] = state->blob.dtype;
-    } else if (std::find(assign_var_nids_.cbegin(),
-        assign_var_nids_.cend(), nid) == assign_var_nids_.cend()) {
-      CHECK(state->initialized())
-          << "Attempt to execute a graph un-initialized Variable";
-    }
-  }
-  for (uint32_t nid : placeholder_nids_) {
-    const std::string& key = idx[nid].source->attrs.name;
-    const TBlob& value = inputs.at(key);
-    new_shape[idx.entry_id(nid, 0)] = value.shape;
-    new_dtype[idx.entry_id(nid, 0)] = value.dtype;
-  }
-  graph_.attrs["shape"] = std::make_shared<any>(std::move(new_shape));
-  graph_.attrs["dtype"] = std::make_shared<any>(std::move(new_dtype));
-  graph_ = ApplyPasses(std::move(graph_), {"InferShape", "InferType"});
-  CHECK_EQ(graph_.GetAttr<size_t>("shape_num_unknown_nodes"), 0)
-      << "Shape information in the graph is in-complete";
-  CHECK_EQ(graph_.GetAttr<size_t>("dtype_num_unknown_nodes"), 0)
-      << "Type information in the graph is in-complete";
-  node_shape_ = &(graph_.GetAttr<ShapeVector>("shape"));
-  node_dtype_ = &(graph_.GetAttr<DTypeVector>("dtype"));
   // setup out Variable space.
   for (uint32_t nid : assign_var_nids_) {
     node_states_[nid]->ResetSpace(
@@ -420,10 +602,28 @@ void TorchExecutor::SetupShapeDType(
   }
 }
 
-void TorchExecutor::SetupStorage() {
+void TorchExecutor::SetupStorage(bool batch_only) {
   const auto& idx = graph_.indexed_graph();
-  if (storage_pool_.size() == 0) {
-    graph_ = nnvm::ApplyPass(std::move(graph_), "PlanMemory");
+  // a new batch size keeps the plan and the space as long as the planned
+  // space holds it, the entries are bound to it with the new shapes.
+  const bool keep_plan = batch_only &&
+      FitsStoragePlan(idx, graph_.GetAttr<StorageVector>("storage_id"),
+                      pool_capacity_, *node_shape_);
+  if (!keep_plan) {
+    // read-only placeholders on CPU alias the fed buffer.
+    placeholder_alias_.assign(idx.num_nodes(), false);
+    if (dev_mask_ == kCPU) {
+      placeholder_alias_ = FindReadOnlyPlaceholders(idx, placeholder_nids_);
+      // the lua closures may take views of their inputs when created, which
+      // are not rebuilt when the entry is bound to another buffer.
+      for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+        if (idx[nid].source->is_variable() || RunsNative(nid)) continue;
+        for (const auto& e : idx[nid].inputs) {
+          placeholder_alias_[e.node_id] = false;
+        }
+      }
+    }
+    PlanGraphStorage(&graph_, placeholder_nids_, placeholder_alias_, plan_concurrency_);
   }
   const auto& vstorage = graph_.GetAttr<StorageVector>("storage_id");
   const auto& vshape = graph_.GetAttr<ShapeVector>("shape");
@@ -443,29 +643,47 @@ void TorchExecutor::SetupStorage() {
   }
 
 
-  // size of each storage pool entry
-  std::vector<size_t> pool_entry_size;
-  for (size_t i = 0; i < vshape.size(); ++i) {
-    if (data_entry_is_var_[i]) continue;
-    int storage_id = vstorage[i];
-    size_t size = vshape[i].Size();
-    CHECK_GE(storage_id, 0) << "Do not support runtime shape op yet";
-    size_t sid = static_cast<size_t>(storage_id);
-    if (sid >= pool_entry_size.size()) {
-      pool_entry_size.resize(sid + 1, 0);
+  if (!keep_plan) {
+    std::vector<size_t> pool_entry_size = StoragePoolSize(graph_, data_entry_is_var_);
+    // the old space goes back to the arena first, so it can be taken again.
+    storage_pool_.clear();
+    for (size_t i = 0; i < pool_entry_size.size(); ++i) {
+      storage_pool_.push_back(arena_->Alloc(pool_entry_size[i]));
     }
-    pool_entry_size[sid] = std::max(pool_entry_size[sid], size);
-  }
-  storage_pool_.clear();
-  for (size_t i = 0; i < pool_entry_size.size(); ++i) {
-    storage_pool_.push_back(
-        th->NewStorage(pool_entry_size[i], dev_mask_));
+    pool_capacity_ = pool_entry_size;
   }
   // assign pooled data to entry
   for (size_t i = 0; i < data_entry_.size(); ++i) {
-    if (data_entry_is_var_[i]) continue;
+    if (data_entry_is_var_[i] || vstorage[i] == kExternalStorageID) continue;
     int storage_id = vstorage[i];
-    th->ResetStorage(data_entry_[i], storage_pool_.at(storage_id), vshape[i]);
+    th->ResetStorage(data_entry_[i], *storage_pool_.at(storage_id), vshape[i]);
+  }
+  const auto& constant_node = graph_.GetAttr<std::vector<int> >("constant_node");
+  std::vector<bool> is_constant(data_entry_.size(), false);
+  // the constants are computed again for the new shapes.
+  constant_storage_.clear();
+  constant_storage_.resize(data_entry_.size());
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (constant_node[nid] == kNotConstant) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      is_constant[eid] = true;
+      constant_storage_[eid] = arena_->Alloc(vshape[eid].Size());
+      th->ResetStorage(data_entry_[eid], *constant_storage_[eid], vshape[eid]);
+    }
+  }
+  // aliased placeholders are bound again on next run.
+  placeholder_bound_.assign(idx.num_nodes(), TBlob());
+  if (dev_mask_ == kCPU) {
+    entry_blobs_.resize(data_entry_.size());
+    for (size_t i = 0; i < data_entry_.size(); ++i) {
+      if (data_entry_is_var_[i]) continue;
+      if (vstorage[i] == kExternalStorageID && !is_constant[i]) continue;
+      entry_blobs_[i] = th->GetTBlob(data_entry_[i]);
+    }
+  }
+  if (!keep_plan && scheduler_ != nullptr) {
+    op_deps_ = BuildOpDepGraph(idx, vstorage);
   }
 
   outputs_.resize(idx.outputs().size());
@@ -482,6 +700,12 @@ void TorchExecutor::SetupOpExecs() {
   // We can separate some logics into a new pass later.
   auto* lua = LuaState::ThreadLocalState();
   const auto& idx = graph_.indexed_graph();
+  // nodes that run native kernels instead of lua.
+  std::vector<bool> native(idx.num_nodes(), false);
+  op_execs_.resize(idx.num_nodes());
+  if (dev_mask_ == kCPU) {
+    SetupNativeOpExecs(&native);
+  }
   const auto& lua_create_module =
       nnvm::Op::GetAttr<FLuaCreateNNModule>("FLuaCreateNNModule");
   const auto& lua_compute_code =
@@ -618,9 +842,9 @@ void TorchExecutor::SetupOpExecs() {
   // setup the array and requirements.
   for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
     const auto& inode = idx[nid];
-    if (inode.source->is_variable()) continue;
+    if (inode.source->is_variable() || native[nid]) continue;
     std::string lua_code;
-    if (lua_create_module.count(inode.source->op())) {
+    if (lua_create_module.count(inode.source->op()) && op_exec_modules_[nid].is_nil()) {
       lua_code = "return " + lua_create_module[inode.source->op()];
       LuaRef fcreate = lua->Eval(lua_code);
       std::vector<TShape> ishape;
@@ -634,11 +858,10 @@ void TorchExecutor::SetupOpExecs() {
 
   // setup executor closure
   const Op* backward_op = Op::Get("_backward");
-  op_execs_.resize(idx.num_nodes());
   // setup the array and requirements.
   for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
     const auto& inode = idx[nid];
-    if (inode.source->is_variable()) continue;
+    if (inode.source->is_variable() || native[nid]) continue;
     std::vector<LuaRef> in_array, out_array;
     for (const auto& e : inode.inputs) {
       in_array.push_back(data_entry_[idx.entry_id(e)]);
@@ -705,6 +928,112 @@ void TorchExecutor::SetupOpExecs() {
                  << inode.source->op()->name;
     }
   }
+  // the constants are computed here once, only the space of those
+  // read by the other nodes is kept.
+  const auto& constant_node = graph_.GetAttr<std::vector<int> >("constant_node");
+  RunConstantOps(constant_node, &op_execs_);
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (constant_node[nid] != kDeadConstant) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      data_entry_[eid] = TorchState::ThreadLocalState()->NewTensorEmpty(dev_mask_);
+      constant_storage_[eid].reset();
+      if (dev_mask_ == kCPU) entry_blobs_[eid] = TBlob();
+    }
+  }
+  if (profiler_ != nullptr) {
+    ProfileOpExecs(profiler_.get(), idx, *node_shape_, &op_execs_);
+  }
+}
+
+bool TorchExecutor::RunsNative(uint32_t nid) const {
+  // ops with FCompute can run on any thread of the scheduler.
+  // nn module ops run natively only when the backward kernel is
+  // also available, since the backward reuses the lua module of the forward.
+  // Without a scheduler, only ops that prefer the native kernel (e.g. the simd
+  // elementwise ones), or have no lua kernel, run natively.
+  static auto& lua_compute = Op::GetAttr<FLuaCompute>("FLuaCompute");
+  static auto& prefer_native = Op::GetAttr<bool>("PreferNative");
+  static auto& lua_create_module =
+      Op::GetAttr<FLuaCreateNNModule>("FLuaCreateNNModule");
+  const Op* backward_op = Op::Get("_backward");
+  const Op* placeholder_op = Op::Get("placeholder");
+  const auto& idx = graph_.indexed_graph();
+  const auto& inode = idx[nid];
+  if (dev_mask_ != kCPU || inode.source->is_variable()) return false;
+  const Op* op = inode.source->op();
+  // the nn module backward follows the preference of the forward op.
+  const Op* kernel_op = op;
+  if (op == backward_op && inode.control_deps.size() != 0) {
+    kernel_op = idx[inode.control_deps[0]].source->op();
+  }
+  if (scheduler_ == nullptr && !prefer_native.get(kernel_op, false) &&
+      (op == placeholder_op || op == backward_op ||
+       lua_compute.count(op) || lua_create_module.count(op))) {
+    return false;
+  }
+  if (op == placeholder_op) return true;
+  if (op == backward_op) {
+    CHECK_GE(inode.control_deps.size(), 1);
+    return RunsNative(inode.control_deps[0]);
+  }
+  return HasNativeCompute(op, false) &&
+      !(lua_create_module.count(op) && !HasNativeCompute(op, true));
+}
+
+void TorchExecutor::SetupNativeOpExecs(std::vector<bool>* p_native) {
+  const Op* backward_op = Op::Get("_backward");
+  const Op* placeholder_op = Op::Get("placeholder");
+  const auto& idx = graph_.indexed_graph();
+  std::vector<bool>& native = *p_native;
+  op_on_driver_.assign(idx.num_nodes(), false);
+  // passed for the outputs no one reads, which the kernel skips.
+  static const TBlob skipped_blob;
+  const std::vector<bool> skipped = FindSkippedOutputs(idx);
+
+  // blob source of each entry
+  auto entry_blob = [this, &idx](const nnvm::IndexedGraph::NodeEntry& e) -> const TBlob* {
+    uint32_t eid = idx.entry_id(e);
+    if (data_entry_is_var_[eid]) {
+      return &(node_states_[e.node_id]->blob);
+    }
+    return &entry_blobs_[eid];
+  };
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    if (inode.source->is_variable()) continue;
+    if (!RunsNative(nid)) {
+      op_on_driver_[nid] = true; continue;
+    }
+    const Op* op = inode.source->op();
+    const NodeAttrs* attrs = &(inode.source->attrs);
+    if (op == placeholder_op) {
+      const TBlob* src = &placeholder_tblobs_[nid];
+      const TBlob* dst = &entry_blobs_[idx.entry_id(nid, 0)];
+      native[nid] = true;
+      op_execs_[nid] = [src, dst]() { CopyBlob(*src, *dst); };
+      continue;
+    } else if (op == backward_op) {
+      attrs = &(idx[inode.control_deps[0]].source->attrs);
+    }
+    FCompute fcomp = GetNativeCompute(idx, nid, *node_shape_);
+    std::vector<const TBlob*> in_src, out_src;
+    for (const auto& e : inode.inputs) {
+      in_src.push_back(entry_blob(e));
+    }
+    for (uint32_t index = 0; index < inode.source->num_outputs(); ++index) {
+      const uint32_t eid = idx.entry_id(nid, index);
+      out_src.push_back(skipped[eid] ? &skipped_blob : &entry_blobs_[eid]);
+    }
+    native[nid] = true;
+    // the blobs are read at call time, variable space can be reset by other executors.
+    op_execs_[nid] = [fcomp, attrs, in_src, out_src]() {
+      std::vector<TBlob> in_array, out_array;
+      for (const TBlob* b : in_src) in_array.push_back(*b);
+      for (const TBlob* b : out_src) out_array.push_back(*b);
+      fcomp(*attrs, in_array, out_array);
+    };
+  }
 }
 
 #if TINYFLOW_USE_FUSION == 1
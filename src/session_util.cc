@@ -0,0 +1,649 @@
+// Copyright (c) 2016 by Contributors
+// structural hashing of symbols, used as key of the executor cache,
+// and the other graph utilities of the sessions.
+#include <nnvm/graph.h>
+#include <nnvm/pass.h>
+#include <nnvm/pass_functions.h>
+#include <nnvm/op_attr_types.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "./op_util.h"
+#include "./session_util.h"
+
+namespace tinyflow {
+
+using nnvm::Node;
+using nnvm::NodeEntry;
+using nnvm::NodePtr;
+
+namespace {
+
+inline void HashCombine(uint64_t* seed, uint64_t value) {
+  *seed ^= value + 0x9e3779b97f4a7c15ULL + (*seed << 6) + (*seed >> 2);
+}
+
+inline uint64_t HashString(const std::string& str) {
+  return std::hash<std::string>()(str);
+}
+
+// the name of variables and placeholders is part of the interface:
+// states and feeds are looked up by name.
+inline bool NameMatters(const Node* node) {
+  static const Op* placeholder_op = Op::Get("placeholder");
+  return node->is_variable() || node->op() == placeholder_op;
+}
+
+// nodes reachable from the outputs in topological order
+std::vector<const Node*> TopoOrder(const nnvm::Symbol& sym) {
+  std::vector<const Node*> order;
+  nnvm::DFSVisit(sym.outputs, [&order](const NodePtr& n) {
+      order.push_back(n.get());
+    });
+  return order;
+}
+
+// sorted view of the attribute dict, the dict itself has no stable order.
+std::vector<std::pair<std::string, std::string> >
+SortedDict(const Node* node) {
+  std::vector<std::pair<std::string, std::string> > kv(
+      node->attrs.dict.begin(), node->attrs.dict.end());
+  std::sort(kv.begin(), kv.end());
+  return kv;
+}
+
+}  // namespace
+
+uint64_t StructuralHash(const nnvm::Symbol& sym) {
+  std::vector<const Node*> order = TopoOrder(sym);
+  std::unordered_map<const Node*, uint64_t> index;
+  uint64_t hash_value = order.size();
+  for (const Node* n : order) {
+    const uint64_t nid = index.size();
+    index[n] = nid;
+    HashCombine(&hash_value, n->is_variable() ? 0 : HashString(n->op()->name));
+    if (NameMatters(n)) {
+      HashCombine(&hash_value, HashString(n->attrs.name));
+    }
+    for (const auto& kv : SortedDict(n)) {
+      HashCombine(&hash_value, HashString(kv.first));
+      HashCombine(&hash_value, HashString(kv.second));
+    }
+    HashCombine(&hash_value, n->inputs.size());
+    for (const NodeEntry& e : n->inputs) {
+      HashCombine(&hash_value, index.at(e.node.get()));
+      HashCombine(&hash_value, e.index);
+      HashCombine(&hash_value, e.version);
+    }
+    HashCombine(&hash_value, n->control_deps.size());
+    for (const NodePtr& c : n->control_deps) {
+      HashCombine(&hash_value, index.at(c.get()));
+    }
+  }
+  for (const NodeEntry& e : sym.outputs) {
+    HashCombine(&hash_value, index.at(e.node.get()));
+    HashCombine(&hash_value, e.index);
+    HashCombine(&hash_value, e.version);
+  }
+  return hash_value;
+}
+
+bool StructuralEqual(const nnvm::Symbol& lhs, const nnvm::Symbol& rhs) {
+  if (lhs.outputs.size() != rhs.outputs.size()) return false;
+  std::vector<const Node*> lorder = TopoOrder(lhs);
+  std::vector<const Node*> rorder = TopoOrder(rhs);
+  if (lorder.size() != rorder.size()) return false;
+  // map of lhs node -> rhs node, built along the topological order.
+  std::unordered_map<const Node*, const Node*> lmap;
+  auto same_entry = [&lmap](const NodeEntry& a, const NodeEntry& b) {
+    auto it = lmap.find(a.node.get());
+    return it != lmap.end() && it->second == b.node.get() &&
+        a.index == b.index && a.version == b.version;
+  };
+  for (size_t i = 0; i < lorder.size(); ++i) {
+    const Node* a = lorder[i];
+    const Node* b = rorder[i];
+    if (a->op() != b->op()) return false;
+    if (NameMatters(a) && a->attrs.name != b->attrs.name) return false;
+    if (a->attrs.dict != b->attrs.dict) return false;
+    if (a->inputs.size() != b->inputs.size()) return false;
+    for (size_t j = 0; j < a->inputs.size(); ++j) {
+      if (!same_entry(a->inputs[j], b->inputs[j])) return false;
+    }
+    if (a->control_deps.size() != b->control_deps.size()) return false;
+    for (size_t j = 0; j < a->control_deps.size(); ++j) {
+      auto it = lmap.find(a->control_deps[j].get());
+      if (it == lmap.end() || it->second != b->control_deps[j].get()) return false;
+    }
+    lmap[a] = b;
+  }
+  for (size_t i = 0; i < lhs.outputs.size(); ++i) {
+    if (!same_entry(lhs.outputs[i], rhs.outputs[i])) return false;
+  }
+  return true;
+}
+
+std::vector<bool> FindReadOnlyPlaceholders(
+    const nnvm::IndexedGraph& idx, const std::vector<uint32_t>& placeholder_nids) {
+  static auto& fmutate_inputs = Op::GetAttr<nnvm::FMutateInputs>("FMutateInputs");
+  static auto& finplace_option = Op::GetAttr<nnvm::FInplaceOption>("FInplaceOption");
+  std::vector<bool> ret(idx.num_nodes(), false);
+  for (uint32_t nid : placeholder_nids) ret[nid] = true;
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    if (inode.source->is_variable()) continue;
+    const Op* op = inode.source->op();
+    if (fmutate_inputs.count(op)) {
+      for (uint32_t i : fmutate_inputs[op](inode.source->attrs)) {
+        ret[inode.inputs[i].node_id] = false;
+      }
+    }
+    if (finplace_option.count(op)) {
+      for (const auto& kv : finplace_option[op](inode.source->attrs)) {
+        ret[inode.inputs[kv.first].node_id] = false;
+      }
+    }
+  }
+  return ret;
+}
+
+std::vector<bool> FindSkippedOutputs(const nnvm::IndexedGraph& idx) {
+  static auto& fskip = Op::GetAttr<bool>("SkipUnusedOutputs");
+  const Op* backward_op = Op::Get("_backward");
+  std::vector<bool> used(idx.num_node_entries(), false);
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    for (const auto& e : idx[nid].inputs) {
+      used[idx.entry_id(e)] = true;
+    }
+  }
+  for (const auto& e : idx.outputs()) {
+    used[idx.entry_id(e)] = true;
+  }
+  std::vector<bool> ret(idx.num_node_entries(), false);
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    if (inode.source->is_variable()) continue;
+    const Op* op = inode.source->op();
+    if (op == backward_op && inode.control_deps.size() != 0) {
+      op = idx[inode.control_deps[0]].source->op();
+    }
+    if (!fskip.get(op, false)) continue;
+    for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      ret[eid] = !used[eid];
+    }
+  }
+  return ret;
+}
+
+bool IsBatchChange(const nnvm::IndexedGraph& idx,
+                   const std::vector<uint32_t>& placeholder_nids,
+                   const nnvm::ShapeVector& shapes,
+                   const nnvm::DTypeVector& dtypes,
+                   const std::vector<TBlob>& feeds) {
+  CHECK_EQ(placeholder_nids.size(), feeds.size());
+  for (size_t i = 0; i < feeds.size(); ++i) {
+    const uint32_t eid = idx.entry_id(placeholder_nids[i], 0);
+    const TShape& old_shape = shapes[eid];
+    const TShape& new_shape = feeds[i].shape;
+    if (dtypes[eid] != feeds[i].dtype) return false;
+    if (old_shape.ndim() != new_shape.ndim() || new_shape.ndim() == 0) return false;
+    for (size_t k = 1; k < new_shape.ndim(); ++k) {
+      if (old_shape[k] != new_shape[k]) return false;
+    }
+  }
+  return true;
+}
+
+bool FitsStoragePlan(const nnvm::IndexedGraph& idx,
+                     const nnvm::StorageVector& storage_id,
+                     const std::vector<size_t>& capacity,
+                     const nnvm::ShapeVector& shapes) {
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    const auto& inode = idx[nid];
+    if (inode.source->is_variable()) continue;
+    for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+      const uint32_t eid = idx.entry_id(nid, i);
+      const int sid = storage_id[eid];
+      if (sid < 0) continue;
+      if (static_cast<size_t>(sid) >= capacity.size() ||
+          shapes[eid].Size() > capacity[sid]) {
+        return false;
+      }
+      // the kernels written in place expect the input of the same size.
+      for (const auto& e : inode.inputs) {
+        const uint32_t in_eid = idx.entry_id(e);
+        if (storage_id[in_eid] == sid && shapes[in_eid].Size() != shapes[eid].Size()) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+nnvm::Graph OptimizeGraph(nnvm::Graph graph, bool fold_conv_bn,
+                          const std::string& layout, bool fusion) {
+  graph = nnvm::ApplyPasses(std::move(graph), {"EliminateMerge", "EliminateCommonExpr"});
+  if (fold_conv_bn) {
+    graph = nnvm::ApplyPass(std::move(graph), "FoldConvBatchNorm");
+  }
+  if (layout.length() != 0) {
+    graph.attrs["target_layout"] = std::make_shared<nnvm::any>(layout);
+    graph = nnvm::ApplyPass(std::move(graph), "ConvertLayout");
+  }
+  if (fusion) {
+    graph = nnvm::ApplyPass(std::move(graph), "FuseElemwise");
+  }
+  return graph;
+}
+
+bool InferGraphShape(nnvm::Graph* graph,
+                     const std::vector<uint32_t>& read_var_nids,
+                     const std::vector<uint32_t>& assign_var_nids,
+                     const std::function<const TBlob*(uint32_t nid)>& var_blob,
+                     const std::vector<uint32_t>& placeholder_nids,
+                     const std::vector<TBlob>& feeds,
+                     BatchShapeCache* shape_cache,
+                     const nnvm::ShapeVector** node_shape,
+                     const nnvm::DTypeVector** node_dtype,
+                     bool* batch_only) {
+  const auto& idx = graph->indexed_graph();
+  bool need_redo_infer = (*node_shape == nullptr);
+  *batch_only = false;
+  // check the variable states
+  if (!need_redo_infer) {
+    CHECK(*node_dtype != nullptr);
+    for (uint32_t nid : read_var_nids) {
+      const TBlob* blob = var_blob(nid);
+      CHECK(blob != nullptr)
+          << "Attempt to execute a graph un-initialized Variable";
+      if ((*node_shape)->at(idx.entry_id(nid, 0)) != blob->shape ||
+          (*node_dtype)->at(idx.entry_id(nid, 0)) != blob->dtype) {
+        need_redo_infer = true; break;
+      }
+    }
+  }
+  const bool same_vars = !need_redo_infer;
+  // check placeholder shapes.
+  if (!need_redo_infer) {
+    for (size_t i = 0; i < placeholder_nids.size(); ++i) {
+      const uint32_t eid = idx.entry_id(placeholder_nids[i], 0);
+      if ((*node_shape)->at(eid) != feeds[i].shape ||
+          (*node_dtype)->at(eid) != feeds[i].dtype) {
+        need_redo_infer = true; break;
+      }
+    }
+  }
+  if (!need_redo_infer) return false;
+  // a batch size seen before takes the shapes inferred for it.
+  *batch_only = same_vars &&
+      IsBatchChange(idx, placeholder_nids, **node_shape, **node_dtype, feeds);
+  if (!*batch_only) shape_cache->Clear();
+  const nnvm::ShapeVector* cached = shape_cache->Find(feeds);
+  if (cached != nullptr) {
+    graph->attrs["shape"] = std::make_shared<nnvm::any>(*cached);
+    *node_shape = &(graph->GetAttr<nnvm::ShapeVector>("shape"));
+    return true;
+  }
+  // run shape inference.
+  nnvm::ShapeVector new_shape(idx.num_node_entries(), TShape());
+  nnvm::DTypeVector new_dtype(idx.num_node_entries(), -1);
+  for (uint32_t nid : read_var_nids) {
+    const TBlob* blob = var_blob(nid);
+    if (blob != nullptr) {
+      new_shape[idx.entry_id(nid, 0)] = blob->shape;
+      new_dtype[idx.entry_id(nid, 0)] = blob->dtype;
+    } else {
+      // a variable assigned by the graph is inferred from its value.
+      CHECK(std::find(assign_var_nids.cbegin(), assign_var_nids.cend(), nid) !=
+            assign_var_nids.cend())
+          << "Attempt to execute a graph un-initialized Variable";
+    }
+  }
+  for (size_t i = 0; i < placeholder_nids.size(); ++i) {
+    const uint32_t eid = idx.entry_id(placeholder_nids[i], 0);
+    new_shape[eid] = feeds[i].shape;
+    new_dtype[eid] = feeds[i].dtype;
+  }
+  graph->attrs["shape"] = std::make_shared<nnvm::any>(std::move(new_shape));
+  graph->attrs["dtype"] = std::make_shared<nnvm::any>(std::move(new_dtype));
+  *graph = nnvm::ApplyPasses(std::move(*graph), {"InferShape", "InferType"});
+  CHECK_EQ(graph->GetAttr<size_t>("shape_num_unknown_nodes"), 0)
+      << "Shape information in the graph is in-complete";
+  CHECK_EQ(graph->GetAttr<size_t>("dtype_num_unknown_nodes"), 0)
+      << "Type information in the graph is in-complete";
+  *node_shape = &(graph->GetAttr<nnvm::ShapeVector>("shape"));
+  *node_dtype = &(graph->GetAttr<nnvm::DTypeVector>("dtype"));
+  shape_cache->Insert(feeds, **node_shape);
+  return true;
+}
+
+void PlanGraphStorage(nnvm::Graph* graph,
+                      const std::vector<uint32_t>& placeholder_nids,
+                      const std::vector<bool>& placeholder_alias,
+                      int plan_concurrency) {
+  *graph = nnvm::ApplyPass(std::move(*graph), "FoldConstant");
+  const auto& idx = graph->indexed_graph();
+  const auto& constant_node = graph->GetAttr<std::vector<int> >("constant_node");
+  nnvm::StorageVector init_storage(idx.num_node_entries(), -1);
+  for (uint32_t nid : placeholder_nids) {
+    if (placeholder_alias[nid]) {
+      init_storage[idx.entry_id(nid, 0)] = kExternalStorageID;
+    }
+  }
+  for (uint32_t nid = 0; nid < idx.num_nodes(); ++nid) {
+    if (constant_node[nid] == kNotConstant) continue;
+    for (uint32_t i = 0; i < idx[nid].source->num_outputs(); ++i) {
+      init_storage[idx.entry_id(nid, i)] = kExternalStorageID;
+    }
+  }
+  graph->attrs["storage_id"] = std::make_shared<nnvm::any>(std::move(init_storage));
+  // avoid reusing space between branches that can run concurrently.
+  graph->attrs["mem_plan_concurrency"] = std::make_shared<nnvm::any>(plan_concurrency);
+  *graph = nnvm::ApplyPass(std::move(*graph), "PlanMemoryParallel");
+}
+
+std::vector<size_t> StoragePoolSize(const nnvm::Graph& graph,
+                                    const std::vector<bool>& entry_is_var) {
+  const auto& vstorage = graph.GetAttr<nnvm::StorageVector>("storage_id");
+  const auto& vshape = graph.GetAttr<nnvm::ShapeVector>("shape");
+  std::vector<size_t> pool_entry_size;
+  for (size_t i = 0; i < vshape.size(); ++i) {
+    if (entry_is_var[i] || vstorage[i] == kExternalStorageID) continue;
+    int storage_id = vstorage[i];
+    CHECK_GE(storage_id, 0) << "Do not support runtime shape op yet";
+    size_t sid = static_cast<size_t>(storage_id);
+    if (sid >= pool_entry_size.size()) {
+      pool_entry_size.resize(sid + 1, 0);
+    }
+    pool_entry_size[sid] = std::max(pool_entry_size[sid], vshape[i].Size());
+  }
+  return pool_entry_size;
+}
+
+namespace {
+
+// kinds of loss a gradient comes from.
+const int kLossSum = 1;
+const int kLossMean = 2;
+
+// whether the placeholder is declared with an unknown leading dimension,
+// e.g. shape=[None, 784], which is the batch.
+bool IsBatchPlaceholder(const Node* n) {
+  auto it = n->attrs.dict.find("shape");
+  if (it == n->attrs.dict.end()) return false;
+  const size_t begin = it->second.find_first_not_of("[( ");
+  return begin != std::string::npos && it->second.compare(begin, 4, "None") == 0;
+}
+
+// the kind of loss of the node, if it takes the batch axis away.
+int BatchReduction(const Node* n) {
+  static const Op* reduce_sum_op = Op::Get("reduce_sum");
+  static const Op* reduce_mean_op = Op::Get("reduce_mean");
+  static const Op* xent_op = Op::Get("mean_sparse_softmax_cross_entropy_with_logits");
+  if (n->op() == xent_op) return kLossMean;
+  if (n->op() != reduce_sum_op && n->op() != reduce_mean_op) return 0;
+  const auto& axis = dmlc::get<ReduceParam>(n->attrs.parsed).reduction_indices;
+  if (axis.ndim() != 0 && std::count(axis.begin(), axis.end(), 0) == 0) return 0;
+  return n->op() == reduce_sum_op ? kLossSum : kLossMean;
+}
+
+}  // namespace
+
+DataParallelGraph SplitDataParallel(const nnvm::Symbol& sym) {
+  static auto& fmutate_inputs = Op::GetAttr<nnvm::FMutateInputs>("FMutateInputs");
+  static const Op* placeholder_op = Op::Get("placeholder");
+  static const Op* ones_like_op = Op::Get("ones_like");
+  static const Op* zeros_like_op = Op::Get("zeros_like");
+  static const Op* ewise_sum_op = Op::Get("__ewise_sum__");
+  static const Op* add_op = Op::Get("__add_symbol__");
+  static const Op* batch_norm_op = Op::Get("batch_normalization");
+  DataParallelGraph ret;
+  // what is known of the value of each node of the replicas.
+  struct Info {
+    // whether it depends on the batch.
+    bool batch{false};
+    // whether it keeps the batch axis.
+    bool axis{false};
+    // kinds of reduction of the batch among its inputs.
+    int reduce{0};
+    // kinds of the losses it is a gradient of.
+    int loss{0};
+  };
+  std::unordered_map<const Node*, Info> info;
+  // copy in the update graph of the nodes that run after the updates.
+  std::unordered_map<const Node*, NodePtr> update_node;
+  bool has_update = false;
+  // a node whose rows depend on the other rows of the batch.
+  const Node* batch_stats = nullptr;
+
+  nnvm::DFSVisit(sym.outputs, [&](const NodePtr& n) {
+      Info& in = info[n.get()];
+      if (n->is_variable()) return;
+      if (n->op() == placeholder_op) {
+        in.batch = in.axis = IsBatchPlaceholder(n.get());
+        if (in.batch) ret.batch_feeds.push_back(n->attrs.name);
+        return;
+      }
+      bool is_update = fmutate_inputs.count(n->op()) != 0;
+      for (const auto& e : n->inputs) {
+        const Info& x = info.at(e.node.get());
+        in.batch = in.batch || x.batch;
+        in.axis = in.axis || x.axis;
+        in.reduce |= x.reduce;
+        in.loss |= x.loss;
+        is_update = is_update || update_node.count(e.node.get()) != 0;
+      }
+      for (const auto& dep : n->control_deps) {
+        const Info& x = info.at(dep.get());
+        in.batch = in.batch || x.batch;
+        in.loss |= x.loss;
+        is_update = is_update || update_node.count(dep.get()) != 0;
+      }
+      if (n->op() == batch_norm_op && in.axis &&
+          !dmlc::get<BatchNormalizationParam>(n->attrs.parsed).use_global_stats) {
+        batch_stats = n.get();
+      }
+      if (n->op() == ones_like_op || n->op() == zeros_like_op) {
+        // only the shape is read, the seed of a gradient of loss y.
+        const Info& y = info.at(n->inputs[0].node.get());
+        in = Info();
+        in.batch = in.axis = y.axis;
+        if (n->op() == ones_like_op && y.batch) {
+          in.loss = y.reduce != 0 ? y.reduce : kLossSum;
+          if (y.axis) in.loss |= kLossSum;
+        }
+      } else if (in.axis) {
+        const int reduction = BatchReduction(n.get());
+        in.reduce |= reduction;
+        in.axis = reduction == 0;
+      }
+      if (!is_update) return;
+      has_update = true;
+      update_node[n.get()] = NodePtr();
+    });
+  if (!has_update || ret.batch_feeds.size() == 0) {
+    return DataParallelGraph();
+  }
+  if (batch_stats != nullptr) {
+    LOG(WARNING) << "replicas: " << batch_stats->attrs.name
+                 << " normalizes by the statistics of the batch, the graph runs whole";
+    return DataParallelGraph();
+  }
+  // how a fetched value is combined from the replicas. A value reduced over
+  // the batch by its own op, e.g. the loss, is summed or averaged like a gradient.
+  auto fetch_aggregate = [&](const Node* n) {
+    const Info& x = info.at(n);
+    if (!x.batch) return static_cast<int>(DataParallelGraph::kFirst);
+    if (x.axis) return static_cast<int>(DataParallelGraph::kConcat);
+    const int reduction = n->is_variable() ? 0 : BatchReduction(n);
+    if (reduction == 0) return -1;
+    for (const auto& e : n->inputs) {
+      const Info& y = info.at(e.node.get());
+      if (y.batch && (!y.axis || y.reduce != 0)) return -1;
+    }
+    return static_cast<int>(reduction == kLossSum ?
+                            DataParallelGraph::kSum : DataParallelGraph::kAverage);
+  };
+  for (const auto& e : sym.outputs) {
+    if (update_node.count(e.node.get()) == 0 && fetch_aggregate(e.node.get()) < 0) {
+      LOG(WARNING) << "replicas: " << e.node->attrs.name
+                   << " is not a sum or mean over the batch, the graph runs whole";
+      return DataParallelGraph();
+    }
+  }
+
+  // output of replica of each entry read by the update graph, and its placeholder.
+  std::map<std::tuple<const Node*, uint32_t, uint32_t>, NodeEntry> cut;
+  // output of replica of each entry summed or averaged, which the executor
+  // combines in place, so each entry is an output once.
+  std::map<std::tuple<const Node*, uint32_t, uint32_t>, uint32_t> combined;
+  std::function<NodeEntry(const NodeEntry&)> from_replica = [&](const NodeEntry& e) {
+    auto key = std::make_tuple(e.node.get(), e.index, e.version);
+    auto it = cut.find(key);
+    if (it != cut.end()) return it->second;
+    const Info& x = info.at(e.node.get());
+    int aggregate = DataParallelGraph::kFirst;
+    if (x.batch) {
+      bool mixed = false;
+      if (e.node->op() == ewise_sum_op || e.node->op() == add_op) {
+        for (const auto& in : e.node->inputs) {
+          const Info& y = info.at(in.node.get());
+          mixed = mixed || y.batch != x.batch || y.loss != x.loss;
+        }
+      }
+      if (mixed) {
+        // each term is combined on its own, and summed once.
+        NodePtr p = Node::Create();
+        p->attrs = e.node->attrs;
+        for (const auto& in : e.node->inputs) {
+          p->inputs.push_back(from_replica(in));
+        }
+        return cut[key] = NodeEntry{p, e.index, 0};
+      }
+      CHECK(x.loss == kLossSum || x.loss == kLossMean)
+          << "replicas can not combine " << e.node->attrs.name
+          << ", which is not the gradient of a loss summed or averaged over the batch";
+      aggregate = x.loss == kLossSum ? DataParallelGraph::kSum : DataParallelGraph::kAverage;
+    }
+    const uint32_t k = static_cast<uint32_t>(ret.replica.outputs.size());
+    NodePtr p = Node::Create();
+    p->attrs.op = placeholder_op;
+    p->attrs.name = e.node->attrs.name + "/replicas" + std::to_string(k);
+    ret.replica.outputs.push_back(e);
+    ret.aggregate.push_back(aggregate);
+    ret.update_feed.push_back(p->attrs.name);
+    if (aggregate != DataParallelGraph::kFirst) combined[key] = k;
+    return cut[key] = NodeEntry{p, 0, 0};
+  };
+
+  nnvm::DFSVisit(sym.outputs, [&](const NodePtr& n) {
+      if (update_node.count(n.get()) == 0) return;
+      NodePtr p = Node::Create();
+      p->attrs = n->attrs;
+      std::vector<uint32_t> mutate;
+      if (fmutate_inputs.count(n->op())) mutate = fmutate_inputs[n->op()](n->attrs);
+      for (uint32_t i = 0; i < n->inputs.size(); ++i) {
+        const NodeEntry& e = n->inputs[i];
+        auto it = update_node.find(e.node.get());
+        if (it != update_node.end()) {
+          p->inputs.push_back(NodeEntry{it->second, e.index, e.version});
+        } else if (e.node->is_variable() || e.node->op() == placeholder_op ||
+                   std::count(mutate.begin(), mutate.end(), i) != 0) {
+          p->inputs.push_back(e);
+        } else {
+          p->inputs.push_back(from_replica(e));
+        }
+      }
+      // the nodes of the replicas all run before the updates.
+      for (const auto& dep : n->control_deps) {
+        auto it = update_node.find(dep.get());
+        if (it != update_node.end()) p->control_deps.push_back(it->second);
+      }
+      update_node[n.get()] = p;
+    });
+
+  for (const auto& e : sym.outputs) {
+    auto it = update_node.find(e.node.get());
+    if (it != update_node.end()) {
+      ret.outputs.emplace_back(true, static_cast<uint32_t>(ret.update.outputs.size()));
+      ret.update.outputs.push_back(NodeEntry{it->second, e.index, e.version});
+      continue;
+    }
+    const int aggregate = fetch_aggregate(e.node.get());
+    auto key = std::make_tuple(e.node.get(), e.index, e.version);
+    auto jt = combined.find(key);
+    if (jt != combined.end()) {
+      if (ret.aggregate[jt->second] != aggregate) {
+        LOG(WARNING) << "replicas: " << e.node->attrs.name
+                     << " is fetched before it is combined, the graph runs whole";
+        return DataParallelGraph();
+      }
+      ret.outputs.emplace_back(false, jt->second);
+      continue;
+    }
+    const uint32_t k = static_cast<uint32_t>(ret.replica.outputs.size());
+    ret.outputs.emplace_back(false, k);
+    ret.replica.outputs.push_back(e);
+    ret.aggregate.push_back(aggregate);
+    ret.update_feed.push_back(std::string());
+    if (aggregate == DataParallelGraph::kSum || aggregate == DataParallelGraph::kAverage) {
+      combined[key] = k;
+    }
+  }
+  // nothing to share out, e.g. updates that only read the feeds.
+  if (cut.size() == 0) return DataParallelGraph();
+  ret.replicated = true;
+  return ret;
+}
+
+bool HasNativeCompute(const Op* op, bool backward) {
+  if (backward) {
+    return Op::GetAttr<FComputeBackward>("FComputeBackward").count(op) ||
+        Op::GetAttr<FCreateComputeBackward>("FCreateComputeBackward").count(op);
+  }
+  return Op::GetAttr<FCompute>("FCompute").count(op) ||
+      Op::GetAttr<FCreateCompute>("FCreateCompute").count(op);
+}
+
+FCompute GetNativeCompute(const nnvm::IndexedGraph& idx, uint32_t nid,
+                          const nnvm::ShapeVector& shapes) {
+  static auto& fcompute = Op::GetAttr<FCompute>("FCompute");
+  static auto& fcompute_backward = Op::GetAttr<FComputeBackward>("FComputeBackward");
+  static auto& fcreate = Op::GetAttr<FCreateCompute>("FCreateCompute");
+  static auto& fcreate_backward =
+      Op::GetAttr<FCreateComputeBackward>("FCreateComputeBackward");
+  const Op* backward_op = Op::Get("_backward");
+  const auto& inode = idx[nid];
+  const Op* op = inode.source->op();
+  const nnvm::NodeAttrs* attrs = &(inode.source->attrs);
+  const bool backward = (op == backward_op);
+  if (backward) {
+    CHECK_GE(inode.control_deps.size(), 1);
+    const Node* fwd = idx[inode.control_deps[0]].source;
+    op = fwd->op();
+    attrs = &(fwd->attrs);
+  }
+  const auto& create = backward ? fcreate_backward : fcreate;
+  if (create.count(op)) {
+    std::vector<TShape> ishape, oshape;
+    for (const auto& e : inode.inputs) {
+      ishape.push_back(shapes[idx.entry_id(e)]);
+    }
+    for (uint32_t i = 0; i < inode.source->num_outputs(); ++i) {
+      oshape.push_back(shapes[idx.entry_id(nid, i)]);
+    }
+    return create[op](*attrs, ishape, oshape);
+  }
+  const auto& compute = backward ? fcompute_backward : fcompute;
+  return compute.get(op, FCompute());
+}
+
+}  // namespace tinyflow
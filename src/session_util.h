@@ -0,0 +1,523 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file session_util.h
+ * \brief common util shared by the session implementations.
+ */
+#ifndef TINYFLOW_SESSION_UTIL_H_
+#define TINYFLOW_SESSION_UTIL_H_
+
+#include <tinyflow/base.h>
+#include <nnvm/graph.h>
+#include <nnvm/graph_attr_types.h>
+#include <dmlc/logging.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tinyflow {
+
+/*!
+ * \brief parse the session config string.
+ *  The config is a list of tokens separated by space or comma,
+ *  a token is either a flag (e.g. gpu) or key=value (e.g. exec_cache=4).
+ * \return map of key->value, flags are mapped to empty string.
+ */
+inline std::unordered_map<std::string, std::string>
+ParseSessionConfig(const std::string& config) {
+  std::unordered_map<std::string, std::string> ret;
+  std::string s = config;
+  for (char& c : s) {
+    if (c == ',') c = ' ';
+  }
+  std::istringstream is(s);
+  std::string token;
+  while (is >> token) {
+    size_t pos = token.find('=');
+    if (pos == std::string::npos) {
+      ret[token] = "";
+    } else {
+      ret[token.substr(0, pos)] = token.substr(pos + 1);
+    }
+  }
+  return ret;
+}
+
+// get non-negative integer option from parsed config, return def if not set.
+inline int GetSessionOption(
+    const std::unordered_map<std::string, std::string>& kwargs,
+    const std::string& key, int def) {
+  auto it = kwargs.find(key);
+  if (it == kwargs.end() || it->second.length() == 0) return def;
+  std::istringstream is(it->second);
+  int value;
+  char rest;
+  CHECK(is >> value && !(is >> rest))
+      << "session option " << key << "=" << it->second << " is not an integer";
+  CHECK_GE(value, 0)
+      << "session option " << key << "=" << it->second << " need to be non-negative";
+  return value;
+}
+
+/*!
+ * \brief check that each option of the parsed config is supported by the session.
+ * \param known the options the session reads.
+ * \param session name of the session, in the error message.
+ */
+inline void CheckSessionOptions(
+    const std::unordered_map<std::string, std::string>& kwargs,
+    const std::vector<std::string>& known, const std::string& session) {
+  for (const auto& kv : kwargs) {
+    CHECK(std::find(known.begin(), known.end(), kv.first) != known.end())
+        << "session option " << kv.first << " is not supported by the "
+        << session << " session";
+  }
+}
+
+/*!
+ * \brief create a session that runs the session created by fcreate
+ *  on a background thread, which supports RunAsync.
+ */
+Session* CreateAsyncSession(std::function<Session*()> fcreate);
+
+/*!
+ * \brief structural hash of the graph reachable from the outputs of sym.
+ *  The hash covers op names, attribute dicts, names of variables and
+ *  placeholders, and the input/control dependency topology,
+ *  so two symbols built separately by the same code hash to the same value.
+ */
+uint64_t StructuralHash(const nnvm::Symbol& sym);
+
+/*!
+ * \brief whether two symbols are structurally identical,
+ *  i.e. an executor compiled for one can run the other.
+ */
+bool StructuralEqual(const nnvm::Symbol& lhs, const nnvm::Symbol& rhs);
+
+/*!
+ * \brief arrange the feed dict into positional feeds,
+ *  feeds[i] is the value of placeholder_nids[i].
+ */
+inline std::vector<TBlob> ArrangeFeeds(
+    const nnvm::IndexedGraph& idx, const std::vector<uint32_t>& placeholder_nids,
+    const std::unordered_map<std::string, TBlob>& inputs) {
+  std::vector<TBlob> feeds(placeholder_nids.size());
+  for (size_t i = 0; i < placeholder_nids.size(); ++i) {
+    auto it = inputs.find(idx[placeholder_nids[i]].source->attrs.name);
+    CHECK(it != inputs.end())
+        << "Not enought placeholder argument to feed_dict";
+    feeds[i] = it->second;
+  }
+  return feeds;
+}
+
+/*! \brief names of the placeholders, in the order of positional feeds */
+inline std::vector<std::string> PlaceholderNames(
+    const nnvm::IndexedGraph& idx, const std::vector<uint32_t>& placeholder_nids) {
+  std::vector<std::string> names;
+  for (uint32_t nid : placeholder_nids) {
+    names.push_back(idx[nid].source->attrs.name);
+  }
+  return names;
+}
+
+/*! \brief storage id of entries whose space is provided by the caller */
+const int kExternalStorageID = -2;
+
+/*!
+ * \brief find the placeholders that can alias the fed buffer directly.
+ *  A placeholder qualifies when no consumer mutates it (FMutateInputs)
+ *  or may write its output in place of it (FInplaceOption).
+ * \return flag of each node, true for placeholders that can be aliased.
+ */
+std::vector<bool> FindReadOnlyPlaceholders(
+    const nnvm::IndexedGraph& idx, const std::vector<uint32_t>& placeholder_nids);
+
+/*!
+ * \brief find the outputs that need not be computed, e.g. the gradient
+ *  of a matmul input that is not differentiated.
+ *  An output qualifies when no node reads it, it is not an output of the graph,
+ *  and the op is marked SkipUnusedOutputs, whose kernel skips outputs of null data.
+ *  The nn module backward is marked by the forward op.
+ * \return flag of each entry, true for outputs to be passed as null data.
+ */
+std::vector<bool> FindSkippedOutputs(const nnvm::IndexedGraph& idx);
+
+/*!
+ * \brief whether the feeds differ from the shapes of the placeholders only
+ *  in the leading dimension, e.g. the batch size, with the same types.
+ */
+bool IsBatchChange(const nnvm::IndexedGraph& idx,
+                   const std::vector<uint32_t>& placeholder_nids,
+                   const nnvm::ShapeVector& shapes,
+                   const nnvm::DTypeVector& dtypes,
+                   const std::vector<TBlob>& feeds);
+
+/*!
+ * \brief whether the storages planned for other shapes still hold the entries.
+ *  Each pooled entry need to fit in its storage, and an output planned in
+ *  place of an input need to keep the size of the input.
+ * \param storage_id the planned storage id of each entry.
+ * \param capacity number of floats of each storage.
+ * \param shapes the new shapes.
+ */
+bool FitsStoragePlan(const nnvm::IndexedGraph& idx,
+                     const nnvm::StorageVector& storage_id,
+                     const std::vector<size_t>& capacity,
+                     const nnvm::ShapeVector& shapes);
+
+/*!
+ * \brief a graph cut in two for data parallel training.
+ *  The nodes that do not depend on an update, an op mutating its inputs, run
+ *  on each replica on its shard of the batch, e.g. the forward and backward.
+ *  The updates and the nodes after them run once, on the values of the
+ *  replicas combined, e.g. the gradients summed.
+ *  The batch is fed by the placeholders declared with an unknown leading
+ *  dimension, e.g. tf.placeholder(tf.float32, shape=[None, 784]).
+ */
+struct DataParallelGraph {
+  /*! \brief how the values of the replicas are combined */
+  enum Aggregate : int {
+    /*! \brief mean weighted by the shard sizes, e.g. gradient of a mean loss */
+    kAverage = 0,
+    /*! \brief sum, e.g. gradient of a sum loss */
+    kSum = 1,
+    /*! \brief concatenated on the batch axis */
+    kConcat = 2,
+    /*! \brief the same on all replicas as it does not depend on the batch */
+    kFirst = 3
+  };
+  /*! \brief whether the graph runs on replicas, the other fields are empty if not */
+  bool replicated{false};
+  /*! \brief names of the placeholders cut on the batch axis */
+  std::vector<std::string> batch_feeds;
+  /*! \brief graph run by each replica, its outputs are the values handed over */
+  nnvm::Symbol replica;
+  /*!
+   * \brief how each output of replica is combined, the summed and averaged
+   *  ones are combined in the space of the replicas.
+   */
+  std::vector<int> aggregate;
+  /*! \brief graph of the updates, no outputs when there are none */
+  nnvm::Symbol update;
+  /*! \brief placeholder of update that takes each output of replica, empty if none */
+  std::vector<std::string> update_feed;
+  /*! \brief where each output of the graph is, (whether in update, index of the output) */
+  std::vector<std::pair<bool, uint32_t> > outputs;
+};
+
+/*!
+ * \brief cut the graph for data parallel training.
+ *  Only a graph with updates that reads the batch is cut, the others run
+ *  whole. So does a graph with a batch_normalization on the statistics of
+ *  the batch, or fetching a value reduced over the batch other than by a
+ *  reduce_sum, reduce_mean or mean cross entropy of the rows, e.g. the loss,
+ *  which is combined like a gradient.
+ *  The update graph reads the placeholders fed, the variables, and the
+ *  entries of the replicas through new placeholders. A gradient is summed,
+ *  or averaged when the loss it comes from, the input of its ones_like seed,
+ *  is a mean over the batch. A sum of gradients combined differently, e.g.
+ *  with the one of a regularizer that does not read the batch, is moved to
+ *  the update graph. A value read by the updates that is not such a gradient
+ *  is an error.
+ */
+DataParallelGraph SplitDataParallel(const nnvm::Symbol& sym);
+
+/*!
+ * \brief the shapes inferred for each batch size of the feeds.
+ *  Servers see the same few batch sizes over and over, so the shapes of a
+ *  batch size seen before are looked up instead of inferred again.
+ *  The entries hold while only the leading dimension of the feeds changes,
+ *  the executor clears them on other changes.
+ */
+class BatchShapeCache {
+ public:
+  /*! \brief maximum number of batch sizes kept */
+  static const size_t kMaxEntries = 64;
+  /*! \return the shapes inferred for the leading dimensions of the feeds, nullptr if none */
+  const nnvm::ShapeVector* Find(const std::vector<TBlob>& feeds) const {
+    auto it = entries_.find(Key(feeds));
+    return it != entries_.end() ? &(it->second) : nullptr;
+  }
+  /*! \brief keep the shapes inferred for the feeds */
+  void Insert(const std::vector<TBlob>& feeds, const nnvm::ShapeVector& shapes) {
+    if (entries_.size() >= kMaxEntries) entries_.clear();
+    entries_[Key(feeds)] = shapes;
+  }
+  /*! \brief drop all the shapes */
+  void Clear() {
+    entries_.clear();
+  }
+
+ private:
+  // the leading dimension of each feed.
+  static std::vector<size_t> Key(const std::vector<TBlob>& feeds) {
+    std::vector<size_t> key;
+    for (const TBlob& b : feeds) {
+      key.push_back(b.shape.ndim() != 0 ? b.shape[0] : 0);
+    }
+    return key;
+  }
+  std::map<std::vector<size_t>, nnvm::ShapeVector> entries_;
+};
+
+/*! \brief state of each node in graph attribute constant_node, set by pass FoldConstant */
+enum ConstantState : int {
+  /*! \brief computed on every run */
+  kNotConstant = 0,
+  /*! \brief constant only read by other constants, dropped once they are evaluated */
+  kDeadConstant = 1,
+  /*! \brief constant read by the rest of the graph, its outputs are kept */
+  kFrozenConstant = 2
+};
+
+/*!
+ * \brief the graph passes run by the executors before the kernels are bound.
+ * \param fold_conv_bn whether to fold batch normalization into conv2d.
+ * \param layout the layout to convert the graph to, empty to keep it.
+ * \param fusion whether to fuse the elementwise ops with pass FuseElemwise.
+ */
+nnvm::Graph OptimizeGraph(nnvm::Graph graph, bool fold_conv_bn,
+                          const std::string& layout, bool fusion);
+
+/*!
+ * \brief infer the shapes and types of the graph when the variables or the
+ *  feeds changed, the shapes of a batch size seen before are taken from the cache.
+ * \param var_blob the value of a variable, nullptr if it is not initialized.
+ * \param node_shape the inferred shapes, nullptr to infer them anyway.
+ * \param node_dtype the inferred types.
+ * \param batch_only set to whether only the leading dimension of the feeds changed.
+ * \return whether the shapes changed.
+ */
+bool InferGraphShape(nnvm::Graph* graph,
+                     const std::vector<uint32_t>& read_var_nids,
+                     const std::vector<uint32_t>& assign_var_nids,
+                     const std::function<const TBlob*(uint32_t nid)>& var_blob,
+                     const std::vector<uint32_t>& placeholder_nids,
+                     const std::vector<TBlob>& feeds,
+                     BatchShapeCache* shape_cache,
+                     const nnvm::ShapeVector** node_shape,
+                     const nnvm::DTypeVector** node_dtype,
+                     bool* batch_only);
+
+/*!
+ * \brief plan the storage of the entries into graph attribute storage_id.
+ *  The constants, marked by pass FoldConstant, and the aliased placeholders
+ *  keep their own space, they are kept out of the pool.
+ * \param placeholder_alias flag of each node, true for placeholders aliasing the fed buffer.
+ * \param plan_concurrency number of branches that may run at once.
+ */
+void PlanGraphStorage(nnvm::Graph* graph,
+                      const std::vector<uint32_t>& placeholder_nids,
+                      const std::vector<bool>& placeholder_alias,
+                      int plan_concurrency);
+
+/*! \brief number of floats of each storage planned by PlanGraphStorage */
+std::vector<size_t> StoragePoolSize(const nnvm::Graph& graph,
+                                    const std::vector<bool>& entry_is_var);
+
+/*!
+ * \brief evaluate the constant nodes once, in topological order, and drop
+ *  their closures, so the later runs skip them.
+ *  The outputs of the constants need their own space, not shared with other entries.
+ * \param constant_node the graph attribute constant_node.
+ * \param op_execs the closure of each node, the constants are reset to empty.
+ */
+inline void RunConstantOps(const std::vector<int>& constant_node,
+                           std::vector<std::function<void()> >* op_execs) {
+  for (size_t nid = 0; nid < op_execs->size(); ++nid) {
+    if (constant_node[nid] == kNotConstant) continue;
+    if ((*op_execs)[nid]) (*op_execs)[nid]();
+    (*op_execs)[nid] = nullptr;
+  }
+}
+
+/*!
+ * \brief whether the op has a native kernel, FCompute or FCreateCompute.
+ * \param backward check for the kernel of the nn module backward instead.
+ */
+bool HasNativeCompute(const nnvm::Op* op, bool backward);
+
+/*!
+ * \brief get the native kernel of a node, created by FCreateCompute
+ *  with the shapes of the node when registered.
+ *  The kernel of the nn module backward is the one of the forward op,
+ *  it is called with the attributes of the forward node.
+ * \return the kernel, empty when the op has none.
+ */
+FCompute GetNativeCompute(const nnvm::IndexedGraph& idx, uint32_t nid,
+                          const nnvm::ShapeVector& shapes);
+
+/*!
+ * \brief bounded LRU cache of executors keyed on the graph structure.
+ *  Symbols that are rebuilt each iteration share the executor
+ *  compiled for the first structurally identical symbol.
+ * \tparam Executor the executor type.
+ */
+template<typename Executor>
+class ExecutorCache {
+ public:
+  /*! \brief default number of executors kept alive */
+  static const int kDefaultCapacity = 4;
+  /*! \brief maximum number of alias symbols remembered per executor */
+  static const size_t kMaxAlias = 4;
+  explicit ExecutorCache(int capacity = kDefaultCapacity)
+      : capacity_(static_cast<size_t>(capacity)) {
+    CHECK_GE(capacity, 1) << "executor cache need to hold at least one executor";
+  }
+  /*!
+   * \brief get the executor of the symbol, create one by fcreate on miss.
+   *  The least recently used executor is evicted when the cache is full.
+   * \param sym the symbol to be executed.
+   * \param fcreate function(const Symbol&) -> std::shared_ptr<Executor>
+   */
+  template<typename FCreate>
+  std::shared_ptr<Executor> Get(const nnvm::Symbol& sym, FCreate fcreate) {
+    // fast path: the very same symbol was seen before, skip the graph walk.
+    for (auto& kv : entries_) {
+      for (const nnvm::Symbol& alias : kv.second.aliases) {
+        if (SameOutputs(alias, sym)) return this->Touch(&kv.second);
+      }
+    }
+    uint64_t hash_value = StructuralHash(sym);
+    auto it = entries_.find(hash_value);
+    if (it != entries_.end()) {
+      if (StructuralEqual(it->second.cached_symbol, sym)) {
+        ExecEntry& e = it->second;
+        // keep the alias alive, so its node pointers cannot be reused.
+        if (e.aliases.size() >= kMaxAlias) {
+          e.aliases.erase(e.aliases.begin() + 1);
+        }
+        e.aliases.push_back(sym);
+        return this->Touch(&e);
+      }
+      // hash collision, replace the stale one.
+      entries_.erase(it);
+    }
+    ++stats_.num_miss;
+    while (entries_.size() >= capacity_) {
+      this->EvictOne();
+    }
+    ExecEntry& e = entries_[hash_value];
+    e.cached_symbol = sym;
+    e.aliases.push_back(sym);
+    e.exec = fcreate(sym);
+    e.use_count = 1;
+    e.last_use = ++clock_;
+    return e.exec;
+  }
+  /*! \return the statistics of the cache */
+  const ExecCacheStats& stats() const {
+    return stats_;
+  }
+
+ private:
+  // entry to store cached executor
+  struct ExecEntry {
+    nnvm::Symbol cached_symbol;
+    // symbols known to map to this entry, aliases[0] is cached_symbol.
+    std::vector<nnvm::Symbol> aliases;
+    std::shared_ptr<Executor> exec;
+    size_t use_count{0};
+    // logical time of last use
+    uint64_t last_use{0};
+  };
+  // record a hit on entry e
+  std::shared_ptr<Executor> Touch(ExecEntry* e) {
+    ++e->use_count;
+    e->last_use = ++clock_;
+    ++stats_.num_hit;
+    return e->exec;
+  }
+  // whether the two symbol have same outputs
+  static bool SameOutputs(const nnvm::Symbol& old_sym, const nnvm::Symbol& new_sym) {
+    if (old_sym.outputs.size() != new_sym.outputs.size()) return false;
+    for (size_t i = 0; i < old_sym.outputs.size(); ++i) {
+      if (old_sym.outputs[i].node.get() != new_sym.outputs[i].node.get() ||
+          old_sym.outputs[i].index != new_sym.outputs[i].index ||
+          old_sym.outputs[i].version != new_sym.outputs[i].version) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // evict the least recently used entry
+  void EvictOne() {
+    auto victim = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.last_use < victim->second.last_use) victim = it;
+    }
+    entries_.erase(victim);
+    ++stats_.num_evict;
+  }
+  // maximum number of executors
+  size_t capacity_;
+  // logical clock, increase on every access
+  uint64_t clock_{0};
+  // cached executor
+  std::unordered_map<uint64_t, ExecEntry> entries_;
+  // statistics
+  ExecCacheStats stats_;
+};
+
+/*!
+ * \brief callable bound to one executor.
+ *  The feed names are resolved into placeholder positions once,
+ *  and the executor is held, so it survives eviction from the cache.
+ * \tparam Executor the executor type, need to provide feed_names(),
+ *  Run(feeds) and RunInto(feeds, outputs) on positional feeds.
+ */
+template<typename Executor>
+class ExecutorCallable : public Callable {
+ public:
+  ExecutorCallable(std::shared_ptr<Executor> exec,
+                   const std::vector<std::string>& feed_names)
+      : exec_(exec) {
+    std::vector<std::string> names = exec_->feed_names();
+    std::vector<bool> fed(names.size(), false);
+    for (const std::string& name : feed_names) {
+      auto it = std::find(names.begin(), names.end(), name);
+      // feeds not used by the graph are ignored, same as the feed_dict.
+      int slot = -1;
+      if (it != names.end()) {
+        slot = static_cast<int>(it - names.begin());
+        fed[slot] = true;
+      }
+      feed_slot_.push_back(slot);
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+      CHECK(fed[i]) << "placeholder " << names[i] << " is not in the feed list";
+    }
+    feeds_.resize(names.size());
+  }
+  const std::vector<TBlob>& Run(const std::vector<TBlob>& feeds) override {
+    return exec_->Run(this->Arrange(feeds));
+  }
+  void RunInto(const std::vector<TBlob>& feeds,
+               const std::vector<TBlob>& outputs) override {
+    exec_->RunInto(this->Arrange(feeds), outputs);
+  }
+
+ private:
+  const std::vector<TBlob>& Arrange(const std::vector<TBlob>& feeds) {
+    CHECK_EQ(feeds.size(), feed_slot_.size()) << "number of feeds mismatch";
+    for (size_t i = 0; i < feeds.size(); ++i) {
+      if (feed_slot_[i] >= 0) feeds_[feed_slot_[i]] = feeds[i];
+    }
+    return feeds_;
+  }
+  // the bound executor
+  std::shared_ptr<Executor> exec_;
+  // placeholder position of each feed, -1 if not used by the graph.
+  std::vector<int> feed_slot_;
+  // positional feeds passed to the executor.
+  std::vector<TBlob> feeds_;
+};
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_SESSION_UTIL_H_
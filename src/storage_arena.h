@@ -0,0 +1,103 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file storage_arena.h
+ * \brief session wide pool of the storages planned by the executors.
+ */
+#ifndef TINYFLOW_STORAGE_ARENA_H_
+#define TINYFLOW_STORAGE_ARENA_H_
+
+#include <tinyflow/base.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tinyflow {
+
+/*!
+ * \brief storages recycled by size class.
+ *  The executors of a session draw the entries of their storage pool from
+ *  the arena, and the entries go back to it when the executor sets up its
+ *  space again for new shapes or is evicted, so later setups take them
+ *  instead of allocating. Sizes are rounded up to one of four classes
+ *  between two powers of two, so a batch size that changes a bit maps to the
+ *  same storages, and at most a quarter of a storage is unused.
+ *  The free storages are held until the arena goes with the last of its
+ *  blocks. Thread safe.
+ * \tparam TStorage the storage type, e.g. LuaRef of torch storage.
+ */
+template<typename TStorage>
+class StorageArena : public std::enable_shared_from_this<StorageArena<TStorage> > {
+ public:
+  /*! \brief a storage of the arena, returned to it when the last reference goes */
+  using Block = std::shared_ptr<TStorage>;
+  /*! \brief allocate a storage of given number of floats */
+  using FAlloc = std::function<TStorage(size_t size)>;
+  /*! \brief smallest size class, in floats */
+  static const size_t kMinClass = 64;
+
+  explicit StorageArena(FAlloc falloc) : falloc_(falloc) {}
+  /*!
+   * \brief get a storage of at least size floats.
+   * \note the arena need to be held by a shared_ptr.
+   */
+  Block Alloc(size_t size) {
+    const size_t cls = SizeClass(size);
+    TStorage storage;
+    bool reuse = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<TStorage>& free_list = free_[cls];
+      if (free_list.size() != 0) {
+        storage = std::move(free_list.back());
+        free_list.pop_back();
+        reuse = true;
+        ++stats_.num_reuse;
+        stats_.bytes_cached -= cls * sizeof(float);
+      } else {
+        ++stats_.num_alloc;
+        stats_.bytes_allocated += cls * sizeof(float);
+      }
+    }
+    if (!reuse) storage = falloc_(cls);
+    auto arena = this->shared_from_this();
+    return Block(new TStorage(std::move(storage)), [arena, cls](TStorage* p) {
+        arena->Free(cls, p);
+      });
+  }
+  /*! \return the statistics of the arena */
+  StorageStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+  /*! \return the size class of size floats */
+  static size_t SizeClass(size_t size) {
+    if (size <= kMinClass) return kMinClass;
+    size_t top = kMinClass;
+    while (top * 2 < size) top *= 2;
+    const size_t step = top / 4;
+    return (size + step - 1) / step * step;
+  }
+
+ private:
+  // put the storage of a block back to the free list.
+  void Free(size_t cls, TStorage* p) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_[cls].push_back(std::move(*p));
+    stats_.bytes_cached += cls * sizeof(float);
+    delete p;
+  }
+  // allocator of new storage
+  FAlloc falloc_;
+  // free storages by size class
+  std::unordered_map<size_t, std::vector<TStorage> > free_;
+  // statistics
+  StorageStats stats_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace tinyflow
+
+#endif  // TINYFLOW_STORAGE_ARENA_H_
@@ -77,7 +77,9 @@ NNVM_REGISTER_OP(conv2d)
     local padH = 0
     local padW = 0
 
-    assert(kwarg.data_format == 'NCHW')
+    assert(kwarg.data_format == 'NCHW', 'lua module only supports NCHW, use the native kernel')
+    assert(kwarg.activation == nil or kwarg.activation == '',
+           'lua module has no fused activation, use the native kernel')
     if kwarg.padding == 'SAME' then
       padW = math.floor((kW - 1) / 2)
       padH = math.floor((kH - 1) / 2)
@@ -105,7 +107,7 @@ NNVM_REGISTER_OP(max_pool)
     local dW = stride[3]
     local padH = 0
     local padW = 0
-    assert(kwarg.data_format == 'NCHW')
+    assert(kwarg.data_format == 'NCHW', 'lua module only supports NCHW, use the native kernel')
     if kwarg.padding == 'SAME' then
       padW = math.floor((kW - 1) / 2)
       padH = math.floor((kH - 1) / 2)
@@ -127,7 +129,7 @@ NNVM_REGISTER_OP(avg_pool)
     local dW = stride[3]
     local padH = 0
     local padW = 0
-    assert(kwarg.data_format == 'NCHW')
+    assert(kwarg.data_format == 'NCHW', 'lua module only supports NCHW, use the native kernel')
     if kwarg.padding == 'SAME' then
       padW = math.floor((kW - 1) / 2)
       padH = math.floor((kH - 1) / 2)
@@ -142,6 +144,10 @@ NNVM_REGISTER_OP(batch_normalization)
 .set_attr<FLuaCreateNNModule>(
   "FLuaCreateNNModule", R"(
   function(ishape, kwarg)
+    assert(kwarg.data_format == nil or kwarg.data_format == 'NCHW',
+           'lua module only supports NCHW, use the native kernel')
+    assert(#ishape == 3,
+           'lua module only supports the statistics of the batch, use the native kernel')
     local n = ishape[1][2]
     return nn.SpatialBatchNormalization(n)
   end
@@ -404,4 +404,76 @@ NNVM_REGISTER_OP(_argmax)
   end
 )");
 
+
+// the optimizer updates mutate the weights and their states in place,
+// x holds the n weights, the n gradients, then each kind of state.
+NNVM_REGISTER_OP(sgd_update)
+.set_attr<FLuaCompute>(
+  "FLuaCompute", R"(
+  function(x, y, kwarg)
+    local n = tonumber(kwarg.num_weights or 1)
+    local lr = tonumber(kwarg.learning_rate)
+    return function()
+      for i = 1, n do
+        x[i]:add(-lr, x[n + i])
+        if y[i]:storage() ~= x[i]:storage() then
+          y[i]:copy(x[i])
+        end
+      end
+    end
+  end
+)");
+
+
+NNVM_REGISTER_OP(momentum_update)
+.set_attr<FLuaCompute>(
+  "FLuaCompute", R"(
+  function(x, y, kwarg)
+    local n = tonumber(kwarg.num_weights or 1)
+    local lr = tonumber(kwarg.learning_rate)
+    local momentum = tonumber(kwarg.momentum)
+    return function()
+      for i = 1, n do
+        local mom = x[2 * n + i]
+        mom:mul(momentum):add(x[n + i])
+        x[i]:add(-lr, mom)
+        if y[i]:storage() ~= x[i]:storage() then
+          y[i]:copy(x[i])
+        end
+      end
+    end
+  end
+)");
+
+
+NNVM_REGISTER_OP(adam_update)
+.set_attr<FLuaCompute>(
+  "FLuaCompute", R"(
+  function(x, y, kwarg)
+    local n = tonumber(kwarg.num_weights or 1)
+    local lr = tonumber(kwarg.learning_rate)
+    local beta1 = tonumber(kwarg.beta1)
+    local beta2 = tonumber(kwarg.beta2)
+    local epsilon = tonumber(kwarg.epsilon)
+    local denom = {}
+    for i = 1, n do
+      denom[i] = x[3 * n + i]:clone()
+    end
+    return function()
+      local t = x[4 * n + 1][1]
+      local lr_t = lr * math.sqrt(1 - beta2 ^ t) / (1 - beta1 ^ t)
+      for i = 1, n do
+        local g, m, v = x[n + i], x[2 * n + i], x[3 * n + i]
+        m:mul(beta1):add(1 - beta1, g)
+        v:mul(beta2):addcmul(1 - beta2, g, g)
+        denom[i]:sqrt(v):add(epsilon)
+        x[i]:addcdiv(-lr_t, m, denom[i])
+        if y[i]:storage() ~= x[i]:storage() then
+          y[i]:copy(x[i])
+        end
+      end
+    end
+  end
+)");
+
 } // namespace tinyflow
@@ -142,6 +142,24 @@ class TorchState {
         reinterpret_cast<intptr_t>(src.data),
         src.shape, src.shape.Size(), src.dev_mask);
   }
+  // set tensor to share space with src, keeping the tensor object.
+  // The memory is managed by src.
+  void SetTensorShared(LuaRef tensor, TBlob src) {
+    CHECK_EQ(src.dtype, 0) << "only float is supported so far";
+    CHECK_EQ(src.dev_mask, kCPU) << "only CPU space can be shared";
+    if (ftensor_set_shared_.is_nil()) {
+      auto* lua = LuaState::ThreadLocalState();
+      ftensor_set_shared_ = lua->Eval(R"(
+      return
+      function(tensor, ptr, shape, size)
+        local sz = torch.LongStorage(shape)
+        tensor:set(torch.FloatStorage(size, ptr), 1, sz)
+      end
+      )");
+    }
+    ftensor_set_shared_(tensor, reinterpret_cast<intptr_t>(src.data),
+                        src.shape, src.shape.Size());
+  }
   // copy from one tensor to another one
   void CopyFromTo(LuaRef from, LuaRef to) {
     if (fcopy_from_to_.is_nil()) {
@@ -213,6 +231,7 @@ class TorchState {
   LuaRef fstorage_new_;
   LuaRef ftensor_new_;
   LuaRef ftensor_new_shared_;
+  LuaRef ftensor_set_shared_;
   LuaRef ftensor_set_;
   LuaRef fcopy_from_to_;
   LuaRef fget_internal_;
@@ -0,0 +1,691 @@
+import tinyflow as tf
+import numpy as np
+from nnvm import graph
+
+def test_native_ewise():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    z = tf.sqrt(x * y + 1) / 2 - tf.exp(x)
+    ax = np.random.uniform(size=(2, 3))
+    ay = np.random.uniform(size=(2, 3))
+    sess = tf.Session(config='cpu-native')
+    az = sess.run(z, feed_dict={x:ax, y:ay})
+    np.testing.assert_almost_equal(az, np.sqrt(ax * ay + 1) / 2 - np.exp(ax), decimal=5)
+
+def test_native_matmul_grad():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    ax = np.random.uniform(size=(2, 3))
+    ay = np.random.uniform(size=(3, 4))
+    z = tf.matmul(x, y) * 4
+    gx, gy = tf.gradients(z, [x, y])
+    sess = tf.Session(config='cpu-native')
+    agx, agy = sess.run([gx, gy], feed_dict={x:ax, y:ay})
+    np.testing.assert_almost_equal(agx, np.dot(np.ones((2,4)), ay.T) * 4, decimal=5)
+    np.testing.assert_almost_equal(agy, np.dot(ax.T, np.ones((2,4))) * 4, decimal=5)
+
+def test_native_reduce():
+    axis = [1, 3]
+    x = tf.placeholder(tf.float32)
+    y = tf.reduce_mean(x, reduction_indices=axis)
+    ax = np.random.uniform(size=(2, 4, 8, 7))
+    sess = tf.Session(config='cpu-native')
+    ay = sess.run(y, feed_dict={x:ax})
+    np.testing.assert_almost_equal(ay, ax.mean(axis=tuple(axis)), decimal=5)
+
+def test_native_softmax_grad():
+    x = tf.placeholder(tf.float32)
+    y = tf.nn.softmax(x)
+    gx = tf.gradients(tf.reduce_sum(y * y), [x])[0]
+    ax = np.random.uniform(size=(3, 5))
+    sess = tf.Session(config='cpu-native')
+    ay, agx = sess.run([y, gx], feed_dict={x:ax})
+    npy = np.exp(ax) / np.sum(np.exp(ax), axis=1, keepdims=True)
+    g = 2 * npy
+    npgx = npy * (g - np.sum(g * npy, axis=1, keepdims=True))
+    np.testing.assert_almost_equal(ay, npy, decimal=5)
+    np.testing.assert_almost_equal(agx, npgx, decimal=5)
+
+def test_native_assign():
+    x = tf.Variable(tf.zeros(shape=[2,3]))
+    sess = tf.Session(config='cpu-native')
+    sess.run(tf.initialize_all_variables())
+    sess.run(tf.assign(x, x + 1))
+    ax = sess.run(x)
+    np.testing.assert_almost_equal(ax, np.ones((2,3)))
+
+def test_native_parallel():
+    # many independent branches writing to variables
+    xs = [tf.Variable(tf.zeros(shape=[4, 5])) for i in range(8)]
+    g = tf.placeholder(tf.float32)
+    updates = [tf.assign(x, x * 0.5 + g * (i + 1)) for i, x in enumerate(xs)]
+    ag = np.random.uniform(size=(4, 5))
+    for config in ['cpu-native num_threads=4', 'cpu num_threads=4',
+                   'cpu-native num_threads=4 plan_concurrency=1']:
+        sess = tf.Session(config=config)
+        sess.run(tf.initialize_all_variables())
+        for k in range(3):
+            sess.run(tf.group(*updates), feed_dict={g:ag})
+        for i, x in enumerate(xs):
+            expect = ag * (i + 1) * (1 + 0.5 + 0.25)
+            np.testing.assert_almost_equal(sess.run(x), expect, decimal=5)
+
+def test_native_parallel_plan():
+    # two long independent chains, whose space must not be mixed up
+    x = tf.placeholder(tf.float32)
+    a, b = x, x
+    for i in range(6):
+        a = tf.exp(a * 0.1)
+        b = tf.sqrt(b + 1)
+    y = a + b
+    ax = np.random.uniform(size=(8, 16))
+    ea, eb = ax, ax
+    for i in range(6):
+        ea = np.exp(ea * 0.1)
+        eb = np.sqrt(eb + 1)
+    for k in [1, 2, 8]:
+        sess = tf.Session(config='cpu-native num_threads=4 plan_concurrency=%d' % k)
+        ay = sess.run(y, feed_dict={x:ax})
+        np.testing.assert_almost_equal(ay, ea + eb, decimal=5)
+
+def test_native_feed_alias():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    # x is only read, y feeds an op that can run in place
+    z = tf.matmul(x, x) + tf.exp(y * 2)
+    ax = np.random.uniform(size=(4, 4)).astype(np.float32)
+    ay = np.random.uniform(size=(4, 4)).astype(np.float32)
+    bx, by = ax.copy(), ay.copy()
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        for k in range(2):
+            az = sess.run(z, feed_dict={x:ax, y:ay})
+            np.testing.assert_almost_equal(az, np.dot(bx, bx) + np.exp(by * 2), decimal=4)
+            np.testing.assert_equal(ax, bx)
+            np.testing.assert_equal(ay, by)
+            ax = ax + 1
+            bx = bx + 1
+
+def test_feed_lua_view():
+    # the lua reduce takes a view of the fed tensor when its closure is built.
+    x = tf.placeholder(tf.float32)
+    ys = [tf.reduce_sum(x), tf.reduce_mean(x)]
+    for config in ['cpu', 'cpu num_threads=2']:
+        sess = tf.Session(config=config)
+        for k in range(3):
+            # a new buffer on each run
+            ax = np.random.uniform(size=(3, 4)).astype(np.float32)
+            ay = sess.run(ys, feed_dict={x:ax})
+            np.testing.assert_almost_equal(ay[0], ax.sum(), decimal=4)
+            np.testing.assert_almost_equal(ay[1], ax.mean(), decimal=5)
+
+def test_run_into():
+    x = tf.placeholder(tf.float32)
+    y = tf.exp(x)
+    z = tf.reduce_sum(x * 2, reduction_indices=[1])
+    ax = np.random.uniform(size=(3, 4))
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        oy = np.empty((3, 4), dtype=np.float32)
+        oz = np.empty((3,), dtype=np.float32)
+        ret = sess.run([y, z], feed_dict={x:ax}, out=[oy, oz])
+        assert ret[0] is oy and ret[1] is oz
+        np.testing.assert_almost_equal(oy, np.exp(ax), decimal=5)
+        np.testing.assert_almost_equal(oz, (ax * 2).sum(axis=1), decimal=5)
+        sess.run(y, feed_dict={x:ax + 1}, out=oy)
+        np.testing.assert_almost_equal(oy, np.exp(ax + 1), decimal=5)
+
+def test_make_callable():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    z = x * 2 - y
+    ax = np.random.uniform(size=(2, 3))
+    ay = np.random.uniform(size=(2, 3))
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        # feeds are passed in the bound order, not the graph order.
+        f = sess.make_callable(z, [y, x])
+        np.testing.assert_almost_equal(f(ay, ax), ax * 2 - ay, decimal=5)
+        np.testing.assert_almost_equal(f(ax, ay), ay * 2 - ax, decimal=5)
+        oz = np.empty((2, 3), dtype=np.float32)
+        assert f(ay, ax, out=oz) is oz
+        np.testing.assert_almost_equal(oz, ax * 2 - ay, decimal=5)
+        # the callable shares the executor cache with run.
+        np.testing.assert_almost_equal(
+            sess.run(z, feed_dict={x:ax, y:ay}), ax * 2 - ay, decimal=5)
+        assert sess.cache_stats()['miss'] == 1
+
+def test_run_async():
+    x = tf.placeholder(tf.float32)
+    y = tf.exp(x) + 1
+    batches = [np.random.uniform(size=(4, 3)) for i in range(5)]
+    for config in ['cpu-native async', 'cpu async']:
+        sess = tf.Session(config=config)
+        futures = [sess.run_async(y, feed_dict={x:batches[0]})]
+        for i in range(1, len(batches)):
+            # the feed is copied, it can be changed right away.
+            ax = batches[i].copy()
+            futures.append(sess.run_async(y, feed_dict={x:ax}))
+            ax[:] = 0
+            ay = futures[i - 1].wait()
+            np.testing.assert_almost_equal(ay, np.exp(batches[i - 1]) + 1, decimal=5)
+        ay = futures[-1].wait()
+        np.testing.assert_almost_equal(ay, np.exp(batches[-1]) + 1, decimal=5)
+        # synchronous run on the same session.
+        ay = sess.run(y, feed_dict={x:batches[0]})
+        np.testing.assert_almost_equal(ay, np.exp(batches[0]) + 1, decimal=5)
+
+def test_profile():
+    import json, os, tempfile
+    x = tf.placeholder(tf.float32)
+    y = tf.exp(x) * 2
+    ax = np.random.uniform(size=(4, 3))
+    for config in ['cpu-native profile', 'cpu profile num_threads=2']:
+        sess = tf.Session(config=config)
+        for i in range(3):
+            sess.run(y, feed_dict={x:ax})
+        trace_file = os.path.join(tempfile.mkdtemp(), 'trace.json')
+        summary = dict((s['op'], s) for s in sess.dump_profile(trace_file))
+        assert summary['exp']['count'] == 3
+        assert summary['exp']['bytes_read'] == 3 * ax.size * 4
+        assert summary['__mul_scalar__']['bytes_written'] == 3 * ax.size * 4
+        with open(trace_file) as f:
+            events = json.load(f)['traceEvents']
+        assert len([e for e in events if e['name'] == 'exp']) == 3
+        # the records are cleared by dump.
+        assert sess.dump_profile() == []
+
+def test_fuse_elemwise():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    z = tf.sqrt(x * y + 1) / 2 - tf.exp(x)
+    ax = np.random.uniform(size=(40, 30))
+    ay = np.random.uniform(size=(40, 30))
+    for config in ['cpu-native fusion profile', 'cpu fusion profile']:
+        sess = tf.Session(config=config)
+        az = sess.run(z, feed_dict={x:ax, y:ay})
+        np.testing.assert_almost_equal(az, np.sqrt(ax * ay + 1) / 2 - np.exp(ax), decimal=5)
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        assert summary['_fused_elemwise']['count'] == 1
+        assert 'exp' not in summary
+    # the (1,) learning rate broadcasts inside the fused update.
+    w = tf.Variable(tf.ones(shape=[3, 4]))
+    lr = tf.placeholder(tf.float32)
+    g = tf.placeholder(tf.float32)
+    ag = np.random.uniform(size=(3, 4))
+    sess = tf.Session(config='cpu-native fusion')
+    sess.run(tf.initialize_all_variables())
+    sess.run(tf.assign(w, w - lr * (g * 2 + 1)), feed_dict={lr:np.array([0.5]), g:ag})
+    np.testing.assert_almost_equal(sess.run(w), 1 - 0.5 * (ag * 2 + 1), decimal=5)
+
+def test_simd_ewise():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    s = tf.placeholder(tf.float32)
+    # odd size to cover the tail of the vector loops.
+    ax = np.random.uniform(0.1, 10, size=(7, 19))
+    ay = np.random.uniform(0.1, 10, size=(7, 19))
+    cases = [
+        (x + y, ax + ay), (x - y, ax - ay), (x * y, ax * ay), (x / y, ax / ay),
+        (2 - x, 2 - ax), (x / 4, ax / 4), (s / x, 3 / ax), (x - s, ax - 3),
+        (tf.exp(x), np.exp(ax)), (tf.log(x), np.log(ax)),
+        (tf.sqrt(x), np.sqrt(ax)), (tf.pow(x, y), np.power(ax, ay))]
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        for z, expect in cases:
+            az = sess.run(z, feed_dict={x:ax, y:ay, s:np.array([3.0])})
+            np.testing.assert_allclose(az, expect, rtol=1e-5)
+
+def test_native_gemm():
+    x = tf.placeholder(tf.float32)
+    y = tf.placeholder(tf.float32)
+    # sizes not a multiple of the tile, and large enough to be blocked.
+    ax = np.random.uniform(size=(37, 301))
+    ay = np.random.uniform(size=(301, 70))
+    z = tf.matmul(x, y)
+    gx, gy = tf.gradients(tf.reduce_sum(z * z), [x, y])
+    # only the gradient of y is needed.
+    gy_only = tf.gradients(tf.reduce_sum(z), [y])[0]
+    az = np.dot(ax, ay)
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        bz, bgx, bgy = sess.run([z, gx, gy], feed_dict={x:ax, y:ay})
+        np.testing.assert_allclose(bz, az, rtol=1e-4)
+        np.testing.assert_allclose(bgx, np.dot(2 * az, ay.T), rtol=1e-4)
+        np.testing.assert_allclose(bgy, np.dot(ax.T, 2 * az), rtol=1e-4)
+        bgy = sess.run(gy_only, feed_dict={x:ax, y:ay})
+        np.testing.assert_allclose(bgy, np.dot(ax.T, np.ones((37, 70))), rtol=1e-4)
+
+def test_native_linear():
+    x = tf.placeholder(tf.float32)
+    y = tf.nn.linear(x, num_hidden=13, name="fc")
+    gx = tf.gradients(tf.reduce_sum(y), [x])[0]
+    ax = np.random.uniform(size=(9, 21))
+    sess = tf.Session(config='cpu-native')
+    weights = {}
+    for v, name, shape in tf.infer_variable_shapes(y, feed_dict={x: list(ax.shape)}):
+        sess.run(tf.assign(v, tf.normal(shape)))
+        weights[len(shape)] = sess.run(v)
+    w, b = weights[2], weights[1]
+    ay, agx = sess.run([y, gx], feed_dict={x:ax})
+    np.testing.assert_allclose(ay, np.dot(ax, w.T) + b, rtol=1e-4, atol=1e-5)
+    np.testing.assert_allclose(agx, np.dot(np.ones((9, 13)), w), rtol=1e-4, atol=1e-5)
+
+def _conv2d_ref(ax, aw, stride, pad):
+    n, c, h, w = ax.shape
+    o, _, kh, kw = aw.shape
+    xp = np.pad(ax, ((0, 0), (0, 0), (pad, pad), (pad, pad)), 'constant')
+    oh = (h + 2 * pad - kh) // stride + 1
+    ow = (w + 2 * pad - kw) // stride + 1
+    ay = np.zeros((n, o, oh, ow))
+    for i in range(oh):
+        for j in range(ow):
+            patch = xp[:, :, i * stride:i * stride + kh, j * stride:j * stride + kw]
+            ay[:, :, i, j] = np.tensordot(patch, aw, axes=([1, 2, 3], [1, 2, 3]))
+    return ay
+
+def test_native_conv2d():
+    import os
+    cases = [(3, 5, 1, (2, 3, 9, 11)), (16, 3, 1, (2, 16, 8, 8)),
+             (12, 3, 2, (2, 8, 9, 9)), (20, 1, 1, (2, 16, 6, 6))]
+    for algo in ['', 'direct', 'winograd', 'gemm']:
+        os.environ['TINYFLOW_CONV_ALGO'] = algo
+        if not algo:
+            del os.environ['TINYFLOW_CONV_ALGO']
+        for num_filter, k, stride, dshape in cases:
+            x = tf.placeholder(tf.float32)
+            y = tf.nn.conv2d(x, num_filter=num_filter, ksize=[1, k, k, 1],
+                             strides=[1, stride, stride, 1], padding='SAME')
+            gx = tf.gradients(tf.reduce_sum(y * y), [x])[0]
+            ax = np.random.uniform(-1, 1, size=dshape)
+            sess = tf.Session(config='cpu-native')
+            for v, name, shape in tf.infer_variable_shapes(y, feed_dict={x: list(dshape)}):
+                sess.run(tf.assign(v, tf.normal(shape)))
+                aw = sess.run(v)
+            ay, agx = sess.run([y, gx], feed_dict={x:ax})
+            pad = (k - 1) // 2
+            ref = _conv2d_ref(ax, aw, stride, pad)
+            np.testing.assert_allclose(ay, ref, rtol=1e-3, atol=1e-3)
+            # gradient of data by finite difference of the linear conv.
+            eps = np.zeros(dshape)
+            eps[1, -1, 2, 3] = 1
+            expect = np.sum(2 * ref * _conv2d_ref(eps, aw, stride, pad))
+            np.testing.assert_allclose(agx[1, -1, 2, 3], expect, rtol=1e-3, atol=1e-3)
+    os.environ.pop('TINYFLOW_CONV_ALGO', None)
+
+
+def _conv_bn_stack(x, data_format):
+    net = tf.nn.conv2d(x, num_filter=16, ksize=[1, 3, 3, 1], padding='SAME',
+                       data_format=data_format, name='conv1')
+    net = tf.nn.batch_normalization(net, data_format=data_format, name='bn1')
+    net = tf.nn.max_pool(tf.nn.relu(net), ksize=[1, 2, 2, 1], strides=[1, 2, 2, 1],
+                         data_format=data_format)
+    net = tf.nn.conv2d(net, num_filter=32, ksize=[1, 3, 3, 1], padding='SAME',
+                       data_format=data_format, name='conv2')
+    return tf.nn.avg_pool(tf.nn.relu(net) + net, ksize=[1, 3, 3, 1],
+                          strides=[1, 1, 1, 1], padding='SAME', data_format=data_format)
+
+
+def test_native_layout():
+    weights = {}
+    def run(data_format, config, ax, grad):
+        x = tf.placeholder(tf.float32)
+        y = _conv_bn_stack(x, data_format)
+        fetch = [y]
+        if grad:
+            fetch.append(tf.gradients(tf.reduce_sum(y * y), [x])[0])
+        sess = tf.Session(config=config)
+        for v, name, shape in tf.infer_variable_shapes(y, feed_dict={x: list(ax.shape)}):
+            if name not in weights:
+                sess.run(tf.assign(v, tf.normal(shape)))
+                weights[name] = sess.run(v)
+            w = tf.placeholder(tf.float32)
+            sess.run(tf.assign(v, w), feed_dict={w: weights[name]})
+        return sess.run(fetch, feed_dict={x: ax})
+    ax = np.random.uniform(-1, 1, size=(2, 16, 12, 12))
+    ay, agx = run('NCHW', 'cpu-native', ax, True)
+    # the ops in NHWC
+    to_nhwc = (0, 2, 3, 1)
+    by, bgx = run('NHWC', 'cpu-native', ax.transpose(to_nhwc), True)
+    np.testing.assert_allclose(by, ay.transpose(to_nhwc), rtol=1e-3, atol=1e-3)
+    np.testing.assert_allclose(bgx, agx.transpose(to_nhwc), rtol=1e-3, atol=1e-3)
+    # the graph converted by the session, the first conv reads 3 channels
+    # and stays in NCHW for the blocked layouts.
+    weights.clear()
+    ax = ax[:, :3]
+    ay = run('NCHW', 'cpu-native', ax, False)[0]
+    for layout in ['NHWC', 'NCHW8c', 'NCHW16c']:
+        by = run('NCHW', 'cpu-native layout=%s' % layout, ax, False)[0]
+        np.testing.assert_allclose(by, ay, rtol=1e-3, atol=1e-3)
+
+
+def test_fold_conv_bn():
+    x = tf.placeholder(tf.float32)
+    net = tf.nn.conv2d(x, num_filter=8, ksize=[1, 3, 3, 1], padding='SAME', name='conv')
+    net = tf.nn.batch_normalization(net, use_global_stats=True, name='bn')
+    y = tf.nn.relu(net)
+    ax = np.random.uniform(-1, 1, size=(2, 4, 6, 6))
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        values = {}
+        for v, name, shape in tf.infer_variable_shapes(y, feed_dict={x: list(ax.shape)}):
+            value = np.random.uniform(0.5, 1.5, size=shape)
+            w = tf.placeholder(tf.float32)
+            sess.run(tf.assign(v, w), feed_dict={w: value})
+            values[name.split('_', 1)[1]] = value
+        ay = sess.run(y, feed_dict={x: ax})
+        stat = lambda v: v.reshape((1, -1, 1, 1))
+        ref = (_conv2d_ref(ax, values['weight'], 1, 1) - stat(values['moving_mean'])) / \
+            np.sqrt(stat(values['moving_var']) + 1e-5) * stat(values['gamma']) + stat(values['beta'])
+        np.testing.assert_allclose(ay, np.maximum(ref, 0), rtol=1e-3, atol=1e-3)
+        # batch normalization and relu run inside the conv2d.
+        ops = [s['op'] for s in sess.dump_profile()]
+        assert 'batch_normalization' not in ops and 'relu' not in ops
+
+
+def test_fold_constant():
+    x = tf.placeholder(tf.float32)
+    # ones_like only reads the shape of x, the chain is computed once per shape.
+    c = tf.ones_like(x) * 2 + 1
+    y = x * c + tf.zeros(shape=[1])
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        for shape in [(4, 3), (4, 3), (2, 5)]:
+            ax = np.random.uniform(size=shape)
+            ay, ac = sess.run([y, c], feed_dict={x: ax})
+            np.testing.assert_allclose(ay, ax * 3, rtol=1e-5)
+            np.testing.assert_allclose(ac, np.full(shape, 3.0))
+        ops = [s['op'] for s in sess.dump_profile()]
+        for op in ['ones_like', 'zeros', '__mul_scalar__', '__add_scalar__']:
+            assert op not in ops
+        assert 'mul' in ops
+
+
+def test_eliminate_common_expr():
+    x = tf.placeholder(tf.float32)
+    y = tf.exp(x * 2) + tf.exp(x * 2)
+    # random ops are never merged.
+    r = tf.normal(shape=[100]) - tf.normal(shape=[100])
+    ax = np.random.uniform(size=(4, 3))
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        ay, ar = sess.run([y, r], feed_dict={x:ax})
+        np.testing.assert_almost_equal(ay, 2 * np.exp(ax * 2), decimal=5)
+        assert np.abs(ar).max() > 0
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        assert summary['exp']['count'] == 1
+        assert summary['__mul_scalar__']['count'] == 1
+        assert summary['normal']['count'] == 2
+
+
+def test_dynamic_batch():
+    x = tf.placeholder(tf.float32)
+    w = tf.Variable(tf.ones(shape=[3, 4]))
+    y = tf.nn.softmax(tf.matmul(x, w) * 0.5 + tf.ones_like(tf.matmul(x, w)))
+    aw = np.ones((3, 4))
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        sess.run(tf.initialize_all_variables())
+        stats = None
+        # the space planned for the first batch holds the smaller ones.
+        for batch in [8, 3, 8, 1, 5]:
+            ax = np.random.uniform(size=(batch, 3))
+            ay = sess.run(y, feed_dict={x:ax})
+            az = np.exp(np.dot(ax, aw) * 0.5 + 1)
+            np.testing.assert_almost_equal(ay, az / az.sum(axis=1, keepdims=True), decimal=5)
+            if stats is None:
+                stats = sess.storage_stats()
+        # nothing new is allocated, the constants take their space back from the arena.
+        assert sess.storage_stats()['alloc'] == stats['alloc']
+        ax = np.random.uniform(size=(16, 3))
+        ay = sess.run(y, feed_dict={x:ax})
+        az = np.exp(np.dot(ax, aw) * 0.5 + 1)
+        np.testing.assert_almost_equal(ay, az / az.sum(axis=1, keepdims=True), decimal=5)
+
+
+def test_optimizer_update():
+    x = tf.placeholder(tf.float32)
+    optimizers = [tf.train.GradientDescentOptimizer(0.1),
+                  tf.train.MomentumOptimizer(0.1, 0.9),
+                  tf.train.AdamOptimizer(0.1)]
+    weights, steps = [], []
+    for opt in optimizers:
+        w = tf.Variable(tf.ones(shape=[3, 5]))
+        b = tf.Variable(tf.zeros(shape=[3, 5]))
+        weights.append([w, b])
+        steps.append(opt.minimize(tf.reduce_sum(w * x + b)))
+    init = tf.initialize_all_variables()
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        sess.run(init)
+        aw = [[np.ones((3, 5)), np.zeros((3, 5))] for _ in optimizers]
+        acc = [np.zeros((3, 5)) for _ in range(2)]
+        m = [np.zeros((3, 5)) for _ in range(2)]
+        v = [np.zeros((3, 5)) for _ in range(2)]
+        for t in range(1, 4):
+            # the gradient of w is x, that of b is ones.
+            ax = np.random.uniform(size=(3, 5))
+            for step in steps:
+                sess.run(step, feed_dict={x:ax})
+            lr_t = 0.1 * np.sqrt(1 - 0.999 ** t) / (1 - 0.9 ** t)
+            for k, g in enumerate([ax, np.ones((3, 5))]):
+                aw[0][k] -= 0.1 * g
+                acc[k] = acc[k] * 0.9 + g
+                aw[1][k] -= 0.1 * acc[k]
+                m[k] = 0.9 * m[k] + 0.1 * g
+                v[k] = 0.999 * v[k] + 0.001 * g * g
+                aw[2][k] -= lr_t * m[k] / (np.sqrt(v[k]) + 1e-4)
+        for ws, refs in zip(weights, aw):
+            for w, ref in zip(ws, refs):
+                np.testing.assert_allclose(sess.run(w), ref, rtol=1e-4, atol=1e-6)
+        # one node updates all the variables of an optimizer.
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        for op in ['sgd_update', 'momentum_update', 'adam_update']:
+            assert summary[op]['count'] == 3
+        assert '__div_symbol__' not in summary
+
+
+def test_optimizer_update_chunks():
+    # a weight larger than a chunk among small ones, so the tasks of the
+    # update cover parts of several weights and run on the pool.
+    shapes = [(3, 5), (300, 250), (7,), (100, 50)]
+    optimizers = [tf.train.GradientDescentOptimizer(0.1),
+                  tf.train.MomentumOptimizer(0.1, 0.9),
+                  tf.train.AdamOptimizer(0.1)]
+    xs = [tf.placeholder(tf.float32) for _ in shapes]
+    weights, steps = [], []
+    for opt in optimizers:
+        ws = [tf.Variable(tf.ones(shape=list(s))) for s in shapes]
+        weights.append(ws)
+        loss = tf.reduce_sum(ws[0] * xs[0])
+        for w, x in zip(ws[1:], xs[1:]):
+            loss = loss + tf.reduce_sum(w * x)
+        steps.append(opt.minimize(loss))
+    init = tf.initialize_all_variables()
+    for config in ['cpu-native', 'cpu']:
+        sess = tf.Session(config=config)
+        sess.run(init)
+        aw = [[np.ones(s) for s in shapes] for _ in optimizers]
+        acc = [np.zeros(s) for s in shapes]
+        m = [np.zeros(s) for s in shapes]
+        v = [np.zeros(s) for s in shapes]
+        for t in range(1, 4):
+            # the gradient of each weight is its x.
+            ax = [np.random.uniform(size=s) for s in shapes]
+            feed = dict(zip(xs, ax))
+            for step in steps:
+                sess.run(step, feed_dict=feed)
+            lr_t = 0.1 * np.sqrt(1 - 0.999 ** t) / (1 - 0.9 ** t)
+            for k, g in enumerate(ax):
+                aw[0][k] -= 0.1 * g
+                acc[k] = acc[k] * 0.9 + g
+                aw[1][k] -= 0.1 * acc[k]
+                m[k] = 0.9 * m[k] + 0.1 * g
+                v[k] = 0.999 * v[k] + 0.001 * g * g
+                aw[2][k] -= lr_t * m[k] / (np.sqrt(v[k]) + 1e-4)
+        for ws, refs in zip(weights, aw):
+            for w, ref in zip(ws, refs):
+                np.testing.assert_allclose(sess.run(w), ref, rtol=1e-4, atol=1e-5)
+
+
+def test_parallelize():
+    x = tf.placeholder(tf.float32, name='x')
+    w = tf.placeholder(tf.float32, name='w')
+    y = tf.matmul(x, w)
+    # the op without the attribute is split when it is worth it.
+    py = tf.parallelize(y, feed_dict={x:(64, 256), w:(256, 512)}, num_partitions=4)
+    # too small to be worth a split
+    pz = tf.parallelize(y, feed_dict={x:(2, 4), w:(4, 4)}, num_partitions=4)
+    with tf.attr_scope(parallelism='model'):
+        m = tf.matmul(x, w)
+    pm = tf.parallelize(m, num_partitions=4)
+    ax = np.random.uniform(size=(64, 256)).astype(np.float32)
+    aw = np.random.uniform(size=(256, 512)).astype(np.float32)
+    for config in ['cpu-native profile', 'cpu profile']:
+        for net, count in [(py, 4), (pm, 4), (pz, 1)]:
+            sess = tf.Session(config=config)
+            if count == 1:
+                feed = {x:ax[:2, :4], w:aw[:4, :4]}
+            else:
+                feed = {x:ax, w:aw}
+            ay = sess.run(net, feed_dict=feed)
+            np.testing.assert_allclose(ay, np.dot(feed[x], feed[w]), rtol=1e-4)
+            summary = dict((s['op'], s) for s in sess.dump_profile())
+            assert summary['matmul']['count'] == count
+    # the shape of a variable weight comes from its initialization.
+    v = tf.Variable(tf.ones(shape=[256, 512]))
+    pv = tf.parallelize(tf.matmul(x, v), feed_dict={x:(64, 256)}, num_partitions=4)
+    init = tf.initialize_all_variables()
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        sess.run(init)
+        ay = sess.run(pv, feed_dict={x:ax})
+        np.testing.assert_allclose(ay, np.dot(ax, np.ones((256, 512))), rtol=1e-4)
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        assert summary['matmul']['count'] == 4
+
+
+def test_eliminate_merge():
+    x = tf.placeholder(tf.float32, name='x')
+    w = tf.placeholder(tf.float32, name='w')
+    w2 = tf.placeholder(tf.float32, name='w2')
+    y = tf.matmul(tf.exp(tf.matmul(x, w) * 0.01), w2)
+    py = tf.parallelize(y, feed_dict={x:(256, 256), w:(256, 512), w2:(512, 128)},
+                        num_partitions=4)
+    ax = np.random.uniform(size=(256, 256)).astype(np.float32)
+    aw = np.random.uniform(size=(256, 512)).astype(np.float32)
+    aw2 = np.random.uniform(size=(512, 128)).astype(np.float32)
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        ay = sess.run(py, feed_dict={x:ax, w:aw, w2:aw2})
+        np.testing.assert_allclose(ay, np.dot(np.exp(np.dot(ax, aw) * 0.01), aw2), rtol=1e-4)
+        # the parts flow through the elementwise ops into the second matmul,
+        # only x is split and the output merged.
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        assert summary['matmul']['count'] == 8
+        assert summary['split']['count'] == 1
+        assert summary['concat']['count'] == 1
+    # a graph split without the pass, the executors cancel its merges.
+    with tf.attr_scope(parallelism='data'):
+        z = tf.exp(tf.matmul(x, w) * 0.01)
+    g = graph.create(z)
+    g._set_json_attr("num_partitions", 4, "int")
+    pz = g.apply("Parallelize").symbol
+    for config in ['cpu-native profile', 'cpu profile']:
+        sess = tf.Session(config=config)
+        az = sess.run(pz, feed_dict={x:ax, w:aw})
+        np.testing.assert_allclose(az, np.exp(np.dot(ax, aw) * 0.01), rtol=1e-4)
+        summary = dict((s['op'], s) for s in sess.dump_profile())
+        assert summary['split']['count'] == 1
+        assert summary['concat']['count'] == 1
+
+
+def test_data_parallel():
+    # a leading None marks the batch.
+    x = tf.placeholder(tf.float32, shape=[None, 6])
+    label = tf.placeholder(tf.float32, shape=[None, 4])
+    w = tf.Variable(tf.ones(shape=[6, 4]))
+    y = tf.nn.softmax(tf.matmul(x, w))
+    loss = tf.reduce_mean(tf.reduce_sum((y - label) * (y - label), reduction_indices=1))
+    train = tf.train.GradientDescentOptimizer(0.5).minimize(loss)
+    # a sum loss with a regularizer, which is counted once.
+    v = tf.Variable(tf.ones(shape=[6, 4]))
+    sum_loss = tf.reduce_sum(tf.matmul(x, v) * label) + tf.reduce_sum(v * v) * 0.1
+    train_sum = tf.train.GradientDescentOptimizer(0.01).minimize(sum_loss)
+    # fetches reduced over the batch
+    reduced = [tf.reduce_sum(y), tf.reduce_mean(tf.matmul(x, w), reduction_indices=[0])]
+    init = tf.initialize_all_variables()
+    # shards of uneven size, the gradients are weighted by the size of the shard.
+    ax = np.random.uniform(size=(30, 6))
+    alabel = np.random.uniform(size=(30, 4))
+    feed = {x:ax, label:alabel}
+    results = []
+    for config in ['cpu-native replicas=4', 'cpu-native']:
+        sess = tf.Session(config=config)
+        sess.run(init)
+        for _ in range(3):
+            sess.run(train, feed_dict=feed)
+            sess.run(train_sum, feed_dict=feed)
+        # the loss fetched with the updates, averaged like the gradients.
+        ret = sess.run([train, loss], feed_dict=feed)
+        results.append([sess.run(w), sess.run(v), ret[1],
+                        sess.run(y, feed_dict={x:ax})] +
+                       sess.run(reduced, feed_dict={x:ax}))
+    for a, b in zip(*results):
+        np.testing.assert_allclose(a, b, rtol=1e-4, atol=1e-6)
+    assert results[0][3].shape == (30, 4)
+    # the sum loss takes the full step.
+    aw = np.ones((6, 4))
+    for _ in range(3):
+        aw -= 0.01 * (np.dot(ax.T, alabel) + 0.2 * aw)
+    np.testing.assert_allclose(results[0][1], aw, rtol=1e-4)
+    # the forward runs on each replica and the update once, also with the loss
+    # fetched. batch_normalization on the statistics of the batch runs whole.
+    xi = tf.placeholder(tf.float32, shape=[None, 2, 3, 3])
+    bn = tf.nn.batch_normalization(xi, name='dp_bn')
+    train_bn = tf.train.GradientDescentOptimizer(0.1).minimize(tf.reduce_mean(bn * xi))
+    axi = np.random.uniform(size=(8, 2, 3, 3))
+    counts = []
+    for config in ['cpu-native replicas=4 profile', 'cpu-native profile']:
+        sess = tf.Session(config=config)
+        sess.run(init)
+        for v, name, shape in tf.infer_variable_shapes(bn, feed_dict={xi: list(axi.shape)}):
+            sess.run(tf.assign(v, tf.ones(shape=shape)))
+        sess.run([train, loss], feed_dict=feed)
+        sess.run(train_bn, feed_dict={xi:axi})
+        counts.append(dict((s['op'], s['count']) for s in sess.dump_profile()))
+    assert counts[0]['matmul'] == 4 * counts[1]['matmul']
+    assert counts[0]['sgd_update'] == counts[1]['sgd_update'] == 2
+    assert counts[0]['batch_normalization'] == counts[1]['batch_normalization'] == 1
+
+
+if __name__ == "__main__":
+    test_native_ewise()
+    test_native_matmul_grad()
+    test_native_reduce()
+    test_native_softmax_grad()
+    test_native_assign()
+    test_native_parallel()
+    test_native_parallel_plan()
+    test_native_feed_alias()
+    test_feed_lua_view()
+    test_run_into()
+    test_make_callable()
+    test_run_async()
+    test_profile()
+    test_fuse_elemwise()
+    test_simd_ewise()
+    test_native_gemm()
+    test_native_linear()
+    test_native_conv2d()
+    test_native_layout()
+    test_fold_conv_bn()
+    test_fold_constant()
+    test_eliminate_common_expr()
+    test_dynamic_batch()
+    test_optimizer_update()
+    test_optimizer_update_chunks()
+    test_parallelize()
+    test_eliminate_merge()
+    test_data_parallel()
+    pass
@@ -30,6 +30,66 @@ def test_init():
     np.testing.assert_almost_equal(ax1, np.ones((2,3)))
     np.testing.assert_almost_equal(ax2, np.zeros((2,3)))
 
+def test_exec_cache():
+    x = tf.Variable(tf.ones(shape=[2,3]))
+    y = x * 2
+    z = x + 1
+    sess = tf.Session(config='cpu exec_cache=2')
+    sess.run(tf.initialize_all_variables())
+    for i in range(3):
+        ay = sess.run(y)
+        az = sess.run(z)
+    np.testing.assert_almost_equal(ay, np.ones((2,3)) * 2)
+    np.testing.assert_almost_equal(az, np.ones((2,3)) * 2)
+    stats = sess.cache_stats()
+    assert stats['miss'] == 3
+    assert stats['hit'] == 4
+    assert stats['evict'] == 1
+
+def test_exec_cache_rebuild():
+    x = tf.Variable(tf.zeros(shape=[2,3]))
+    sess = tf.Session()
+    sess.run(tf.initialize_all_variables())
+    for i in range(4):
+        # a structurally identical graph is rebuilt every iteration
+        sess.run(tf.group(tf.assign(x, x + 1)))
+    np.testing.assert_almost_equal(sess.run(x), np.ones((2,3)) * 4)
+    stats = sess.cache_stats()
+    assert stats['miss'] == 3
+    assert stats['hit'] == 3
+
+def test_exec_cache_config():
+    # a malformed or unsupported option is reported as a session error, not a crash.
+    for config in ['cpu exec_cache=abc', 'cpu exec_cache=-1', 'cpu-native exec_cache=0',
+                   'cpu layout=NHWC', 'cpu replicas=2', 'cpu-native gpu', 'cpu fusoin']:
+        failed = False
+        try:
+            tf.Session(config=config)
+        except Exception:
+            failed = True
+        assert failed, config
+
+def test_storage_arena():
+    x = tf.placeholder(tf.float32)
+    y = tf.exp(x) * 2 + 1
+    z = tf.exp(x) - 1
+    for config in ['cpu', 'cpu-native']:
+        sess = tf.Session(config=config)
+        def run_batches():
+            for batch in [8, 7, 8, 6, 8]:
+                ax = np.random.uniform(size=(batch, 30))
+                ay, az = sess.run([y, z], feed_dict={x:ax})
+                np.testing.assert_almost_equal(ay, np.exp(ax) * 2 + 1, decimal=5)
+                ay = sess.run(y, feed_dict={x:ax})
+                np.testing.assert_almost_equal(ay, np.exp(ax) * 2 + 1, decimal=5)
+        run_batches()
+        stats = sess.storage_stats()
+        assert stats['reuse'] > 0
+        # the shapes seen before, and the other executor, take the cached space.
+        run_batches()
+        assert sess.storage_stats()['alloc'] == stats['alloc']
+        assert sess.storage_stats()['bytes_allocated'] == stats['bytes_allocated']
+
 if __name__ == "__main__":
 
     pass